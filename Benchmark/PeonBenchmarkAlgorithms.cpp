@@ -0,0 +1,117 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkAlgorithms.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The number of elements used by each algorithm (sort uses less, it is much more expensive per element)
+#define TotalElements				(1 << 22)
+#define TotalSortElements			(1 << 20)
+
+// The number of rounds we run for each algorithm (we keep the best one)
+#define TotalRounds					(5)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// Run the method a few times and return the best time (in milliseconds), the setup isn't measured
+template <typename SetupMethod, typename RunMethod>
+double Measure(SetupMethod _setupMethod, RunMethod _runMethod)
+{
+	double best = 1e9;
+	for (int round = 0; round < TotalRounds; round++)
+	{
+		_setupMethod();
+
+		auto begin = BenchmarkClock::now();
+		_runMethod();
+		auto end = BenchmarkClock::now();
+
+		best = std::min(best, std::chrono::duration<double, std::milli>(end - begin).count());
+	}
+
+	return best;
+}
+
+int main()
+{
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	// The input data
+	std::mt19937 randomGenerator(42);
+	std::vector<float> input(TotalElements);
+	std::vector<float> output(TotalElements);
+	std::vector<uint32_t> sortInput(TotalSortElements);
+	std::vector<uint32_t> sortData(TotalSortElements);
+	for (float& value : input) value = (float)(randomGenerator() % 1000) / 1000.0f;
+	for (uint32_t& value : sortInput) value = randomGenerator();
+
+	auto NoSetup = []() {};
+	auto SortSetup = [&]() { sortData = sortInput; };
+	auto Expensive = [](float _value) { return std::sqrt(_value) * std::sin(_value) + std::cos(_value); };
+
+	printf("Peon parallel algorithms benchmark (%d elements, %d for sort, best of %d rounds, times in ms)\n", TotalElements, TotalSortElements, TotalRounds);
+
+	// The sequential standard algorithms
+	double forEachTime = Measure(NoSetup, [&]() { std::for_each(output.begin(), output.end(), [](float& _value) { _value = _value * 0.5f + 1.0f; }); });
+	double transformTime = Measure(NoSetup, [&]() { std::transform(input.begin(), input.end(), output.begin(), Expensive); });
+	double reduceTime = Measure(NoSetup, [&]() { volatile double result = std::reduce(input.begin(), input.end(), 0.0); (void)result; });
+	double transformReduceTime = Measure(NoSetup, [&]() { volatile double result = std::transform_reduce(input.begin(), input.end(), 0.0, std::plus<>(), Expensive); (void)result; });
+	double inclusiveScanTime = Measure(NoSetup, [&]() { std::inclusive_scan(input.begin(), input.end(), output.begin()); });
+	double exclusiveScanTime = Measure(NoSetup, [&]() { std::exclusive_scan(input.begin(), input.end(), output.begin(), 0.0f); });
+	double sortTime = Measure(SortSetup, [&]() { std::sort(sortData.begin(), sortData.end()); });
+
+	printf("%-10s | %9s | %9s | %9s | %9s | %9s | %9s | %9s\n", "", "for_each", "transform", "reduce", "t_reduce", "incl_scan", "excl_scan", "sort");
+	printf("%-10s | %9.3f | %9.3f | %9.3f | %9.3f | %9.3f | %9.3f | %9.3f\n", "std",
+		forEachTime, transformTime, reduceTime, transformReduceTime, inclusiveScanTime, exclusiveScanTime, sortTime);
+
+	for (unsigned int totalWorkers = 1; ; totalWorkers = std::min(totalWorkers * 2, hardwareThreads))
+	{
+		Peon::Scheduler* scheduler = new Peon::Scheduler();
+		scheduler->Initialize(totalWorkers, 1 << 16);
+
+		Peon::ParallelPolicy policy = Peon::execution::par(scheduler);
+		auto FrameSetup = [&]() { scheduler->ResetWorkerFrame(); };
+		auto FrameSortSetup = [&]() { scheduler->ResetWorkerFrame(); sortData = sortInput; };
+
+		forEachTime = Measure(FrameSetup, [&]() { Peon::for_each(policy, output.begin(), output.end(), [](float& _value) { _value = _value * 0.5f + 1.0f; }); });
+		transformTime = Measure(FrameSetup, [&]() { Peon::transform(policy, input.begin(), input.end(), output.begin(), Expensive); });
+		reduceTime = Measure(FrameSetup, [&]() { volatile double result = Peon::reduce(policy, input.begin(), input.end(), 0.0); (void)result; });
+		transformReduceTime = Measure(FrameSetup, [&]() { volatile double result = Peon::transform_reduce(policy, input.begin(), input.end(), 0.0, std::plus<>(), Expensive); (void)result; });
+		inclusiveScanTime = Measure(FrameSetup, [&]() { Peon::inclusive_scan(policy, input.begin(), input.end(), output.begin()); });
+		exclusiveScanTime = Measure(FrameSetup, [&]() { Peon::exclusive_scan(policy, input.begin(), input.end(), output.begin(), 0.0f); });
+		sortTime = Measure(FrameSortSetup, [&]() { Peon::sort(policy, sortData.begin(), sortData.end()); });
+
+		// Release this scheduler (its workers would compete with the next one)
+		delete scheduler;
+
+		printf("workers %2u | %9.3f | %9.3f | %9.3f | %9.3f | %9.3f | %9.3f | %9.3f\n", totalWorkers,
+			forEachTime, transformTime, reduceTime, transformReduceTime, inclusiveScanTime, exclusiveScanTime, sortTime);
+
+		if (totalWorkers == hardwareThreads)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkCancel.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The tree shape, the root container has a child container for each branch with its leaves (100k leaves, all queued before
+// the tree starts)
+#define TotalBranches				(100)
+#define LeavesPerBranch				(1000)
+
+// The work done by each leaf (in microseconds, leaves poll the cancellation while working)
+#define LeafWork					(10)
+
+// The fraction of the leaves that must run before we cancel (or measure the remaining time when not cancelling)
+#define CancelPoint					(0.1)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// Keep the cpu busy for the given time, stopping early if the job was cancelled
+void Work(Peon::Scheduler* _scheduler, uint32_t _microseconds)
+{
+	auto end = BenchmarkClock::now() + std::chrono::microseconds(_microseconds);
+	while (BenchmarkClock::now() < end && !_scheduler->IsCancelled())
+	{
+	}
+}
+
+// Run the tree and return the time from the cancel point until the tree completes (in milliseconds), also return the
+// number of leaves that started running after that point
+double MeasureTree(Peon::Scheduler* _scheduler, bool _cancel, uint32_t& _leavesAfterPoint)
+{
+	Peon::CancellationToken token;
+	std::atomic<uint32_t> totalLeaves(0);
+	std::atomic<uint32_t> leavesAtPoint(0);
+	BenchmarkClock::time_point begin;
+
+	// The leaf that reaches the cancel point records the time and cancels the tree (the thread that initialized the system is
+	// worker 0, it only runs jobs while waiting so it can't watch the tree)
+	const uint32_t cancelPoint = uint32_t(TotalBranches * LeavesPerBranch * CancelPoint);
+	auto leaf = [_scheduler, _cancel, cancelPoint, &token, &totalLeaves, &leavesAtPoint, &begin]()
+	{
+		if (totalLeaves.fetch_add(1, std::memory_order_relaxed) + 1 == cancelPoint)
+		{
+			begin = BenchmarkClock::now();
+			leavesAtPoint.store(totalLeaves.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			if (_cancel)
+			{
+				token.Cancel();
+			}
+		}
+
+		Work(_scheduler, LeafWork);
+	};
+
+	// The token is inherited by every job created under the root
+	Peon::Container* root = _scheduler->CreateContainer();
+	_scheduler->SetJobCancellationToken(root, &token);
+	for (uint32_t i = 0; i < TotalBranches; i++)
+	{
+		Peon::Container* branch = _scheduler->CreateChildContainer(root);
+		for (uint32_t j = 0; j < LeavesPerBranch; j++)
+		{
+			_scheduler->StartJob(_scheduler->CreateChildJob(branch, leaf));
+		}
+
+		_scheduler->StartJob(branch);
+	}
+
+	_scheduler->StartJob(root);
+	_scheduler->WaitForJob(root);
+	auto end = BenchmarkClock::now();
+
+	_leavesAfterPoint = totalLeaves.load(std::memory_order_relaxed) - leavesAtPoint.load(std::memory_order_relaxed);
+
+	return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+int main()
+{
+	unsigned int totalWorkers = std::max(1u, std::thread::hardware_concurrency());
+
+	Peon::Scheduler* scheduler = new Peon::Scheduler();
+	scheduler->Initialize(totalWorkers, 1 << 18);
+
+	printf("Peon cancel benchmark (%u workers, %d leaves of %d us, cancel after %.0f%% of them started)\n", totalWorkers,
+		TotalBranches * LeavesPerBranch, LeafWork, CancelPoint * 100);
+
+	for (bool cancel : { false, true })
+	{
+		uint32_t leavesAfterPoint = 0;
+		double milliseconds = MeasureTree(scheduler, cancel, leavesAfterPoint);
+		scheduler->ResetWorkerFrame();
+
+		printf("%-10s | tree done %9.2f ms after the cancel point | leaves started after it %6u\n", cancel ? "cancelled" : "completed",
+			milliseconds, leavesAfterPoint);
+	}
+
+	delete scheduler;
+
+	return 0;
+}
@@ -0,0 +1,258 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkCoroutine.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The number of independent items processed by each run
+#define TotalItems					(2000)
+
+// The number of steps each item goes through (each step runs in its own job)
+#define TotalSteps					(16)
+
+// The number of runs for each style (we keep the best one)
+#define TotalRuns					(5)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// A tiny amount of work for each step
+uint32_t Step(uint32_t _value)
+{
+	return _value * 1664525u + 1013904223u;
+}
+
+// The data for an item processed with callbacks (each step creates the job for the next one)
+struct CallbackItem
+{
+	Peon::Scheduler* scheduler;
+	uint32_t value;
+	uint32_t step;
+};
+
+// Run a step and chain the next one as a child (so the item container waits for all of them)
+void CallbackStep(CallbackItem* _item)
+{
+	_item->value = Step(_item->value);
+	if (++_item->step < TotalSteps)
+	{
+		_item->scheduler->StartJob(_item->scheduler->CreateChildJob([_item]() { CallbackStep(_item); }));
+	}
+}
+
+// Each step of each item runs in a new job, chained with callbacks
+double MeasureCallbackChain(Peon::Scheduler* _scheduler, std::vector<uint32_t>& _results)
+{
+	std::vector<CallbackItem> items(TotalItems);
+	auto begin = BenchmarkClock::now();
+
+	Peon::Container* container = _scheduler->CreateContainer();
+	for (uint32_t i = 0; i < TotalItems; i++)
+	{
+		items[i] = { _scheduler, i, 0 };
+		CallbackItem* item = &items[i];
+		_scheduler->StartJob(_scheduler->CreateChildJob(container, [item]() { CallbackStep(item); }));
+	}
+
+	_scheduler->StartJob(container);
+	_scheduler->WaitForJob(container);
+	auto end = BenchmarkClock::now();
+
+	for (uint32_t i = 0; i < TotalItems; i++)
+	{
+		_results[i] = items[i].value;
+	}
+
+	return std::chrono::duration<double>(end - begin).count();
+}
+
+// Each step of the item runs after hopping onto a worker
+Peon::Task<uint32_t> CoroutineChain(Peon::Scheduler* _scheduler, uint32_t _value)
+{
+	for (uint32_t step = 0; step < TotalSteps; step++)
+	{
+		co_await _scheduler->Schedule();
+		_value = Step(_value);
+	}
+
+	co_return _value;
+}
+
+// Each step of each item runs in a new job, from a coroutine
+double MeasureCoroutineChain(Peon::Scheduler* _scheduler, std::vector<uint32_t>& _results)
+{
+	std::vector<Peon::Task<uint32_t>> tasks;
+	tasks.reserve(TotalItems);
+	auto begin = BenchmarkClock::now();
+
+	Peon::Container* container = _scheduler->CreateContainer();
+	for (uint32_t i = 0; i < TotalItems; i++)
+	{
+		tasks.push_back(CoroutineChain(_scheduler, i));
+		Peon::Job* taskJob = tasks.back().CreateJob(_scheduler);
+		_scheduler->AddJobDependency(taskJob, _scheduler->CreateChildJob(container, []() {}));
+		_scheduler->StartJob(taskJob);
+	}
+
+	_scheduler->StartJob(container);
+	_scheduler->WaitForJob(container);
+	auto end = BenchmarkClock::now();
+
+	for (uint32_t i = 0; i < TotalItems; i++)
+	{
+		_results[i] = tasks[i].GetResult();
+	}
+
+	return std::chrono::duration<double>(end - begin).count();
+}
+
+// Each step of the item runs in a child job, the item continues from a dependant job created for each step
+struct CallbackForkItem
+{
+	Peon::Scheduler* scheduler;
+	Peon::Container* container;
+	uint32_t value;
+	uint32_t step;
+};
+
+void CallbackFork(CallbackForkItem* _item)
+{
+	if (_item->step++ == TotalSteps)
+	{
+		return;
+	}
+
+	Peon::Scheduler* scheduler = _item->scheduler;
+	Peon::Job* child = scheduler->CreateChildJob(_item->container, [_item]() { _item->value = Step(_item->value); });
+	Peon::Job* continuation = scheduler->CreateChildJob(_item->container, [_item]() { CallbackFork(_item); });
+	scheduler->AddJobDependency(child, continuation);
+	scheduler->StartJob(child);
+}
+
+// Fork a child for each step and continue after it with callbacks
+double MeasureCallbackFork(Peon::Scheduler* _scheduler, std::vector<uint32_t>& _results)
+{
+	std::vector<CallbackForkItem> items(TotalItems);
+	auto begin = BenchmarkClock::now();
+
+	Peon::Container* container = _scheduler->CreateContainer();
+	for (uint32_t i = 0; i < TotalItems; i++)
+	{
+		items[i] = { _scheduler, container, i, 0 };
+		CallbackForkItem* item = &items[i];
+		_scheduler->StartJob(_scheduler->CreateChildJob(container, [item]() { CallbackFork(item); }));
+	}
+
+	_scheduler->StartJob(container);
+	_scheduler->WaitForJob(container);
+	auto end = BenchmarkClock::now();
+
+	for (uint32_t i = 0; i < TotalItems; i++)
+	{
+		_results[i] = items[i].value;
+	}
+
+	return std::chrono::duration<double>(end - begin).count();
+}
+
+// Fork a child for each step and await it
+Peon::Task<uint32_t> CoroutineFork(Peon::Scheduler* _scheduler, uint32_t _value)
+{
+	for (uint32_t step = 0; step < TotalSteps; step++)
+	{
+		Peon::Job* child = _scheduler->CreateJob([&_value]() { _value = Step(_value); });
+		_scheduler->StartJob(child);
+		co_await child;
+	}
+
+	co_return _value;
+}
+
+// Fork a child for each step and continue after it with a coroutine
+double MeasureCoroutineFork(Peon::Scheduler* _scheduler, std::vector<uint32_t>& _results)
+{
+	std::vector<Peon::Task<uint32_t>> tasks;
+	tasks.reserve(TotalItems);
+	auto begin = BenchmarkClock::now();
+
+	Peon::Container* container = _scheduler->CreateContainer();
+	for (uint32_t i = 0; i < TotalItems; i++)
+	{
+		tasks.push_back(CoroutineFork(_scheduler, i));
+		Peon::Job* taskJob = tasks.back().CreateJob(_scheduler);
+		_scheduler->AddJobDependency(taskJob, _scheduler->CreateChildJob(container, []() {}));
+		_scheduler->StartJob(taskJob);
+	}
+
+	_scheduler->StartJob(container);
+	_scheduler->WaitForJob(container);
+	auto end = BenchmarkClock::now();
+
+	for (uint32_t i = 0; i < TotalItems; i++)
+	{
+		_results[i] = tasks[i].GetResult();
+	}
+
+	return std::chrono::duration<double>(end - begin).count();
+}
+
+// Run a style a few times and return the best items per second
+template <typename MeasureType>
+double Measure(Peon::Scheduler* _scheduler, MeasureType _measure, std::vector<uint32_t>& _results)
+{
+	double bestSeconds = 0;
+	for (int run = 0; run < TotalRuns; run++)
+	{
+		double seconds = _measure(_scheduler, _results);
+		bestSeconds = run == 0 ? seconds : std::min(bestSeconds, seconds);
+
+		_scheduler->ResetWorkerFrame();
+	}
+
+	return TotalItems / bestSeconds;
+}
+
+int main()
+{
+	unsigned int totalWorkers = std::max(1u, std::thread::hardware_concurrency());
+
+	Peon::Scheduler* scheduler = new Peon::Scheduler();
+	scheduler->Initialize(totalWorkers, 1 << 18);
+
+	printf("Peon coroutine benchmark (%u workers, %d items, %d steps each, best of %d runs)\n", totalWorkers, TotalItems, TotalSteps, TotalRuns);
+
+	// Both styles must compute the same values
+	std::vector<uint32_t> callbackResults(TotalItems), coroutineResults(TotalItems);
+
+	double callbackChain = Measure(scheduler, MeasureCallbackChain, callbackResults);
+	double coroutineChain = Measure(scheduler, MeasureCoroutineChain, coroutineResults);
+	printf("hop chain  | callbacks %10.0f items/s | coroutines %10.0f items/s%s\n", callbackChain, coroutineChain,
+		callbackResults == coroutineResults ? "" : " (MISMATCH)");
+
+	double callbackFork = Measure(scheduler, MeasureCallbackFork, callbackResults);
+	double coroutineFork = Measure(scheduler, MeasureCoroutineFork, coroutineResults);
+	printf("fork/await | callbacks %10.0f items/s | coroutines %10.0f items/s%s\n", callbackFork, coroutineFork,
+		callbackResults == coroutineResults ? "" : " (MISMATCH)");
+
+	delete scheduler;
+
+	return 0;
+}
@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkFalseSharing.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The fan-out shape from the Peon.cpp demo: each primary job has this many dependant jobs, all inside one container
+#define TotalDependantJobs			(4)
+#define TotalPrimaryJobs			(4096)
+
+// The number of frames we run for each worker count (we keep the best one)
+#define TotalFrames					(30)
+
+// The amount of work done by each job (keeps the job body local, all shared traffic comes from the job structures)
+#define JobWorkIterations			(64)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+void JobWork(uint32_t _seed)
+{
+	volatile uint32_t value = _seed;
+	for (int i = 0; i < JobWorkIterations; i++)
+	{
+		value = value * 1664525u + 1013904223u;
+	}
+}
+
+double RunFrame(Peon::Scheduler* _scheduler)
+{
+	auto begin = BenchmarkClock::now();
+
+	// Create a container
+	Peon::Container* container = _scheduler->CreateContainer();
+
+	// Create the jobs
+	for (uint32_t i = 0; i < TotalPrimaryJobs; i++)
+	{
+		Peon::Job* newJob = _scheduler->CreateChildJob(container, [i]() { JobWork(i); });
+
+		// For each dependant jobs we should create
+		for (uint32_t j = 0; j < TotalDependantJobs; j++)
+		{
+			Peon::Job* dependantJob = _scheduler->CreateChildJob(container, [i, j]() { JobWork(i + j); });
+			_scheduler->AddJobDependency(newJob, dependantJob);
+		}
+
+		_scheduler->StartJob(newJob);
+	}
+
+	// Begin and wait for the container
+	_scheduler->StartJob(container);
+	_scheduler->WaitForJob(container);
+
+	auto end = BenchmarkClock::now();
+
+	_scheduler->ResetWorkerFrame();
+
+	return std::chrono::duration<double, std::nano>(end - begin).count() / (TotalPrimaryJobs * (TotalDependantJobs + 1));
+}
+
+int main()
+{
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	printf("Peon false sharing benchmark (sizeof(Job): %zu bytes, alignof(Job): %zu bytes, %d jobs per frame)\n",
+		sizeof(Peon::Job), alignof(Peon::Job), TotalPrimaryJobs * (TotalDependantJobs + 1));
+
+	for (unsigned int totalWorkers = 1; ; totalWorkers = std::min(totalWorkers * 2, hardwareThreads))
+	{
+		Peon::Scheduler* scheduler = new Peon::Scheduler();
+		scheduler->Initialize(totalWorkers, TotalPrimaryJobs * (TotalDependantJobs + 1) * 2);
+
+		double best = 1e9;
+		for (int frame = 0; frame < TotalFrames; frame++)
+		{
+			best = std::min(best, RunFrame(scheduler));
+		}
+
+		// Release this scheduler (its workers would compete with the next one)
+		delete scheduler;
+
+		printf("workers: %2u | %7.2f ns/job\n", totalWorkers, best);
+
+		if (totalWorkers == hardwareThreads)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkFiber.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+#include "PeonFiber.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The number of fiber round trips used to measure the raw switch cost
+#define TotalSwitches				(1 << 20)
+
+// The number of create/start/wait sequences used to measure the wait cost
+#define TotalWaits					(1 << 16)
+
+// The number of waiting jobs for each frame of the tail latency test, and the maximum work done by each awaited job (in
+// microseconds, each one gets a random amount)
+#define TotalWaiters				(2000)
+#define MaximumChildWork			(50)
+
+// The number of frames for each mode (the latencies of all frames are merged)
+#define TotalFrames					(5)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// The two fibers used by the switch test
+struct SwitchTest
+{
+	__InternalPeon::PeonFiber threadFiber;
+	__InternalPeon::PeonFiber fiber;
+};
+
+// Switch straight back to the thread fiber, forever
+void SwitchBack(void* _test)
+{
+	SwitchTest* test = (SwitchTest*)_test;
+	while (true)
+	{
+		test->fiber.SwitchTo(&test->threadFiber);
+	}
+}
+
+// Return the average cost of a single switch (in nanoseconds)
+double MeasureSwitch()
+{
+	SwitchTest test;
+	test.threadFiber.InitializeFromCurrentThread();
+	test.fiber.Initialize(64 * 1024, &SwitchBack, &test);
+
+	auto begin = BenchmarkClock::now();
+	for (uint32_t i = 0; i < TotalSwitches; i++)
+	{
+		test.threadFiber.SwitchTo(&test.fiber);
+	}
+	auto end = BenchmarkClock::now();
+
+	// Each iteration switches twice
+	return std::chrono::duration<double, std::nano>(end - begin).count() / (TotalSwitches * 2.0);
+}
+
+// Return the current time in nanoseconds
+uint64_t Now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(BenchmarkClock::now().time_since_epoch()).count();
+}
+
+// Keep the cpu busy for the given time
+void Work(uint32_t _microseconds)
+{
+	uint64_t end = Now() + uint64_t(_microseconds) * 1000;
+	while (Now() < end)
+	{
+	}
+}
+
+// Create a new scheduler using the given wait mode
+Peon::Scheduler* CreateScheduler(unsigned int _totalWorkers, bool _fibers)
+{
+	Peon::FiberSettings fiberSettings;
+	fiberSettings.enabled = _fibers;
+
+	Peon::Scheduler* scheduler = new Peon::Scheduler();
+	scheduler->SetFiberSettings(fiberSettings);
+	scheduler->Initialize(_totalWorkers, 1 << 18);
+
+	return scheduler;
+}
+
+// Return the average cost of creating, starting and waiting for an empty child job from inside a job (single worker, so the
+// child is always found in our own queue, in fiber mode each wait suspends the waiting fiber)
+double MeasureWait(bool _fibers)
+{
+	Peon::Scheduler* scheduler = CreateScheduler(1, _fibers);
+
+	auto begin = BenchmarkClock::now();
+	Peon::Job* root = scheduler->CreateJob([scheduler]()
+	{
+		for (uint32_t i = 0; i < TotalWaits; i++)
+		{
+			Peon::Job* child = scheduler->CreateChildJob([]() {});
+			scheduler->StartJob(child);
+			scheduler->WaitForJob(child);
+		}
+	});
+
+	scheduler->StartJob(root);
+	scheduler->WaitForJob(root);
+	auto end = BenchmarkClock::now();
+
+	delete scheduler;
+
+	return std::chrono::duration<double, std::nano>(end - begin).count() / TotalWaits;
+}
+
+// Return the given percentile from a sorted latency array
+double Percentile(const std::vector<double>& _sortedLatencies, double _percentile)
+{
+	size_t index = std::min(_sortedLatencies.size() - 1, (size_t)(_percentile * (_sortedLatencies.size() - 1) + 0.5));
+	return _sortedLatencies[index];
+}
+
+// Each waiter starts a child with a random amount of work and waits for it, we record the time from the child end until the
+// waiter continues (a waiter buried under other jobs on a nested stack can only continue after they all return), return
+// the sorted latencies (in microseconds) and the average frame time
+std::vector<double> MeasureResume(unsigned int _totalWorkers, bool _fibers, double& _frameMilliseconds)
+{
+	Peon::Scheduler* scheduler = CreateScheduler(_totalWorkers, _fibers);
+
+	std::vector<double> latencies;
+	std::vector<uint64_t> childEndTimes(TotalWaiters);
+	std::vector<uint32_t> childWork(TotalWaiters);
+	std::mt19937 random(1234);
+	for (auto& work : childWork)
+	{
+		work = random() % (MaximumChildWork + 1);
+	}
+
+	double totalMilliseconds = 0;
+	for (int frame = 0; frame < TotalFrames; frame++)
+	{
+		std::vector<double> frameLatencies(TotalWaiters);
+
+		auto begin = BenchmarkClock::now();
+		Peon::Container* container = scheduler->CreateContainer();
+		for (uint32_t i = 0; i < TotalWaiters; i++)
+		{
+			scheduler->StartJob(scheduler->CreateChildJob(container, [scheduler, i, &childEndTimes, &childWork, &frameLatencies]()
+			{
+				Peon::Job* child = scheduler->CreateChildJob([i, &childEndTimes, &childWork]()
+				{
+					Work(childWork[i]);
+					childEndTimes[i] = Now();
+				});
+
+				scheduler->StartJob(child);
+				scheduler->WaitForJob(child);
+				frameLatencies[i] = (Now() - childEndTimes[i]) / 1000.0;
+			}));
+		}
+
+		scheduler->StartJob(container);
+		scheduler->WaitForJob(container);
+		auto end = BenchmarkClock::now();
+
+		scheduler->ResetWorkerFrame();
+
+		totalMilliseconds += std::chrono::duration<double, std::milli>(end - begin).count();
+		latencies.insert(latencies.end(), frameLatencies.begin(), frameLatencies.end());
+	}
+
+	delete scheduler;
+
+	_frameMilliseconds = totalMilliseconds / TotalFrames;
+	std::sort(latencies.begin(), latencies.end());
+
+	return latencies;
+}
+
+int main()
+{
+	unsigned int totalWorkers = std::max(2u, std::thread::hardware_concurrency());
+
+	printf("Peon fiber benchmark\n");
+
+	// The raw switch cost
+	printf("fiber switch: %8.1f ns\n", MeasureSwitch());
+
+	// The cost of a wait that must run the child first
+	double nestedWait = MeasureWait(false);
+	double fiberWait = MeasureWait(true);
+	printf("wait nested: %8.1f ns | wait fiber: %8.1f ns\n", nestedWait, fiberWait);
+
+	// The resume latency under a mixed workload
+	for (bool fibers : { false, true })
+	{
+		double frameMilliseconds = 0;
+		std::vector<double> latencies = MeasureResume(totalWorkers, fibers, frameMilliseconds);
+
+		printf("workers: %2u | %s | frame %8.2f ms | resume latency: p50 %9.2f us, p99 %9.2f us, p999 %9.2f us, max %9.2f us\n", totalWorkers,
+			fibers ? "fiber " : "nested", frameMilliseconds, Percentile(latencies, 0.5), Percentile(latencies, 0.99), Percentile(latencies, 0.999),
+			latencies.back());
+	}
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkFuture.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The number of independent pipelines for each run (each one has three stages)
+#define TotalPipelines				(10000)
+
+// The number of runs for each style (we keep the best one)
+#define TotalRuns					(5)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// The value passed between stages
+struct Sample
+{
+	uint64_t sum;
+	uint32_t count;
+};
+
+// The stages
+Sample Produce(uint32_t _index)
+{
+	return Sample{ uint64_t(_index) * 3, 1 };
+}
+
+Sample Transform(const Sample& _sample)
+{
+	return Sample{ _sample.sum * 2 + 1, _sample.count + 1 };
+}
+
+uint64_t Reduce(const Sample& _sample)
+{
+	return _sample.sum + _sample.count;
+}
+
+// The stages pass their values through shared heap objects, each stage is a dependency of the previous one
+double MeasureShared(Peon::Scheduler* _scheduler, std::vector<uint64_t>& _results)
+{
+	auto begin = BenchmarkClock::now();
+
+	Peon::Container* container = _scheduler->CreateContainer();
+	for (uint32_t i = 0; i < TotalPipelines; i++)
+	{
+		std::shared_ptr<Sample> produced = std::make_shared<Sample>();
+		std::shared_ptr<Sample> transformed = std::make_shared<Sample>();
+		uint64_t* result = &_results[i];
+
+		Peon::Job* produce = _scheduler->CreateChildJob(container, [produced, i]() { *produced = Produce(i); });
+		Peon::Job* transform = _scheduler->CreateChildJob(container, [produced, transformed]() { *transformed = Transform(*produced); });
+		Peon::Job* reduce = _scheduler->CreateChildJob(container, [transformed, result]() { *result = Reduce(*transformed); });
+
+		_scheduler->AddJobDependency(produce, transform);
+		_scheduler->AddJobDependency(transform, reduce);
+		_scheduler->StartJob(produce);
+	}
+
+	_scheduler->StartJob(container);
+	_scheduler->WaitForJob(container);
+
+	return std::chrono::duration<double>(BenchmarkClock::now() - begin).count();
+}
+
+// The stages pass their values through futures (each value lives inside the job that produced it)
+double MeasureFutures(Peon::Scheduler* _scheduler, std::vector<uint64_t>& _results)
+{
+	auto begin = BenchmarkClock::now();
+
+	Peon::Container* container = _scheduler->CreateContainer();
+	for (uint32_t i = 0; i < TotalPipelines; i++)
+	{
+		uint64_t* result = &_results[i];
+
+		Peon::Future<Sample> produce = _scheduler->CreateChildJob(container, [i]() { return Produce(i); });
+		Peon::Future<Sample> transform = produce.Then(&Transform);
+		Peon::Future<void> reduce = transform.Then([result](const Sample& _sample) { *result = Reduce(_sample); });
+
+		// The continuations are children of the container too
+		_scheduler->StartJob(produce);
+	}
+
+	_scheduler->StartJob(container);
+	_scheduler->WaitForJob(container);
+
+	return std::chrono::duration<double>(BenchmarkClock::now() - begin).count();
+}
+
+// Run a style a few times and return the best pipelines per second
+template <typename MeasureType>
+double Measure(Peon::Scheduler* _scheduler, MeasureType _measure, std::vector<uint64_t>& _results)
+{
+	double bestSeconds = 0;
+	for (int run = 0; run < TotalRuns; run++)
+	{
+		double seconds = _measure(_scheduler, _results);
+		bestSeconds = run == 0 ? seconds : std::min(bestSeconds, seconds);
+
+		_scheduler->ResetWorkerFrame();
+	}
+
+	return TotalPipelines / bestSeconds;
+}
+
+int main()
+{
+	unsigned int totalWorkers = std::max(1u, std::thread::hardware_concurrency());
+
+	Peon::Scheduler* scheduler = new Peon::Scheduler();
+	scheduler->Initialize(totalWorkers, 1 << 18);
+
+	printf("Peon future benchmark (%u workers, %d three stage pipelines, best of %d runs)\n", totalWorkers, TotalPipelines, TotalRuns);
+
+	// Both styles must compute the same values
+	std::vector<uint64_t> sharedResults(TotalPipelines), futureResults(TotalPipelines);
+
+	double shared = Measure(scheduler, MeasureShared, sharedResults);
+	double futures = Measure(scheduler, MeasureFutures, futureResults);
+	printf("shared heap objects %10.0f pipelines/s | futures %10.0f pipelines/s%s\n", shared, futures,
+		sharedResults == futureResults ? "" : " (MISMATCH)");
+
+	delete scheduler;
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkIdle.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The number of worker threads used by each scheduler
+#define TotalWorkerThreads			(4)
+
+// How long we will measure the idle cpu usage (in milliseconds)
+#define IdleMeasureTime				(500)
+
+// The number of wake-up latency samples and the idle time between them (in milliseconds)
+#define TotalWakeSamples			(200)
+#define WakeSampleInterval			(2)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+double MeasureIdleCpuUsage()
+{
+	// Let the workers settle into their idle state
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	// Measure the process cpu time while nothing is running (std::clock is the process time on posix systems)
+	std::clock_t cpuBegin = std::clock();
+	auto wallBegin = BenchmarkClock::now();
+	std::this_thread::sleep_for(std::chrono::milliseconds(IdleMeasureTime));
+	std::clock_t cpuEnd = std::clock();
+	auto wallEnd = BenchmarkClock::now();
+
+	double cpuSeconds = double(cpuEnd - cpuBegin) / CLOCKS_PER_SEC;
+	double wallSeconds = std::chrono::duration<double>(wallEnd - wallBegin).count();
+
+	// Return the number of cores in use
+	return cpuSeconds / wallSeconds;
+}
+
+std::vector<double> MeasureWakeLatency(Peon::Scheduler* _scheduler)
+{
+	std::vector<double> samples;
+	samples.reserve(TotalWakeSamples);
+
+	for (int i = 0; i < TotalWakeSamples; i++)
+	{
+		// Let the workers become idle again
+		std::this_thread::sleep_for(std::chrono::milliseconds(WakeSampleInterval));
+
+		std::atomic<int64_t> startTime(0);
+		auto pushTime = BenchmarkClock::now();
+
+		// The job is pushed into the main thread queue, another worker must steal it
+		Peon::Job* job = _scheduler->CreateJob([&startTime]()
+		{
+			startTime = BenchmarkClock::now().time_since_epoch().count();
+		});
+		_scheduler->StartJob(job);
+
+		// Don't use WaitForJob here (the main thread would run the job itself)
+		while (startTime == 0)
+		{
+			std::this_thread::yield();
+		}
+
+		BenchmarkClock::duration latency = BenchmarkClock::duration(startTime.load()) - pushTime.time_since_epoch();
+		samples.push_back(std::chrono::duration<double, std::micro>(latency).count());
+
+		_scheduler->ResetWorkerFrame();
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	return samples;
+}
+
+void RunPolicy(Peon::IdlePolicy _policy, const char* _policyName)
+{
+	Peon::Scheduler* scheduler = new Peon::Scheduler();
+
+	// Set the idle policy and initialize the scheduler
+	Peon::IdleSettings idleSettings;
+	idleSettings.policy = _policy;
+	scheduler->SetIdleSettings(idleSettings);
+	scheduler->Initialize(TotalWorkerThreads, 1024);
+
+	double idleCores = MeasureIdleCpuUsage();
+	std::vector<double> latency = MeasureWakeLatency(scheduler);
+
+	// Release the scheduler (its workers would keep spinning or yielding during the next policy)
+	delete scheduler;
+
+	printf("%-8s idle cpu: %5.2f cores | wake latency p50: %8.1fus p99: %8.1fus max: %8.1fus\n",
+		_policyName,
+		idleCores,
+		latency[latency.size() / 2],
+		latency[(latency.size() * 99) / 100],
+		latency.back());
+}
+
+int main()
+{
+	printf("Peon idle benchmark (%d workers, worker 0 is the main thread)\n", TotalWorkerThreads);
+
+	// Each policy runs with its own scheduler (released before the next one starts)
+	RunPolicy(Peon::IdlePolicy::Park, "park");
+	RunPolicy(Peon::IdlePolicy::Backoff, "backoff");
+	RunPolicy(Peon::IdlePolicy::Yield, "yield");
+
+	return 0;
+}
@@ -0,0 +1,171 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkInjector.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The number of jobs submitted by each external producer thread for each run
+#define JobsPerProducer				(20000)
+
+// The time each producer waits between two submissions (in nanoseconds, so we measure latency and not just a full queue)
+#define SubmitInterval				(2000)
+
+// The number of worker threads used by each scheduler (0 uses one for each hardware thread)
+#define TotalWorkerThreads			(0)
+
+// The number of runs for each configuration (the latencies of all runs are merged)
+#define TotalRuns					(3)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// The configurations we compare
+struct BenchmarkConfiguration
+{
+	const char* name;
+	Peon::IdlePolicy idlePolicy;
+};
+
+// The data shared by all producers and jobs from a run
+struct BenchmarkRun
+{
+	Peon::Scheduler* scheduler;
+	Peon::Container* container;
+	Peon::Job* producersDone;
+	std::atomic<uint32_t> totalFinishedProducers;
+	std::vector<double> latencies;
+};
+
+// Submit jobs from a thread that isn't a worker, each job records how long it took to start
+void Producer(BenchmarkRun* _run, uint32_t _producerIndex, uint32_t _totalProducers)
+{
+	for (uint32_t i = 0; i < JobsPerProducer; i++)
+	{
+		uint32_t latencyIndex = _producerIndex * JobsPerProducer + i;
+		BenchmarkClock::time_point submitTime = BenchmarkClock::now();
+
+		_run->scheduler->StartJob(_run->scheduler->CreateChildJob(_run->container, [_run, latencyIndex, submitTime]()
+		{
+			_run->latencies[latencyIndex] = std::chrono::duration<double, std::micro>(BenchmarkClock::now() - submitTime).count();
+		}));
+
+		// Wait a little before the next one
+		while (BenchmarkClock::now() - submitTime < std::chrono::nanoseconds(SubmitInterval))
+		{
+		}
+	}
+
+	// The last producer lets the container finish
+	if (_run->totalFinishedProducers.fetch_add(1) + 1 == _totalProducers)
+	{
+		_run->scheduler->StartJob(_run->producersDone);
+	}
+}
+
+// Return the given percentile from a sorted latency array
+double Percentile(const std::vector<double>& _sortedLatencies, double _percentile)
+{
+	size_t index = std::min(_sortedLatencies.size() - 1, (size_t)(_percentile * (_sortedLatencies.size() - 1) + 0.5));
+	return _sortedLatencies[index];
+}
+
+// Run the producers a few times and return all latencies (sorted, in microseconds) and the submission rate
+std::vector<double> Measure(Peon::Scheduler* _scheduler, uint32_t _totalProducers, double& _jobsPerSecond)
+{
+	std::vector<double> latencies;
+	double totalSeconds = 0;
+	for (int run = 0; run < TotalRuns; run++)
+	{
+		BenchmarkRun benchmarkRun;
+		benchmarkRun.scheduler = _scheduler;
+		benchmarkRun.container = _scheduler->CreateContainer();
+		benchmarkRun.totalFinishedProducers = 0;
+		benchmarkRun.latencies.resize(_totalProducers * JobsPerProducer);
+
+		// This child keeps the container alive until all producers are done (the producers add children to a running container)
+		benchmarkRun.producersDone = _scheduler->CreateChildJob(benchmarkRun.container, []() {});
+		_scheduler->RetainJob(benchmarkRun.container);
+		_scheduler->StartJob(benchmarkRun.container);
+
+		auto begin = BenchmarkClock::now();
+		std::vector<std::thread> producers;
+		for (uint32_t i = 0; i < _totalProducers; i++)
+		{
+			producers.emplace_back(Producer, &benchmarkRun, i, _totalProducers);
+		}
+
+		// Help the workers until every submitted job ran
+		_scheduler->WaitForJob(benchmarkRun.container);
+		auto end = BenchmarkClock::now();
+		_scheduler->ReleaseJob(benchmarkRun.container);
+
+		for (auto& producer : producers)
+		{
+			producer.join();
+		}
+
+		totalSeconds += std::chrono::duration<double>(end - begin).count();
+		latencies.insert(latencies.end(), benchmarkRun.latencies.begin(), benchmarkRun.latencies.end());
+	}
+
+	_jobsPerSecond = latencies.size() / totalSeconds;
+	std::sort(latencies.begin(), latencies.end());
+
+	return latencies;
+}
+
+int main()
+{
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	unsigned int totalWorkers = TotalWorkerThreads > 0 ? TotalWorkerThreads : hardwareThreads;
+	const BenchmarkConfiguration configurations[] =
+	{
+		{ "yield", Peon::IdlePolicy::Yield },
+		{ "park ", Peon::IdlePolicy::Park },
+	};
+
+	printf("Peon injector benchmark (%u workers, %d jobs per producer, one every %d ns, %d runs)\n", totalWorkers, JobsPerProducer, SubmitInterval, TotalRuns);
+
+	for (uint32_t totalProducers = 1; totalProducers <= 8; totalProducers *= 2)
+	{
+		for (auto& configuration : configurations)
+		{
+			Peon::IdleSettings idleSettings;
+			idleSettings.policy = configuration.idlePolicy;
+
+			Peon::Scheduler* scheduler = new Peon::Scheduler();
+			scheduler->SetIdleSettings(idleSettings);
+			scheduler->SetJobStorageMode(Peon::JobStorageMode::Recycling);
+			scheduler->Initialize(totalWorkers, 4096);
+
+			double jobsPerSecond = 0;
+			std::vector<double> latencies = Measure(scheduler, totalProducers, jobsPerSecond);
+
+			// Release this scheduler (its workers would compete with the next one)
+			delete scheduler;
+
+			printf("producers: %u | idle %s | %10.0f jobs/s | submit-to-start: p50 %9.2f us, p99 %9.2f us, p999 %9.2f us\n", totalProducers, configuration.name,
+				jobsPerSecond, Percentile(latencies, 0.5), Percentile(latencies, 0.99), Percentile(latencies, 0.999));
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkJobFunction.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The number of jobs created each round and the number of rounds
+#define TotalJobsPerRound			(65536)
+#define TotalRounds					(20)
+
+////////////////
+// STRUCTURES //
+////////////////
+
+// A capture bigger than the job inline storage (and than any std::function small buffer)
+struct LargeCapture
+{
+	uint64_t values[12];
+};
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// Run the given creation method, return the best time per job (in nanoseconds) for creation only and creation + execution
+template <typename CreateMethod>
+void RunBenchmark(Peon::Scheduler* _scheduler, const char* _name, CreateMethod _createMethod)
+{
+	double bestCreate = 1e9;
+	double bestCreateAndRun = 1e9;
+
+	for (int round = 0; round < TotalRounds; round++)
+	{
+		// Creation only (the jobs are never started)
+		auto createBegin = BenchmarkClock::now();
+		for (int i = 0; i < TotalJobsPerRound; i++)
+		{
+			_createMethod(nullptr, i);
+		}
+		auto createEnd = BenchmarkClock::now();
+
+		_scheduler->ResetWorkerFrame();
+
+		// Creation, start and execution (there is only one worker, the main thread runs everything inside WaitForJob)
+		auto runBegin = BenchmarkClock::now();
+		Peon::Container* container = _scheduler->CreateContainer();
+		for (int i = 0; i < TotalJobsPerRound; i++)
+		{
+			_scheduler->StartJob(_createMethod(container, i));
+		}
+		_scheduler->StartJob(container);
+		_scheduler->WaitForJob(container);
+		auto runEnd = BenchmarkClock::now();
+
+		_scheduler->ResetWorkerFrame();
+
+		bestCreate = std::min(bestCreate, std::chrono::duration<double, std::nano>(createEnd - createBegin).count() / TotalJobsPerRound);
+		bestCreateAndRun = std::min(bestCreateAndRun, std::chrono::duration<double, std::nano>(runEnd - runBegin).count() / TotalJobsPerRound);
+	}
+
+	printf("%-32s create: %7.2f ns/job | create + run: %7.2f ns/job\n", _name, bestCreate, bestCreateAndRun);
+}
+
+// The previous creation path: the std::function was copied by value into CreateJob and copied again into the job
+template <typename FunctionType>
+void RunLegacyCopyBenchmark(const char* _name, FunctionType _function)
+{
+	double best = 1e9;
+	std::function<void()> storedFunction;
+
+	for (int round = 0; round < TotalRounds; round++)
+	{
+		auto begin = BenchmarkClock::now();
+		for (int i = 0; i < TotalJobsPerRound; i++)
+		{
+			std::function<void()> argument = _function;
+			std::function<void()> byValue = argument;
+			storedFunction = byValue;
+			storedFunction();
+		}
+		auto end = BenchmarkClock::now();
+
+		best = std::min(best, std::chrono::duration<double, std::nano>(end - begin).count() / TotalJobsPerRound);
+	}
+
+	printf("%-32s copies + call: %7.2f ns/job\n", _name, best);
+}
+
+int main()
+{
+	// A single worker, the main thread
+	Peon::Scheduler* scheduler = new Peon::Scheduler();
+	scheduler->Initialize(1, TotalJobsPerRound * 2);
+
+	std::atomic<uint64_t> counter(0);
+	LargeCapture largeCapture = {};
+
+	printf("Peon job function benchmark (%d jobs per round, best of %d rounds)\n", TotalJobsPerRound, TotalRounds);
+
+	// Small lambda, stored inline
+	RunBenchmark(scheduler, "small lambda (inline)", [&](Peon::Job* _parent, int _index)
+	{
+		auto function = [&counter, _index]() { counter += _index; };
+		return _parent == nullptr ? scheduler->CreateJob(function) : scheduler->CreateChildJob(_parent, function);
+	});
+
+	// Small std::function, the type-erased path used by existing call sites
+	RunBenchmark(scheduler, "small std::function", [&](Peon::Job* _parent, int _index)
+	{
+		std::function<void()> function = [&counter, _index]() { counter += _index; };
+		return _parent == nullptr ? scheduler->CreateJob(std::move(function)) : scheduler->CreateChildJob(_parent, std::move(function));
+	});
+
+	// Large lambda, allocated by the worker memory allocator
+	RunBenchmark(scheduler, "large lambda (worker allocator)", [&](Peon::Job* _parent, int _index)
+	{
+		auto function = [&counter, largeCapture, _index]() { counter += largeCapture.values[_index % 12]; };
+		return _parent == nullptr ? scheduler->CreateJob(function) : scheduler->CreateChildJob(_parent, function);
+	});
+
+	// Large std::function, allocated on the heap by std::function
+	RunBenchmark(scheduler, "large std::function (heap)", [&](Peon::Job* _parent, int _index)
+	{
+		std::function<void()> function = [&counter, largeCapture, _index]() { counter += largeCapture.values[_index % 12]; };
+		return _parent == nullptr ? scheduler->CreateJob(std::move(function)) : scheduler->CreateChildJob(_parent, std::move(function));
+	});
+
+	// The copies the previous implementation made for each job
+	int index = 7;
+	RunLegacyCopyBenchmark("legacy small std::function", [&counter, index]() { counter += index; });
+	RunLegacyCopyBenchmark("legacy large std::function", [&counter, largeCapture, index]() { counter += largeCapture.values[index % 12]; });
+
+	return 0;
+}
@@ -0,0 +1,131 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkParallelFor.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The number of elements for the cheap and the expensive loop bodies
+#define TotalCheapElements			(1 << 20)
+#define TotalExpensiveElements		(1 << 14)
+
+// The amount of work done by each expensive element
+#define ExpensiveWorkIterations		(2048)
+
+// The number of rounds we run for each configuration (we keep the best one)
+#define TotalRounds					(10)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+void CheapWork(float* _values, int _index)
+{
+	_values[_index] = _values[_index] * 1.0001f + 1.0f;
+}
+
+void ExpensiveWork(float* _values, int _index)
+{
+	float value = _values[_index];
+	for (int i = 0; i < ExpensiveWorkIterations; i++)
+	{
+		value = value * 1.0001f + 1.0f;
+	}
+
+	_values[_index] = value;
+}
+
+// One job for each element inside a container (the pattern from the container example)
+template <typename WorkMethod>
+double RunPerElementJobs(Peon::Scheduler* _scheduler, float* _values, int _totalElements, WorkMethod _workMethod)
+{
+	double best = 1e9;
+	for (int round = 0; round < TotalRounds; round++)
+	{
+		auto begin = BenchmarkClock::now();
+
+		Peon::Container* container = _scheduler->CreateContainer();
+		for (int i = 0; i < _totalElements; i++)
+		{
+			_scheduler->StartJob(_scheduler->CreateChildJob(container, [_values, i, _workMethod]() { _workMethod(_values, i); }));
+		}
+
+		_scheduler->StartJob(container);
+		_scheduler->WaitForJob(container);
+
+		auto end = BenchmarkClock::now();
+
+		_scheduler->ResetWorkerFrame();
+
+		best = std::min(best, std::chrono::duration<double, std::milli>(end - begin).count());
+	}
+
+	return best;
+}
+
+// The same loop using the parallel for
+template <typename WorkMethod>
+double RunParallelFor(Peon::Scheduler* _scheduler, float* _values, int _totalElements, int _grainSize, WorkMethod _workMethod)
+{
+	double best = 1e9;
+	for (int round = 0; round < TotalRounds; round++)
+	{
+		auto begin = BenchmarkClock::now();
+
+		_scheduler->ParallelFor(0, _totalElements, [_values, _workMethod](int _index) { _workMethod(_values, _index); }, _grainSize);
+
+		auto end = BenchmarkClock::now();
+
+		_scheduler->ResetWorkerFrame();
+
+		best = std::min(best, std::chrono::duration<double, std::milli>(end - begin).count());
+	}
+
+	return best;
+}
+
+int main()
+{
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<float> values(TotalCheapElements, 1.0f);
+
+	printf("Peon parallel for benchmark (best of %d rounds)\n", TotalRounds);
+
+	for (unsigned int totalWorkers = 1; ; totalWorkers = std::min(totalWorkers * 2, hardwareThreads))
+	{
+		Peon::Scheduler* scheduler = new Peon::Scheduler();
+		scheduler->Initialize(totalWorkers, TotalCheapElements * 2);
+
+		double cheapJobs = RunPerElementJobs(scheduler, values.data(), TotalCheapElements, CheapWork);
+		double cheapParallelFor = RunParallelFor(scheduler, values.data(), TotalCheapElements, 1024, CheapWork);
+		double expensiveJobs = RunPerElementJobs(scheduler, values.data(), TotalExpensiveElements, ExpensiveWork);
+		double expensiveParallelFor = RunParallelFor(scheduler, values.data(), TotalExpensiveElements, 1, ExpensiveWork);
+
+		// Release this scheduler (its workers would compete with the next one)
+		delete scheduler;
+
+		printf("workers: %2u | cheap (%d): jobs %8.3f ms, parallel for %8.3f ms | expensive (%d): jobs %8.3f ms, parallel for %8.3f ms\n",
+			totalWorkers, TotalCheapElements, cheapJobs, cheapParallelFor, TotalExpensiveElements, expensiveJobs, expensiveParallelFor);
+
+		if (totalWorkers == hardwareThreads)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
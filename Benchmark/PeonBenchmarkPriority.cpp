@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkPriority.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The bulk load is a binary tree of jobs with this depth, each node starts its children after doing its work
+#define BulkTreeDepth				(15)
+
+// One probe job (the latency critical work) is started every this many bulk jobs
+#define ProbeInterval				(64)
+
+// The amount of work done by each bulk job
+#define JobWorkIterations			(256)
+
+// The number of runs for each mode (the latencies of all runs are merged)
+#define TotalRuns					(5)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// The data shared by all jobs from a run
+struct BenchmarkRun
+{
+	Peon::Scheduler* scheduler;
+	Peon::Container* container;
+	Peon::JobPriority probePriority;
+	std::atomic<uint32_t> totalBulkJobs;
+	std::atomic<uint32_t> totalProbes;
+	std::vector<double> probeLatencies;
+};
+
+void JobWork(uint32_t _seed)
+{
+	volatile uint32_t value = _seed;
+	for (int i = 0; i < JobWorkIterations; i++)
+	{
+		value = value * 1664525u + 1013904223u;
+	}
+}
+
+// Start a probe, its latency is the time between the start and the moment it runs
+void StartProbe(BenchmarkRun* _run)
+{
+	uint32_t probeIndex = _run->totalProbes.fetch_add(1, std::memory_order_relaxed);
+	BenchmarkClock::time_point startTime = BenchmarkClock::now();
+
+	_run->scheduler->StartJob(_run->scheduler->CreateChildJob(_run->container, [_run, probeIndex, startTime]()
+	{
+		_run->probeLatencies[probeIndex] = std::chrono::duration<double, std::micro>(BenchmarkClock::now() - startTime).count();
+	}), _run->probePriority);
+}
+
+// A bulk job does its work, may start a probe and then starts its children (they are pushed after the probe, with a single
+// lane the probe waits for the whole subtree)
+void BulkJob(BenchmarkRun* _run, uint32_t _depth)
+{
+	uint32_t bulkIndex = _run->totalBulkJobs.fetch_add(1, std::memory_order_relaxed);
+	JobWork(bulkIndex);
+
+	if (bulkIndex % ProbeInterval == 0)
+	{
+		StartProbe(_run);
+	}
+
+	if (_depth == 0)
+	{
+		return;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		_run->scheduler->StartJob(_run->scheduler->CreateChildJob(_run->container, [_run, _depth]() { BulkJob(_run, _depth - 1); }), Peon::JobPriority::Normal);
+	}
+}
+
+// Return the given percentile from a sorted latency array
+double Percentile(const std::vector<double>& _sortedLatencies, double _percentile)
+{
+	size_t index = std::min(_sortedLatencies.size() - 1, (size_t)(_percentile * (_sortedLatencies.size() - 1) + 0.5));
+	return _sortedLatencies[index];
+}
+
+// Run the bulk load a few times and return all probe latencies (sorted, in microseconds)
+std::vector<double> Measure(Peon::Scheduler* _scheduler, Peon::JobPriority _probePriority)
+{
+	const uint32_t totalBulkJobs = (1u << (BulkTreeDepth + 1)) - 1;
+	const uint32_t totalProbes = (totalBulkJobs + ProbeInterval - 1) / ProbeInterval;
+
+	std::vector<double> latencies;
+	for (int run = 0; run < TotalRuns; run++)
+	{
+		BenchmarkRun benchmarkRun;
+		benchmarkRun.scheduler = _scheduler;
+		benchmarkRun.container = _scheduler->CreateContainer();
+		benchmarkRun.probePriority = _probePriority;
+		benchmarkRun.totalBulkJobs = 0;
+		benchmarkRun.totalProbes = 0;
+		benchmarkRun.probeLatencies.resize(totalProbes);
+
+		BenchmarkRun* runPointer = &benchmarkRun;
+		_scheduler->StartJob(_scheduler->CreateChildJob(benchmarkRun.container, [runPointer]() { BulkJob(runPointer, BulkTreeDepth); }));
+		_scheduler->StartJob(benchmarkRun.container);
+		_scheduler->WaitForJob(benchmarkRun.container);
+
+		_scheduler->ResetWorkerFrame();
+
+		latencies.insert(latencies.end(), benchmarkRun.probeLatencies.begin(), benchmarkRun.probeLatencies.end());
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+
+	return latencies;
+}
+
+int main()
+{
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	const uint32_t totalBulkJobs = (1u << (BulkTreeDepth + 1)) - 1;
+
+	printf("Peon priority benchmark (%u bulk jobs, one probe every %d bulk jobs, %d runs)\n", totalBulkJobs, ProbeInterval, TotalRuns);
+
+	for (unsigned int totalWorkers = 1; ; totalWorkers = std::min(totalWorkers * 2, hardwareThreads))
+	{
+		Peon::Scheduler* scheduler = new Peon::Scheduler();
+		scheduler->Initialize(totalWorkers, totalBulkJobs * 2);
+		scheduler->EnableLaneStatistics(true);
+
+		std::vector<double> normalLatencies = Measure(scheduler, Peon::JobPriority::Normal);
+		scheduler->ResetLaneStatistics();
+		std::vector<double> highLatencies = Measure(scheduler, Peon::JobPriority::High);
+
+		// The lane statistics only see the high priority probes
+		Peon::LaneStatistics highLane = scheduler->GetLaneStatistics(Peon::JobPriority::High);
+
+		// Release this scheduler (its workers would compete with the next one)
+		delete scheduler;
+
+		printf("workers: %2u | normal probes: p50 %9.2f us, p99 %9.2f us | high probes: p50 %9.2f us, p99 %9.2f us | high lane p99 (histogram) <= %9.2f us\n",
+			totalWorkers, Percentile(normalLatencies, 0.5), Percentile(normalLatencies, 0.99), Percentile(highLatencies, 0.5), Percentile(highLatencies, 0.99),
+			highLane.GetWaitTimePercentile(0.99) / 1000.0);
+
+		if (totalWorkers == hardwareThreads)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,499 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkScaling.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The library version (set by the build)
+#ifndef PeonBenchmarkVersion
+#define PeonBenchmarkVersion		"unknown"
+#endif
+
+// The number of xorshift rounds for each unit of work (around a microsecond)
+#define WorkIterationsPerUnit		(256)
+
+// The frames run before measuring (the job storage and allocators warm up)
+#define WarmupFrames				(5)
+
+// The job storage for each worker (must hold every job created in a frame)
+#define JobBufferSize				(1 << 15)
+
+// The fan out shape, the Peon.cpp loop scenario (a random number of primary jobs, each one with dependants)
+#define FanOutMaximumPrimaries		(1024)
+#define FanOutDependants			(4)
+
+// The wide shape (a single job spawning a random number of leaves)
+#define WideMaximumLeaves			(4096)
+
+// The chain shape (independent chains of random lengths, the parallelism is limited to the number of chains)
+#define TotalChains					(8)
+#define ChainMaximumLength			(256)
+
+// The nested shape (each level is a child container created by a job of the level above, the root has a random branching)
+#define NestedDepth					(4)
+#define NestedBranching				(8)
+
+// The random shape (each node depends on up to a few random nodes among the previous ones)
+#define RandomNodes					(4096)
+#define RandomMaximumPredecessors	(3)
+#define RandomWindow				(64)
+
+// The imbalanced shape (most leaves are cheap, a few are much more expensive)
+#define ImbalancedLeaves			(4096)
+#define ImbalancedHeavyChance		(20)
+#define ImbalancedHeavyUnits		(50)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// A small random generator (the same one used by the Peon.cpp loop), each frame has its own so the graphs only depend on the
+// seed and never on the number of workers
+struct FrameRandom
+{
+	uint32_t seed;
+
+	uint32_t RandomIntInRange(uint32_t _from, uint32_t _to)
+	{
+		seed = (214013 * seed + 2531011);
+		uint32_t rand = (seed >> 16) & 0x7FFF;
+		return (rand % (_to - _from)) + _from;
+	}
+};
+
+// A frame, the cost of each job and where each job writes its result (every job must write a non zero result)
+struct Frame
+{
+	Peon::Scheduler* scheduler;
+	std::vector<uint32_t> costs;
+	std::vector<uint64_t> results;
+	uint64_t seed;
+};
+
+// Do some work that can't be optimized away
+uint64_t Work(uint32_t _units, uint64_t _seed)
+{
+	uint64_t value = _seed | 1;
+	for (uint32_t i = 0; i < _units * WorkIterationsPerUnit; i++)
+	{
+		value ^= value << 13;
+		value ^= value >> 7;
+		value ^= value << 17;
+	}
+
+	return value | 1;
+}
+
+// Run a node of the frame
+void RunNode(Frame* _frame, uint32_t _index)
+{
+	_frame->results[_index] = Work(_frame->costs[_index], _frame->seed + _index);
+}
+
+// Prepare the frame for the given number of jobs (all of them cost a single unit)
+void PrepareFrame(Frame* _frame, uint32_t _totalJobs)
+{
+	_frame->costs.assign(_totalJobs, 1);
+	_frame->results.assign(_totalJobs, 0);
+}
+
+// The fan out shape, built like the Peon.cpp loop
+void BuildFanOut(Frame* _frame, FrameRandom& _random, Peon::Container* _container)
+{
+	Peon::Scheduler* scheduler = _frame->scheduler;
+	uint32_t totalPrimaries = _random.RandomIntInRange(uint32_t(FanOutMaximumPrimaries * 0.8), FanOutMaximumPrimaries);
+	PrepareFrame(_frame, totalPrimaries * (FanOutDependants + 1));
+
+	for (uint32_t i = 0; i < totalPrimaries; i++)
+	{
+		uint32_t primaryIndex = i * (FanOutDependants + 1);
+		Peon::Job* primaryJob = scheduler->CreateChildJob(_container, [_frame, primaryIndex]() { RunNode(_frame, primaryIndex); });
+		for (uint32_t j = 1; j <= FanOutDependants; j++)
+		{
+			Peon::Job* dependantJob = scheduler->CreateChildJob(_container, [_frame, primaryIndex, j]() { RunNode(_frame, primaryIndex + j); });
+			scheduler->AddJobDependency(primaryJob, dependantJob);
+		}
+
+		scheduler->StartJob(primaryJob);
+	}
+}
+
+// The wide shape, a single job spawns all leaves (the other workers must steal everything from it)
+void BuildWide(Frame* _frame, FrameRandom& _random, Peon::Container* _container)
+{
+	uint32_t totalLeaves = _random.RandomIntInRange(uint32_t(WideMaximumLeaves * 0.8), WideMaximumLeaves);
+	PrepareFrame(_frame, totalLeaves + 1);
+
+	Peon::Scheduler* scheduler = _frame->scheduler;
+	scheduler->StartJob(scheduler->CreateChildJob(_container, [_frame, totalLeaves]()
+	{
+		for (uint32_t i = 1; i <= totalLeaves; i++)
+		{
+			_frame->scheduler->StartJob(_frame->scheduler->CreateChildJob([_frame, i]() { RunNode(_frame, i); }));
+		}
+
+		RunNode(_frame, 0);
+	}));
+}
+
+// The chain shape
+void BuildChains(Frame* _frame, FrameRandom& _random, Peon::Container* _container)
+{
+	Peon::Scheduler* scheduler = _frame->scheduler;
+
+	// Pick the chain lengths first, the chains are stored one after the other
+	uint32_t chainLengths[TotalChains];
+	uint32_t totalJobs = 0;
+	for (uint32_t i = 0; i < TotalChains; i++)
+	{
+		chainLengths[i] = _random.RandomIntInRange(ChainMaximumLength / 2, ChainMaximumLength + 1);
+		totalJobs += chainLengths[i];
+	}
+
+	PrepareFrame(_frame, totalJobs);
+
+	uint32_t firstIndex = 0;
+	for (uint32_t i = 0; i < TotalChains; i++)
+	{
+		Peon::Job* firstJob = scheduler->CreateChildJob(_container, [_frame, firstIndex]() { RunNode(_frame, firstIndex); });
+		Peon::Job* previousJob = firstJob;
+		for (uint32_t j = 1; j < chainLengths[i]; j++)
+		{
+			Peon::Job* nextJob = scheduler->CreateChildJob(_container, [_frame, firstIndex, j]() { RunNode(_frame, firstIndex + j); });
+			scheduler->AddJobDependency(previousJob, nextJob);
+			previousJob = nextJob;
+		}
+
+		scheduler->StartJob(firstJob);
+		firstIndex += chainLengths[i];
+	}
+}
+
+// A level of the nested shape, each node creates a child container with the given number of nodes for the level below (the
+// leaves do the work)
+void RunNestedLevel(Frame* _frame, uint32_t _depth, uint32_t _index, uint32_t _branching)
+{
+	if (_depth == NestedDepth)
+	{
+		RunNode(_frame, _index);
+		return;
+	}
+
+	Peon::Scheduler* scheduler = _frame->scheduler;
+	Peon::Container* container = scheduler->CreateChildContainer();
+	for (uint32_t i = 0; i < _branching; i++)
+	{
+		uint32_t childIndex = _index * NestedBranching + i;
+		scheduler->StartJob(scheduler->CreateChildJob(container, [_frame, _depth, childIndex]() { RunNestedLevel(_frame, _depth + 1, childIndex, NestedBranching); }));
+	}
+
+	scheduler->StartJob(container);
+}
+
+// The nested shape
+void BuildNested(Frame* _frame, FrameRandom& _random, Peon::Container* _container)
+{
+	// The leaves are numbered level by level, the root branching only limits the first digit
+	uint32_t rootBranching = _random.RandomIntInRange(NestedBranching / 2, NestedBranching + 1);
+	uint32_t totalLeaves = rootBranching;
+	for (uint32_t i = 1; i < NestedDepth; i++)
+	{
+		totalLeaves *= NestedBranching;
+	}
+
+	PrepareFrame(_frame, totalLeaves);
+
+	Peon::Scheduler* scheduler = _frame->scheduler;
+	scheduler->StartJob(scheduler->CreateChildJob(_container, [_frame, rootBranching]() { RunNestedLevel(_frame, 0, 0, rootBranching); }));
+}
+
+// The random shape, the nodes are created in topological order and the ones without predecessors are started
+void BuildRandom(Frame* _frame, FrameRandom& _random, Peon::Container* _container)
+{
+	Peon::Scheduler* scheduler = _frame->scheduler;
+	PrepareFrame(_frame, RandomNodes);
+
+	std::vector<Peon::Job*> jobs(RandomNodes);
+	std::vector<Peon::Job*> rootJobs;
+	for (uint32_t i = 0; i < RandomNodes; i++)
+	{
+		jobs[i] = scheduler->CreateChildJob(_container, [_frame, i]() { RunNode(_frame, i); });
+
+		// Pick the predecessors (duplicates are skipped, a node could end up without any)
+		uint32_t totalPredecessors = i == 0 ? 0 : _random.RandomIntInRange(0, RandomMaximumPredecessors + 1);
+		uint32_t predecessors[RandomMaximumPredecessors];
+		uint32_t totalUnique = 0;
+		for (uint32_t j = 0; j < totalPredecessors; j++)
+		{
+			uint32_t predecessor = i - 1 - _random.RandomIntInRange(0, std::min(i, uint32_t(RandomWindow)));
+			if (std::find(predecessors, predecessors + totalUnique, predecessor) == predecessors + totalUnique)
+			{
+				predecessors[totalUnique++] = predecessor;
+				scheduler->AddJobDependency(jobs[predecessor], jobs[i]);
+			}
+		}
+
+		if (totalUnique == 0)
+		{
+			rootJobs.push_back(jobs[i]);
+		}
+	}
+
+	// Only start after every dependency was added
+	for (Peon::Job* rootJob : rootJobs)
+	{
+		scheduler->StartJob(rootJob);
+	}
+}
+
+// The imbalanced shape
+void BuildImbalanced(Frame* _frame, FrameRandom& _random, Peon::Container* _container)
+{
+	Peon::Scheduler* scheduler = _frame->scheduler;
+	PrepareFrame(_frame, ImbalancedLeaves);
+
+	for (uint32_t i = 0; i < ImbalancedLeaves; i++)
+	{
+		if (_random.RandomIntInRange(0, ImbalancedHeavyChance) == 0)
+		{
+			_frame->costs[i] = ImbalancedHeavyUnits;
+		}
+
+		scheduler->StartJob(scheduler->CreateChildJob(_container, [_frame, i]() { RunNode(_frame, i); }));
+	}
+}
+
+// The shapes
+struct Shape
+{
+	const char* name;
+	void(*build)(Frame*, FrameRandom&, Peon::Container*);
+};
+
+const Shape Shapes[] =
+{
+	{ "fanout", &BuildFanOut },
+	{ "wide", &BuildWide },
+	{ "chains", &BuildChains },
+	{ "nested", &BuildNested },
+	{ "random", &BuildRandom },
+	{ "imbalanced", &BuildImbalanced },
+};
+
+// The result of a shape for a number of workers
+struct ScalingResult
+{
+	const char* shape;
+	unsigned int workers;
+	double jobsPerFrame;
+	double framePercentiles[3];
+	double jobsPerSecond;
+	double totalSeconds;
+	double speedup;
+	double efficiency;
+};
+
+// Return a percentile of the sorted values (nearest rank)
+double GetPercentile(const std::vector<double>& _sortedValues, double _percentile)
+{
+	size_t rank = size_t(_percentile * _sortedValues.size() + 0.5);
+	return _sortedValues[std::min(rank == 0 ? 0 : rank - 1, _sortedValues.size() - 1)];
+}
+
+// Run the frames of a shape, each frame builds its graph (timed, real frames do it too), waits for it and checks every job ran
+bool RunShape(Peon::Scheduler* _scheduler, const Shape& _shape, uint32_t _seed, uint32_t _totalFrames, ScalingResult& _result)
+{
+	Frame frame = { _scheduler, {}, {}, 0 };
+	std::vector<double> frameTimes;
+	uint64_t totalJobs = 0;
+
+	for (uint32_t i = 0; i < WarmupFrames + _totalFrames; i++)
+	{
+		// The graph only depends on the seed, the shape and the frame index
+		FrameRandom random = { _seed * 2654435761u + i * 40503u + uint32_t(&_shape - Shapes) * 97u };
+		frame.seed = random.seed;
+
+		auto begin = BenchmarkClock::now();
+
+		Peon::Container* container = _scheduler->CreateContainer();
+		_shape.build(&frame, random, container);
+		_scheduler->StartJob(container);
+		_scheduler->WaitForJob(container);
+
+		double frameTime = std::chrono::duration<double, std::micro>(BenchmarkClock::now() - begin).count();
+		_scheduler->ResetWorkerFrame();
+
+		if (std::count(frame.results.begin(), frame.results.end(), 0ull) != 0)
+		{
+			fprintf(stderr, "Shape %s frame %u didn't run every job!\n", _shape.name, i);
+			return false;
+		}
+
+		if (i >= WarmupFrames)
+		{
+			frameTimes.push_back(frameTime);
+			totalJobs += frame.results.size();
+		}
+	}
+
+	double totalTime = 0;
+	for (double frameTime : frameTimes)
+	{
+		totalTime += frameTime;
+	}
+
+	std::sort(frameTimes.begin(), frameTimes.end());
+	_result.shape = _shape.name;
+	_result.jobsPerFrame = double(totalJobs) / _totalFrames;
+	_result.framePercentiles[0] = GetPercentile(frameTimes, 0.5);
+	_result.framePercentiles[1] = GetPercentile(frameTimes, 0.99);
+	_result.framePercentiles[2] = GetPercentile(frameTimes, 0.999);
+	_result.totalSeconds = totalTime / 1e6;
+	_result.jobsPerSecond = totalJobs / _result.totalSeconds;
+
+	return true;
+}
+
+// Write the results as json
+void WriteResults(FILE* _file, const std::vector<ScalingResult>& _results, uint32_t _seed, uint32_t _totalFrames)
+{
+	fprintf(_file, "{\n");
+	fprintf(_file, "  \"benchmark\": \"peon_bench_scaling\",\n");
+	fprintf(_file, "  \"version\": \"%s\",\n", PeonBenchmarkVersion);
+	fprintf(_file, "  \"seed\": %u,\n", _seed);
+	fprintf(_file, "  \"frames\": %u,\n", _totalFrames);
+	fprintf(_file, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+	fprintf(_file, "  \"results\": [");
+	for (size_t i = 0; i < _results.size(); i++)
+	{
+		const ScalingResult& result = _results[i];
+		fprintf(_file, "%s\n    { \"shape\": \"%s\", \"workers\": %u, \"jobs_per_frame\": %.1f, \"frame_p50_us\": %.2f, \"frame_p99_us\": %.2f, "
+			"\"frame_p999_us\": %.2f, \"jobs_per_second\": %.0f, \"speedup\": %.3f, \"efficiency\": %.3f }", i == 0 ? "" : ",", result.shape,
+			result.workers, result.jobsPerFrame, result.framePercentiles[0], result.framePercentiles[1], result.framePercentiles[2],
+			result.jobsPerSecond, result.speedup, result.efficiency);
+	}
+
+	fprintf(_file, "\n  ]\n}\n");
+}
+
+int main(int _argc, char** _argv)
+{
+	// The options, the json goes to the standard output unless a file is given, the progress always goes to the error output
+	const char* outputPath = nullptr;
+	const char* shapeFilter = nullptr;
+	uint32_t seed = 1;
+	uint32_t totalFrames = 100;
+	unsigned int maximumWorkers = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 1; i < _argc; i++)
+	{
+		if (strcmp(_argv[i], "--output") == 0 && i + 1 < _argc)
+		{
+			outputPath = _argv[++i];
+		}
+		else if (strcmp(_argv[i], "--shape") == 0 && i + 1 < _argc)
+		{
+			shapeFilter = _argv[++i];
+		}
+		else if (strcmp(_argv[i], "--seed") == 0 && i + 1 < _argc)
+		{
+			seed = uint32_t(strtoul(_argv[++i], nullptr, 10));
+		}
+		else if (strcmp(_argv[i], "--frames") == 0 && i + 1 < _argc)
+		{
+			totalFrames = std::max(1, atoi(_argv[++i]));
+		}
+		else if (strcmp(_argv[i], "--workers") == 0 && i + 1 < _argc)
+		{
+			maximumWorkers = std::max(1, atoi(_argv[++i]));
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [--output file.json] [--shape name] [--seed value] [--frames count] [--workers maximum]\n", _argv[0]);
+			return 1;
+		}
+	}
+
+	// 1, 2, 4... workers and the maximum
+	std::vector<unsigned int> workerCounts;
+	for (unsigned int workers = 1; workers < maximumWorkers; workers *= 2)
+	{
+		workerCounts.push_back(workers);
+	}
+
+	workerCounts.push_back(maximumWorkers);
+
+	fprintf(stderr, "Peon scaling sweep %s (seed %u, %u frames, up to %u workers)\n", PeonBenchmarkVersion, seed, totalFrames, maximumWorkers);
+
+	// A new system for each worker count (shut down before the next one)
+	std::vector<ScalingResult> results;
+	for (unsigned int workers : workerCounts)
+	{
+		Peon::Scheduler* scheduler = new Peon::Scheduler();
+		scheduler->Initialize(workers, JobBufferSize);
+
+		for (const Shape& shape : Shapes)
+		{
+			if (shapeFilter != nullptr && strcmp(shapeFilter, shape.name) != 0)
+			{
+				continue;
+			}
+
+			ScalingResult result = {};
+			result.workers = workers;
+			if (!RunShape(scheduler, shape, seed, totalFrames, result))
+			{
+				return 1;
+			}
+
+			// Compare with the single worker run of the same shape
+			auto baseline = std::find_if(results.begin(), results.end(), [&](const ScalingResult& _result)
+			{
+				return _result.workers == 1 && strcmp(_result.shape, shape.name) == 0;
+			});
+
+			result.speedup = baseline != results.end() ? baseline->totalSeconds / result.totalSeconds : 1.0;
+			result.efficiency = result.speedup / workers;
+			results.push_back(result);
+
+			fprintf(stderr, "%-10s | %2u workers | %7.0f jobs/frame | p50 %9.1f us | p99 %9.1f us | p999 %9.1f us | %10.0f jobs/s | speedup %5.2f | efficiency %4.2f\n",
+				shape.name, workers, result.jobsPerFrame, result.framePercentiles[0], result.framePercentiles[1], result.framePercentiles[2],
+				result.jobsPerSecond, result.speedup, result.efficiency);
+		}
+
+		delete scheduler;
+	}
+
+	FILE* outputFile = outputPath != nullptr ? fopen(outputPath, "w") : stdout;
+	if (outputFile == nullptr)
+	{
+		fprintf(stderr, "Can't write %s\n", outputPath);
+		return 1;
+	}
+
+	WriteResults(outputFile, results, seed, totalFrames);
+	if (outputFile != stdout)
+	{
+		fclose(outputFile);
+	}
+
+	return 0;
+}
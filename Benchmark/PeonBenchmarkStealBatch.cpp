@@ -0,0 +1,228 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkStealBatch.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/////////////
+// DEFINES //
+/////////////
+
+// The number of jobs pushed by the producer for each run
+#define TotalJobs					(1 << 18)
+
+// The amount of work done by each job (tiny, so the steals dominate)
+#define JobWorkIterations			(16)
+
+// The number of runs for each batch size (we keep the best one)
+#define TotalRuns					(5)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// The cache miss counters, one for each thread that ran a job (only on linux, when the hardware counters are available)
+struct CacheMissCounters
+{
+	std::mutex mutex;
+	std::vector<int> counters;
+	bool available = true;
+};
+
+CacheMissCounters cacheMissCounters;
+thread_local bool cacheMissCounterOpened = false;
+
+// Open the cache miss counter for the calling thread (once)
+void OpenCacheMissCounter()
+{
+	if (cacheMissCounterOpened)
+	{
+		return;
+	}
+
+	cacheMissCounterOpened = true;
+
+#if defined(__linux__)
+
+	perf_event_attr attributes;
+	memset(&attributes, 0, sizeof(attributes));
+	attributes.size = sizeof(attributes);
+	attributes.type = PERF_TYPE_HARDWARE;
+	attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+
+	int counter = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+
+	std::lock_guard<std::mutex> lock(cacheMissCounters.mutex);
+	if (counter < 0)
+	{
+		cacheMissCounters.available = false;
+		return;
+	}
+
+	// Grow the list and store the descriptor (push_back takes the local by reference, gcc 12 reports it as a dangling pointer)
+	size_t counterIndex = cacheMissCounters.counters.size();
+	cacheMissCounters.counters.resize(counterIndex + 1);
+	cacheMissCounters.counters[counterIndex] = counter;
+
+#else
+
+	cacheMissCounters.available = false;
+
+#endif
+}
+
+// Reset all cache miss counters
+void ResetCacheMisses()
+{
+#if defined(__linux__)
+
+	std::lock_guard<std::mutex> lock(cacheMissCounters.mutex);
+	for (int counter : cacheMissCounters.counters)
+	{
+		ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+	}
+
+#endif
+}
+
+// Return the total number of cache misses since the last reset
+uint64_t ReadCacheMisses()
+{
+	uint64_t totalMisses = 0;
+
+#if defined(__linux__)
+
+	std::lock_guard<std::mutex> lock(cacheMissCounters.mutex);
+	for (int counter : cacheMissCounters.counters)
+	{
+		uint64_t misses = 0;
+		if (read(counter, &misses, sizeof(misses)) == sizeof(misses))
+		{
+			totalMisses += misses;
+		}
+	}
+
+#endif
+
+	return totalMisses;
+}
+
+void JobWork(uint32_t _seed)
+{
+	volatile uint32_t value = _seed;
+	for (int i = 0; i < JobWorkIterations; i++)
+	{
+		value = value * 1664525u + 1013904223u;
+	}
+}
+
+// The measured values of a run
+struct BenchmarkResult
+{
+	double jobsPerSecond = 0;
+	uint64_t totalSteals = 0;
+	uint64_t cacheMisses = 0;
+};
+
+// The producer (this thread, worker 0) pushes all jobs while the other workers steal them, then it helps until all finish
+BenchmarkResult Measure(Peon::Scheduler* _scheduler)
+{
+	BenchmarkResult best;
+	for (int run = 0; run < TotalRuns; run++)
+	{
+		uint64_t totalSteals = _scheduler->GetTotalSteals(Peon::StealTier::Sibling) + _scheduler->GetTotalSteals(Peon::StealTier::Local) +
+			_scheduler->GetTotalSteals(Peon::StealTier::Remote);
+		ResetCacheMisses();
+
+		auto begin = BenchmarkClock::now();
+		Peon::Container* container = _scheduler->CreateContainer();
+		_scheduler->RetainJob(container);
+		for (uint32_t i = 0; i < TotalJobs; i++)
+		{
+			_scheduler->StartJob(_scheduler->CreateChildJob(container, [i]() { OpenCacheMissCounter(); JobWork(i); }));
+		}
+
+		_scheduler->StartJob(container);
+		_scheduler->WaitForJob(container);
+		_scheduler->ReleaseJob(container);
+		auto end = BenchmarkClock::now();
+
+		BenchmarkResult result;
+		result.jobsPerSecond = TotalJobs / std::chrono::duration<double>(end - begin).count();
+		result.totalSteals = _scheduler->GetTotalSteals(Peon::StealTier::Sibling) + _scheduler->GetTotalSteals(Peon::StealTier::Local) +
+			_scheduler->GetTotalSteals(Peon::StealTier::Remote) - totalSteals;
+		result.cacheMisses = ReadCacheMisses();
+
+		if (result.jobsPerSecond > best.jobsPerSecond)
+		{
+			best = result;
+		}
+	}
+
+	return best;
+}
+
+int main()
+{
+	unsigned int hardwareThreads = std::max(2u, std::thread::hardware_concurrency());
+	const uint32_t batchSizes[] = { 1, 4, 16, 64 };
+
+	OpenCacheMissCounter();
+
+	printf("Peon steal batch benchmark (1 producer, %u jobs, best of %d runs)\n", TotalJobs, TotalRuns);
+
+	for (unsigned int totalWorkers = 2; ; totalWorkers = std::min(totalWorkers * 2, hardwareThreads))
+	{
+		for (uint32_t batchSize : batchSizes)
+		{
+			Peon::Scheduler* scheduler = new Peon::Scheduler();
+			scheduler->SetJobStorageMode(Peon::JobStorageMode::Recycling);
+			scheduler->SetStealBatchSize(batchSize);
+			scheduler->Initialize(totalWorkers, 4096);
+
+			BenchmarkResult result = Measure(scheduler);
+
+			// Release this scheduler (its workers would compete with the next one)
+			delete scheduler;
+
+			char cacheMisses[32] = "n/a";
+			if (cacheMissCounters.available)
+			{
+				snprintf(cacheMisses, sizeof(cacheMisses), "%llu", (unsigned long long)result.cacheMisses);
+			}
+
+			printf("thieves: %2u | batch %2u%s | %10.0f jobs/s | steals: %8llu | cache misses: %s\n", totalWorkers - 1, batchSize, batchSize == 1 ? " (single)" : "         ",
+				result.jobsPerSecond, (unsigned long long)result.totalSteals, cacheMisses);
+		}
+
+		if (totalWorkers == hardwareThreads)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
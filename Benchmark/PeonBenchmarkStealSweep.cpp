@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkStealSweep.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The number of jobs pushed by a single worker (all other workers start empty)
+#define TotalJobs					(1 << 14)
+
+// Most jobs are short, one in each SkewInterval jobs is SkewFactor times longer
+#define JobWorkIterations			(256)
+#define SkewInterval				(16)
+#define SkewFactor					(32)
+
+// The number of runs for each configuration (we keep the best one)
+#define TotalRuns					(5)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// The configurations we compare
+struct BenchmarkConfiguration
+{
+	const char* name;
+	Peon::StealSettings stealSettings;
+};
+
+// The measured values of a run
+struct BenchmarkResult
+{
+	double drainMilliseconds = 1e9;
+	uint64_t totalStealAttempts = 0;
+	uint64_t totalSteals = 0;
+};
+
+void JobWork(uint32_t _seed, uint32_t _iterations)
+{
+	volatile uint32_t value = _seed;
+	for (uint32_t i = 0; i < _iterations; i++)
+	{
+		value = value * 1664525u + 1013904223u;
+	}
+}
+
+uint64_t TotalSteals(Peon::Scheduler* _scheduler)
+{
+	return _scheduler->GetTotalSteals(Peon::StealTier::Sibling) + _scheduler->GetTotalSteals(Peon::StealTier::Local) + _scheduler->GetTotalSteals(Peon::StealTier::Remote);
+}
+
+uint64_t TotalStealAttempts(Peon::Scheduler* _scheduler)
+{
+	return _scheduler->GetTotalStealAttempts(Peon::StealTier::Sibling) + _scheduler->GetTotalStealAttempts(Peon::StealTier::Local) +
+		_scheduler->GetTotalStealAttempts(Peon::StealTier::Remote);
+}
+
+// Push all jobs from this thread (worker 0) and measure the time until all of them finish
+BenchmarkResult Measure(Peon::Scheduler* _scheduler)
+{
+	BenchmarkResult best;
+	for (int run = 0; run < TotalRuns; run++)
+	{
+		uint64_t totalSteals = TotalSteals(_scheduler);
+		uint64_t totalStealAttempts = TotalStealAttempts(_scheduler);
+
+		auto begin = BenchmarkClock::now();
+		Peon::Container* container = _scheduler->CreateContainer();
+		for (uint32_t i = 0; i < TotalJobs; i++)
+		{
+			uint32_t iterations = i % SkewInterval == 0 ? JobWorkIterations * SkewFactor : JobWorkIterations;
+			_scheduler->StartJob(_scheduler->CreateChildJob(container, [i, iterations]() { JobWork(i, iterations); }));
+		}
+
+		_scheduler->StartJob(container);
+		_scheduler->WaitForJob(container);
+		auto end = BenchmarkClock::now();
+
+		_scheduler->ResetWorkerFrame();
+
+		double drainMilliseconds = std::chrono::duration<double, std::milli>(end - begin).count();
+		if (drainMilliseconds < best.drainMilliseconds)
+		{
+			best.drainMilliseconds = drainMilliseconds;
+			best.totalSteals = TotalSteals(_scheduler) - totalSteals;
+			best.totalStealAttempts = TotalStealAttempts(_scheduler) - totalStealAttempts;
+		}
+	}
+
+	return best;
+}
+
+int main()
+{
+	unsigned int hardwareThreads = std::max(2u, std::thread::hardware_concurrency());
+
+	// The original behavior, a single random victim for each failed job fetch
+	BenchmarkConfiguration configurations[3];
+	configurations[0].name = "single random victim    ";
+	configurations[0].stealSettings.fullSweep = false;
+	configurations[0].stealSettings.lastVictimAffinity = false;
+	configurations[0].stealSettings.totalSweeps = 1;
+
+	// Sweep all victims, but without affinity or backoff
+	configurations[1].name = "full sweep              ";
+	configurations[1].stealSettings.lastVictimAffinity = false;
+	configurations[1].stealSettings.totalSweeps = 1;
+
+	// The default settings
+	configurations[2].name = "sweep, affinity, backoff";
+
+	printf("Peon steal sweep benchmark (%u jobs pushed by one worker, 1 in %d jobs is %dx longer, best of %d runs)\n", TotalJobs, SkewInterval, SkewFactor, TotalRuns);
+
+	for (unsigned int totalWorkers = 2; ; totalWorkers = std::min(totalWorkers * 2, hardwareThreads))
+	{
+		for (auto& configuration : configurations)
+		{
+			Peon::Scheduler* scheduler = new Peon::Scheduler();
+			scheduler->SetStealSettings(configuration.stealSettings);
+			scheduler->Initialize(totalWorkers, TotalJobs * 2);
+
+			BenchmarkResult result = Measure(scheduler);
+
+			// Release this scheduler (its workers would compete with the next one)
+			delete scheduler;
+
+			double successRate = result.totalStealAttempts > 0 ? 100.0 * result.totalSteals / result.totalStealAttempts : 0.0;
+			printf("workers: %2u | %s | drain %8.3f ms | steal attempts %9llu, steals %7llu (%5.1f%%)\n", totalWorkers, configuration.name, result.drainMilliseconds,
+				(unsigned long long)result.totalStealAttempts, (unsigned long long)result.totalSteals, successRate);
+		}
+
+		if (totalWorkers == hardwareThreads)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,616 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkSuite.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The library version (set by the build)
+#ifndef PeonBenchmarkVersion
+#define PeonBenchmarkVersion		"unknown"
+#endif
+
+// The number of runs for each benchmark (we report the best and the median)
+#define TotalRuns					(7)
+
+// The number of operations for each run
+#define QueueOperations				(1 << 16)
+#define JobOperations				(1 << 14)
+#define WaitOperations				(1 << 12)
+#define AllocatorOperations			(1 << 14)
+
+// The allocations made before freeing them (so the free lists are walked, not just a single hot block)
+#define AllocatorBatchSize			(64)
+
+// The trace events recorded for each job (create, start, begin and end), the ring size used while measuring them (big enough
+// to hold a whole run, so no event is dropped) and the trace file (removed once measured)
+#define TraceEventsPerJob			(4)
+#define TraceRingSize				(1 << 17)
+#define TraceFilePath				"peon_bench_trace.json"
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// A benchmark result (the time of a single operation, in nanoseconds)
+struct BenchmarkResult
+{
+	std::string name;
+	uint64_t operations;
+	double bestNanoseconds;
+	double medianNanoseconds;
+};
+
+// The benchmark context
+struct BenchmarkSuite
+{
+	Peon::Scheduler* scheduler;
+	const char* filter;
+	std::vector<BenchmarkResult> results;
+};
+
+// Return the elapsed time since the given time point (in nanoseconds)
+double ElapsedNanoseconds(BenchmarkClock::time_point _begin)
+{
+	return std::chrono::duration<double, std::nano>(BenchmarkClock::now() - _begin).count();
+}
+
+// Run a benchmark a few times, the function runs all operations once and returns the time they took (in nanoseconds), the
+// frame is reset after each run
+template <typename FunctionType>
+void Run(BenchmarkSuite& _suite, const std::string& _name, uint64_t _operations, FunctionType&& _function)
+{
+	if (_suite.filter != nullptr && _name.find(_suite.filter) == std::string::npos)
+	{
+		return;
+	}
+
+	std::vector<double> times;
+	for (int run = 0; run < TotalRuns; run++)
+	{
+		times.push_back(_function() / double(_operations));
+		_suite.scheduler->ResetWorkerFrame();
+	}
+
+	std::sort(times.begin(), times.end());
+	_suite.results.push_back(BenchmarkResult{ _name, _operations, times.front(), times[times.size() / 2] });
+
+	fprintf(stderr, "%-36s %10.2f ns/op (median %10.2f)\n", _name.c_str(), times.front(), times[times.size() / 2]);
+}
+
+// Empty job function
+void Nothing()
+{
+}
+
+// The work stealing deque on its own (the jobs are only pointers here, they never run)
+void BenchmarkQueue(BenchmarkSuite& _suite)
+{
+	std::unique_ptr<Peon::Job[]> jobs(new Peon::Job[QueueOperations]);
+
+	// The owner pushing and popping (the common path, no thief around)
+	Run(_suite, "queue_push_pop", 2 * QueueOperations, [&]()
+	{
+		__InternalPeon::PeonStealingQueue queue;
+		queue.Initialize(0, 1024);
+
+		auto begin = BenchmarkClock::now();
+		for (uint32_t i = 0; i < QueueOperations; i++)
+		{
+			queue.Push(&jobs[i]);
+		}
+
+		for (uint32_t i = 0; i < QueueOperations; i++)
+		{
+			queue.Pop();
+		}
+
+		return ElapsedNanoseconds(begin);
+	});
+
+	// Stealing from the top (uncontended, the cost of the steal protocol itself)
+	Run(_suite, "queue_push_steal", 2 * QueueOperations, [&]()
+	{
+		__InternalPeon::PeonStealingQueue queue;
+		queue.Initialize(0, 1024);
+
+		auto begin = BenchmarkClock::now();
+		for (uint32_t i = 0; i < QueueOperations; i++)
+		{
+			queue.Push(&jobs[i]);
+		}
+
+		for (uint32_t i = 0; i < QueueOperations; i++)
+		{
+			queue.Steal();
+		}
+
+		return ElapsedNanoseconds(begin);
+	});
+
+	// The owner pushing and popping while thieves steal, until every job was taken (the time for each job)
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	unsigned int totalThieves = std::max(1u, hardwareThreads - 1);
+	for (unsigned int thieves = 1; thieves <= totalThieves; thieves *= 2)
+	{
+		Run(_suite, "queue_contended_" + std::to_string(thieves) + "_thieves", QueueOperations, [&]()
+		{
+			__InternalPeon::PeonStealingQueue queue;
+			queue.Initialize(0, 1024);
+
+			std::atomic<uint32_t> totalTaken(0);
+			std::atomic<bool> running(true);
+			std::vector<std::thread> thiefThreads;
+			for (unsigned int i = 0; i < thieves; i++)
+			{
+				thiefThreads.emplace_back([&]()
+				{
+					while (running.load(std::memory_order_relaxed))
+					{
+						if (queue.Steal() != nullptr)
+						{
+							totalTaken.fetch_add(1, std::memory_order_relaxed);
+						}
+					}
+				});
+			}
+
+			// Push in small bursts and take half of each one back
+			auto begin = BenchmarkClock::now();
+			uint32_t totalPopped = 0;
+			for (uint32_t i = 0; i < QueueOperations; i += 64)
+			{
+				for (uint32_t j = i; j < std::min(i + 64, uint32_t(QueueOperations)); j++)
+				{
+					queue.Push(&jobs[j]);
+				}
+
+				for (uint32_t j = 0; j < 32; j++)
+				{
+					totalPopped += queue.Pop() != nullptr ? 1 : 0;
+				}
+			}
+
+			while (queue.Pop() != nullptr)
+			{
+				totalPopped++;
+			}
+
+			while (totalPopped + totalTaken.load(std::memory_order_relaxed) < QueueOperations)
+			{
+				std::this_thread::yield();
+			}
+
+			double elapsedTime = ElapsedNanoseconds(begin);
+
+			running.store(false, std::memory_order_relaxed);
+			for (auto& thiefThread : thiefThreads)
+			{
+				thiefThread.join();
+			}
+
+			return elapsedTime;
+		});
+	}
+}
+
+// Creating and starting jobs
+void BenchmarkJobs(BenchmarkSuite& _suite)
+{
+	Peon::Scheduler* scheduler = _suite.scheduler;
+	std::vector<Peon::Job*> jobs(JobOperations);
+
+	// Creating root jobs (never started, the frame reset drops them)
+	Run(_suite, "create_job", JobOperations, [&]()
+	{
+		auto begin = BenchmarkClock::now();
+		for (uint32_t i = 0; i < JobOperations; i++)
+		{
+			jobs[i] = scheduler->CreateJob(&Nothing);
+		}
+
+		return ElapsedNanoseconds(begin);
+	});
+
+	// Creating children (the parent counter is incremented for each one)
+	Run(_suite, "create_child_job", JobOperations, [&]()
+	{
+		Peon::Container* container = scheduler->CreateContainer();
+
+		auto begin = BenchmarkClock::now();
+		for (uint32_t i = 0; i < JobOperations; i++)
+		{
+			jobs[i] = scheduler->CreateChildJob(container, &Nothing);
+		}
+
+		return ElapsedNanoseconds(begin);
+	});
+
+	// Starting the children (the other workers are already stealing them)
+	Run(_suite, "start_job", JobOperations, [&]()
+	{
+		Peon::Container* container = scheduler->CreateContainer();
+		for (uint32_t i = 0; i < JobOperations; i++)
+		{
+			jobs[i] = scheduler->CreateChildJob(container, &Nothing);
+		}
+
+		auto begin = BenchmarkClock::now();
+		for (uint32_t i = 0; i < JobOperations; i++)
+		{
+			scheduler->StartJob(jobs[i]);
+		}
+
+		double elapsedTime = ElapsedNanoseconds(begin);
+
+		scheduler->StartJob(container);
+		scheduler->WaitForJob(container);
+
+		return elapsedTime;
+	});
+
+	// Everything, create, start, run and wait for the whole batch
+	Run(_suite, "create_start_wait", JobOperations, [&]()
+	{
+		auto begin = BenchmarkClock::now();
+
+		Peon::Container* container = scheduler->CreateContainer();
+		for (uint32_t i = 0; i < JobOperations; i++)
+		{
+			scheduler->StartJob(scheduler->CreateChildJob(container, &Nothing));
+		}
+
+		scheduler->StartJob(container);
+		scheduler->WaitForJob(container);
+
+		return ElapsedNanoseconds(begin);
+	});
+}
+
+// The cost of recording trace events, the same create, start and wait batch without and with a trace running
+void BenchmarkTrace(BenchmarkSuite& _suite)
+{
+	Peon::Scheduler* scheduler = _suite.scheduler;
+
+	auto CreateStartWait = [&]()
+	{
+		auto begin = BenchmarkClock::now();
+
+		Peon::Container* container = scheduler->CreateContainer();
+		for (uint32_t i = 0; i < JobOperations; i++)
+		{
+			scheduler->StartJob(scheduler->CreateChildJob(container, &Nothing));
+		}
+
+		scheduler->StartJob(container);
+		scheduler->WaitForJob(container);
+
+		// Write the events outside of the measured time (the ring only has to hold a single run)
+		double elapsedTime = ElapsedNanoseconds(begin);
+		scheduler->FlushTrace();
+
+		return elapsedTime;
+	};
+
+	size_t totalResults = _suite.results.size();
+	Run(_suite, "create_start_wait_trace_off", JobOperations, CreateStartWait);
+	if (_suite.results.size() == totalResults)
+	{
+		return;
+	}
+
+	// The trace is streamed to a file while measuring (the writer thread runs like in a real capture)
+	Peon::TraceSettings traceSettings;
+	traceSettings.ringSize = TraceRingSize;
+	if (!scheduler->StartTrace(TraceFilePath, traceSettings))
+	{
+		fprintf(stderr, "%-36s skipped (the tracing is compiled out or the trace file can't be written)\n", "create_start_wait_trace_on");
+		return;
+	}
+
+	Run(_suite, "create_start_wait_trace_on", JobOperations, CreateStartWait);
+	scheduler->StopTrace();
+	remove(TraceFilePath);
+
+	// The cost of each event is the difference spread over the events of a job (both best times)
+	const BenchmarkResult& traceOff = _suite.results[_suite.results.size() - 2];
+	const BenchmarkResult& traceOn = _suite.results[_suite.results.size() - 1];
+	double bestNanoseconds = (traceOn.bestNanoseconds - traceOff.bestNanoseconds) / TraceEventsPerJob;
+	double medianNanoseconds = (traceOn.medianNanoseconds - traceOff.medianNanoseconds) / TraceEventsPerJob;
+	_suite.results.push_back(BenchmarkResult{ "trace_event", uint64_t(JobOperations) * TraceEventsPerJob, bestNanoseconds, medianNanoseconds });
+
+	fprintf(stderr, "%-36s %10.2f ns/op (median %10.2f), %llu dropped events\n", "trace_event", bestNanoseconds, medianNanoseconds,
+		(unsigned long long)scheduler->GetTraceDroppedEvents());
+}
+
+// The time from starting a job to the waiter seeing it finished
+void BenchmarkWait(BenchmarkSuite& _suite)
+{
+	Peon::Scheduler* scheduler = _suite.scheduler;
+
+	// A worker waiting for its own job (it usually runs the job itself)
+	Run(_suite, "wait_for_job_worker", WaitOperations, [&]()
+	{
+		auto begin = BenchmarkClock::now();
+		for (uint32_t i = 0; i < WaitOperations; i++)
+		{
+			Peon::Job* job = scheduler->CreateJob(&Nothing);
+			scheduler->StartJob(job);
+			scheduler->WaitForJob(job);
+		}
+
+		return ElapsedNanoseconds(begin);
+	});
+
+	// A thread that isn't a worker, the job goes through an injector and a worker runs it (we keep waiting for a gate job
+	// that is only started at the end, so this thread runs jobs too, it's worker 0)
+	Run(_suite, "wait_for_job_external", WaitOperations, [&]()
+	{
+		Peon::Container* gate = scheduler->CreateContainer();
+		Peon::Job* gateRelease = scheduler->CreateChildJob(gate, &Nothing);
+		double elapsedTime = 0;
+
+		std::thread externalThread([&]()
+		{
+			auto begin = BenchmarkClock::now();
+			for (uint32_t i = 0; i < WaitOperations; i++)
+			{
+				Peon::Job* job = scheduler->CreateJob(&Nothing);
+				scheduler->StartJob(job);
+				scheduler->WaitForJob(job);
+			}
+
+			elapsedTime = ElapsedNanoseconds(begin);
+
+			scheduler->StartJob(gateRelease);
+		});
+
+		scheduler->StartJob(gate);
+		scheduler->WaitForJob(gate);
+		externalThread.join();
+
+		return elapsedTime;
+	});
+}
+
+// The worker memory allocator (used by the job functions and results that don't fit inside a job)
+void BenchmarkAllocator(BenchmarkSuite& _suite)
+{
+	Peon::Worker* worker = _suite.scheduler->GetCurrentWorker();
+	__InternalPeon::PeonMemoryAllocator& allocator = worker->GetMemoryAllocator();
+	std::vector<char*> blocks(AllocatorOperations);
+
+	// Allocate a batch and free it (for each size class, the time for each allocation and free pair)
+	for (uint32_t size = 16; size <= 65536; size *= 4)
+	{
+		Run(_suite, "allocator_" + std::to_string(size), AllocatorOperations, [&]()
+		{
+			auto begin = BenchmarkClock::now();
+			for (uint32_t i = 0; i < AllocatorOperations; i += AllocatorBatchSize)
+			{
+				for (uint32_t j = 0; j < AllocatorBatchSize; j++)
+				{
+					blocks[j] = allocator.AllocateData(worker, size);
+				}
+
+				for (uint32_t j = 0; j < AllocatorBatchSize; j++)
+				{
+					allocator.DeallocateData(blocks[j]);
+				}
+			}
+
+			return ElapsedNanoseconds(begin);
+		});
+	}
+
+	// Blocks freed by another thread, they go into our remote list and we take them back later (both sides are measured, the
+	// time for each block)
+	for (uint32_t size : { 64u, 4096u })
+	{
+		Run(_suite, "allocator_remote_free_" + std::to_string(size), AllocatorOperations, [&]()
+		{
+			for (uint32_t i = 0; i < AllocatorOperations; i++)
+			{
+				blocks[i] = allocator.AllocateData(worker, size);
+			}
+
+			double elapsedTime = 0;
+			std::thread remoteThread([&]()
+			{
+				auto begin = BenchmarkClock::now();
+				for (uint32_t i = 0; i < AllocatorOperations; i++)
+				{
+					__InternalPeon::PeonMemoryAllocator::DeallocateExternalData(blocks[i]);
+				}
+
+				elapsedTime = ElapsedNanoseconds(begin);
+			});
+
+			remoteThread.join();
+			worker->RefreshMemoryAllocator();
+
+			return elapsedTime;
+		});
+
+		Run(_suite, "allocator_remote_reclaim_" + std::to_string(size), AllocatorOperations, [&]()
+		{
+			for (uint32_t i = 0; i < AllocatorOperations; i++)
+			{
+				blocks[i] = allocator.AllocateData(worker, size);
+			}
+
+			std::thread remoteThread([&]()
+			{
+				for (uint32_t i = 0; i < AllocatorOperations; i++)
+				{
+					__InternalPeon::PeonMemoryAllocator::DeallocateExternalData(blocks[i]);
+				}
+			});
+
+			remoteThread.join();
+
+			auto begin = BenchmarkClock::now();
+			worker->RefreshMemoryAllocator();
+
+			return ElapsedNanoseconds(begin);
+		});
+	}
+}
+
+// Releasing the dependants when a job finishes (the time for each released job, running it included)
+void BenchmarkDependencies(BenchmarkSuite& _suite)
+{
+	Peon::Scheduler* scheduler = _suite.scheduler;
+
+	// A job with many dependants (a fan out), the graphs are built before measuring
+	for (uint32_t totalDependants : { 1u, 16u, 256u })
+	{
+		uint32_t totalGraphs = JobOperations / totalDependants;
+		Run(_suite, "finish_release_" + std::to_string(totalDependants), JobOperations, [&]()
+		{
+			Peon::Container* container = scheduler->CreateContainer();
+			std::vector<Peon::Job*> predecessors(totalGraphs);
+			for (uint32_t i = 0; i < totalGraphs; i++)
+			{
+				predecessors[i] = scheduler->CreateChildJob(container, &Nothing);
+				for (uint32_t j = 0; j < totalDependants; j++)
+				{
+					scheduler->AddJobDependency(predecessors[i], scheduler->CreateChildJob(container, &Nothing));
+				}
+			}
+
+			auto begin = BenchmarkClock::now();
+			for (Peon::Job* predecessor : predecessors)
+			{
+				scheduler->StartJob(predecessor);
+			}
+
+			scheduler->StartJob(container);
+			scheduler->WaitForJob(container);
+
+			return ElapsedNanoseconds(begin);
+		});
+	}
+
+	// A chain, each job only starts when the previous one finishes (no parallelism, the release latency)
+	Run(_suite, "finish_chain", JobOperations, [&]()
+	{
+		Peon::Container* container = scheduler->CreateContainer();
+		Peon::Job* first = scheduler->CreateChildJob(container, &Nothing);
+		Peon::Job* previous = first;
+		for (uint32_t i = 1; i < JobOperations; i++)
+		{
+			Peon::Job* next = scheduler->CreateChildJob(container, &Nothing);
+			scheduler->AddJobDependency(previous, next);
+			previous = next;
+		}
+
+		auto begin = BenchmarkClock::now();
+		scheduler->StartJob(first);
+		scheduler->StartJob(container);
+		scheduler->WaitForJob(container);
+
+		return ElapsedNanoseconds(begin);
+	});
+}
+
+// Write the results as json
+void WriteResults(FILE* _file, const BenchmarkSuite& _suite, unsigned int _totalWorkers)
+{
+	fprintf(_file, "{\n");
+	fprintf(_file, "  \"benchmark\": \"peon_bench\",\n");
+	fprintf(_file, "  \"version\": \"%s\",\n", PeonBenchmarkVersion);
+	fprintf(_file, "  \"workers\": %u,\n", _totalWorkers);
+	fprintf(_file, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+	fprintf(_file, "  \"statistics\": %s,\n", PeonStatisticsEnabled ? "true" : "false");
+	fprintf(_file, "  \"trace\": %s,\n", PeonTraceEnabled ? "true" : "false");
+	fprintf(_file, "  \"runs\": %d,\n", TotalRuns);
+	fprintf(_file, "  \"unit\": \"ns/op\",\n");
+	fprintf(_file, "  \"results\": [");
+	for (size_t i = 0; i < _suite.results.size(); i++)
+	{
+		const BenchmarkResult& result = _suite.results[i];
+		fprintf(_file, "%s\n    { \"name\": \"%s\", \"operations\": %llu, \"best\": %.3f, \"median\": %.3f }", i == 0 ? "" : ",",
+			result.name.c_str(), (unsigned long long)result.operations, result.bestNanoseconds, result.medianNanoseconds);
+	}
+
+	fprintf(_file, "\n  ]\n}\n");
+}
+
+int main(int _argc, char** _argv)
+{
+	// The options, the json goes to the standard output unless a file is given, the progress always goes to the error output
+	const char* outputPath = nullptr;
+	const char* filter = nullptr;
+	unsigned int totalWorkers = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 1; i < _argc; i++)
+	{
+		if (strcmp(_argv[i], "--output") == 0 && i + 1 < _argc)
+		{
+			outputPath = _argv[++i];
+		}
+		else if (strcmp(_argv[i], "--filter") == 0 && i + 1 < _argc)
+		{
+			filter = _argv[++i];
+		}
+		else if (strcmp(_argv[i], "--workers") == 0 && i + 1 < _argc)
+		{
+			totalWorkers = std::max(1, atoi(_argv[++i]));
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [--output file.json] [--filter name] [--workers count]\n", _argv[0]);
+			return 1;
+		}
+	}
+
+	Peon::Scheduler* scheduler = new Peon::Scheduler();
+	scheduler->Initialize(totalWorkers, 1 << 18);
+
+	fprintf(stderr, "Peon benchmark suite %s (%u workers, best of %d runs)\n", PeonBenchmarkVersion, totalWorkers, TotalRuns);
+
+	BenchmarkSuite suite = { scheduler, filter, {} };
+	BenchmarkQueue(suite);
+	BenchmarkJobs(suite);
+	BenchmarkWait(suite);
+	BenchmarkAllocator(suite);
+	BenchmarkDependencies(suite);
+	BenchmarkTrace(suite);
+
+	delete scheduler;
+
+	FILE* outputFile = outputPath != nullptr ? fopen(outputPath, "w") : stdout;
+	if (outputFile == nullptr)
+	{
+		fprintf(stderr, "Can't write %s\n", outputPath);
+		return 1;
+	}
+
+	WriteResults(outputFile, suite, totalWorkers);
+	if (outputFile != stdout)
+	{
+		fclose(outputFile);
+	}
+
+	return 0;
+}
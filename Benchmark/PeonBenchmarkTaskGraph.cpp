@@ -0,0 +1,246 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkTaskGraph.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The fan-out shape from the Peon.cpp demo: each primary job has this many dependant jobs
+#define TotalDependantJobs			(4)
+#define TotalPrimaryJobs			(4096)
+
+// The layered shape: each node depends on two nodes from the previous layer
+#define TotalLayers					(64)
+#define TotalNodesPerLayer			(256)
+
+// The number of frames we run for each worker count (we keep the best one)
+#define TotalFrames					(30)
+
+// The amount of work done by each node
+#define JobWorkIterations			(64)
+
+// The replays checked before measuring
+#define TotalCheckedReplays			(100)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+void JobWork(uint32_t _seed)
+{
+	volatile uint32_t value = _seed;
+	for (int i = 0; i < JobWorkIterations; i++)
+	{
+		value = value * 1664525u + 1013904223u;
+	}
+}
+
+// Build the fan-out shape using jobs (each frame)
+void BuildFanOutJobs(Peon::Scheduler* _scheduler)
+{
+	Peon::Container* container = _scheduler->CreateContainer();
+	for (uint32_t i = 0; i < TotalPrimaryJobs; i++)
+	{
+		Peon::Job* primaryJob = _scheduler->CreateChildJob(container, [i]() { JobWork(i); });
+		for (uint32_t j = 0; j < TotalDependantJobs; j++)
+		{
+			Peon::Job* dependantJob = _scheduler->CreateChildJob(container, [i, j]() { JobWork(i + j); });
+			_scheduler->AddJobDependency(primaryJob, dependantJob);
+		}
+
+		_scheduler->StartJob(primaryJob);
+	}
+
+	_scheduler->StartJob(container);
+	_scheduler->WaitForJob(container);
+}
+
+// Build the fan-out shape as a task graph (once)
+void BuildFanOutGraph(Peon::TaskGraph& _taskGraph)
+{
+	for (uint32_t i = 0; i < TotalPrimaryJobs; i++)
+	{
+		Peon::TaskGraph::NodeId primaryNode = _taskGraph.AddNode([i]() { JobWork(i); });
+		for (uint32_t j = 0; j < TotalDependantJobs; j++)
+		{
+			_taskGraph.AddDependency(primaryNode, _taskGraph.AddNode([i, j]() { JobWork(i + j); }));
+		}
+	}
+
+	_taskGraph.Compile();
+}
+
+// Build the layered shape using jobs (each frame), the jobs from the first layer are started after all dependencies are set
+void BuildLayeredJobs(Peon::Scheduler* _scheduler)
+{
+	Peon::Container* container = _scheduler->CreateContainer();
+	std::vector<Peon::Job*> jobs(TotalLayers * TotalNodesPerLayer);
+	for (uint32_t layer = 0; layer < TotalLayers; layer++)
+	{
+		for (uint32_t i = 0; i < TotalNodesPerLayer; i++)
+		{
+			uint32_t index = layer * TotalNodesPerLayer + i;
+			jobs[index] = _scheduler->CreateChildJob(container, [index]() { JobWork(index); });
+			if (layer > 0)
+			{
+				uint32_t previousLayer = (layer - 1) * TotalNodesPerLayer;
+				_scheduler->AddJobDependency({ jobs[previousLayer + i], jobs[previousLayer + (i + 1) % TotalNodesPerLayer] }, jobs[index]);
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < TotalNodesPerLayer; i++)
+	{
+		_scheduler->StartJob(jobs[i]);
+	}
+
+	_scheduler->StartJob(container);
+	_scheduler->WaitForJob(container);
+}
+
+// Build the layered shape as a task graph (once)
+void BuildLayeredGraph(Peon::TaskGraph& _taskGraph)
+{
+	for (uint32_t layer = 0; layer < TotalLayers; layer++)
+	{
+		for (uint32_t i = 0; i < TotalNodesPerLayer; i++)
+		{
+			uint32_t index = layer * TotalNodesPerLayer + i;
+			Peon::TaskGraph::NodeId node = _taskGraph.AddNode([index]() { JobWork(index); });
+			if (layer > 0)
+			{
+				uint32_t previousLayer = (layer - 1) * TotalNodesPerLayer;
+				_taskGraph.AddDependency(previousLayer + i, node);
+				_taskGraph.AddDependency(previousLayer + (i + 1) % TotalNodesPerLayer, node);
+			}
+		}
+	}
+
+	_taskGraph.Compile();
+}
+
+// Replay a layered graph where the first node releases the whole second layer (more successors than a single start batch),
+// every node checks that its predecessors ran in the same replay, return false if a replay skips, repeats or reorders a node
+bool CheckReplays(Peon::Scheduler* _scheduler)
+{
+	Peon::TaskGraph taskGraph;
+	std::vector<uint32_t> nodeReplays(TotalLayers * TotalNodesPerLayer, 0);
+	std::atomic<bool> failed = { false };
+	uint32_t replay = 0;
+	for (uint32_t layer = 0; layer < TotalLayers; layer++)
+	{
+		for (uint32_t i = 0; i < TotalNodesPerLayer; i++)
+		{
+			uint32_t index = layer * TotalNodesPerLayer + i;
+			uint32_t previousLayer = (layer - 1) * TotalNodesPerLayer;
+			uint32_t firstPredecessor = previousLayer + i;
+			uint32_t secondPredecessor = layer == 1 ? 0 : previousLayer + (i + 1) % TotalNodesPerLayer;
+			Peon::TaskGraph::NodeId node = taskGraph.AddNode([&, index, layer, firstPredecessor, secondPredecessor]()
+			{
+				if (nodeReplays[index] != replay || (layer > 0 && (nodeReplays[firstPredecessor] != replay + 1 || nodeReplays[secondPredecessor] != replay + 1)))
+				{
+					failed = true;
+				}
+
+				nodeReplays[index] = replay + 1;
+			});
+
+			if (layer > 0)
+			{
+				taskGraph.AddDependency(firstPredecessor, node);
+				taskGraph.AddDependency(secondPredecessor, node);
+			}
+		}
+	}
+
+	for (replay = 0; replay < TotalCheckedReplays && !failed; replay++)
+	{
+		if (!taskGraph.Execute(_scheduler) || std::count(nodeReplays.begin(), nodeReplays.end(), replay + 1) != (long)nodeReplays.size())
+		{
+			failed = true;
+		}
+
+		_scheduler->ResetWorkerFrame();
+	}
+
+	return !failed;
+}
+
+// Run the method for a few frames and return the best time per node (in nanoseconds)
+template <typename FrameMethod>
+double Measure(Peon::Scheduler* _scheduler, uint32_t _totalNodes, FrameMethod _frameMethod)
+{
+	double best = 1e9;
+	for (int frame = 0; frame < TotalFrames; frame++)
+	{
+		auto begin = BenchmarkClock::now();
+		_frameMethod();
+		auto end = BenchmarkClock::now();
+
+		_scheduler->ResetWorkerFrame();
+
+		best = std::min(best, std::chrono::duration<double, std::nano>(end - begin).count() / _totalNodes);
+	}
+
+	return best;
+}
+
+int main()
+{
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	const uint32_t totalFanOutNodes = TotalPrimaryJobs * (TotalDependantJobs + 1);
+	const uint32_t totalLayeredNodes = TotalLayers * TotalNodesPerLayer;
+
+	// The graphs are built once
+	Peon::TaskGraph fanOutGraph;
+	Peon::TaskGraph layeredGraph;
+	BuildFanOutGraph(fanOutGraph);
+	BuildLayeredGraph(layeredGraph);
+
+	printf("Peon task graph benchmark (fan-out: %u nodes, layered: %u nodes, best of %d frames)\n", totalFanOutNodes, totalLayeredNodes, TotalFrames);
+
+	for (unsigned int totalWorkers = 1; ; totalWorkers = std::min(totalWorkers * 2, hardwareThreads))
+	{
+		Peon::Scheduler* scheduler = new Peon::Scheduler();
+		scheduler->Initialize(totalWorkers, totalFanOutNodes * 2);
+
+		if (!CheckReplays(scheduler))
+		{
+			printf("workers: %2u | a task graph replay didn't run every node once in order!\n", totalWorkers);
+			return 1;
+		}
+
+		double fanOutJobs = Measure(scheduler, totalFanOutNodes, [&]() { BuildFanOutJobs(scheduler); });
+		double fanOutGraphTime = Measure(scheduler, totalFanOutNodes, [&]() { fanOutGraph.Execute(scheduler); });
+		double layeredJobs = Measure(scheduler, totalLayeredNodes, [&]() { BuildLayeredJobs(scheduler); });
+		double layeredGraphTime = Measure(scheduler, totalLayeredNodes, [&]() { layeredGraph.Execute(scheduler); });
+
+		// Release this scheduler (its workers would compete with the next one)
+		delete scheduler;
+
+		printf("workers: %2u | fan-out: rebuild %7.2f ns/node, replay %7.2f ns/node | layered: rebuild %7.2f ns/node, replay %7.2f ns/node\n",
+			totalWorkers, fanOutJobs, fanOutGraphTime, layeredJobs, layeredGraphTime);
+
+		if (totalWorkers == hardwareThreads)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,143 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonBenchmarkTopology.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+//////////////
+// INCLUDES //
+//////////////
+#include "Peon.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The array size (in 64 bit values, big enough to not fit in the last level cache) and the chunk processed by each call
+#define TotalValues					(1 << 24)
+#define ChunkValues					(1 << 13)
+
+// The number of passes over the array for each configuration (we keep the best one)
+#define TotalPasses					(10)
+
+/////////////
+// METHODS //
+/////////////
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+// The configurations we compare
+struct BenchmarkConfiguration
+{
+	const char* name;
+	bool pinWorkers;
+	bool hierarchicalStealing;
+};
+
+// Sum a chunk (the memory bandwidth is the bottleneck)
+PeonNoInline uint64_t SumChunk(const uint64_t* _values, size_t _begin, size_t _end)
+{
+	uint64_t sum = 0;
+	for (size_t i = _begin; i < _end; i++)
+	{
+		sum += _values[i];
+	}
+
+	return sum;
+}
+
+// Run the passes and return the best bandwidth (in GB/s)
+double Measure(Peon::Scheduler* _scheduler, uint64_t* _values)
+{
+	std::atomic<uint64_t> total = { 0 };
+	double best = 0;
+	for (int pass = 0; pass < TotalPasses; pass++)
+	{
+		auto begin = BenchmarkClock::now();
+		_scheduler->ParallelFor(size_t(0), size_t(TotalValues), [&](size_t _begin, size_t _end)
+		{
+			total.fetch_add(SumChunk(_values, _begin, _end), std::memory_order_relaxed);
+		}, size_t(ChunkValues));
+		auto end = BenchmarkClock::now();
+
+		_scheduler->ResetWorkerFrame();
+
+		double seconds = std::chrono::duration<double>(end - begin).count();
+		best = std::max(best, TotalValues * sizeof(uint64_t) / seconds / 1e9);
+	}
+
+	// Keep the sums alive
+	if (total.load() == 1)
+	{
+		printf("!");
+	}
+
+	return best;
+}
+
+int main()
+{
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	const BenchmarkConfiguration configurations[] =
+	{
+		{ "unpinned, random steal  ", false, false },
+		{ "pinned, random steal    ", true, false },
+		{ "pinned, hierarchical    ", true, true },
+	};
+
+	// Print the detected topology
+	Peon::Topology topology;
+	bool detected = topology.Detect();
+	printf("Peon topology benchmark (%u MB array, %u cpus, %u packages, %u nodes%s)\n", unsigned(TotalValues * sizeof(uint64_t) >> 20),
+		topology.GetTotalCpus(), topology.GetTotalPackages(), topology.GetTotalNodes(), detected ? "" : ", flat layout");
+
+	for (unsigned int totalWorkers = 1; ; totalWorkers = std::min(totalWorkers * 2, hardwareThreads))
+	{
+		for (auto& configuration : configurations)
+		{
+			Peon::TopologySettings topologySettings;
+			topologySettings.pinWorkers = configuration.pinWorkers;
+			topologySettings.hierarchicalStealing = configuration.hierarchicalStealing;
+
+			Peon::Scheduler* scheduler = new Peon::Scheduler();
+			scheduler->SetTopologySettings(topologySettings);
+			scheduler->Initialize(totalWorkers, 4096);
+
+			// Touch the array from the workers (each chunk lands on the node of the worker that touched it first)
+			std::unique_ptr<uint64_t[]> values(new uint64_t[TotalValues]);
+			scheduler->ParallelFor(size_t(0), size_t(TotalValues), [&](size_t _begin, size_t _end)
+			{
+				for (size_t i = _begin; i < _end; i++)
+				{
+					values[i] = i;
+				}
+			}, size_t(ChunkValues));
+			scheduler->ResetWorkerFrame();
+
+			double bandwidth = Measure(scheduler, values.get());
+
+			printf("workers: %2u | %s | %7.2f GB/s | steals: sibling %8llu, local %8llu, remote %8llu\n", totalWorkers, configuration.name, bandwidth,
+				(unsigned long long)scheduler->GetTotalSteals(Peon::StealTier::Sibling), (unsigned long long)scheduler->GetTotalSteals(Peon::StealTier::Local),
+				(unsigned long long)scheduler->GetTotalSteals(Peon::StealTier::Remote));
+
+			// Release this scheduler (its workers would compete with the next one)
+			delete scheduler;
+
+			// The main thread was pinned as worker 0, let it run anywhere again
+			topology.UnpinCurrentThread();
+		}
+
+		if (totalWorkers == hardwareThreads)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -10,6 +10,9 @@
 #include "PeonSystem.h"
 #include "PeonWorker.h"
 #include "PeonJob.h"
+#include "PeonAlgorithms.h"
+#include "PeonTaskGraph.h"
+#include "PeonTask.h"
 
 /////////////
 // DEFINES //
@@ -30,9 +33,34 @@ typedef __InternalPeon::PeonWorker		Worker;
 typedef __InternalPeon::PeonJob			Job;
 typedef __InternalPeon::Container		Container;
 typedef __InternalPeon::PeonSystem		Scheduler;
+typedef __InternalPeon::PeonIdlePolicy	IdlePolicy;
+typedef __InternalPeon::PeonIdleSettings	IdleSettings;
+typedef __InternalPeon::PeonJobStorageMode	JobStorageMode;
+typedef __InternalPeon::PeonJobPriority		JobPriority;
+typedef __InternalPeon::PeonLaneStatistics	LaneStatistics;
+typedef __InternalPeon::PeonParallelPolicy	ParallelPolicy;
+typedef __InternalPeon::PeonTaskGraph		TaskGraph;
+typedef __InternalPeon::PeonTopology		Topology;
+typedef __InternalPeon::PeonTopologySettings	TopologySettings;
+typedef __InternalPeon::PeonStealTier		StealTier;
+typedef __InternalPeon::PeonStealSettings	StealSettings;
+typedef __InternalPeon::PeonAutoScaleSettings	AutoScaleSettings;
+typedef __InternalPeon::PeonFiberSettings	FiberSettings;
+typedef __InternalPeon::PeonCancellationToken	CancellationToken;
+typedef __InternalPeon::PeonStatistics		Statistics;
+typedef __InternalPeon::PeonWorkerStatistics	WorkerStatistics;
+typedef __InternalPeon::PeonTraceSettings		TraceSettings;
 
 template <typename TypeClass>
 using Allocator = __InternalPeon::PeonAllocator<TypeClass>;
 
+template <typename ResultType>
+using Future = __InternalPeon::PeonFuture<ResultType>;
+
+#ifdef PeonCoroutinesSupported
+template <typename ResultType = void>
+using Task = __InternalPeon::PeonTask<ResultType>;
+#endif
+
 // Peon
 PeonNamespaceEnd(Peon)
@@ -0,0 +1,589 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonAlgorithms.h
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+//////////////
+// INCLUDES //
+//////////////
+#include "PeonConfig.h"
+#include "PeonSystem.h"
+#include "PeonWorker.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+/////////////
+// DEFINES //
+/////////////
+
+// Ranges smaller than this are sorted (and merged) using the sequential algorithms
+#ifndef PeonParallelSortCutoff
+#define PeonParallelSortCutoff (2048)
+#endif
+
+// The number of chunks we try to create for each worker when the policy doesn't set a grain size
+#define PeonParallelChunksPerWorker (16)
+
+////////////
+// GLOBAL //
+////////////
+
+///////////////
+// NAMESPACE //
+///////////////
+
+// __InternalPeon
+PeonNamespaceBegin(__InternalPeon)
+
+// The parallel execution policy, all algorithms using it run on the scheduler workers (the calling thread helps)
+struct PeonParallelPolicy
+{
+	// The scheduler that will run the algorithm
+	PeonSystem* scheduler;
+
+	// The minimum number of elements processed by each job (0 selects it from the range size and the number of workers)
+	std::size_t grainSize;
+};
+
+// Raw scratch memory taken from a worker memory allocator (released back to it when destroyed, a null worker uses the heap)
+template <typename ObjectType>
+class PeonScratchBuffer
+{
+public:
+	PeonScratchBuffer(PeonWorker* _worker, std::size_t _totalObjects) : m_Worker(_worker), m_TotalObjects(_totalObjects), m_Constructed(false)
+	{
+		// Reserve space to align the data (the allocator only aligns to the block header)
+		std::size_t totalBytes = _totalObjects * sizeof(ObjectType) + alignof(ObjectType);
+
+		// The allocator works with 32 bits block sizes, huge buffers (and threads that aren't workers) go directly to the heap
+		if (m_Worker != nullptr && totalBytes < (std::size_t(1) << 30))
+		{
+			m_RawData = m_Worker->GetMemoryAllocator().AllocateData(m_Worker, (uint32_t)totalBytes);
+			if (m_RawData == nullptr)
+			{
+				throw std::bad_alloc();
+			}
+		}
+		else
+		{
+			m_RawData = (char*)::operator new(totalBytes);
+			m_Worker = nullptr;
+		}
+
+		// Align the data
+		void* alignedData = m_RawData;
+		std::align(alignof(ObjectType), _totalObjects * sizeof(ObjectType), alignedData, totalBytes);
+		m_Data = (ObjectType*)alignedData;
+	}
+
+	PeonScratchBuffer(const PeonScratchBuffer&) = delete;
+	PeonScratchBuffer& operator=(const PeonScratchBuffer&) = delete;
+
+	~PeonScratchBuffer()
+	{
+		// Destroy the objects (if they were constructed)
+		if (m_Constructed)
+		{
+			for (std::size_t i = 0; i < m_TotalObjects; i++)
+			{
+				m_Data[i].~ObjectType();
+			}
+		}
+
+		// Give the memory back
+		if (m_Worker != nullptr)
+		{
+			m_Worker->GetMemoryAllocator().DeallocateData(m_RawData);
+		}
+		else
+		{
+			::operator delete(m_RawData);
+		}
+	}
+
+	// Default construct all objects
+	void ConstructDefault()
+	{
+		for (std::size_t i = 0; i < m_TotalObjects; i++)
+		{
+			new (&m_Data[i]) ObjectType();
+		}
+
+		m_Constructed = true;
+	}
+
+	// Let the buffer know that all objects were constructed by the caller (they will be destroyed with the buffer)
+	void SetConstructed()
+	{
+		m_Constructed = true;
+	}
+
+	// Return the data
+	ObjectType* GetData()
+	{
+		return m_Data;
+	}
+
+	// Access an object
+	ObjectType& operator[](std::size_t _index)
+	{
+		return m_Data[_index];
+	}
+
+private:
+
+	// The worker that owns the memory (nullptr if it came from the heap)
+	PeonWorker* m_Worker;
+
+	// The allocated and the aligned data
+	char* m_RawData;
+	ObjectType* m_Data;
+
+	// The number of objects and if they were constructed
+	std::size_t m_TotalObjects;
+	bool m_Constructed;
+};
+
+// A partial result for each worker (on its own cache line)
+template <typename ValueType>
+struct alignas(PeonCacheLineSize) PeonPartialResult
+{
+	std::optional<ValueType> value;
+};
+
+// Return the grain size used for the given number of elements
+inline std::ptrdiff_t GetParallelGrainSize(const PeonParallelPolicy& _policy, std::ptrdiff_t _totalElements)
+{
+	if (_policy.grainSize != 0)
+	{
+		return (std::ptrdiff_t)_policy.grainSize;
+	}
+
+	std::ptrdiff_t totalChunks = (std::ptrdiff_t)_policy.scheduler->GetTotalWorkers() * PeonParallelChunksPerWorker;
+	return std::max(std::ptrdiff_t(1), _totalElements / totalChunks);
+}
+
+// Run both functions, the first one can be taken by an idle worker while we run the second one
+template <typename FirstFunctionType, typename SecondFunctionType>
+void ParallelInvoke(PeonSystem* _system, FirstFunctionType&& _first, SecondFunctionType&& _second)
+{
+	// Nobody to help us
+	if (!_system->HasIdleWorkers())
+	{
+		_first();
+		_second();
+		return;
+	}
+
+	Container* container = _system->CreateContainer();
+	_system->RetainJob(container);
+
+	_system->StartJob(_system->CreateChildJob(container, [&_first]() { _first(); }));
+	_second();
+
+	_system->StartJob(container);
+	_system->WaitForJob(container);
+	_system->ReleaseJob(container);
+}
+
+// Reduce the transformed value of each index in a chunk (must not be empty)
+template <typename ValueType, typename ReduceOperation, typename IndexTransform>
+PeonNoInline ValueType TransformReduceChunk(std::ptrdiff_t _begin, std::ptrdiff_t _end, ReduceOperation& _reduceOperation, IndexTransform& _indexTransform)
+{
+	ValueType value = _indexTransform(_begin);
+	for (std::ptrdiff_t i = _begin + 1; i < _end; i++)
+	{
+		value = _reduceOperation(std::move(value), _indexTransform(i));
+	}
+
+	return value;
+}
+
+// Reduce the transformed value of each index, the partial results are combined in any order (like std::reduce)
+template <typename ValueType, typename ReduceOperation, typename IndexTransform>
+ValueType ParallelTransformReduce(const PeonParallelPolicy& _policy, std::ptrdiff_t _totalElements, ValueType _init, ReduceOperation _reduceOperation, IndexTransform _indexTransform)
+{
+	if (_totalElements <= 0)
+	{
+		return _init;
+	}
+
+	PeonSystem* system = _policy.scheduler;
+
+	// One partial result for each worker (and the last one for the calling thread, if it isn't a worker)
+	const unsigned int totalPartialResults = system->GetTotalWorkers() + 1;
+	PeonScratchBuffer<PeonPartialResult<ValueType>> partialResults(system->GetCurrentWorker(), totalPartialResults);
+	partialResults.ConstructDefault();
+
+	// Reduce each chunk locally and merge it with our worker partial result
+	system->ParallelFor(std::ptrdiff_t(0), _totalElements, [&](std::ptrdiff_t _begin, std::ptrdiff_t _end)
+	{
+		ValueType value = TransformReduceChunk<ValueType>(_begin, _end, _reduceOperation, _indexTransform);
+
+		int workerIndex = system->GetCurrentWorkerIndex();
+		std::optional<ValueType>& partialResult = partialResults[workerIndex >= 0 ? workerIndex : totalPartialResults - 1].value;
+		if (partialResult)
+		{
+			*partialResult = _reduceOperation(std::move(*partialResult), std::move(value));
+		}
+		else
+		{
+			partialResult.emplace(std::move(value));
+		}
+	}, GetParallelGrainSize(_policy, _totalElements));
+
+	// Combine the partial results
+	for (unsigned int i = 0; i < totalPartialResults; i++)
+	{
+		if (partialResults[i].value)
+		{
+			_init = _reduceOperation(std::move(_init), std::move(*partialResults[i].value));
+		}
+	}
+
+	return _init;
+}
+
+// Scan a chunk starting with the given offset (the input and output can be the same range)
+template <typename InputIterator, typename OutputIterator, typename ValueType, typename ScanOperation>
+PeonNoInline void ScanChunk(InputIterator _first, InputIterator _last, OutputIterator _output, const ValueType& _initialOffset, ScanOperation& _scanOperation, bool _inclusive)
+{
+	ValueType offset = _initialOffset;
+	if (_inclusive)
+	{
+		for (; _first != _last; ++_first, ++_output)
+		{
+			offset = _scanOperation(std::move(offset), *_first);
+			*_output = offset;
+		}
+	}
+	else
+	{
+		for (; _first != _last; ++_first, ++_output)
+		{
+			ValueType value = *_first;
+			*_output = offset;
+			offset = _scanOperation(std::move(offset), std::move(value));
+		}
+	}
+}
+
+// Scan the range using three passes: reduce each block, scan the block sums (sequential) and scan each block again with
+// its offset. When there is no initial value the first element starts the inclusive scan, exclusive scans always have one
+template <typename InputIterator, typename OutputIterator, typename ValueType, typename ScanOperation>
+OutputIterator ParallelScan(const PeonParallelPolicy& _policy, InputIterator _first, InputIterator _last, OutputIterator _output, ScanOperation _scanOperation, std::optional<ValueType> _init, bool _inclusive)
+{
+	PeonSystem* system = _policy.scheduler;
+	std::ptrdiff_t totalElements = _last - _first;
+	std::ptrdiff_t grainSize = GetParallelGrainSize(_policy, totalElements);
+
+	// Scan a block with the given offset (the input and output can be the same range)
+	auto ScanBlock = [&](std::ptrdiff_t _begin, std::ptrdiff_t _end, std::optional<ValueType> _offset)
+	{
+		if (_begin == _end)
+		{
+			return;
+		}
+
+		// Only the first inclusive block can start without an offset
+		if (!_offset)
+		{
+			_offset.emplace(_first[_begin]);
+			_output[_begin] = *_offset;
+			_begin++;
+		}
+
+		ScanChunk(_first + _begin, _first + _end, _output + _begin, *_offset, _scanOperation, _inclusive);
+	};
+
+	// Access the input elements by index
+	auto ElementAt = [&](std::ptrdiff_t _index) { return ValueType(_first[_index]); };
+
+	// Small ranges (or a single worker) don't benefit from the extra pass
+	if (totalElements <= grainSize || system->GetTotalWorkers() == 1)
+	{
+		ScanBlock(0, totalElements, std::move(_init));
+		return _output + totalElements;
+	}
+
+	// Split the range in a few blocks for each worker
+	std::ptrdiff_t totalBlocks = std::min((totalElements + grainSize - 1) / grainSize, (std::ptrdiff_t)system->GetTotalWorkers() * PeonParallelChunksPerWorker);
+	std::ptrdiff_t blockSize = (totalElements + totalBlocks - 1) / totalBlocks;
+	totalBlocks = (totalElements + blockSize - 1) / blockSize;
+
+	PeonScratchBuffer<std::optional<ValueType>> blockValues(system->GetCurrentWorker(), totalBlocks);
+	blockValues.ConstructDefault();
+
+	// Reduce each block (the last one isn't needed)
+	system->ParallelFor(std::ptrdiff_t(0), totalBlocks - 1, [&](std::ptrdiff_t _block)
+	{
+		std::ptrdiff_t begin = _block * blockSize;
+		std::ptrdiff_t end = std::min(begin + blockSize, totalElements);
+
+		blockValues[_block].emplace(TransformReduceChunk<ValueType>(begin, end, _scanOperation, ElementAt));
+	});
+
+	// Replace each block sum by the block offset
+	std::optional<ValueType> offset = std::move(_init);
+	for (std::ptrdiff_t i = 0; i < totalBlocks; i++)
+	{
+		std::optional<ValueType> blockValue = std::move(blockValues[i]);
+		blockValues[i] = offset;
+		if (i + 1 < totalBlocks)
+		{
+			offset = offset ? ValueType(_scanOperation(std::move(*offset), std::move(*blockValue))) : std::move(*blockValue);
+		}
+	}
+
+	// Scan each block
+	system->ParallelFor(std::ptrdiff_t(0), totalBlocks, [&](std::ptrdiff_t _block)
+	{
+		std::ptrdiff_t begin = _block * blockSize;
+		ScanBlock(begin, std::min(begin + blockSize, totalElements), std::move(blockValues[_block]));
+	});
+
+	return _output + totalElements;
+}
+
+// Merge two sorted ranges (moving the elements) into the output, the larger range is split in half and its middle element
+// is used to split the other one, both sides can be merged in parallel
+template <typename InputIterator, typename OutputIterator, typename CompareFunction>
+void ParallelMerge(PeonSystem* _system, InputIterator _first, std::ptrdiff_t _firstSize, InputIterator _second, std::ptrdiff_t _secondSize, OutputIterator _output, CompareFunction& _compare)
+{
+	if (_firstSize + _secondSize <= PeonParallelSortCutoff || !_system->HasIdleWorkers())
+	{
+		std::merge(std::make_move_iterator(_first), std::make_move_iterator(_first + _firstSize),
+			std::make_move_iterator(_second), std::make_move_iterator(_second + _secondSize), _output, _compare);
+		return;
+	}
+
+	// Always split the larger range
+	if (_firstSize < _secondSize)
+	{
+		std::swap(_first, _second);
+		std::swap(_firstSize, _secondSize);
+	}
+
+	std::ptrdiff_t firstMiddle = _firstSize / 2;
+	std::ptrdiff_t secondMiddle = std::lower_bound(_second, _second + _secondSize, _first[firstMiddle], _compare) - _second;
+	_output[firstMiddle + secondMiddle] = std::move(_first[firstMiddle]);
+
+	ParallelInvoke(_system,
+		[&]() { ParallelMerge(_system, _first, firstMiddle, _second, secondMiddle, _output, _compare); },
+		[&]() { ParallelMerge(_system, _first + firstMiddle + 1, _firstSize - firstMiddle - 1, _second + secondMiddle, _secondSize - secondMiddle, _output + firstMiddle + secondMiddle + 1, _compare); });
+}
+
+// Sort the data range, the result ends in the data range or in the buffer range (they are used alternately by each level)
+template <typename DataIterator, typename BufferIterator, typename CompareFunction>
+void ParallelMergeSort(PeonSystem* _system, DataIterator _data, BufferIterator _buffer, std::ptrdiff_t _totalElements, bool _resultOnBuffer, CompareFunction& _compare)
+{
+	if (_totalElements <= PeonParallelSortCutoff)
+	{
+		std::sort(_data, _data + _totalElements, _compare);
+		if (_resultOnBuffer)
+		{
+			std::move(_data, _data + _totalElements, _buffer);
+		}
+
+		return;
+	}
+
+	// Sort both halves into the other range
+	std::ptrdiff_t middle = _totalElements / 2;
+	ParallelInvoke(_system,
+		[&]() { ParallelMergeSort(_system, _data, _buffer, middle, !_resultOnBuffer, _compare); },
+		[&]() { ParallelMergeSort(_system, _data + middle, _buffer + middle, _totalElements - middle, !_resultOnBuffer, _compare); });
+
+	// Merge them back
+	if (_resultOnBuffer)
+	{
+		ParallelMerge(_system, _data, middle, _data + middle, _totalElements - middle, _buffer, _compare);
+	}
+	else
+	{
+		ParallelMerge(_system, _buffer, middle, _buffer + middle, _totalElements - middle, _data, _compare);
+	}
+}
+
+// __InternalPeon
+PeonNamespaceEnd(__InternalPeon)
+
+// Peon
+PeonNamespaceBegin(Peon)
+
+// The execution policies
+PeonNamespaceBegin(execution)
+
+// Run the algorithm on the scheduler workers
+inline __InternalPeon::PeonParallelPolicy par(__InternalPeon::PeonSystem* _scheduler, std::size_t _grainSize = 0)
+{
+	return { _scheduler, _grainSize };
+}
+
+// execution
+PeonNamespaceEnd(execution)
+
+// Apply the function to each element
+template <typename RandomIterator, typename FunctionType>
+void for_each(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, FunctionType _function)
+{
+	std::ptrdiff_t totalElements = _last - _first;
+	_policy.scheduler->ParallelFor(std::ptrdiff_t(0), totalElements, [&](std::ptrdiff_t _begin, std::ptrdiff_t _end)
+	{
+		for (std::ptrdiff_t i = _begin; i < _end; i++)
+		{
+			_function(_first[i]);
+		}
+	}, __InternalPeon::GetParallelGrainSize(_policy, totalElements));
+}
+
+// Store the result of the operation for each element
+template <typename RandomIterator, typename OutputIterator, typename UnaryOperation>
+OutputIterator transform(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, OutputIterator _output, UnaryOperation _operation)
+{
+	std::ptrdiff_t totalElements = _last - _first;
+	_policy.scheduler->ParallelFor(std::ptrdiff_t(0), totalElements, [&](std::ptrdiff_t _begin, std::ptrdiff_t _end)
+	{
+		for (std::ptrdiff_t i = _begin; i < _end; i++)
+		{
+			_output[i] = _operation(_first[i]);
+		}
+	}, __InternalPeon::GetParallelGrainSize(_policy, totalElements));
+
+	return _output + totalElements;
+}
+
+// Store the result of the operation for each pair of elements
+template <typename RandomIterator, typename SecondRandomIterator, typename OutputIterator, typename BinaryOperation>
+OutputIterator transform(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, SecondRandomIterator _second, OutputIterator _output, BinaryOperation _operation)
+{
+	std::ptrdiff_t totalElements = _last - _first;
+	_policy.scheduler->ParallelFor(std::ptrdiff_t(0), totalElements, [&](std::ptrdiff_t _begin, std::ptrdiff_t _end)
+	{
+		for (std::ptrdiff_t i = _begin; i < _end; i++)
+		{
+			_output[i] = _operation(_first[i], _second[i]);
+		}
+	}, __InternalPeon::GetParallelGrainSize(_policy, totalElements));
+
+	return _output + totalElements;
+}
+
+// Reduce the transformed elements (the operation must be associative and commutative)
+template <typename RandomIterator, typename ValueType, typename ReduceOperation, typename TransformOperation>
+ValueType transform_reduce(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, ValueType _init, ReduceOperation _reduceOperation, TransformOperation _transformOperation)
+{
+	return __InternalPeon::ParallelTransformReduce(_policy, _last - _first, std::move(_init), _reduceOperation,
+		[&](std::ptrdiff_t _index) { return _transformOperation(_first[_index]); });
+}
+
+// Reduce the transformed pairs of elements (the operation must be associative and commutative)
+template <typename RandomIterator, typename SecondRandomIterator, typename ValueType, typename ReduceOperation, typename TransformOperation>
+ValueType transform_reduce(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, SecondRandomIterator _second, ValueType _init, ReduceOperation _reduceOperation, TransformOperation _transformOperation)
+{
+	return __InternalPeon::ParallelTransformReduce(_policy, _last - _first, std::move(_init), _reduceOperation,
+		[&](std::ptrdiff_t _index) { return _transformOperation(_first[_index], _second[_index]); });
+}
+
+// Reduce the elements (the operation must be associative and commutative)
+template <typename RandomIterator, typename ValueType, typename ReduceOperation>
+ValueType reduce(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, ValueType _init, ReduceOperation _reduceOperation)
+{
+	return __InternalPeon::ParallelTransformReduce(_policy, _last - _first, std::move(_init), _reduceOperation,
+		[&](std::ptrdiff_t _index) { return ValueType(_first[_index]); });
+}
+
+// Sum the elements
+template <typename RandomIterator, typename ValueType>
+ValueType reduce(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, ValueType _init)
+{
+	return Peon::reduce(_policy, _first, _last, std::move(_init), std::plus<>());
+}
+
+// Sum the elements
+template <typename RandomIterator>
+typename std::iterator_traits<RandomIterator>::value_type reduce(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last)
+{
+	return Peon::reduce(_policy, _first, _last, typename std::iterator_traits<RandomIterator>::value_type(), std::plus<>());
+}
+
+// Store the inclusive prefix of each element (the operation must be associative, the input and output can be the same)
+template <typename RandomIterator, typename OutputIterator, typename ScanOperation, typename ValueType>
+OutputIterator inclusive_scan(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, OutputIterator _output, ScanOperation _scanOperation, ValueType _init)
+{
+	return __InternalPeon::ParallelScan(_policy, _first, _last, _output, _scanOperation, std::optional<ValueType>(std::move(_init)), true);
+}
+
+// Store the inclusive prefix of each element (the operation must be associative, the input and output can be the same)
+template <typename RandomIterator, typename OutputIterator, typename ScanOperation>
+OutputIterator inclusive_scan(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, OutputIterator _output, ScanOperation _scanOperation)
+{
+	using ValueType = typename std::iterator_traits<RandomIterator>::value_type;
+	return __InternalPeon::ParallelScan(_policy, _first, _last, _output, _scanOperation, std::optional<ValueType>(), true);
+}
+
+// Store the inclusive sum of each element
+template <typename RandomIterator, typename OutputIterator>
+OutputIterator inclusive_scan(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, OutputIterator _output)
+{
+	return Peon::inclusive_scan(_policy, _first, _last, _output, std::plus<>());
+}
+
+// Store the exclusive prefix of each element (the operation must be associative, the input and output can be the same)
+template <typename RandomIterator, typename OutputIterator, typename ValueType, typename ScanOperation>
+OutputIterator exclusive_scan(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, OutputIterator _output, ValueType _init, ScanOperation _scanOperation)
+{
+	return __InternalPeon::ParallelScan(_policy, _first, _last, _output, _scanOperation, std::optional<ValueType>(std::move(_init)), false);
+}
+
+// Store the exclusive sum of each element
+template <typename RandomIterator, typename OutputIterator, typename ValueType>
+OutputIterator exclusive_scan(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, OutputIterator _output, ValueType _init)
+{
+	return Peon::exclusive_scan(_policy, _first, _last, _output, std::move(_init), std::plus<>());
+}
+
+// Sort the elements using a parallel merge sort (not stable), the temporary buffer comes from the calling worker allocator
+template <typename RandomIterator, typename CompareFunction>
+void sort(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last, CompareFunction _compare)
+{
+	using ValueType = typename std::iterator_traits<RandomIterator>::value_type;
+
+	__InternalPeon::PeonSystem* system = _policy.scheduler;
+	std::ptrdiff_t totalElements = _last - _first;
+	if (totalElements <= PeonParallelSortCutoff || system->GetTotalWorkers() == 1)
+	{
+		std::sort(_first, _last, _compare);
+		return;
+	}
+
+	// Move the elements to the buffer, the original range is used as the temporary one
+	__InternalPeon::PeonScratchBuffer<ValueType> buffer(system->GetCurrentWorker(), totalElements);
+	system->ParallelFor(std::ptrdiff_t(0), totalElements, [&](std::ptrdiff_t _begin, std::ptrdiff_t _end)
+	{
+		std::uninitialized_move(_first + _begin, _first + _end, buffer.GetData() + _begin);
+	}, std::ptrdiff_t(PeonParallelSortCutoff));
+	buffer.SetConstructed();
+
+	// Sort the buffer, the result ends on the original range
+	__InternalPeon::ParallelMergeSort(system, buffer.GetData(), _first, totalElements, true, _compare);
+}
+
+// Sort the elements using a parallel merge sort (not stable)
+template <typename RandomIterator>
+void sort(const __InternalPeon::PeonParallelPolicy& _policy, RandomIterator _first, RandomIterator _last)
+{
+	Peon::sort(_policy, _first, _last, std::less<>());
+}
+
+// Peon
+PeonNamespaceEnd(Peon)
@@ -14,6 +14,19 @@
 #define PeonNamespaceBegin(name) namespace name {
 #define PeonNamespaceEnd(name) }
 
+// Keep a function out of its caller (used by the hot loops of the parallel algorithms, once inlined into their bigger
+// callers the compiler may keep the loop accumulator in memory)
+#if defined(_MSC_VER)
+#define PeonNoInline __declspec(noinline)
+#else
+#define PeonNoInline __attribute__((noinline))
+#endif
+
+// The cache line size used to separate data written by different threads
+#ifndef PeonCacheLineSize
+#define PeonCacheLineSize (64)
+#endif
+
 PeonNamespaceBegin(__InternalPeon)
 
 template <typename ObjectType>
@@ -0,0 +1,234 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonFiber.cpp
+////////////////////////////////////////////////////////////////////////////////
+#include "PeonFiber.h"
+
+#if defined(PeonFiberWindows)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(PeonFiberAssembly)
+
+// Save the callee-saved registers (and the sse/x87 control words) on the current stack, store the stack pointer into the
+// first argument, then load the second one as the stack pointer and restore the registers saved there
+extern "C" void PeonFiberSwitchContext(void** _currentStackPointer, void* _nextStackPointer);
+
+// The first return address of a new fiber, calls the entry function (r12) with its argument (r13)
+extern "C" void PeonFiberStartContext();
+
+asm(
+	".text\n"
+	".globl PeonFiberSwitchContext\n"
+	".hidden PeonFiberSwitchContext\n"
+	".type PeonFiberSwitchContext, @function\n"
+	"PeonFiberSwitchContext:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size PeonFiberSwitchContext, .-PeonFiberSwitchContext\n"
+	".globl PeonFiberStartContext\n"
+	".hidden PeonFiberStartContext\n"
+	".type PeonFiberStartContext, @function\n"
+	"PeonFiberStartContext:\n"
+	"	movq %r13, %rdi\n"
+	"	callq *%r12\n"
+	"	ud2\n"
+	".size PeonFiberStartContext, .-PeonFiberStartContext\n"
+);
+
+#endif
+
+///////////////
+// NAMESPACE //
+///////////////
+
+__InternalPeon::PeonFiber::PeonFiber()
+{
+	// Set the initial data
+#if defined(PeonFiberWindows)
+	m_Handle = nullptr;
+#elif defined(PeonFiberAssembly)
+	m_StackPointer = nullptr;
+#endif
+	m_Stack = nullptr;
+	m_StackSize = 0;
+	m_EntryFunction = nullptr;
+	m_Argument = nullptr;
+}
+
+__InternalPeon::PeonFiber::PeonFiber(const __InternalPeon::PeonFiber& other)
+{
+	// Set the initial data
+#if defined(PeonFiberWindows)
+	m_Handle = nullptr;
+#elif defined(PeonFiberAssembly)
+	m_StackPointer = nullptr;
+#endif
+	m_Stack = nullptr;
+	m_StackSize = 0;
+	m_EntryFunction = nullptr;
+	m_Argument = nullptr;
+}
+
+__InternalPeon::PeonFiber::~PeonFiber()
+{
+#if defined(PeonFiberWindows)
+
+	// The thread fiber isn't ours to delete
+	if (m_Handle != nullptr && m_EntryFunction != nullptr)
+	{
+		DeleteFiber(m_Handle);
+	}
+
+#else
+
+	if (m_Stack != nullptr)
+	{
+		munmap(m_Stack, m_StackSize);
+	}
+
+#endif
+}
+
+bool __InternalPeon::PeonFiber::Initialize(uint32_t _stackSize, EntryFunction _entryFunction, void* _argument)
+{
+	// Set the entry function
+	m_EntryFunction = _entryFunction;
+	m_Argument = _argument;
+
+	if (_stackSize < PeonFiberMinimumStackSize)
+	{
+		_stackSize = PeonFiberMinimumStackSize;
+	}
+
+#if defined(PeonFiberWindows)
+
+	// Windows allocates the stack (with its own guard page)
+	m_Handle = CreateFiber(_stackSize, &PeonFiber::Start, this);
+
+	return m_Handle != nullptr;
+
+#else
+
+	// Reserve the stack and a guard page below it (the pages are only committed when touched)
+	size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+	size_t stackSize = (size_t(_stackSize) + pageSize - 1) / pageSize * pageSize;
+	m_StackSize = stackSize + pageSize;
+	m_Stack = mmap(nullptr, m_StackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (m_Stack == MAP_FAILED)
+	{
+		m_Stack = nullptr;
+		return false;
+	}
+
+	mprotect(m_Stack, pageSize, PROT_NONE);
+
+#if defined(PeonFiberAssembly)
+
+	// Build the frame PeonFiberSwitchContext expects (control words, r15, r14, r13, r12, rbx, rbp and the return address), the
+	// start function must find a 16 byte aligned stack after the return address is popped
+	uintptr_t stackTop = (uintptr_t(m_Stack) + m_StackSize) & ~uintptr_t(15);
+	uint64_t* frame = (uint64_t*)(stackTop - 64);
+	frame[0] = 0x1F80 | (uint64_t(0x037F) << 32);		// Default mxcsr and x87 control word
+	frame[1] = 0;										// r15
+	frame[2] = 0;										// r14
+	frame[3] = uint64_t(uintptr_t(_argument));			// r13
+	frame[4] = uint64_t(uintptr_t(_entryFunction));		// r12
+	frame[5] = 0;										// rbx
+	frame[6] = 0;										// rbp
+	frame[7] = uint64_t(uintptr_t(&PeonFiberStartContext));
+	m_StackPointer = frame;
+
+#else
+
+	// The fiber pointer is split in two, makecontext only passes ints
+	getcontext(&m_Context);
+	m_Context.uc_stack.ss_sp = (char*)m_Stack + pageSize;
+	m_Context.uc_stack.ss_size = stackSize;
+	m_Context.uc_link = nullptr;
+	uint64_t fiber = uint64_t(uintptr_t(this));
+	makecontext(&m_Context, (void(*)())&PeonFiber::Start, 2, (unsigned int)(fiber >> 32), (unsigned int)(fiber & 0xFFFFFFFF));
+
+#endif
+
+	return true;
+
+#endif
+}
+
+bool __InternalPeon::PeonFiber::InitializeFromCurrentThread()
+{
+#if defined(PeonFiberWindows)
+
+	// The thread must be a fiber itself before it can switch to one (it could be one already)
+	m_Handle = ConvertThreadToFiber(nullptr);
+	if (m_Handle == nullptr && GetLastError() == ERROR_ALREADY_FIBER)
+	{
+		m_Handle = GetCurrentFiber();
+	}
+
+	return m_Handle != nullptr;
+
+#else
+
+	// Nothing to do, the context is saved when we switch away from it
+	return true;
+
+#endif
+}
+
+void __InternalPeon::PeonFiber::SwitchTo(PeonFiber* _fiber)
+{
+#if defined(PeonFiberWindows)
+
+	SwitchToFiber(_fiber->m_Handle);
+
+#elif defined(PeonFiberAssembly)
+
+	PeonFiberSwitchContext(&m_StackPointer, _fiber->m_StackPointer);
+
+#else
+
+	swapcontext(&m_Context, &_fiber->m_Context);
+
+#endif
+}
+
+#if defined(PeonFiberWindows)
+
+void __stdcall __InternalPeon::PeonFiber::Start(void* _fiber)
+{
+	PeonFiber* fiber = (PeonFiber*)_fiber;
+	fiber->m_EntryFunction(fiber->m_Argument);
+}
+
+#elif defined(PeonFiberUContext)
+
+void __InternalPeon::PeonFiber::Start(unsigned int _fiberHigh, unsigned int _fiberLow)
+{
+	PeonFiber* fiber = (PeonFiber*)uintptr_t((uint64_t(_fiberHigh) << 32) | uint64_t(_fiberLow));
+	fiber->m_EntryFunction(fiber->m_Argument);
+}
+
+#endif
@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonFiber.h
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+//////////////
+// INCLUDES //
+//////////////
+#include "PeonConfig.h"
+#include <cstdint>
+#include <cstddef>
+
+/////////////
+// DEFINES //
+/////////////
+
+// Select the context switch implementation, a hand-written one on x86-64 linux (it saves only the callee-saved registers, no
+// system calls), the windows fibers or ucontext everywhere else
+#if defined(_WIN32)
+#define PeonFiberWindows
+#elif defined(__x86_64__) && defined(__linux__)
+#define PeonFiberAssembly
+#else
+#define PeonFiberUContext
+#include <ucontext.h>
+#endif
+
+// The smallest fiber stack we accept (in bytes)
+#define PeonFiberMinimumStackSize	(16 * 1024)
+
+///////////////
+// NAMESPACE //
+///////////////
+
+// __InternalPeon
+PeonNamespaceBegin(__InternalPeon)
+
+////////////
+// GLOBAL //
+////////////
+
+// The fiber configuration used by all workers (should be set before initializing the system)
+struct PeonFiberSettings
+{
+	// When WaitForJob must wait inside a worker, suspend the current fiber and keep running jobs on another one from the pool
+	// (instead of running other jobs on top of the waiting one, on the same stack)
+	bool enabled = false;
+
+	// The number of pre-allocated fibers for each worker, when all of them are waiting WaitForJob runs other jobs on top of
+	// the waiting one (the original behavior)
+	uint32_t fibersPerWorker = 32;
+
+	// The stack size of each fiber (in bytes, rounded up to the page size, a guard page below each stack catches overflows)
+	uint32_t stackSize = 256 * 1024;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: PeonFiber
+////////////////////////////////////////////////////////////////////////////////
+class PeonFiber
+{
+public:
+
+	// The function run by a fiber, it must never return (switch to another fiber instead)
+	typedef void (*EntryFunction)(void* _argument);
+
+public:
+	PeonFiber();
+	PeonFiber(const PeonFiber&);
+	~PeonFiber();
+
+	// Allocate the stack and prepare this fiber to run the entry function the first time someone switches to it
+	bool Initialize(uint32_t _stackSize, EntryFunction _entryFunction, void* _argument);
+
+	// Make this fiber represent the calling thread own stack (must be called by that thread before switching away from it)
+	bool InitializeFromCurrentThread();
+
+	// Save the calling context into this fiber and continue the given one (returns when someone switches back to this fiber),
+	// both fibers must belong to the calling thread
+	void SwitchTo(PeonFiber* _fiber);
+
+private:
+
+	// The first function run by a fiber (calls the entry function)
+#if defined(PeonFiberWindows)
+	static void __stdcall Start(void* _fiber);
+#elif defined(PeonFiberUContext)
+	static void Start(unsigned int _fiberHigh, unsigned int _fiberLow);
+#endif
+
+///////////////
+// VARIABLES //
+private: //////
+
+	// The saved context
+#if defined(PeonFiberWindows)
+	void* m_Handle;
+#elif defined(PeonFiberAssembly)
+	void* m_StackPointer;
+#else
+	ucontext_t m_Context;
+#endif
+
+	// The stack memory (including the guard page) and its size (nullptr for the thread own stack)
+	void* m_Stack;
+	size_t m_StackSize;
+
+	// The entry function and its argument
+	EntryFunction m_EntryFunction;
+	void* m_Argument;
+};
+
+// __InternalPeon
+PeonNamespaceEnd(__InternalPeon)
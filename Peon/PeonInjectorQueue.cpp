@@ -0,0 +1,139 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonInjectorQueue.cpp
+////////////////////////////////////////////////////////////////////////////////
+#include "PeonInjectorQueue.h"
+
+///////////////
+// NAMESPACE //
+///////////////
+
+__InternalPeon::PeonInjectorQueue::PeonInjectorQueue()
+{
+	// Set the initial data
+	m_Cells = nullptr;
+	m_Mask = 0;
+	m_EnqueuePosition = 0;
+	m_DequeuePosition = 0;
+}
+
+__InternalPeon::PeonInjectorQueue::PeonInjectorQueue(const __InternalPeon::PeonInjectorQueue& other)
+{
+	// Set the initial data
+	m_Cells = nullptr;
+	m_Mask = 0;
+	m_EnqueuePosition = 0;
+	m_DequeuePosition = 0;
+}
+
+__InternalPeon::PeonInjectorQueue::~PeonInjectorQueue()
+{
+	delete[] m_Cells;
+}
+
+bool __InternalPeon::PeonInjectorQueue::Initialize(uint32_t _capacity)
+{
+	// We need at least 2 slots (a single slot can't tell full from empty using the sequences)
+	if (_capacity < 2)
+	{
+		_capacity = 2;
+	}
+
+	// Each slot starts ready to be written for its own position
+	m_Cells = new Cell[_capacity];
+	for (uint32_t i = 0; i < _capacity; i++)
+	{
+		m_Cells[i].sequence.store(i, std::memory_order_relaxed);
+		m_Cells[i].job = nullptr;
+	}
+
+	m_Mask = _capacity - 1;
+	m_EnqueuePosition.store(0, std::memory_order_relaxed);
+	m_DequeuePosition.store(0, std::memory_order_relaxed);
+
+	return true;
+}
+
+bool __InternalPeon::PeonInjectorQueue::Push(PeonJob* _job)
+{
+	size_t position = m_EnqueuePosition.load(std::memory_order_relaxed);
+	while (true)
+	{
+		Cell* cell = &m_Cells[position & m_Mask];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t difference = intptr_t(sequence) - intptr_t(position);
+
+		// The slot is free for this position, claim it (another producer could be doing the same)
+		if (difference == 0)
+		{
+			if (m_EnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				// Publish the job, consumers wait for this sequence
+				cell->job = _job;
+				cell->sequence.store(position + 1, std::memory_order_release);
+
+				return true;
+			}
+		}
+		// The slot still holds the job from the previous lap, the queue is full
+		else if (difference < 0)
+		{
+			return false;
+		}
+		// Another producer took this position, try the next one
+		else
+		{
+			position = m_EnqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+__InternalPeon::PeonJob* __InternalPeon::PeonInjectorQueue::Pop()
+{
+	size_t position = m_DequeuePosition.load(std::memory_order_relaxed);
+	while (true)
+	{
+		Cell* cell = &m_Cells[position & m_Mask];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t difference = intptr_t(sequence) - intptr_t(position + 1);
+
+		// The slot has a job for this position, claim it (another consumer could be doing the same)
+		if (difference == 0)
+		{
+			if (m_DequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				// Take the job and free the slot for the next lap
+				PeonJob* job = cell->job;
+				cell->sequence.store(position + m_Mask + 1, std::memory_order_release);
+
+				return job;
+			}
+		}
+		// Nothing was written for this position yet, the queue is empty (or the job is still being written)
+		else if (difference < 0)
+		{
+			return nullptr;
+		}
+		// Another consumer took this position, try the next one
+		else
+		{
+			position = m_DequeuePosition.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+bool __InternalPeon::PeonInjectorQueue::IsEmpty()
+{
+	// The sequentially consistent loads pair with the fence used before checking for parked workers
+	size_t dequeuePosition = m_DequeuePosition.load(std::memory_order_seq_cst);
+	size_t enqueuePosition = m_EnqueuePosition.load(std::memory_order_seq_cst);
+
+	return enqueuePosition <= dequeuePosition;
+}
+
+size_t __InternalPeon::PeonInjectorQueue::GetSize()
+{
+	size_t dequeuePosition = m_DequeuePosition.load(std::memory_order_relaxed);
+	size_t enqueuePosition = m_EnqueuePosition.load(std::memory_order_relaxed);
+
+	return enqueuePosition > dequeuePosition ? enqueuePosition - dequeuePosition : 0;
+}
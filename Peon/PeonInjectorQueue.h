@@ -0,0 +1,75 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonInjectorQueue.h
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+//////////////
+// INCLUDES //
+//////////////
+#include "PeonConfig.h"
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+///////////////
+// NAMESPACE //
+///////////////
+
+// __InternalPeon
+PeonNamespaceBegin(__InternalPeon)
+
+// We know the job
+class PeonJob;
+
+/////////////
+// DEFINES //
+/////////////
+
+// The default number of jobs each injector queue can hold
+#define PeonDefaultInjectorQueueSize	(4096)
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: PeonInjectorQueue
+////////////////////////////////////////////////////////////////////////////////
+class PeonInjectorQueue
+{
+	// A queue slot, the sequence tells if the slot is ready to be written or read for a given position
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		PeonJob* job;
+	};
+
+public:
+	PeonInjectorQueue();
+	PeonInjectorQueue(const PeonInjectorQueue&);
+	~PeonInjectorQueue();
+
+	// Initialize the queue with the given capacity (must be a power of 2)
+	bool Initialize(uint32_t _capacity);
+
+	// Insert a job (can be called from any thread, return false if the queue is full)
+	bool Push(PeonJob* _job);
+
+	// Take the oldest job (can be called from any thread, return nullptr if the queue is empty)
+	PeonJob* Pop();
+
+	// Return if this queue looks empty (can be called from any thread, a job being pushed right now counts as queued)
+	bool IsEmpty();
+
+	// Return the number of queued jobs (can be called from any thread, only a snapshot)
+	size_t GetSize();
+
+private:
+
+	// The slots and the position mask
+	Cell* m_Cells;
+	size_t m_Mask;
+
+	// The next position to write and to read (each one in its own cache line, producers and consumers don't share them)
+	alignas(PeonCacheLineSize) std::atomic<size_t> m_EnqueuePosition;
+	alignas(PeonCacheLineSize) std::atomic<size_t> m_DequeuePosition;
+};
+
+// __InternalPeon
+PeonNamespaceEnd(__InternalPeon)
@@ -4,6 +4,14 @@
 #include "PeonJob.h"
 #include "PeonWorker.h"
 #include "PeonSystem.h"
+#include "PeonStealingQueue.h"
+
+// With the default function storage size, each job uses one cache line for the dispatch data, one for the completion
+// counter and one for the control data
+static_assert(PeonJobFunctionStorageSize != 40 || sizeof(__InternalPeon::PeonJob) == 3 * PeonCacheLineSize, "Peon: Unexpected job layout!");
+
+// Marks a waiter list as closed (the job completed)
+static __InternalPeon::PeonJobWaiter ClosedWaiterList;
 
 ///////////////
 // NAMESPACE //
@@ -11,65 +19,278 @@
 
 __InternalPeon::PeonJob::PeonJob()
 {
+	// Set the initial data
+	m_FunctionDispatcher = nullptr;
+	m_Continuations = nullptr;
+	m_OwnerQueue = nullptr;
+	m_NextFreeJob = nullptr;
+	m_Recyclable = false;
 }
 
 __InternalPeon::PeonJob::PeonJob(const PeonJob& other)
 {
+	// Set the initial data
+	m_FunctionDispatcher = nullptr;
+	m_Continuations = nullptr;
+	m_OwnerQueue = nullptr;
+	m_NextFreeJob = nullptr;
+	m_Recyclable = false;
 }
 
 __InternalPeon::PeonJob::~PeonJob()
 {
 }
 
-bool __InternalPeon::PeonJob::Initialize()
+bool __InternalPeon::PeonJob::Initialize(bool _recyclable)
 {
     // Set the initial data
     m_CurrentWorkerThread = nullptr;
     m_ParentJob = nullptr;
     m_UnfinishedJobs = 1;
 	m_TotalJobsThatDependsOnThis = 0;
+	m_PendingPredecessors = 0;
+	m_Waiters.store(nullptr, std::memory_order_relaxed);
+	m_Completed.store(false, std::memory_order_relaxed);
+	m_Priority = PeonJobPriority::Normal;
+	m_EnqueueTime = 0;
+	m_CancellationToken = nullptr;
+	m_Label = nullptr;
+
+	// Set the references (the execution and the creator)
+	m_Recyclable = _recyclable;
+	if (_recyclable)
+	{
+		m_ReferenceCount.store(2, std::memory_order_relaxed);
+	}
 
     return true;
 }
 
-void __InternalPeon::PeonJob::SetJobFunction(PeonJob* _parentJob, std::function<void()> _function)
-{
-    // Set the function and the data
-    m_Function = _function;
-
-    // Set the current worker thread
-    m_ParentJob = _parentJob;
-}
 
 void __InternalPeon::PeonJob::Finish(PeonWorker* _peonWorker)
 {
-	// Decrement the number of unfinished jobs
-	m_UnfinishedJobs--;
-	const int32_t unfinishedJobs = m_UnfinishedJobs;
+	// Decrement the number of unfinished jobs (only one thread can see it reaching zero)
+	const int32_t unfinishedJobs = --m_UnfinishedJobs;
 
 	// Check if there are no jobs remaining
 	if (unfinishedJobs == 0)
 	{
+		// Run follow-up jobs (only the ones that aren't waiting for other jobs)
+		const int32_t totalJobsThatDependsOnThis = m_TotalJobsThatDependsOnThis.load(std::memory_order_acquire);
+		PeonJobContinuations* continuations = m_Continuations.load(std::memory_order_acquire);
+		PeonJob* readyJobs[PeonJobReleaseBatchSize];
+		uint32_t totalReadyJobs = 0;
+		for (int32_t i = 0; i < totalJobsThatDependsOnThis; ++i)
+		{
+			// Move to the next block
+			if (i > 0 && i % PeonJobContinuationBlockSize == 0)
+			{
+				continuations = continuations->next.load(std::memory_order_acquire);
+			}
+
+			// Check if we were the last job this one was waiting for
+			PeonJob* dependantJob = continuations->jobs[i % PeonJobContinuationBlockSize];
+			if (dependantJob->m_PendingPredecessors.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			{
+				continue;
+			}
+
+			// Release the ready jobs when the batch is full
+			readyJobs[totalReadyJobs++] = dependantJob;
+			if (totalReadyJobs == PeonJobReleaseBatchSize)
+			{
+				ReleaseReadyJobs(_peonWorker, readyJobs, totalReadyJobs);
+				totalReadyJobs = 0;
+			}
+		}
+
+		// Release the remaining ready jobs
+		ReleaseReadyJobs(_peonWorker, readyJobs, totalReadyJobs);
+
+		// Take the suspended coroutines waiting for this job (nobody can add one after this)
+		PeonJobWaiter* waiters = m_Waiters.exchange(&ClosedWaiterList, std::memory_order_acq_rel);
+
+		// We are done with this job, let the waiters know (they can reuse it after this)
+		PeonJob* parentJob = m_ParentJob;
+		bool recyclable = m_Recyclable;
+		m_Completed.store(true, std::memory_order_release);
+
+		// Resume the waiting coroutines
+		if (waiters != nullptr)
+		{
+			ResumeWaiters(_peonWorker, waiters);
+		}
+
+		// Release the execution reference (a recyclable job is only reused after all references are gone)
+		if (recyclable)
+		{
+			Release();
+		}
+
 		// If we dont have any remaining jobs, we can decrement the number of jobs from our parent
-		// (if we have one).
-		if (m_ParentJob != nullptr)
+		// (if we have one). This must be the last thing we do, once the parent completes this job
+		// could be reused
+		if (parentJob != nullptr)
 		{
 			// Call the finish job for our parent
-			m_ParentJob->Finish(_peonWorker);
+			parentJob->Finish(_peonWorker);
+		}
+	}
+}
+
+void __InternalPeon::PeonJob::ReleaseReadyJobs(PeonWorker* _peonWorker, PeonJob** _jobs, uint32_t _totalJobs)
+{
+	if (_totalJobs == 0)
+	{
+		return;
+	}
+
+	// Insert them on the queue at once (each one goes into the lane for its priority)
+	_peonWorker->PushJobs(_jobs, _totalJobs);
+
+	// Releasing a dependant job works like starting it, the creator reference is gone
+	for (uint32_t i = 0; i < _totalJobs; i++)
+	{
+		_jobs[i]->Release();
+	}
+
+	// Wake parked workers to help with the follow-up jobs
+	_peonWorker->GetOwnerSystem()->WakeParkedWorkers(_totalJobs);
+}
+
+void __InternalPeon::PeonJob::ResumeWaiters(PeonWorker* _peonWorker, PeonJobWaiter* _waiters)
+{
+	PeonSystem* system = _peonWorker->GetOwnerSystem();
+	PeonJob* readyJobs[PeonJobReleaseBatchSize];
+	uint32_t totalReadyJobs = 0;
+	while (_waiters != nullptr)
+	{
+		// Read the waiter before it can be resumed (it lives in the coroutine frame)
+		PeonJobWaiter* waiter = _waiters;
+		_waiters = waiter->next;
+
+		readyJobs[totalReadyJobs++] = system->CreateJob([resumeFunction = waiter->resumeFunction, address = waiter->address]()
+		{
+			resumeFunction(address);
+		});
+
+		// Release the ready jobs when the batch is full
+		if (totalReadyJobs == PeonJobReleaseBatchSize)
+		{
+			ReleaseReadyJobs(_peonWorker, readyJobs, totalReadyJobs);
+			totalReadyJobs = 0;
 		}
-		
-		// Run follow-up jobs
-		for (int32_t i = 0; i < m_TotalJobsThatDependsOnThis; ++i)
+	}
+
+	ReleaseReadyJobs(_peonWorker, readyJobs, totalReadyJobs);
+}
+
+bool __InternalPeon::PeonJob::AddWaiter(PeonJobWaiter* _waiter)
+{
+	// Push the waiter unless the list was closed
+	PeonJobWaiter* waiters = m_Waiters.load(std::memory_order_acquire);
+	do
+	{
+		if (waiters == &ClosedWaiterList)
 		{
-			// Insert them on the queue
-			_peonWorker->GetWorkerQueue()->Push(m_JobsThatDependsOnThis[i]);
+			return false;
 		}
+
+		_waiter->next = waiters;
+	} while (!m_Waiters.compare_exchange_weak(waiters, _waiter, std::memory_order_acq_rel, std::memory_order_acquire));
+
+	return true;
+}
+
+void __InternalPeon::PeonJob::AddContinuation(PeonJob* _job, PeonWorker* _peonWorker)
+{
+	// The dependant job must wait for one more job
+	_job->m_PendingPredecessors.fetch_add(1, std::memory_order_relaxed);
+
+	// Reserve a continuation slot
+	const int32_t index = m_TotalJobsThatDependsOnThis.fetch_add(1, std::memory_order_acq_rel);
+	const int32_t blockIndex = index / PeonJobContinuationBlockSize;
+
+	// Find the block that holds our slot, creating any missing block (someone else could be doing the same)
+	std::atomic<PeonJobContinuations*>* blockLink = &m_Continuations;
+	PeonJobContinuations* block = nullptr;
+	for (int32_t i = 0; i <= blockIndex; i++)
+	{
+		block = blockLink->load(std::memory_order_acquire);
+		if (block == nullptr)
+		{
+			PeonJobContinuations* newBlock = (PeonJobContinuations*)AllocateFunctionData(_peonWorker, sizeof(PeonJobContinuations));
+			newBlock->next = nullptr;
+
+			if (blockLink->compare_exchange_strong(block, newBlock, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				block = newBlock;
+			}
+			else
+			{
+				DeallocateFunctionData(_peonWorker, newBlock);
+			}
+		}
+
+		blockLink = &block->next;
+	}
+
+	block->jobs[index % PeonJobContinuationBlockSize] = _job;
+}
+
+void __InternalPeon::PeonJob::ReleaseContinuations()
+{
+	// Each block goes back to the allocator that created it
+	PeonJobContinuations* block = m_Continuations.exchange(nullptr, std::memory_order_acquire);
+	while (block != nullptr)
+	{
+		PeonJobContinuations* nextBlock = block->next.load(std::memory_order_relaxed);
+		DeallocateFunctionData(nullptr, block);
+		block = nextBlock;
+	}
+}
+
+void __InternalPeon::PeonJob::RunJobFunction(PeonWorker* _peonWorker)
+{
+	// Run and destroy the function (using a single call)
+	FunctionDispatcher functionDispatcher = m_FunctionDispatcher;
+	m_FunctionDispatcher = nullptr;
+	functionDispatcher(this, _peonWorker, FunctionOperation::RunAndDestroy);
+}
+
+void __InternalPeon::PeonJob::DestroyJobFunction(PeonWorker* _peonWorker)
+{
+	if (m_FunctionDispatcher != nullptr)
+	{
+		FunctionDispatcher functionDispatcher = m_FunctionDispatcher;
+		m_FunctionDispatcher = nullptr;
+		functionDispatcher(this, _peonWorker, FunctionOperation::Destroy);
 	}
 }
 
-void __InternalPeon::PeonJob::RunJobFunction()
+void* __InternalPeon::PeonJob::AllocateFunctionData(PeonWorker* _peonWorker, size_t _size)
 {
-    m_Function();
+	// Threads that aren't workers don't have an allocator
+	if (_peonWorker == nullptr)
+	{
+		return PeonMemoryAllocator::AllocateExternalData((uint32_t)_size);
+	}
+
+	if (void* data = _peonWorker->GetMemoryAllocator().AllocateData(_peonWorker, (uint32_t)_size)) return data;
+
+	throw std::bad_alloc();
+}
+
+void __InternalPeon::PeonJob::DeallocateFunctionData(PeonWorker* _peonWorker, void* _data)
+{
+	// Threads that aren't workers don't have an allocator
+	if (_peonWorker == nullptr)
+	{
+		PeonMemoryAllocator::DeallocateExternalData((char*)_data);
+		return;
+	}
+
+	_peonWorker->GetMemoryAllocator().DeallocateData((char*)_data);
 }
 
 __InternalPeon::PeonJob* __InternalPeon::PeonJob::GetParent()
@@ -106,3 +327,75 @@ int32_t __InternalPeon::PeonJob::GetTotalUnfinishedJobs()
 {
     return m_UnfinishedJobs;
 }
+
+bool __InternalPeon::PeonJob::HasCompleted()
+{
+	return m_Completed.load(std::memory_order_acquire);
+}
+
+void __InternalPeon::PeonJob::SetPriority(PeonJobPriority _priority)
+{
+	m_Priority = _priority;
+}
+
+__InternalPeon::PeonJobPriority __InternalPeon::PeonJob::GetPriority()
+{
+	return m_Priority;
+}
+
+void __InternalPeon::PeonJob::SetEnqueueTime(uint64_t _enqueueTime)
+{
+	m_EnqueueTime = _enqueueTime;
+}
+
+uint64_t __InternalPeon::PeonJob::GetEnqueueTime()
+{
+	return m_EnqueueTime;
+}
+
+void __InternalPeon::PeonJob::SetCancellationToken(PeonCancellationToken* _cancellationToken)
+{
+	m_CancellationToken = _cancellationToken;
+}
+
+__InternalPeon::PeonCancellationToken* __InternalPeon::PeonJob::GetCancellationToken()
+{
+	return m_CancellationToken;
+}
+
+bool __InternalPeon::PeonJob::IsCancelled()
+{
+	return m_CancellationToken != nullptr && m_CancellationToken->IsCancelled();
+}
+
+void __InternalPeon::PeonJob::SetLabel(const char* _label)
+{
+	m_Label = _label;
+}
+
+const char* __InternalPeon::PeonJob::GetLabel()
+{
+	return m_Label;
+}
+
+void __InternalPeon::PeonJob::Retain()
+{
+	if (m_Recyclable)
+	{
+		m_ReferenceCount.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void __InternalPeon::PeonJob::Release()
+{
+	// Check if this is the last reference
+	if (!m_Recyclable || m_ReferenceCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+	{
+		return;
+	}
+
+	// Return this job to its owner (use the local path only if we are the owner thread)
+	PeonWorker* currentWorker = PeonWorker::GetCurrentLocalThreadWorker();
+	bool isOwnerThread = currentWorker != nullptr && currentWorker->GetWorkerQueue() == m_OwnerQueue;
+	m_OwnerQueue->ReturnJob(this, isOwnerThread);
+}
\ No newline at end of file
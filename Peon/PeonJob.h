@@ -9,13 +9,32 @@
 #include "PeonConfig.h"
 #include <atomic>
 #include <functional>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 /////////////
 // DEFINES //
 /////////////
 
 // Return if a job is done
-#define HasJobCompleted(job)	((job->GetTotalUnfinishedJobs()) <= 0)
+#define HasJobCompleted(job)	(job->HasCompleted())
+
+// The size of the inline storage used by the job function (bigger functions are allocated by the worker memory allocator),
+// with the default size the function, its dispatcher and the parent/worker pointers fill exactly one cache line
+#ifndef PeonJobFunctionStorageSize
+#define PeonJobFunctionStorageSize	(40)
+#endif
+
+// The number of dependant jobs stored in each continuation block (a block fills a 128 bytes allocator block)
+#define PeonJobContinuationBlockSize	(11)
+
+// The maximum number of ready dependant jobs released at once when a job finishes
+#define PeonJobReleaseBatchSize		(32)
+
+// The number of job priorities (each worker has one queue for each priority)
+#define PeonTotalJobPriorities		(3)
 
 ///////////////
 // NAMESPACE //
@@ -27,35 +46,142 @@ PeonNamespaceBegin(__InternalPeon)
 // Classes we know
 class PeonWorker;
 class PeonSystem;
+class PeonStealingQueue;
+class PeonJob;
 
 ////////////
 // GLOBAL //
 ////////////
 
+// The job priority, selects the worker queue (lane) the job is pushed into, workers look for jobs in this order
+enum class PeonJobPriority : uint8_t
+{
+	// Latency critical jobs (input handling, network replies)
+	High,
+
+	// The default priority
+	Normal,
+
+	// Bulk jobs that can wait, they are aged so they can't starve
+	Background
+};
+
+// A block of jobs that depend on a job (kept out of the job since most jobs never have dependants, blocks are chained so
+// there is no limit on the number of dependants)
+struct PeonJobContinuations
+{
+	std::atomic<PeonJobContinuations*> next;
+	PeonJob* jobs[PeonJobContinuationBlockSize];
+};
+
+// A cancellation flag shared by a job tree, children inherit the token of their parent when created, once cancelled the queued
+// jobs using it finish without running their functions (running jobs can poll it), the token must outlive those jobs
+class PeonCancellationToken
+{
+public:
+	PeonCancellationToken() : m_Cancelled(false) {}
+
+	// Cancel every job using this token (can be called from any thread, at any time)
+	void Cancel()
+	{
+		m_Cancelled.store(true, std::memory_order_relaxed);
+	}
+
+	// Let the token be used by new jobs again (no job using it can be pending)
+	void Reset()
+	{
+		m_Cancelled.store(false, std::memory_order_relaxed);
+	}
+
+	// Return if the token was cancelled
+	bool IsCancelled() const
+	{
+		return m_Cancelled.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	// If the token was cancelled
+	std::atomic<bool> m_Cancelled;
+};
+
+// A suspended coroutine waiting for a job, the worker that completes the job resumes it from a new job pushed into its own
+// queue (the waiter lives in the coroutine frame, so waiting never allocates)
+struct PeonJobWaiter
+{
+	void (*resumeFunction)(void* _address);
+	void* address;
+	PeonJobWaiter* next;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Class name: PeonJob
 ////////////////////////////////////////////////////////////////////////////////
-class PeonJob // alignas(32)
+class alignas(PeonCacheLineSize) PeonJob
 {
 	// Friend classes
 	friend PeonSystem;
+	friend PeonStealingQueue;
 
 public:
 	PeonJob();
 	PeonJob(const PeonJob&);
 	~PeonJob();
 
-	// Initialize the job
-	bool Initialize();
+	// Initialize the job (recyclable jobs return to their owner queue when finished and released)
+	bool Initialize(bool _recyclable = false);
 
-	// Set the job function (syntax: (*MEMBER, &MEMBER::FUNCTION, DATA))
-	void SetJobFunction(PeonJob* _parentJob, std::function<void()> _function);
+	// Set the job function, the function is moved into the job inline storage (or into memory from the given worker
+	// allocator if it doesn't fit), the value returned by the function (if any) takes its place once it runs
+	template <typename FunctionType>
+	void SetJobFunction(PeonJob* _parentJob, FunctionType&& _function, PeonWorker* _peonWorker)
+	{
+		using StoredType = typename std::decay<FunctionType>::type;
+		static_assert(alignof(StoredType) <= alignof(std::max_align_t), "Peon: Over-aligned job functions aren't supported!");
+
+		// Destroy the old function (if this job was never executed)
+		DestroyJobFunction(_peonWorker);
+
+		// Check if the function fits inside our storage
+		if constexpr (sizeof(StoredType) <= PeonJobFunctionStorageSize)
+		{
+			new (m_FunctionStorage) StoredType(std::forward<FunctionType>(_function));
+			m_FunctionDispatcher = &InlineFunctionDispatcher<StoredType>;
+		}
+		else
+		{
+			void* functionData = AllocateFunctionData(_peonWorker, sizeof(StoredType));
+			*reinterpret_cast<StoredType**>(m_FunctionStorage) = new (functionData) StoredType(std::forward<FunctionType>(_function));
+			m_FunctionDispatcher = &AllocatedFunctionDispatcher<StoredType>;
+		}
+
+		// Set the parent job
+		m_ParentJob = _parentJob;
+	}
 
 	// Finish this job
 	void Finish(PeonWorker* _peonWorker);
 
-	// Run the job function
-	void RunJobFunction();
+	// Run the job function (the function is destroyed after running)
+	void RunJobFunction(PeonWorker* _peonWorker);
+
+	// Destroy the job function without running it
+	void DestroyJobFunction(PeonWorker* _peonWorker);
+
+	// Return the value returned by the job function (the job must have completed and the function must return this type, the
+	// value is kept until the job is reused)
+	template <typename ResultType>
+	ResultType& GetResult()
+	{
+		if constexpr (sizeof(ResultType) <= PeonJobFunctionStorageSize)
+		{
+			return *reinterpret_cast<ResultType*>(m_FunctionStorage);
+		}
+		else
+		{
+			return **reinterpret_cast<ResultType**>(m_FunctionStorage);
+		}
+	}
 
 	// Return the parent job
 	PeonJob* GetParent();
@@ -72,10 +198,161 @@ public:
 	// Return the number of unfinished jobs
 	int32_t GetTotalUnfinishedJobs();
 
+	// Return if this job and all its children finished (and the job isn't being used by the worker that finished it)
+	bool HasCompleted();
+
+	// Set and return the job priority (used when the job is pushed into a worker queue)
+	void SetPriority(PeonJobPriority _priority);
+	PeonJobPriority GetPriority();
+
+	// Set and return the time this job was pushed into a worker queue (in nanoseconds, zero if it wasn't recorded)
+	void SetEnqueueTime(uint64_t _enqueueTime);
+	uint64_t GetEnqueueTime();
+
+	// Set and return the cancellation token (children created after this inherit it)
+	void SetCancellationToken(PeonCancellationToken* _cancellationToken);
+	PeonCancellationToken* GetCancellationToken();
+
+	// Return if this job was cancelled (a cancelled job that didn't start yet finishes without running its function)
+	bool IsCancelled();
+
+	// Set and return the label shown by the traces (must outlive the trace, use string literals)
+	void SetLabel(const char* _label);
+	const char* GetLabel();
+
+	// Add a job that depends on this one, it will only start when all jobs it depends on finish (can be called from any
+	// thread, but all dependencies must be added before any of those jobs start)
+	void AddContinuation(PeonJob* _job, PeonWorker* _peonWorker);
+
+	// Release the continuation blocks (they are kept between uses of this job, only call it when the job won't be used again)
+	void ReleaseContinuations();
+
+	// Add a waiter resumed when this job completes (can be called from any thread, at any time), return false if the job
+	// already completed (the waiter won't be resumed)
+	bool AddWaiter(PeonJobWaiter* _waiter);
+
+	// Add and remove a reference to this job (only used by recyclable jobs, the last release returns the job to its owner)
+	void Retain();
+	void Release();
+
 protected:
 
-	// The job function and data
-	std::function<void()> m_Function;
+	// The operations a function dispatcher can do
+	enum class FunctionOperation
+	{
+		RunAndDestroy,
+		Destroy
+	};
+
+	// The function dispatcher type
+	using FunctionDispatcher = void(*)(PeonJob* _job, PeonWorker* _peonWorker, FunctionOperation _operation);
+
+	// The dispatcher for functions stored inside the job
+	template <typename FunctionType>
+	static void InlineFunctionDispatcher(PeonJob* _job, PeonWorker* _peonWorker, FunctionOperation _operation)
+	{
+		using ResultType = typename std::decay<decltype(std::declval<FunctionType&>()())>::type;
+
+		FunctionType* function = reinterpret_cast<FunctionType*>(_job->m_FunctionStorage);
+		if (_operation == FunctionOperation::RunAndDestroy)
+		{
+			if constexpr (std::is_void<ResultType>::value)
+			{
+				(*function)();
+			}
+			else
+			{
+				// The result takes the function place
+				ResultType result = (*function)();
+				function->~FunctionType();
+				_job->SetResult<ResultType>(_peonWorker, std::move(result));
+				return;
+			}
+		}
+
+		function->~FunctionType();
+	}
+
+	// The dispatcher for functions allocated by the worker allocator
+	template <typename FunctionType>
+	static void AllocatedFunctionDispatcher(PeonJob* _job, PeonWorker* _peonWorker, FunctionOperation _operation)
+	{
+		using ResultType = typename std::decay<decltype(std::declval<FunctionType&>()())>::type;
+
+		FunctionType* function = *reinterpret_cast<FunctionType**>(_job->m_FunctionStorage);
+		if (_operation == FunctionOperation::RunAndDestroy)
+		{
+			if constexpr (std::is_void<ResultType>::value)
+			{
+				(*function)();
+			}
+			else
+			{
+				ResultType result = (*function)();
+				function->~FunctionType();
+				DeallocateFunctionData(_peonWorker, function);
+				_job->SetResult<ResultType>(_peonWorker, std::move(result));
+				return;
+			}
+		}
+
+		function->~FunctionType();
+		DeallocateFunctionData(_peonWorker, function);
+	}
+
+	// Move the function result into the job inline storage (or into memory from the given worker allocator if it doesn't fit),
+	// the result is destroyed like a function that never ran when the job is reused
+	template <typename ResultType>
+	void SetResult(PeonWorker* _peonWorker, ResultType&& _result)
+	{
+		static_assert(alignof(ResultType) <= alignof(std::max_align_t), "Peon: Over-aligned job results aren't supported!");
+
+		if constexpr (sizeof(ResultType) <= PeonJobFunctionStorageSize)
+		{
+			new (m_FunctionStorage) ResultType(std::move(_result));
+			m_FunctionDispatcher = &InlineResultDispatcher<ResultType>;
+		}
+		else
+		{
+			void* resultData = AllocateFunctionData(_peonWorker, sizeof(ResultType));
+			*reinterpret_cast<ResultType**>(m_FunctionStorage) = new (resultData) ResultType(std::move(_result));
+			m_FunctionDispatcher = &AllocatedResultDispatcher<ResultType>;
+		}
+	}
+
+	// The dispatchers for results stored inside the job and allocated by the worker allocator (they are only destroyed)
+	template <typename ResultType>
+	static void InlineResultDispatcher(PeonJob* _job, PeonWorker*, FunctionOperation)
+	{
+		reinterpret_cast<ResultType*>(_job->m_FunctionStorage)->~ResultType();
+	}
+
+	template <typename ResultType>
+	static void AllocatedResultDispatcher(PeonJob* _job, PeonWorker* _peonWorker, FunctionOperation)
+	{
+		ResultType* result = *reinterpret_cast<ResultType**>(_job->m_FunctionStorage);
+		result->~ResultType();
+		DeallocateFunctionData(_peonWorker, result);
+	}
+
+	// Push the given ready dependant jobs into the worker queue (as a single batch) and wake workers to run them
+	static void ReleaseReadyJobs(PeonWorker* _peonWorker, PeonJob** _jobs, uint32_t _totalJobs);
+
+	// Create a job to resume each waiter and push them into the worker queue
+	static void ResumeWaiters(PeonWorker* _peonWorker, PeonJobWaiter* _waiters);
+
+	// Allocate and deallocate memory for functions that don't fit inside the job (a null worker means the calling thread
+	// isn't a worker, the memory comes from the heap)
+	static void* AllocateFunctionData(PeonWorker* _peonWorker, size_t _size);
+	static void DeallocateFunctionData(PeonWorker* _peonWorker, void* _data);
+
+	/////////////////////////////////////////////////////////////////////////////////////////////
+	// DISPATCH LINE - Written by the creator, read by the executor and when walking the parents //
+	/////////////////////////////////////////////////////////////////////////////////////////////
+
+	// The job function storage and its dispatcher
+	alignas(std::max_align_t) unsigned char m_FunctionStorage[PeonJobFunctionStorageSize];
+	FunctionDispatcher m_FunctionDispatcher;
 
 	// The parent job
 	PeonJob* m_ParentJob;
@@ -83,14 +360,59 @@ protected:
 	// The current worker thread
 	PeonWorker* m_CurrentWorkerThread;
 
-	// The total number of jobs that depends on this (and the job array)
-	std::atomic<int32_t> m_TotalJobsThatDependsOnThis;
-	PeonJob* m_JobsThatDependsOnThis[17];
-
 public: // Arrumar public / private
 
+	/////////////////////////////////////////////////////////////////////
+	// COMPLETION LINE - Decremented by every child finishing this job //
+	/////////////////////////////////////////////////////////////////////
+
 	// The number of unfinished jobs
-	std::atomic<int32_t> m_UnfinishedJobs;
+	alignas(PeonCacheLineSize) std::atomic<int32_t> m_UnfinishedJobs;
+
+protected:
+
+	// The number of jobs this one depends on that didn't finish yet (the join counter, it only changes before this job starts
+	// so it never competes with the unfinished counter)
+	std::atomic<int32_t> m_PendingPredecessors;
+
+	// Set when the worker that finished this job doesn't need it anymore (the unfinished counter reaches zero before that,
+	// a waiter could reset the frame and reuse this job while the continuations and the parent are still being processed)
+	std::atomic<bool> m_Completed;
+
+	// The trace label (written by the creator, only read by the tracing when the job runs, there is no room in the other lines)
+	const char* m_Label;
+
+protected:
+
+	//////////////////////////////////////////////////////////////////////////////////
+	// CONTROL LINE - Only used when adding dependencies, recycling and queueing it //
+	//////////////////////////////////////////////////////////////////////////////////
+
+	// The total number of jobs that depends on this (and the out-of-line continuation blocks, kept between uses of this job)
+	alignas(PeonCacheLineSize) std::atomic<int32_t> m_TotalJobsThatDependsOnThis;
+	std::atomic<PeonJobContinuations*> m_Continuations;
+
+	// The suspended coroutines waiting for this job (closed when the job completes)
+	std::atomic<PeonJobWaiter*> m_Waiters;
+
+	// The queue that owns this job storage and the next free job (only used by recyclable jobs)
+	PeonStealingQueue* m_OwnerQueue;
+	PeonJob* m_NextFreeJob;
+
+	// The number of references (one for the execution and one for the creator)
+	std::atomic<int32_t> m_ReferenceCount;
+
+	// If this job should be recycled
+	bool m_Recyclable;
+
+	// The job priority
+	PeonJobPriority m_Priority;
+
+	// The time this job was pushed into a worker queue (only recorded when the lane statistics are enabled)
+	uint64_t m_EnqueueTime;
+
+	// The cancellation token (inherited from the parent)
+	PeonCancellationToken* m_CancellationToken;
 };
 
 // The container type
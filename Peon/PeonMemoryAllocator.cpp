@@ -2,17 +2,21 @@
 // Filename: PeonMemoryAllocator.cpp
 ////////////////////////////////////////////////////////////////////////////////
 #include "PeonMemoryAllocator.h"
+#include "PeonMemoryDepot.h"
 #include "PeonSystem.h"
 #include <chrono>
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 
 __InternalPeon::PeonMemoryAllocator::PeonMemoryAllocator(PeonWorker* _owner) : m_Owner(_owner)
 {
 	// Set the initial data
 	memset(m_MemoryBlockFreeList, 0, sizeof(MemoryBlock*) * std::numeric_limits<IntegerSize>::digits);
 	memset(m_TotalMemoryBlocks, 0, sizeof(IntegerSize) * std::numeric_limits<IntegerSize>::digits);
-	m_DeallocationChain = nullptr;
+	memset(m_TotalFreeMemoryBlocks, 0, sizeof(IntegerSize) * std::numeric_limits<IntegerSize>::digits);
+	m_RemoteDeallocationList = nullptr;
+	m_MemoryDepot = nullptr;
 
 #ifdef _DEBUG 
 	memset(m_TotalUsedMemoryBlocks, 0, sizeof(IntegerSize) * std::numeric_limits<IntegerSize>::digits);
@@ -25,7 +29,8 @@ __InternalPeon::PeonMemoryAllocator::PeonMemoryAllocator(const __InternalPeon::P
 
 __InternalPeon::PeonMemoryAllocator::~PeonMemoryAllocator()
 {
-	// Call the validate method (check for any leaks)
+	// Take back the blocks freed by other threads, then call the validate method (check for any leaks)
+	ReclaimRemoteBlocks();
 	Validate(true);
 }
 
@@ -53,11 +58,16 @@ void __InternalPeon::PeonMemoryAllocator::DeallocateData(char* _data)
 	// Get the memory block from this data
 	MemoryBlock* block = CastBlockFromData((char*)_data);
 
+	// Blocks allocated by external threads go back to the heap
+	if (block->workerOwner == nullptr)
+	{
+		delete[] (char*)block;
+	}
 	// Check if this block can be deallocated by this allocator (compare the owners)
-	if (block->workerOwner != m_Owner)
+	else if (block->workerOwner != m_Owner)
 	{
-		// Push this block to a future deallocation
-		PushDeallocationBlock(block);
+		// Hand it back to the owner, it will take it when the size class runs dry
+		block->workerOwner->GetMemoryAllocator().PushRemoteDeallocationBlock(block);
 	}
 	else
 	{
@@ -66,6 +76,33 @@ void __InternalPeon::PeonMemoryAllocator::DeallocateData(char* _data)
 	}
 }
 
+char* __InternalPeon::PeonMemoryAllocator::AllocateExternalData(IntegerSize _amount)
+{
+	// A single block with the exact size, it's never reused
+	MemoryBlock* block = (MemoryBlock*)new char[sizeof(MemoryBlock) + _amount];
+	block->workerOwner = nullptr;
+	block->totalMemory = _amount;
+	block->nextBlock = nullptr;
+
+	return (char*)block + sizeof(MemoryBlock);
+}
+
+void __InternalPeon::PeonMemoryAllocator::DeallocateExternalData(char* _data)
+{
+	// Get the memory block from this data
+	MemoryBlock* block = (MemoryBlock*)(_data - sizeof(MemoryBlock));
+
+	// Blocks allocated by external threads go back to the heap, the others are handed back to their owner
+	if (block->workerOwner == nullptr)
+	{
+		delete[] (char*)block;
+	}
+	else
+	{
+		block->workerOwner->GetMemoryAllocator().PushRemoteDeallocationBlock(block);
+	}
+}
+
 void __InternalPeon::PeonMemoryAllocator::DeallocateBlock(MemoryBlock* _block)
 {
 	// Determine the block index
@@ -81,32 +118,137 @@ void __InternalPeon::PeonMemoryAllocator::DeallocateBlock(MemoryBlock* _block)
 	// Decrement the total used blocks
 	m_TotalUsedMemoryBlocks[blockIndex]--;
 #endif
+
+	// Give the surplus to the depot while we hold more than 3 magazines, checked once every magazine worth of frees so a full
+	// depot costs nothing (we keep 2 so a worker that frees and allocates around the limit doesn't go back and forth, the
+	// magazine sizes are powers of 2)
+	uint32_t magazineSize = GetMagazineSize(blockIndex);
+	if (++m_TotalFreeMemoryBlocks[blockIndex] >= 3 * magazineSize && (m_TotalFreeMemoryBlocks[blockIndex] & (magazineSize - 1)) == 0)
+	{
+		ExportMagazine(blockIndex);
+	}
 }
 
-void __InternalPeon::PeonMemoryAllocator::ReleaseDeallocationChain()
+void __InternalPeon::PeonMemoryAllocator::ReclaimRemoteBlocks()
 {
-	// Until we each the list end
-	while (m_DeallocationChain != nullptr)
+	// Take back our blocks freed by other threads (the whole list at once)
+	MemoryBlock* remoteBlock = m_RemoteDeallocationList.exchange(nullptr, std::memory_order_acquire);
+	while (remoteBlock != nullptr)
 	{
-		// Get the block owner
-		auto* blockOwner = m_DeallocationChain->workerOwner;
+		MemoryBlock* nextBlock = remoteBlock->nextBlock;
+		DeallocateBlock(remoteBlock);
+		remoteBlock = nextBlock;
+	}
+}
 
-		// Get the block itself
-		auto* block = m_DeallocationChain;
+void __InternalPeon::PeonMemoryAllocator::SetMemoryDepot(PeonMemoryDepot* _memoryDepot)
+{
+	m_MemoryDepot = _memoryDepot;
+}
 
-		// Set the new root
-		m_DeallocationChain = block->nextBlock;
+void __InternalPeon::PeonMemoryAllocator::ExportMagazine(IntegerSize _blockIndex)
+{
+	// Cut the magazine from the top of the free list
+	uint32_t magazineSize = GetMagazineSize(_blockIndex);
+	MemoryBlock* magazine = m_MemoryBlockFreeList[_blockIndex];
+	MemoryBlock* lastBlock = magazine;
+	for (uint32_t i = 1; i < magazineSize; i++)
+	{
+		lastBlock = lastBlock->nextBlock;
+	}
 
-		// Deallocate the block
-		blockOwner->GetMemoryAllocator().DeallocateBlock(block);
+	MemoryBlock* remainingBlocks = lastBlock->nextBlock;
+	lastBlock->nextBlock = nullptr;
+
+	// Keep the blocks if the depot is full
+	if (!m_MemoryDepot->PushMagazine(_blockIndex, magazine))
+	{
+		lastBlock->nextBlock = remainingBlocks;
+		return;
 	}
+
+	m_MemoryBlockFreeList[_blockIndex] = remainingBlocks;
+	m_TotalMemoryBlocks[_blockIndex] -= magazineSize;
+	m_TotalFreeMemoryBlocks[_blockIndex] -= magazineSize;
 }
 
-void __InternalPeon::PeonMemoryAllocator::PushDeallocationBlock(MemoryBlock* _block)
+bool __InternalPeon::PeonMemoryAllocator::ImportMagazine(IntegerSize _blockIndex)
 {
-	// Insert this block into the list
-	_block->nextBlock = m_DeallocationChain;
-	m_DeallocationChain = _block;
+	MemoryBlock* magazine = m_MemoryDepot->PopMagazine(_blockIndex);
+	if (magazine == nullptr)
+	{
+		return false;
+	}
+
+	// The blocks are ours now (a trim could have left fewer blocks than a full magazine)
+	uint32_t magazineSize = 1;
+	MemoryBlock* lastBlock = magazine;
+	lastBlock->workerOwner = m_Owner;
+	while (lastBlock->nextBlock != nullptr)
+	{
+		lastBlock = lastBlock->nextBlock;
+		lastBlock->workerOwner = m_Owner;
+		magazineSize++;
+	}
+
+	lastBlock->nextBlock = m_MemoryBlockFreeList[_blockIndex];
+	m_MemoryBlockFreeList[_blockIndex] = magazine;
+	m_TotalMemoryBlocks[_blockIndex] += magazineSize;
+	m_TotalFreeMemoryBlocks[_blockIndex] += magazineSize;
+
+	return true;
+}
+
+bool __InternalPeon::PeonMemoryAllocator::AllocateChunk(PeonWorker* _owner, IntegerSize _amount, IntegerSize _blockIndex)
+{
+	assert(m_MemoryDepot != nullptr && "Peon: The memory allocator doesn't have a depot!");
+
+	// Determine the amount of blocks that should be allocated
+	uint32_t totalBlocksToAllocate = _amount >= LargeBlockSize ? 1 : std::max(MinimumBlocksAllocated, (uint32_t)(m_TotalMemoryBlocks[_blockIndex] * 1.7));
+
+	// Reserve the chunk (it can fit a few more blocks)
+	PeonMemoryDepot::MemoryChunk* chunk = m_MemoryDepot->AllocateChunk(_amount, totalBlocksToAllocate);
+	if (chunk == nullptr)
+	{
+		return false;
+	}
+
+	// Block map method
+	char* chunkData = (char*)chunk + sizeof(PeonMemoryDepot::MemoryChunk);
+	auto MapMemoryBlock = [chunkData, _amount](uint32_t _index)
+	{
+		return (MemoryBlock*)&chunkData[size_t(_amount) * _index];
+	};
+
+	// For each memory block
+	for (uint32_t i = 0; i < chunk->totalBlocks; i++)
+	{
+		// Cast to the current block
+		MemoryBlock* currentBlock = MapMemoryBlock(i);
+
+		// Set the block data
+		currentBlock->totalMemory = _amount;
+		currentBlock->workerOwner = _owner;
+		currentBlock->chunkIndex = i;
+		currentBlock->nextBlock = (i + 1) < chunk->totalBlocks ? MapMemoryBlock(i + 1) : m_MemoryBlockFreeList[_blockIndex];
+	}
+
+	// Set the new root block and increment the total memory blocks
+	m_MemoryBlockFreeList[_blockIndex] = MapMemoryBlock(0);
+	m_TotalMemoryBlocks[_blockIndex] += chunk->totalBlocks;
+	m_TotalFreeMemoryBlocks[_blockIndex] += chunk->totalBlocks;
+
+	return true;
+}
+
+void __InternalPeon::PeonMemoryAllocator::PushRemoteDeallocationBlock(MemoryBlock* _block)
+{
+	// We take the entire list at once so there is no ABA problem
+	MemoryBlock* remoteList = m_RemoteDeallocationList.load(std::memory_order_relaxed);
+	do
+	{
+		_block->nextBlock = remoteList;
+	} while (!m_RemoteDeallocationList.compare_exchange_weak(remoteList, _block, std::memory_order_release, std::memory_order_relaxed));
 }
 
 __InternalPeon::PeonMemoryAllocator::IntegerSize __InternalPeon::PeonMemoryAllocator::DetermineCorrectBlock(IntegerSize& _amount)
@@ -131,61 +273,34 @@ __InternalPeon::PeonMemoryAllocator::IntegerSize __InternalPeon::PeonMemoryAlloc
 
 __InternalPeon::PeonMemoryAllocator::MemoryBlock* __InternalPeon::PeonMemoryAllocator::AllocateBlock(PeonWorker* _owner, IntegerSize _amount, IntegerSize _blockIndex)
 {
-	// Get the memory block list
-	MemoryBlock* blockList = m_MemoryBlockFreeList[_blockIndex];
-
-	// Check if this block is valid
-	if (blockList != nullptr)
-	{
-		// Point to the next block
-		m_MemoryBlockFreeList[_blockIndex] = blockList->nextBlock;
-
-	#ifdef _DEBUG 
-		// Increment the total used blocks
-		m_TotalUsedMemoryBlocks[_blockIndex]++;
-	#endif
-
-		return blockList;
-	}
-
-	// Determine the amount of blocks that should be allocated
-	uint32_t totalBlocksToAllocate = std::max(MinimumBlocksAllocated, (uint32_t)(m_TotalMemoryBlocks[_blockIndex] * 1.7));
-
-	// Block map method
-	auto MapMemoryBlock = [](char* _data, uint32_t _size, uint32_t _index)
+	// Refill the free list if it's empty (producer/consumer patterns would grow without bound if we didn't take back the
+	// blocks other threads freed first)
+	if (m_MemoryBlockFreeList[_blockIndex] == nullptr)
 	{
-		char* dataLocated = &_data[_size * _index];
-		MemoryBlock* blockCasted = (MemoryBlock*)dataLocated;
-		return blockCasted;
-	};
-
-	// Allocate all blocks
-	char* allocatedData = new char[totalBlocksToAllocate * _amount];
+		if (m_RemoteDeallocationList.load(std::memory_order_relaxed) != nullptr)
+		{
+			ReclaimRemoteBlocks();
+		}
 
-	// For each memory block
-	for (unsigned i = 0; i < totalBlocksToAllocate; i++)
-	{
-		// Cast to the current block
-		MemoryBlock* currentBlock = MapMemoryBlock(allocatedData, _amount, i);
-		
-		// Set the block data
-		currentBlock->totalMemory = _amount;
-		currentBlock->workerOwner = _owner;
-		currentBlock->nextBlock = (i + 1) < totalBlocksToAllocate ? MapMemoryBlock(allocatedData, _amount, i + 1) : nullptr;
+		if (m_MemoryBlockFreeList[_blockIndex] == nullptr && !ImportMagazine(_blockIndex) && !AllocateChunk(_owner, _amount, _blockIndex))
+		{
+			return nullptr;
+		}
 	}
 
-	// Increment the total memory blocks
-	m_TotalMemoryBlocks[_blockIndex] += totalBlocksToAllocate;
+	// Get the memory block list
+	MemoryBlock* blockList = m_MemoryBlockFreeList[_blockIndex];
 
-	// Set the new root block
-	m_MemoryBlockFreeList[_blockIndex] = MapMemoryBlock(allocatedData, _amount, 1);
+	// Point to the next block
+	m_MemoryBlockFreeList[_blockIndex] = blockList->nextBlock;
+	m_TotalFreeMemoryBlocks[_blockIndex]--;
 
 #ifdef _DEBUG 
 	// Increment the total used blocks
 	m_TotalUsedMemoryBlocks[_blockIndex]++;
 #endif
 
-	return MapMemoryBlock(allocatedData, _amount, 0);
+	return blockList;
 }
 
 __InternalPeon::PeonMemoryAllocator::MemoryBlock* __InternalPeon::PeonMemoryAllocator::CastBlockFromData(char* _data)
@@ -233,5 +348,8 @@ void __InternalPeon::PeonMemoryAllocator::Validate(bool _destructorCheck)
 		// Check the count
 		assert(m_TotalMemoryBlocks[i] == count);
 #endif
+
+		// Check the free count
+		assert(m_TotalFreeMemoryBlocks[i] == count && "Peon: The free memory block count doesn't match the list count!");
 	}
 }
\ No newline at end of file
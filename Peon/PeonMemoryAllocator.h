@@ -8,6 +8,10 @@
 //////////////
 #include "PeonConfig.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
 #include <iostream>
 #include <chrono>
 #include <thread>
@@ -30,6 +34,7 @@ PeonNamespaceBegin(__InternalPeon)
 // We know the job system
 class PeonSystem;
 class PeonWorker;
+class PeonMemoryDepot;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Class name: PeonMemoryAllocator
@@ -41,12 +46,20 @@ private:
 	// All friend classes
 	friend PeonSystem;
 	friend PeonWorker;
+	friend PeonMemoryDepot;
 
 	// The integer size used
 	using IntegerSize = uint32_t;
 
 	// The minimum number of blocks the should be allocated
-	static const uint32_t MinimumBlocksAllocated = 10;
+	static constexpr uint32_t MinimumBlocksAllocated = 10;
+
+	// Blocks starting at this size are allocated one at a time (big scratch buffers shouldn't reserve 10 times their size)
+	static constexpr uint32_t LargeBlockSize = 1 << 16;
+
+	// The blocks exchanged with the depot at once are limited by size and count (at least a single block)
+	static constexpr uint32_t MagazineBytes = 1 << 14;
+	static constexpr uint32_t MaximumMagazineBlocks = 64;
 
 	// Next power of 2 rounded up
 	inline IntegerSize pow2roundup(IntegerSize x)
@@ -74,8 +87,8 @@ private:
 		// The next memory block
 		MemoryBlock* nextBlock;
 
-		// Padding
-		uint32_t padding;
+		// The block index inside its chunk
+		uint32_t chunkIndex;
 	};
 
 public:
@@ -90,26 +103,51 @@ public: //////////
 	// Allocate x amount of data
 	char* AllocateData(PeonWorker* _owner, IntegerSize _amount);
 
-	// Deallocate the input block
+	// Deallocate the input block (blocks owned by another worker are pushed into its remote list)
 	void DeallocateData(char* _data);
 
+	// Allocate x amount of data for a thread that isn't a worker (those blocks come directly from the heap and have no owner)
+	static char* AllocateExternalData(IntegerSize _amount);
+
+	// Deallocate the input block from a thread that isn't a worker (blocks owned by a worker are handed back to it)
+	static void DeallocateExternalData(char* _data);
+
 protected:
 
 	// Deallocate a block
 	void DeallocateBlock(MemoryBlock* _block);
 
-	// Release our deallocation chain and make each block be deallocated by the correct owner
-	void ReleaseDeallocationChain();
+	// Take back every block other threads freed into our remote list (only the owner, or the system while no job is running)
+	void ReclaimRemoteBlocks();
+
+	// Set the depot shared by the workers of the same system (must be set before allocating)
+	void SetMemoryDepot(PeonMemoryDepot* _memoryDepot);
 
 private:
 
-	// Push a deallocation block (that aren't ours and must be deallocated by the System)
-	void PushDeallocationBlock(MemoryBlock* _block);
+	// Return the number of blocks in a magazine of the given size class
+	uint32_t GetMagazineSize(IntegerSize _blockIndex)
+	{
+		return std::min(std::max(MagazineBytes >> _blockIndex, 1u), MaximumMagazineBlocks);
+	}
+
+	// Give a magazine from our surplus free blocks to the depot
+	void ExportMagazine(IntegerSize _blockIndex);
+
+	// Take a magazine from the depot into our free list, return false if there is none
+	bool ImportMagazine(IntegerSize _blockIndex);
+
+	// Reserve a new chunk and put its blocks into our free list, return false if the system is out of memory
+	bool AllocateChunk(PeonWorker* _owner, IntegerSize _amount, IntegerSize _blockIndex);
+
+	// Push one of our blocks freed by another thread (can be called from any thread, a single compare and swap)
+	void PushRemoteDeallocationBlock(MemoryBlock* _block);
 
 	// Determine the correct block index that should be used for the amount of data needed (also adjust he input memory to the correct size)
 	IntegerSize DetermineCorrectBlock(IntegerSize& _amount);
 
-	// Allocate a block
+	// Allocate a block (the free list is refilled with our blocks freed by other threads, then with a magazine from the depot
+	// and only then with a new chunk)
 	MemoryBlock* AllocateBlock(PeonWorker* _owner, IntegerSize _amount, IntegerSize _blockIndex);
 
 	// Cast data to block
@@ -139,17 +177,22 @@ private: //////
 	// The memory block free list
 	MemoryBlock* m_MemoryBlockFreeList[std::numeric_limits<IntegerSize>::digits];
 
-	// The total number of blocks
+	// The total number of blocks and the number of free ones (only counts the blocks we hold, the ones in the depot belong to
+	// nobody)
 	IntegerSize m_TotalMemoryBlocks[std::numeric_limits<IntegerSize>::digits];
+	IntegerSize m_TotalFreeMemoryBlocks[std::numeric_limits<IntegerSize>::digits];
+
+	// The depot shared by the workers of the same system (it owns the chunks)
+	PeonMemoryDepot* m_MemoryDepot;
 
 #ifdef _DEBUG 
 	// The total number of used blocks
 	IntegerSize m_TotalUsedMemoryBlocks[std::numeric_limits<IntegerSize>::digits];
 #endif
 
-	// The deallocation chain (those blocks aren't from the owner Worker, wi will retain those until the System tell us to
-	// deallocate them using the correct Worker
-	MemoryBlock* m_DeallocationChain;
+	// Our blocks freed by other threads (many producers, we are the only consumer and take the whole list at once when a
+	// size class runs dry), on its own cache line so the producers don't slow down our free lists
+	alignas(PeonCacheLineSize) std::atomic<MemoryBlock*> m_RemoteDeallocationList;
 };
 
 // __InternalPeon
@@ -0,0 +1,276 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonMemoryDepot.cpp
+////////////////////////////////////////////////////////////////////////////////
+#include "PeonMemoryDepot.h"
+#include "PeonWorker.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+///////////////
+// NAMESPACE //
+///////////////
+
+__InternalPeon::PeonMemoryDepot::PeonMemoryDepot()
+{
+	// Set the initial data
+	for (auto& magazines : m_Magazines)
+	{
+		for (auto& magazine : magazines)
+		{
+			magazine = nullptr;
+		}
+	}
+
+	m_Chunks = nullptr;
+	m_ReservedMemory = 0;
+
+#if defined(_WIN32)
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	m_PageSize = size_t(systemInfo.dwPageSize);
+#else
+	m_PageSize = size_t(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+__InternalPeon::PeonMemoryDepot::PeonMemoryDepot(const __InternalPeon::PeonMemoryDepot& other)
+{
+}
+
+__InternalPeon::PeonMemoryDepot::~PeonMemoryDepot()
+{
+	// Release every chunk (nobody can be using the blocks anymore)
+	while (m_Chunks != nullptr)
+	{
+		MemoryChunk* chunk = m_Chunks;
+		m_Chunks = chunk->nextChunk;
+		ReleaseMemory(chunk, chunk->totalBytes);
+	}
+}
+
+__InternalPeon::PeonMemoryDepot::MemoryChunk* __InternalPeon::PeonMemoryDepot::AllocateChunk(uint32_t _blockSize, uint32_t _totalBlocks)
+{
+	// Round up to whole pages, the blocks fill the extra space
+	size_t totalBytes = sizeof(MemoryChunk) + size_t(_blockSize) * _totalBlocks;
+	totalBytes = (totalBytes + m_PageSize - 1) / m_PageSize * m_PageSize;
+
+	MemoryChunk* chunk = (MemoryChunk*)ReserveMemory(totalBytes);
+	if (chunk == nullptr)
+	{
+		return nullptr;
+	}
+
+	chunk->totalBytes = totalBytes;
+	chunk->blockSize = _blockSize;
+	chunk->totalBlocks = uint32_t((totalBytes - sizeof(MemoryChunk)) / _blockSize);
+	chunk->freeBlocks = 0;
+
+	// Register the chunk
+	std::lock_guard<std::mutex> lock(m_ChunkMutex);
+	chunk->nextChunk = m_Chunks;
+	m_Chunks = chunk;
+	m_ReservedMemory.fetch_add(totalBytes, std::memory_order_relaxed);
+
+	return chunk;
+}
+
+bool __InternalPeon::PeonMemoryDepot::PushMagazine(uint32_t _blockIndex, MemoryBlock* _magazine)
+{
+	// Take the first empty slot
+	for (auto& magazine : m_Magazines[_blockIndex])
+	{
+		MemoryBlock* emptyMagazine = nullptr;
+		if (magazine.load(std::memory_order_relaxed) == nullptr && magazine.compare_exchange_strong(emptyMagazine, _magazine, std::memory_order_release, std::memory_order_relaxed))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+__InternalPeon::PeonMemoryDepot::MemoryBlock* __InternalPeon::PeonMemoryDepot::PopMagazine(uint32_t _blockIndex)
+{
+	// Take the first magazine we find
+	for (auto& magazine : m_Magazines[_blockIndex])
+	{
+		if (magazine.load(std::memory_order_relaxed) != nullptr)
+		{
+			MemoryBlock* fullMagazine = magazine.exchange(nullptr, std::memory_order_acquire);
+			if (fullMagazine != nullptr)
+			{
+				return fullMagazine;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+void __InternalPeon::PeonMemoryDepot::Trim(PeonWorker* _workers, uint32_t _totalWorkers)
+{
+	std::lock_guard<std::mutex> lock(m_ChunkMutex);
+
+	// Take back the blocks freed by other threads, every free block must be in a free list or in a magazine
+	for (uint32_t i = 0; i < _totalWorkers; i++)
+	{
+		_workers[i].GetMemoryAllocator().ReclaimRemoteBlocks();
+	}
+
+	// Count the free blocks of each chunk
+	for (MemoryChunk* chunk = m_Chunks; chunk != nullptr; chunk = chunk->nextChunk)
+	{
+		chunk->freeBlocks = 0;
+	}
+
+	auto CountFreeBlock = [](MemoryBlock* _block) { GetChunk(_block)->freeBlocks++; };
+	for (uint32_t i = 0; i < _totalWorkers; i++)
+	{
+		for (MemoryBlock* freeList : _workers[i].GetMemoryAllocator().m_MemoryBlockFreeList)
+		{
+			ForEachBlock(freeList, CountFreeBlock);
+		}
+	}
+
+	for (auto& magazines : m_Magazines)
+	{
+		for (auto& magazine : magazines)
+		{
+			ForEachBlock(magazine.load(std::memory_order_relaxed), CountFreeBlock);
+		}
+	}
+
+	// Take the blocks of the completely free chunks out of the free lists and the magazines (the free lists own their blocks)
+	for (uint32_t i = 0; i < _totalWorkers; i++)
+	{
+		PeonMemoryAllocator& memoryAllocator = _workers[i].GetMemoryAllocator();
+		for (int j = 0; j < std::numeric_limits<uint32_t>::digits; j++)
+		{
+			uint32_t removedBlocks = RemoveReleasedBlocks(memoryAllocator.m_MemoryBlockFreeList[j]);
+			memoryAllocator.m_TotalMemoryBlocks[j] -= removedBlocks;
+			memoryAllocator.m_TotalFreeMemoryBlocks[j] -= removedBlocks;
+		}
+	}
+
+	for (auto& magazines : m_Magazines)
+	{
+		for (auto& magazine : magazines)
+		{
+			MemoryBlock* blocks = magazine.load(std::memory_order_relaxed);
+			RemoveReleasedBlocks(blocks);
+			magazine.store(blocks, std::memory_order_relaxed);
+		}
+	}
+
+	// Release the free chunks
+	MemoryChunk** chunkLink = &m_Chunks;
+	while (*chunkLink != nullptr)
+	{
+		MemoryChunk* chunk = *chunkLink;
+		if (chunk->freeBlocks == chunk->totalBlocks)
+		{
+			*chunkLink = chunk->nextChunk;
+			m_ReservedMemory.fetch_sub(chunk->totalBytes, std::memory_order_relaxed);
+			ReleaseMemory(chunk, chunk->totalBytes);
+		}
+		else
+		{
+			chunkLink = &chunk->nextChunk;
+		}
+	}
+
+	// The remaining big free blocks keep their address space but give their pages back
+	auto DiscardFreeBlock = [this](MemoryBlock* _block) { DiscardBlockPages(_block); };
+	for (uint32_t i = 0; i < _totalWorkers; i++)
+	{
+		for (MemoryBlock* freeList : _workers[i].GetMemoryAllocator().m_MemoryBlockFreeList)
+		{
+			if (freeList != nullptr && freeList->totalMemory >= 2 * m_PageSize)
+			{
+				ForEachBlock(freeList, DiscardFreeBlock);
+			}
+		}
+	}
+
+	for (auto& magazines : m_Magazines)
+	{
+		for (auto& magazine : magazines)
+		{
+			MemoryBlock* blocks = magazine.load(std::memory_order_relaxed);
+			if (blocks != nullptr && blocks->totalMemory >= 2 * m_PageSize)
+			{
+				ForEachBlock(blocks, DiscardFreeBlock);
+			}
+		}
+	}
+}
+
+uint64_t __InternalPeon::PeonMemoryDepot::GetReservedMemory()
+{
+	return m_ReservedMemory.load(std::memory_order_relaxed);
+}
+
+uint32_t __InternalPeon::PeonMemoryDepot::RemoveReleasedBlocks(MemoryBlock*& _list)
+{
+	uint32_t removedBlocks = 0;
+	MemoryBlock** blockLink = &_list;
+	while (*blockLink != nullptr)
+	{
+		MemoryBlock* block = *blockLink;
+		MemoryChunk* chunk = GetChunk(block);
+		if (chunk->freeBlocks == chunk->totalBlocks)
+		{
+			*blockLink = block->nextBlock;
+			removedBlocks++;
+		}
+		else
+		{
+			blockLink = &block->nextBlock;
+		}
+	}
+
+	return removedBlocks;
+}
+
+void __InternalPeon::PeonMemoryDepot::DiscardBlockPages(MemoryBlock* _block)
+{
+	// Only the whole pages after the one holding the header
+	uintptr_t begin = ((uintptr_t)_block + sizeof(MemoryBlock) + m_PageSize - 1) / m_PageSize * m_PageSize;
+	uintptr_t end = ((uintptr_t)_block + _block->totalMemory) / m_PageSize * m_PageSize;
+	if (end <= begin)
+	{
+		return;
+	}
+
+#if defined(_WIN32)
+	VirtualAlloc((void*)begin, end - begin, MEM_RESET, PAGE_READWRITE);
+#else
+	madvise((void*)begin, end - begin, MADV_DONTNEED);
+#endif
+}
+
+void* __InternalPeon::PeonMemoryDepot::ReserveMemory(size_t _totalBytes)
+{
+#if defined(_WIN32)
+	return VirtualAlloc(nullptr, _totalBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	void* memory = mmap(nullptr, _totalBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return memory != MAP_FAILED ? memory : nullptr;
+#endif
+}
+
+void __InternalPeon::PeonMemoryDepot::ReleaseMemory(void* _memory, size_t _totalBytes)
+{
+#if defined(_WIN32)
+	VirtualFree(_memory, 0, MEM_RELEASE);
+#else
+	munmap(_memory, _totalBytes);
+#endif
+}
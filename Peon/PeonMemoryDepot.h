@@ -0,0 +1,133 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonMemoryDepot.h
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+//////////////
+// INCLUDES //
+//////////////
+#include "PeonConfig.h"
+#include "PeonMemoryAllocator.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+
+/////////////
+// DEFINES //
+/////////////
+
+///////////////
+// NAMESPACE //
+///////////////
+
+// __InternalPeon
+PeonNamespaceBegin(__InternalPeon)
+
+// We know the worker
+class PeonWorker;
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: PeonMemoryDepot
+////////////////////////////////////////////////////////////////////////////////
+class PeonMemoryDepot
+{
+public:
+
+	// The memory block type
+	using MemoryBlock = PeonMemoryAllocator::MemoryBlock;
+
+	// The number of magazines the depot holds for each size class (when it's full the surplus blocks stay with their worker)
+	static constexpr uint32_t MagazineSlots = 32;
+
+	// A chunk of blocks reserved from the system, the blocks follow the header (a block finds its chunk using its index)
+	struct alignas(PeonCacheLineSize) MemoryChunk
+	{
+		// The next chunk
+		MemoryChunk* nextChunk;
+
+		// The reserved bytes (including the header)
+		size_t totalBytes;
+
+		// The block size and the number of blocks
+		uint32_t blockSize;
+		uint32_t totalBlocks;
+
+		// The free blocks found by the current trim
+		uint32_t freeBlocks;
+	};
+
+public:
+	PeonMemoryDepot();
+	PeonMemoryDepot(const PeonMemoryDepot&);
+	~PeonMemoryDepot();
+
+//////////////////
+// MAIN METHODS //
+public: //////////
+
+	// Reserve a chunk with room for at least the given number of blocks (the chunk is rounded up to whole pages and filled
+	// with blocks), return null if the system is out of memory
+	MemoryChunk* AllocateChunk(uint32_t _blockSize, uint32_t _totalBlocks);
+
+	// Push a magazine (free blocks of the same size class linked by their headers), return false if the depot is full (can be
+	// called from any thread)
+	bool PushMagazine(uint32_t _blockIndex, MemoryBlock* _magazine);
+
+	// Take any magazine of the given size class, null if there is none (can be called from any thread)
+	MemoryBlock* PopMagazine(uint32_t _blockIndex);
+
+	// Release every chunk that is completely free back to the system and discard the pages inside the other big free blocks,
+	// no job can be running (the free lists of every worker are changed)
+	void Trim(PeonWorker* _workers, uint32_t _totalWorkers);
+
+	// Return the number of bytes reserved by the chunks
+	uint64_t GetReservedMemory();
+
+	// Return the chunk a block belongs to
+	static MemoryChunk* GetChunk(MemoryBlock* _block)
+	{
+		return (MemoryChunk*)((char*)_block - size_t(_block->chunkIndex) * _block->totalMemory - sizeof(MemoryChunk));
+	}
+
+private:
+
+	// Call the function for each block in the list
+	template <typename FunctionType>
+	void ForEachBlock(MemoryBlock* _list, FunctionType _function)
+	{
+		for (MemoryBlock* block = _list; block != nullptr; block = block->nextBlock)
+		{
+			_function(block);
+		}
+	}
+
+	// Remove the blocks from chunks that will be released, return the number of removed blocks
+	uint32_t RemoveReleasedBlocks(MemoryBlock*& _list);
+
+	// Give the pages inside a free block back to the system (the first page keeps the block header), they come back zeroed
+	// when touched again
+	void DiscardBlockPages(MemoryBlock* _block);
+
+	// Reserve and release memory from the system
+	void* ReserveMemory(size_t _totalBytes);
+	void ReleaseMemory(void* _memory, size_t _totalBytes);
+
+///////////////
+// VARIABLES //
+private: //////
+
+	// The magazines for each size class (an empty slot is null, taking a magazine swaps it for null so there is no ABA problem)
+	std::atomic<MemoryBlock*> m_Magazines[std::numeric_limits<uint32_t>::digits][MagazineSlots];
+
+	// Every reserved chunk, the number of reserved bytes and the system page size
+	std::mutex m_ChunkMutex;
+	MemoryChunk* m_Chunks;
+	std::atomic<uint64_t> m_ReservedMemory;
+	size_t m_PageSize;
+};
+
+// __InternalPeon
+PeonNamespaceEnd(__InternalPeon)
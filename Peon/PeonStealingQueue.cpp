@@ -9,21 +9,66 @@
 // NAMESPACE //
 ///////////////
 
+__InternalPeon::PeonStealingQueue::DequeArray::DequeArray(long _size, DequeArray* _retiredArray)
+{
+	size = _size;
+	mask = _size - 1;
+	jobs = new std::atomic<PeonJob*>[_size];
+	retiredArray = _retiredArray;
+}
+
+__InternalPeon::PeonStealingQueue::DequeArray::~DequeArray()
+{
+	delete[] jobs;
+	delete retiredArray;
+}
+
+__InternalPeon::PeonJob* __InternalPeon::PeonStealingQueue::DequeArray::Get(long _index)
+{
+	return jobs[_index & mask].load(std::memory_order_relaxed);
+}
+
+void __InternalPeon::PeonStealingQueue::DequeArray::Put(long _index, PeonJob* _job)
+{
+	jobs[_index & mask].store(_job, std::memory_order_relaxed);
+}
+
 __InternalPeon::PeonStealingQueue::PeonStealingQueue()
 {
+	// Set the initial data
+	m_RingBuffer = nullptr;
+	m_DequeArray = nullptr;
+	m_FreeJobList = nullptr;
+	m_RemoteFreeJobList = nullptr;
+	m_TotalAllocatedJobs = 0;
 }
 
 __InternalPeon::PeonStealingQueue::PeonStealingQueue(const __InternalPeon::PeonStealingQueue& other)
 {
+	// Set the initial data
+	m_RingBuffer = nullptr;
+	m_DequeArray = nullptr;
+	m_FreeJobList = nullptr;
+	m_RemoteFreeJobList = nullptr;
+	m_TotalAllocatedJobs = 0;
 }
 
 __InternalPeon::PeonStealingQueue::~PeonStealingQueue()
 {
+	// Release the deque array (and all retired ones)
+	delete m_DequeArray.load();
+
+	// Release the ring buffer and the job chunks
+	delete[] m_RingBuffer;
+	for (auto* jobChunk : m_JobChunks)
+	{
+		delete[] jobChunk;
+	}
 }
 
 #define QueueMask(bufferSize)	(((unsigned long)bufferSize) - 1u)
 
-bool __InternalPeon::PeonStealingQueue::Initialize(unsigned int _bufferSize)
+bool __InternalPeon::PeonStealingQueue::Initialize(unsigned int _bufferSize, unsigned int _initialDequeSize, PeonJobStorageMode _storageMode)
 {
 #ifdef JobWorkerDebug
 
@@ -32,12 +77,26 @@ bool __InternalPeon::PeonStealingQueue::Initialize(unsigned int _bufferSize)
 
 #endif
 
-    // Set the size and allocate the ring buffer
+    // Set the size and the storage mode
     m_BufferSize = _bufferSize;
-    m_RingBuffer = new PeonJob[_bufferSize];
+	m_StorageMode = _storageMode;
 
-    // Set the deque size (allocate memory for it)
-    m_DequeBuffer = new PeonJob*[_bufferSize];
+	// Allocate the ring buffer or the first job chunk (if this queue has job storage)
+	if (_bufferSize == 0)
+	{
+		// No job storage
+	}
+	else if (m_StorageMode == PeonJobStorageMode::FrameRingBuffer)
+	{
+		m_RingBuffer = new PeonJob[_bufferSize];
+	}
+	else
+	{
+		AllocateJobChunk();
+	}
+
+    // Allocate the initial deque array
+    m_DequeArray = new DequeArray(std::max(_initialDequeSize, 2u), nullptr);
 
     // Set the initial position
     m_RingBufferPosition = 0;
@@ -46,6 +105,10 @@ bool __InternalPeon::PeonStealingQueue::Initialize(unsigned int _bufferSize)
     m_Top = 0;
     m_Bottom = 0;
 
+	// Set the statistics
+	m_HighWaterMark = 0;
+	m_TotalGrows = 0;
+
 	return true;
 }
 
@@ -58,10 +121,66 @@ __InternalPeon::PeonJob* __InternalPeon::PeonStealingQueue::GetFreshJob()
 
 #endif
 
+	// Check if we should use the free list
+	if (m_StorageMode == PeonJobStorageMode::Recycling)
+	{
+		// If our local list is empty, take everything other threads returned to us
+		if (m_FreeJobList == nullptr)
+		{
+			m_FreeJobList = m_RemoteFreeJobList.exchange(nullptr, std::memory_order_acquire);
+
+			// Still empty, we need more jobs
+			if (m_FreeJobList == nullptr)
+			{
+				AllocateJobChunk();
+			}
+		}
+
+		PeonJob* job = m_FreeJobList;
+		m_FreeJobList = job->m_NextFreeJob;
+
+		return job;
+	}
+
     const long index = m_RingBufferPosition++;
     return &m_RingBuffer[(index-1u) & QueueMask(m_BufferSize)];
 }
 
+void __InternalPeon::PeonStealingQueue::ReturnJob(PeonJob* _job, bool _isOwnerThread)
+{
+	// Local path, no synchronization needed
+	if (_isOwnerThread)
+	{
+		_job->m_NextFreeJob = m_FreeJobList;
+		m_FreeJobList = _job;
+		return;
+	}
+
+	// Remote path, push into the remote list (the owner takes the entire list at once so there is no ABA problem)
+	PeonJob* remoteFreeJobList = m_RemoteFreeJobList.load(std::memory_order_relaxed);
+	do
+	{
+		_job->m_NextFreeJob = remoteFreeJobList;
+	} while (!m_RemoteFreeJobList.compare_exchange_weak(remoteFreeJobList, _job, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void __InternalPeon::PeonStealingQueue::AllocateJobChunk()
+{
+	// Allocate the jobs
+	PeonJob* jobChunk = new PeonJob[m_BufferSize];
+	m_JobChunks.push_back(jobChunk);
+	m_TotalAllocatedJobs.store(m_TotalAllocatedJobs.load(std::memory_order_relaxed) + m_BufferSize, std::memory_order_relaxed);
+
+	// Link them into our local free list
+	for (long i = 0; i < m_BufferSize; i++)
+	{
+		jobChunk[i].m_OwnerQueue = this;
+		jobChunk[i].m_NextFreeJob = (i + 1) < m_BufferSize ? &jobChunk[i + 1] : m_FreeJobList;
+	}
+
+	m_FreeJobList = jobChunk;
+}
+
 void __InternalPeon::PeonStealingQueue::Reset()
 {
 #ifdef JobWorkerDebug
@@ -71,9 +190,57 @@ void __InternalPeon::PeonStealingQueue::Reset()
 
 #endif
 
+	// Reset the ring buffer position (recycled jobs don't depend on frames)
 	m_RingBufferPosition = 0;
 }
 
+void __InternalPeon::PeonStealingQueue::ReleaseJobData()
+{
+	// A job keeps its function (if it never ran) or its result until it's reused, the memory goes back to the allocator
+	// that created it
+	auto ReleaseData = [](PeonJob& _job)
+	{
+		_job.DestroyJobFunction(nullptr);
+		_job.ReleaseContinuations();
+	};
+
+	// The ring buffer jobs
+	if (m_RingBuffer != nullptr)
+	{
+		for (long i = 0; i < m_BufferSize; i++)
+		{
+			ReleaseData(m_RingBuffer[i]);
+		}
+	}
+
+	// And the job chunks (recycling mode)
+	for (auto* jobChunk : m_JobChunks)
+	{
+		for (long i = 0; i < m_BufferSize; i++)
+		{
+			ReleaseData(jobChunk[i]);
+		}
+	}
+}
+
+__InternalPeon::PeonStealingQueue::DequeArray* __InternalPeon::PeonStealingQueue::Grow(DequeArray* _array, long _bottom, long _top)
+{
+	// Create a new array with twice the size, the old one will be retired (but not deleted, a thief could be using it)
+	DequeArray* newArray = new DequeArray(_array->size * 2, _array);
+
+	// Copy all queued jobs (their indexes don't change)
+	for (long i = _top; i < _bottom; i++)
+	{
+		newArray->Put(i, _array->Get(i));
+	}
+
+	// Publish the new array
+	m_DequeArray.store(newArray, std::memory_order_release);
+	m_TotalGrows.fetch_add(1, std::memory_order_relaxed);
+
+	return newArray;
+}
+
 void __InternalPeon::PeonStealingQueue::Push(PeonJob* _job)
 {
 #ifdef JobWorkerDebug
@@ -83,16 +250,32 @@ void __InternalPeon::PeonStealingQueue::Push(PeonJob* _job)
 
 #endif
 
-	long b = m_Bottom.load(std::memory_order_acquire);
+	long b = m_Bottom.load(std::memory_order_relaxed);
+	long t = m_Top.load(std::memory_order_acquire);
+	DequeArray* dequeArray = m_DequeArray.load(std::memory_order_relaxed);
+
+	// Check if the deque is full
+	long size = b - t;
+	if (size >= dequeArray->size)
+	{
+		dequeArray = Grow(dequeArray, b, t);
+	}
+
+	// Update the high-water mark
+	if (size + 1 > m_HighWaterMark.load(std::memory_order_relaxed))
+	{
+		m_HighWaterMark.store(size + 1, std::memory_order_relaxed);
+	}
 
     // Push the job
-    m_DequeBuffer[b & QueueMask(m_BufferSize)] = _job;
+	dequeArray->Put(b, _job);
 
     // Set the new bottom
-	m_Bottom.store(b + 1l, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_Bottom.store(b + 1l, std::memory_order_relaxed);
 }
 
-__InternalPeon::PeonJob* __InternalPeon::PeonStealingQueue::Pop()
+void __InternalPeon::PeonStealingQueue::PushBatch(PeonJob** _jobs, uint32_t _totalJobs)
 {
 #ifdef JobWorkerDebug
 
@@ -101,15 +284,55 @@ __InternalPeon::PeonJob* __InternalPeon::PeonStealingQueue::Pop()
 
 #endif
 
-	long b = m_Bottom.load(std::memory_order_acquire);
-	b = b - 1;
-	m_Bottom.store(b, std::memory_order_release);
+	long b = m_Bottom.load(std::memory_order_relaxed);
 	long t = m_Top.load(std::memory_order_acquire);
+	DequeArray* dequeArray = m_DequeArray.load(std::memory_order_relaxed);
+
+	// Grow until all jobs fit
+	long size = b - t + (long)_totalJobs;
+	while (size > dequeArray->size)
+	{
+		dequeArray = Grow(dequeArray, b, t);
+	}
+
+	// Update the high-water mark
+	if (size > m_HighWaterMark.load(std::memory_order_relaxed))
+	{
+		m_HighWaterMark.store(size, std::memory_order_relaxed);
+	}
+
+    // Push the jobs
+	for (uint32_t i = 0; i < _totalJobs; i++)
+	{
+		dequeArray->Put(b + (long)i, _jobs[i]);
+	}
+
+    // Publish all of them with a single bottom update
+	std::atomic_thread_fence(std::memory_order_release);
+	m_Bottom.store(b + (long)_totalJobs, std::memory_order_relaxed);
+}
+
+__InternalPeon::PeonJob* __InternalPeon::PeonStealingQueue::Pop()
+{
+#ifdef JobWorkerDebug
+
+	// Lock our debug mutex
+	std::lock_guard<std::mutex> lock(m_DebugMutex);
+
+#endif
+
+	long b = m_Bottom.load(std::memory_order_relaxed) - 1;
+	DequeArray* dequeArray = m_DequeArray.load(std::memory_order_relaxed);
+	m_Bottom.store(b, std::memory_order_relaxed);
+
+	// The bottom store must be visible before we read the top (a thief does the opposite)
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long t = m_Top.load(std::memory_order_relaxed);
 
 	if (t <= b)
 	{
 		// non-empty queue
-		PeonJob* job = m_DequeBuffer[b & QueueMask(m_BufferSize)];
+		PeonJob* job = dequeArray->Get(b);
 		if (t != b)
 		{
 			// There's still more than one item left in the queue
@@ -120,21 +343,20 @@ __InternalPeon::PeonJob* __InternalPeon::PeonStealingQueue::Pop()
 		long desiredTop = t + 1;
 
 		if (!m_Top.compare_exchange_strong(expectedTop, desiredTop,
-			std::memory_order_acq_rel))
+			std::memory_order_seq_cst, std::memory_order_relaxed))
 		{
 			// Someone already took the last item, abort
 			job = nullptr;
 		}
 
-		m_Bottom.store(t + 1, std::memory_order_release);
+		m_Bottom.store(t + 1, std::memory_order_relaxed);
 
 		return job;
 	}
 	else
 	{
 		// Deque was already empty
-		m_Bottom.store(t, std::memory_order_release);
-		m_Bottom = t;
+		m_Bottom.store(b + 1, std::memory_order_relaxed);
 		return nullptr;
 	}
 }
@@ -151,23 +373,23 @@ __InternalPeon::PeonJob* __InternalPeon::PeonStealingQueue::Steal()
 	long t = m_Top.load(std::memory_order_acquire);
 
     // ensure that top is always read before bottom.
-    // loads will not be reordered with other loads on x86, so a compiler barrier is enough.
-	std::atomic_thread_fence(std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
 	long b = m_Bottom.load(std::memory_order_acquire);
 
 	// Deque status...
     if (t < b)
     {
-        // non-empty queue
-        PeonJob* job = m_DequeBuffer[t & QueueMask(m_BufferSize)];
+        // non-empty queue (the array could be a retired one, it still holds this job since the owner copied it before growing)
+		DequeArray* dequeArray = m_DequeArray.load(std::memory_order_acquire);
+        PeonJob* job = dequeArray->Get(t);
 
 		long expectedTop = t;
 		long desiredTop = t + 1;
 
-        // the interlocked function serves as a compiler barrier, and guarantees that the read happens before the CAS.
-		if (!m_Top.compare_exchange_strong(expectedTop, desiredTop, std::memory_order_acq_rel))
+        // the cas guarantees that the read happens before we take ownership of the job.
+		if (!m_Top.compare_exchange_strong(expectedTop, desiredTop, std::memory_order_seq_cst, std::memory_order_relaxed))
         {
-            // a concurrent steal or pop operation removed an element from the deque in the meantime. Unlock our overhead mutex and return a nullptr
+            // a concurrent steal or pop operation removed an element from the deque in the meantime.
             return nullptr;
         }
 
@@ -178,4 +400,109 @@ __InternalPeon::PeonJob* __InternalPeon::PeonStealingQueue::Steal()
         // empty queue
         return nullptr;
     }
+}
+
+__InternalPeon::PeonJob* __InternalPeon::PeonStealingQueue::StealBatch(PeonStealingQueue* _destination, uint32_t _maximumJobs, uint32_t* _totalStolen)
+{
+#ifdef JobWorkerDebug
+
+	// Lock our debug mutex
+	std::lock_guard<std::mutex> lock(m_DebugMutex);
+
+#endif
+
+	PeonJob* stolenJobs[PeonStealBatchMaximum];
+	uint32_t totalStolen = 0;
+
+	long t = m_Top.load(std::memory_order_acquire);
+
+    // ensure that top is always read before bottom.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long b = m_Bottom.load(std::memory_order_acquire);
+
+	// Take half of the visible jobs (rounding up, so a single job can be stolen too)
+	long batchSize = std::min(std::min((b - t + 1) / 2, (long)_maximumJobs), (long)PeonStealBatchMaximum);
+	while ((long)totalStolen < batchSize)
+	{
+		// Check if the owner didn't pop the remaining jobs in the meantime (the first check was done above)
+		if (totalStolen > 0)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			b = m_Bottom.load(std::memory_order_acquire);
+		}
+
+		if (t >= b)
+		{
+			break;
+		}
+
+		// The owner pops from the bottom without a CAS unless it takes the last job, so a single top advance over many
+		// jobs could claim one it already took, each job is claimed on its own (but the victim lines stay in our cache)
+		DequeArray* dequeArray = m_DequeArray.load(std::memory_order_acquire);
+		PeonJob* job = dequeArray->Get(t);
+
+		long expectedTop = t;
+		if (!m_Top.compare_exchange_strong(expectedTop, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			// Someone else took it, keep what we have
+			break;
+		}
+
+		stolenJobs[totalStolen++] = job;
+		t++;
+	}
+
+	if (_totalStolen != nullptr)
+	{
+		*_totalStolen = totalStolen;
+	}
+
+	if (totalStolen == 0)
+	{
+		return nullptr;
+	}
+
+	// Keep the oldest job for us and move the others into the destination (in the same order, so they are popped newest first)
+	if (totalStolen > 1)
+	{
+		_destination->PushBatch(stolenJobs + 1, totalStolen - 1);
+	}
+
+	return stolenJobs[0];
+}
+
+bool __InternalPeon::PeonStealingQueue::IsEmpty()
+{
+	long t = m_Top.load(std::memory_order_seq_cst);
+	long b = m_Bottom.load(std::memory_order_seq_cst);
+
+	return t >= b;
+}
+
+long __InternalPeon::PeonStealingQueue::GetSize()
+{
+	long t = m_Top.load(std::memory_order_seq_cst);
+	long b = m_Bottom.load(std::memory_order_seq_cst);
+
+	return std::max(b - t, 0l);
+}
+
+long __InternalPeon::PeonStealingQueue::GetCapacity()
+{
+	return m_DequeArray.load(std::memory_order_acquire)->size;
+}
+
+long __InternalPeon::PeonStealingQueue::GetHighWaterMark()
+{
+	return m_HighWaterMark.load(std::memory_order_relaxed);
+}
+
+uint32_t __InternalPeon::PeonStealingQueue::GetTotalGrows()
+{
+	return m_TotalGrows.load(std::memory_order_relaxed);
+}
+
+long __InternalPeon::PeonStealingQueue::GetJobStorageSize()
+{
+	return m_StorageMode == PeonJobStorageMode::Recycling ? m_TotalAllocatedJobs.load(std::memory_order_relaxed) : m_BufferSize;
 }
\ No newline at end of file
@@ -24,45 +24,116 @@ PeonNamespaceBegin(__InternalPeon)
 // DEFINES //
 /////////////
 
+// The maximum number of jobs taken by a single batch steal
+#define PeonStealBatchMaximum		(64)
+
 ////////////
 // GLOBAL //
 ////////////
 
+// How the jobs are stored
+enum class PeonJobStorageMode
+{
+	// Jobs come from a fixed ring buffer and are only reused after ResetWorkerFrame (the original behavior)
+	FrameRingBuffer,
+
+	// Jobs return to the owner free list when finished and released (no need to call ResetWorkerFrame, but the creator
+	// reference is released when the job is started, use RetainJob/ReleaseJob to use the job after starting it)
+	Recycling
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Class name: PeonStealingQueue
 ////////////////////////////////////////////////////////////////////////////////
 class PeonStealingQueue
 {
+	// The circular job array used by the deque, when full a bigger one is created and the old one is retired (thieves may
+	// still be reading it, so retired arrays are only released when the queue is destroyed, their total size is bounded by
+	// the current array size since each growth doubles the capacity)
+	struct DequeArray
+	{
+		DequeArray(long _size, DequeArray* _retiredArray);
+		~DequeArray();
+
+		// Get and put a job using an unbounded index
+		PeonJob* Get(long _index);
+		void Put(long _index, PeonJob* _job);
+
+		// The array size and mask (size is a power of 2)
+		long size;
+		long mask;
+
+		// The jobs
+		std::atomic<PeonJob*>* jobs;
+
+		// The previous (retired) array
+		DequeArray* retiredArray;
+	};
+
 public:
 	PeonStealingQueue();
 	PeonStealingQueue(const PeonStealingQueue&);
 	~PeonStealingQueue();
 
-	// Initialize the work stealing queue
-	bool Initialize(unsigned int _bufferSize);
+	// Initialize the work stealing queue (both sizes must be a power of 2, the deque grows when needed, in recycling mode
+	// the buffer size is the number of jobs allocated each time the free list runs dry, a zero buffer size creates a deque
+	// without job storage, only jobs from other queues can be pushed into it)
+	bool Initialize(unsigned int _bufferSize, unsigned int _initialDequeSize, PeonJobStorageMode _storageMode = PeonJobStorageMode::FrameRingBuffer);
 
-	// Return a valid job from our ring buffer
+	// Return a valid job from our ring buffer (or from the free list in recycling mode)
 	PeonJob* GetFreshJob();
 
+	// Return a finished job to this queue free list (the local path can only be used by the owner thread, any other thread
+	// must use the remote path)
+	void ReturnJob(PeonJob* _job, bool _isOwnerThread);
+
     // Insert a job into this queue (must be called only by the owner thread)
 	void Push(PeonJob* _job);
 
+    // Insert many jobs into this queue at once (must be called only by the owner thread)
+	void PushBatch(PeonJob** _jobs, uint32_t _totalJobs);
+
     // Get a job from this queue (must be called only by the owner thread)
 	PeonJob* Pop();
 
     // Try to steal a job from this queue (can be called from any thread)
 	PeonJob* Steal();
 
+	// Try to steal up to half of the visible jobs from this queue (but no more than the given maximum) in a single visit, the
+	// first stolen job is returned and the others are pushed into the destination queue (must be called by the destination
+	// queue owner thread), the total number of stolen jobs (returned one included) is written into _totalStolen
+	PeonJob* StealBatch(PeonStealingQueue* _destination, uint32_t _maximumJobs, uint32_t* _totalStolen = nullptr);
+
+    // Return if this deque looks empty (can be called from any thread)
+	bool IsEmpty();
+
+	// Return the number of queued jobs (can be called from any thread, only a snapshot)
+	long GetSize();
+
+	// Return the current deque capacity, the maximum number of jobs queued at the same time and the total number of times
+	// the deque had to grow (can be called from any thread, use it to tune the initial deque size)
+	long GetCapacity();
+	long GetHighWaterMark();
+	uint32_t GetTotalGrows();
+
+	// Return the number of jobs this queue owns, the ring buffer size or the number of allocated jobs in recycling mode (can be
+	// called from any thread)
+	long GetJobStorageSize();
+
     // Reset this deque (start at the initial position)
 	void Reset();
 
+	// Destroy the functions and results still held by the jobs this queue owns and release their continuation blocks (only
+	// when the system is being destroyed, the memory must go back to the allocators before the workers are deleted)
+	void ReleaseJobData();
+
 public:
 
 	// The top and bottom deque positions
 	std::atomic<long> m_Top;
 	std::atomic<long> m_Bottom;
 
-	// The job buffer size (for the deque and the ring buffer)
+	// The job ring buffer size
 	long m_BufferSize;
 
 	// The job ring buffer position
@@ -71,8 +142,31 @@ public:
 	// The job ring buffer
 	PeonJob* m_RingBuffer;
 
-	// The deque buffer
-	PeonJob** m_DequeBuffer;
+	// The job storage mode
+	PeonJobStorageMode m_StorageMode;
+
+	// The local and the remote job free lists (recycling mode only, the remote one receives jobs from other threads)
+	PeonJob* m_FreeJobList;
+	std::atomic<PeonJob*> m_RemoteFreeJobList;
+
+	// All allocated job chunks and the total number of jobs in them (recycling mode only)
+	std::vector<PeonJob*> m_JobChunks;
+	std::atomic<long> m_TotalAllocatedJobs;
+
+	// The deque array
+	std::atomic<DequeArray*> m_DequeArray;
+
+	// The deque statistics
+	std::atomic<long> m_HighWaterMark;
+	std::atomic<uint32_t> m_TotalGrows;
+
+private:
+
+	// Replace the given (full) array by a new one with twice the size
+	DequeArray* Grow(DequeArray* _array, long _bottom, long _top);
+
+	// Allocate a new chunk of jobs for the free list
+	void AllocateJobChunk();
 
 #ifdef JobWorkerDebug
 
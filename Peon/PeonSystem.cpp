@@ -4,11 +4,39 @@
 
 #include "PeonSystem.h"
 #include "PeonWorker.h"
+#include <cassert>
+
+// The next system unique id
+static std::atomic<uint64_t> NextSystemId = { 1 };
+
+// The job storage used by this thread (when it isn't a worker) and the id of the system that owns it
+thread_local uint64_t								CurrentExternalStorageSystemId = 0;
+thread_local __InternalPeon::PeonStealingQueue*	CurrentExternalStorage = nullptr;
 
 __InternalPeon::PeonSystem::PeonSystem()
 {
 	// Set the initial data
 	__InternalPeon::PeonSystem::m_JobWorkers = nullptr;
+	m_TotalWokerThreads = 0;
+	m_TotalParkedWorkers = 0;
+	m_TotalIdleWorkers = 0;
+	m_JobBufferSize = 0;
+	m_InitialDequeSize = 256;
+	m_Injectors = nullptr;
+	m_TotalInjectors = 0;
+	m_InjectorQueueSize = PeonDefaultInjectorQueueSize;
+	m_SystemId = NextSystemId.fetch_add(1, std::memory_order_relaxed);
+	m_JobStorageMode = PeonJobStorageMode::FrameRingBuffer;
+	m_StealBatchSize = 16;
+	m_BackgroundAgingInterval = 32;
+	m_LaneStatisticsEnabled = false;
+	m_ExternalCreatedJobs = 0;
+	m_ThreadsBlocked = false;
+	m_TotalActiveWorkers = 0;
+	m_AutoScaleStopRequested = false;
+	m_IsShutdown = false;
+	m_MemoryTrimInterval = 0;
+	m_FramesSinceMemoryTrim = 0;
 }
 
 __InternalPeon::PeonSystem::PeonSystem(const __InternalPeon::PeonSystem& other)
@@ -17,109 +45,262 @@ __InternalPeon::PeonSystem::PeonSystem(const __InternalPeon::PeonSystem& other)
 
 __InternalPeon::PeonSystem::~PeonSystem()
 {
-}
+	// Stop the workers (if nobody did it before)
+	if (m_JobWorkers != nullptr && !m_IsShutdown)
+	{
+		Shutdown();
+	}
 
-__InternalPeon::PeonJob* __InternalPeon::PeonSystem::CreateJob(std::function<void()> _function)
-{
-    // Get the default worker thread
-    PeonWorker* workerThread = PeonSystem::GetCurrentPeon();
+	// Finish the trace file (if a trace is running)
+	m_Tracer.Stop();
 
-    // Get a fresh job
-    PeonJob* freshJob = workerThread->GetFreshJob();
+	// This thread stopped being a worker when the workers were stopped, forget our job storage too (other threads check the
+	// system id before using theirs)
+	if (CurrentExternalStorageSystemId == m_SystemId)
+	{
+		CurrentExternalStorageSystemId = 0;
+		CurrentExternalStorage = nullptr;
+	}
 
-    // Initialize the job
-    freshJob->Initialize();
+	// Destroy the functions and results kept by the jobs and give their memory back to the allocators
+	for (unsigned int i = 0; m_JobWorkers != nullptr && i < m_TotalWokerThreads; i++)
+	{
+		for (uint32_t j = 0; j < PeonTotalJobPriorities; j++)
+		{
+			m_JobWorkers[i].GetWorkerQueue(PeonJobPriority(j))->ReleaseJobData();
+		}
+	}
 
-    // Set the job worker thread
-    freshJob->SetWorkerThread(workerThread);
+	for (auto& externalJobStorage : m_ExternalJobStorages)
+	{
+		externalJobStorage.jobStorage->ReleaseJobData();
+	}
 
-    // Set the job function
-    freshJob->SetJobFunction(nullptr, _function);
+	// Release the injectors and the job storage from the threads that aren't workers
+	delete[] m_Injectors;
+	for (auto& externalJobStorage : m_ExternalJobStorages)
+	{
+		delete externalJobStorage.jobStorage;
+	}
 
-    // Return the new job
-    return freshJob;
+	// Release the workers (their threads were joined), before the memory depot that owns their memory
+	delete[] m_JobWorkers;
+	m_JobWorkers = nullptr;
 }
 
-__InternalPeon::PeonJob* __InternalPeon::PeonSystem::CreateChildJob(PeonJob* _parentJob, std::function<void()> _function)
+__InternalPeon::Container* __InternalPeon::PeonSystem::CreateContainer()
 {
-    // Não preciso me preocupar com o parent job sendo deletado ou liberando waits caso exista concorrencia pois seguimos da seguinte lógica, apenas o job atual pode criar jobs
-    // filhos, e pode apenas adicionar elas para si mesmo, logo se estamos aqui quer dizer que o parent job ainda tem no minimo um trabalho restante (que é adicionar esse job)
-    // e por consequencia ele não será deletado ou liberará algum wait.
+	return CreateJob([=] { JobContainerHelper(nullptr); });
+}
 
-    // Atomic increment the number of unfinished jobs of our parent
-    _parentJob->m_UnfinishedJobs++;
+__InternalPeon::Container* __InternalPeon::PeonSystem::CreateChildContainer()
+{
+	return CreateChildJob(PeonWorker::GetCurrentJob(), [=] { JobContainerHelper(nullptr); });
+}
 
-    // Get the worker thread from the parent
-    PeonWorker* workerThread = PeonSystem::GetCurrentPeon();
+__InternalPeon::Container* __InternalPeon::PeonSystem::CreateChildContainer(PeonJob* _parentJob)
+{
+	return CreateChildJob(_parentJob, [=] { JobContainerHelper(nullptr); });
+}
 
-    // Get a fresh job
-    PeonJob* freshJob = workerThread->GetFreshJob();
+void __InternalPeon::PeonSystem::StartJob(__InternalPeon::PeonJob* _job)
+{
+	// Get the worker thread for the current thread (only the owner thread can push into a worker queue, the job
+	// root worker could be running on another thread)
+	__InternalPeon::PeonWorker* workerThread = GetCurrentPeon();
 
-    // Initialize the job
-    freshJob->Initialize();
+	// Trace it before pushing (another worker could finish and reuse the job right after)
+	TraceEvent(workerThread, PeonTraceEventType::Start, _job, uint32_t(_job->GetPriority()));
 
-    // Set the job function
-    freshJob->SetJobFunction(_parentJob, _function);
+	// Insert the job into the worker thread queue (the lane for its priority), other threads use the injector queues
+	if (workerThread != nullptr)
+	{
+		workerThread->PushJob(_job);
+	}
+	else
+	{
+		InjectJob(_job);
+	}
 
-    // Set the job parent
-    freshJob->SetParentJob(_parentJob);
+	// Wake a parked worker (if any)
+	WakeParkedWorkers();
 
-    // Return the new job
-    return freshJob;
+	// Release the creator reference (a recyclable job can't be used after this unless retained)
+	_job->Release();
 }
 
-__InternalPeon::PeonJob* __InternalPeon::PeonSystem::CreateChildJob(std::function<void()> _function)
+void __InternalPeon::PeonSystem::StartJob(__InternalPeon::PeonJob* _job, PeonJobPriority _priority)
 {
-	return CreateChildJob(PeonWorker::GetCurrentJob(), _function);
+	_job->SetPriority(_priority);
+	StartJob(_job);
 }
 
-__InternalPeon::Container* __InternalPeon::PeonSystem::CreateContainer()
+void __InternalPeon::PeonSystem::StartJobs(__InternalPeon::PeonJob** _jobs, uint32_t _totalJobs)
 {
-	return CreateJob([=] { JobContainerHelper(nullptr); });
+	if (_totalJobs == 0)
+	{
+		return;
+	}
+
+	// Get the worker thread for the current thread
+	__InternalPeon::PeonWorker* workerThread = GetCurrentPeon();
+
+	// Trace them before pushing
+	for (uint32_t i = 0; i < _totalJobs; i++)
+	{
+		TraceEvent(workerThread, PeonTraceEventType::Start, _jobs[i], uint32_t(_jobs[i]->GetPriority()));
+	}
+
+	// Insert the jobs into the worker thread queues at once, other threads use the injector queues
+	if (workerThread != nullptr)
+	{
+		workerThread->PushJobs(_jobs, _totalJobs);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < _totalJobs; i++)
+		{
+			InjectJob(_jobs[i]);
+		}
+	}
+
+	// Wake parked workers to help
+	WakeParkedWorkers(_totalJobs);
+
+	// Release the creator references
+	for (uint32_t i = 0; i < _totalJobs; i++)
+	{
+		_jobs[i]->Release();
+	}
 }
 
-__InternalPeon::Container* __InternalPeon::PeonSystem::CreateChildContainer()
+void __InternalPeon::PeonSystem::SetJobPriority(PeonJob* _job, PeonJobPriority _priority)
 {
-	return CreateChildJob(PeonWorker::GetCurrentJob(), [=] { JobContainerHelper(nullptr); });
+	_job->SetPriority(_priority);
 }
 
-__InternalPeon::Container* __InternalPeon::PeonSystem::CreateChildContainer(PeonJob* _parentJob)
+void __InternalPeon::PeonSystem::SetJobLabel(PeonJob* _job, const char* _label)
 {
-	return CreateChildJob(_parentJob, [=] { JobContainerHelper(nullptr); });
+	_job->SetLabel(_label);
 }
 
-void __InternalPeon::PeonSystem::StartJob(__InternalPeon::PeonJob* _job)
+void __InternalPeon::PeonSystem::SetJobCancellationToken(PeonJob* _job, PeonCancellationToken* _cancellationToken)
 {
-	// Get the worker thread for this job
-	__InternalPeon::PeonWorker* workerThread = _job->GetWorkerThread();
+	_job->SetCancellationToken(_cancellationToken);
+}
 
-	// Insert the job into the worker thread queue
-	workerThread->GetWorkerQueue()->Push(_job);
+bool __InternalPeon::PeonSystem::IsCancelled()
+{
+	// Threads that aren't running a job are never cancelled
+	PeonJob* currentJob = PeonWorker::GetCurrentJob();
+	return currentJob != nullptr && currentJob->IsCancelled();
+}
+
+void __InternalPeon::PeonSystem::InheritJobPriority(PeonJob* _job)
+{
+	PeonJob* currentJob = PeonWorker::GetCurrentJob();
+	if (currentJob != nullptr)
+	{
+		_job->SetPriority(currentJob->GetPriority());
+	}
 }
 
 void __InternalPeon::PeonSystem::WaitForJob(__InternalPeon::PeonJob* _job)
 {
-	// Get the job worker thread
-	__InternalPeon::PeonWorker* workerThread = _job->GetWorkerThread();
+	// Get the worker thread for the current thread (we can only pop from our own queue)
+	__InternalPeon::PeonWorker* workerThread = GetCurrentPeon();
+
+	// Only trace the waits that can block
+	bool traceWait = !HasJobCompleted(_job);
+	if (traceWait)
+	{
+		TraceEvent(workerThread, PeonTraceEventType::WaitBegin, _job);
+	}
+
+	// Threads that aren't workers can't run jobs, just wait
+	if (workerThread == nullptr)
+	{
+		while (!HasJobCompleted(_job))
+		{
+			std::this_thread::yield();
+		}
+
+		if (traceWait)
+		{
+			TraceEvent(workerThread, PeonTraceEventType::WaitEnd, _job);
+		}
+
+		return;
+	}
 
 	// wait until the job has completed. in the meantime, work on any other job.
 	while (!HasJobCompleted(_job))
 	{
+		// Suspend this fiber until the job completes (the worker runs other jobs on another fiber)
+		if (workerThread->SuspendUntilComplete(_job))
+		{
+			continue;
+		}
+
 		// Try to preempt another job (or just yield)
-		workerThread->ExecuteThread(nullptr);
+		if (!workerThread->ExecuteThread(nullptr))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	if (traceWait)
+	{
+		TraceEvent(workerThread, PeonTraceEventType::WaitEnd, _job);
+	}
+
+	// We are back to the caller, we aren't looking for jobs anymore (or running one, unless we are waiting inside a job or
+	// other fibers are)
+	workerThread->SetIdle(false);
+	if (PeonWorker::GetCurrentJob() == nullptr && !workerThread->HasWaitingFibers())
+	{
+		workerThread->SetBusy(false);
 	}
 }
 
+__InternalPeon::PeonScheduleAwaiter __InternalPeon::PeonSystem::Schedule(PeonJobPriority _priority)
+{
+	return PeonScheduleAwaiter{ this, _priority };
+}
+
 void __InternalPeon::PeonSystem::AddJobDependency(PeonJob* _thisFirst, PeonJob* _thenThis)
 {
-	const int32_t count = _thisFirst->m_TotalJobsThatDependsOnThis.fetch_add(1);
-	_thisFirst->m_JobsThatDependsOnThis[count] = _thenThis;
+	// The continuation blocks come from our worker allocator (or the heap if this thread isn't a worker)
+	_thisFirst->AddContinuation(_thenThis, GetCurrentPeon());
+}
+
+void __InternalPeon::PeonSystem::AddJobDependency(std::initializer_list<PeonJob*> _thoseFirst, PeonJob* _thenThis)
+{
+	for (PeonJob* job : _thoseFirst)
+	{
+		job->AddContinuation(_thenThis, GetCurrentPeon());
+	}
+}
+
+void __InternalPeon::PeonSystem::RetainJob(PeonJob* _job)
+{
+	_job->Retain();
+}
+
+void __InternalPeon::PeonSystem::ReleaseJob(PeonJob* _job)
+{
+	_job->Release();
 }
 
 __InternalPeon::PeonWorker* __InternalPeon::PeonSystem::GetCurrentPeon()
 {
-	int currentThreadIdentifier = __InternalPeon::PeonWorker::GetCurrentLocalThreadIdentifier();
-	return &PeonSystem::m_JobWorkers[currentThreadIdentifier];
+	// The thread could be a worker from another system, even one that was destroyed (or not a worker at all)
+	return __InternalPeon::PeonWorker::GetCurrentLocalThreadSystemId() == m_SystemId ? __InternalPeon::PeonWorker::GetCurrentLocalThreadWorker() : nullptr;
+}
+
+bool __InternalPeon::PeonSystem::IsWorkerThread()
+{
+	return GetCurrentPeon() != nullptr;
 }
 
 __InternalPeon::PeonWorker* __InternalPeon::PeonSystem::GetDefaultWorkerThread()
@@ -139,7 +320,615 @@ __InternalPeon::PeonWorker* __InternalPeon::PeonSystem::GetCurrentWorker()
 
 int __InternalPeon::PeonSystem::GetCurrentWorkerIndex()
 {
-	return __InternalPeon::PeonWorker::GetCurrentLocalThreadIdentifier();
+	return IsWorkerThread() ? __InternalPeon::PeonWorker::GetCurrentLocalThreadIdentifier() : -1;
+}
+
+void __InternalPeon::PeonSystem::SetIdleSettings(const PeonIdleSettings& _idleSettings)
+{
+	m_IdleSettings = _idleSettings;
+}
+
+const __InternalPeon::PeonIdleSettings& __InternalPeon::PeonSystem::GetIdleSettings()
+{
+	return m_IdleSettings;
+}
+
+void __InternalPeon::PeonSystem::SetInitialDequeSize(unsigned int _initialDequeSize)
+{
+	m_InitialDequeSize = pow2roundup(_initialDequeSize);
+}
+
+void __InternalPeon::PeonSystem::SetJobStorageMode(PeonJobStorageMode _storageMode)
+{
+	m_JobStorageMode = _storageMode;
+}
+
+void __InternalPeon::PeonSystem::SetInjectorQueueSize(uint32_t _injectorQueueSize)
+{
+	m_InjectorQueueSize = pow2roundup(_injectorQueueSize);
+}
+
+void __InternalPeon::PeonSystem::SetTopologySettings(const PeonTopologySettings& _topologySettings)
+{
+	m_TopologySettings = _topologySettings;
+}
+
+const __InternalPeon::PeonTopologySettings& __InternalPeon::PeonSystem::GetTopologySettings()
+{
+	return m_TopologySettings;
+}
+
+const __InternalPeon::PeonTopology& __InternalPeon::PeonSystem::GetTopology()
+{
+	return m_Topology;
+}
+
+void __InternalPeon::PeonSystem::SetFiberSettings(const PeonFiberSettings& _fiberSettings)
+{
+	m_FiberSettings = _fiberSettings;
+}
+
+const __InternalPeon::PeonFiberSettings& __InternalPeon::PeonSystem::GetFiberSettings()
+{
+	return m_FiberSettings;
+}
+
+uint64_t __InternalPeon::PeonSystem::GetTotalSteals(PeonStealTier _stealTier)
+{
+	uint64_t totalSteals = 0;
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		totalSteals += m_JobWorkers[i].GetTotalSteals(_stealTier);
+	}
+
+	return totalSteals;
+}
+
+uint64_t __InternalPeon::PeonSystem::GetTotalStealAttempts(PeonStealTier _stealTier)
+{
+	uint64_t totalStealAttempts = 0;
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		totalStealAttempts += m_JobWorkers[i].GetTotalStealAttempts(_stealTier);
+	}
+
+	return totalStealAttempts;
+}
+
+void __InternalPeon::PeonSystem::PlaceWorkers()
+{
+	if (!m_TopologySettings.pinWorkers)
+	{
+		return;
+	}
+
+	m_Topology.Detect();
+
+	// Worker i runs on the cpu i (in placement order), if we have more workers than cpus they wrap around
+	uint32_t totalCpus = m_Topology.GetTotalCpus();
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		const PeonCpuInfo& workerCpu = m_Topology.GetCpu(i % totalCpus);
+
+		// The steal tier for each other worker
+		std::vector<PeonStealTier> victimTiers(m_TotalWokerThreads);
+		for (unsigned int j = 0; j < m_TotalWokerThreads; j++)
+		{
+			victimTiers[j] = PeonTopology::GetStealTier(workerCpu, m_Topology.GetCpu(j % totalCpus));
+		}
+
+		m_JobWorkers[i].SetPlacement(i, workerCpu.cpuId, victimTiers, m_TopologySettings.hierarchicalStealing, m_Topology.GetNodeIndex(workerCpu.cpuId));
+	}
+}
+
+void __InternalPeon::PeonSystem::WaitForWorkers()
+{
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		while (!m_JobWorkers[i].IsReady())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void __InternalPeon::PeonSystem::InitializeInjectors()
+{
+	// Pinned workers check the injector from their own node first (the topology was detected when placing them)
+	m_TotalInjectors = m_TopologySettings.pinWorkers ? std::max(m_Topology.GetTotalNodes(), 1u) : 1;
+	m_Injectors = new PeonInjectorQueue[m_TotalInjectors];
+	for (uint32_t i = 0; i < m_TotalInjectors; i++)
+	{
+		m_Injectors[i].Initialize(m_InjectorQueueSize);
+	}
+}
+
+__InternalPeon::PeonJob* __InternalPeon::PeonSystem::GetFreshJob(PeonWorker* _workerThread)
+{
+	if (_workerThread != nullptr)
+	{
+		return _workerThread->GetFreshJob();
+	}
+
+	if (PeonStatisticsEnabled)
+	{
+		m_ExternalCreatedJobs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	return GetExternalJobStorage()->GetFreshJob();
+}
+
+__InternalPeon::PeonStealingQueue* __InternalPeon::PeonSystem::GetExternalJobStorage()
+{
+	// Fast path, this thread used our storage last time
+	if (CurrentExternalStorageSystemId == m_SystemId)
+	{
+		return CurrentExternalStorage;
+	}
+
+	std::lock_guard<std::mutex> lock(m_ExternalStorageMutex);
+
+	// Look for the storage this thread already has (it could have used another system in the meantime)
+	std::thread::id threadId = std::this_thread::get_id();
+	PeonStealingQueue* jobStorage = nullptr;
+	for (auto& externalJobStorage : m_ExternalJobStorages)
+	{
+		if (externalJobStorage.threadId == threadId)
+		{
+			jobStorage = externalJobStorage.jobStorage;
+			break;
+		}
+	}
+
+	// Create a new one, it only holds jobs (they are never pushed into it)
+	if (jobStorage == nullptr)
+	{
+		jobStorage = new PeonStealingQueue();
+		jobStorage->Initialize(m_JobBufferSize, 2, m_JobStorageMode);
+		m_ExternalJobStorages.push_back({ threadId, jobStorage });
+	}
+
+	CurrentExternalStorageSystemId = m_SystemId;
+	CurrentExternalStorage = jobStorage;
+
+	return jobStorage;
+}
+
+void __InternalPeon::PeonSystem::InjectJob(PeonJob* _job)
+{
+	// Use the injector from the node running this thread (the workers from that node check it first)
+	uint32_t injectorIndex = 0;
+	if (m_TotalInjectors > 1)
+	{
+		int cpuId = PeonTopology::GetCurrentCpuId();
+		injectorIndex = cpuId >= 0 ? m_Topology.GetNodeIndex(uint32_t(cpuId)) % m_TotalInjectors : 0;
+	}
+
+	// Record the enqueue time (only when someone wants the lane statistics)
+	_job->SetEnqueueTime(LaneStatisticsEnabled() ? PeonWorker::GetTimeNanoseconds() : 0);
+
+	// The queue is full, make sure the workers are awake and wait for them to catch up
+	while (!m_Injectors[injectorIndex].Push(_job))
+	{
+		WakeParkedWorkers(m_TotalWokerThreads);
+		std::this_thread::yield();
+	}
+}
+
+__InternalPeon::PeonJob* __InternalPeon::PeonSystem::PopInjectedJob(uint32_t _firstInjector)
+{
+	for (uint32_t i = 0; i < m_TotalInjectors; i++)
+	{
+		PeonJob* job = m_Injectors[(_firstInjector + i) % m_TotalInjectors].Pop();
+		if (job != nullptr)
+		{
+			return job;
+		}
+	}
+
+	return nullptr;
+}
+
+void __InternalPeon::PeonSystem::SetStealSettings(const PeonStealSettings& _stealSettings)
+{
+	m_StealSettings = _stealSettings;
+}
+
+const __InternalPeon::PeonStealSettings& __InternalPeon::PeonSystem::GetStealSettings()
+{
+	return m_StealSettings;
+}
+
+void __InternalPeon::PeonSystem::SetStealBatchSize(uint32_t _stealBatchSize)
+{
+	m_StealBatchSize = std::min(std::max(_stealBatchSize, 1u), uint32_t(PeonStealBatchMaximum));
+}
+
+uint32_t __InternalPeon::PeonSystem::GetStealBatchSize()
+{
+	return m_StealBatchSize;
+}
+
+void __InternalPeon::PeonSystem::SetBackgroundAgingInterval(uint32_t _agingInterval)
+{
+	m_BackgroundAgingInterval = _agingInterval;
+}
+
+uint32_t __InternalPeon::PeonSystem::GetBackgroundAgingInterval()
+{
+	return m_BackgroundAgingInterval;
+}
+
+void __InternalPeon::PeonSystem::EnableLaneStatistics(bool _enable)
+{
+	m_LaneStatisticsEnabled.store(_enable, std::memory_order_relaxed);
+}
+
+bool __InternalPeon::PeonSystem::LaneStatisticsEnabled()
+{
+	return m_LaneStatisticsEnabled.load(std::memory_order_relaxed);
+}
+
+__InternalPeon::PeonLaneStatistics __InternalPeon::PeonSystem::GetLaneStatistics(PeonJobPriority _priority)
+{
+	PeonLaneStatistics laneStatistics;
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		m_JobWorkers[i].GatherLaneStatistics(_priority, laneStatistics);
+	}
+
+	return laneStatistics;
+}
+
+void __InternalPeon::PeonSystem::ResetLaneStatistics()
+{
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		m_JobWorkers[i].ResetLaneStatistics();
+	}
+}
+
+__InternalPeon::PeonStatistics __InternalPeon::PeonSystem::GetStatistics()
+{
+	PeonStatistics statistics;
+	statistics.workers.resize(m_TotalWokerThreads);
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		PeonWorkerStatistics& worker = statistics.workers[i];
+		m_JobWorkers[i].GatherStatistics(worker);
+
+		// Sum everything but the peaks
+		PeonWorkerStatistics& total = statistics.total;
+		total.executedJobs += worker.executedJobs;
+		total.createdJobs += worker.createdJobs;
+		total.cancelledJobs += worker.cancelledJobs;
+		total.localPops += worker.localPops;
+		total.injectedPops += worker.injectedPops;
+		total.stealAttempts += worker.stealAttempts;
+		total.steals += worker.steals;
+		total.stealFailures += worker.stealFailures;
+		total.idleTime += worker.idleTime;
+		total.yieldTime += worker.yieldTime;
+		total.blockedTime += worker.blockedTime;
+		total.dequeDepth += worker.dequeDepth;
+		total.peakDequeDepth = std::max(total.peakDequeDepth, worker.peakDequeDepth);
+		total.frameJobs += worker.frameJobs;
+		total.peakFrameJobs = std::max(total.peakFrameJobs, worker.peakFrameJobs);
+		total.jobStorageSize += worker.jobStorageSize;
+	}
+
+	statistics.externalCreatedJobs = m_ExternalCreatedJobs.load(std::memory_order_relaxed);
+	statistics.reservedMemory = m_MemoryDepot.GetReservedMemory();
+
+	return statistics;
+}
+
+bool __InternalPeon::PeonSystem::StartTrace(const char* _filePath, const PeonTraceSettings& _traceSettings)
+{
+	// We need the workers to know how many rings to create
+	if (m_JobWorkers == nullptr)
+	{
+		return false;
+	}
+
+	return m_Tracer.Start(_filePath, m_TotalWokerThreads, _traceSettings);
+}
+
+void __InternalPeon::PeonSystem::FlushTrace()
+{
+	m_Tracer.Flush();
+}
+
+void __InternalPeon::PeonSystem::StopTrace()
+{
+	m_Tracer.Stop();
+}
+
+bool __InternalPeon::PeonSystem::IsTracing()
+{
+	return m_Tracer.IsRunning();
+}
+
+uint64_t __InternalPeon::PeonSystem::GetTraceDroppedEvents()
+{
+	return m_Tracer.GetDroppedEvents();
+}
+
+void __InternalPeon::PeonSystem::WakeParkedWorkers(uint32_t _totalJobs)
+{
+	// The pushed jobs must be visible before we check the parked workers (the worker does the opposite when parking)
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// Fast path, nobody is sleeping
+	if (m_TotalParkedWorkers.load(std::memory_order_relaxed) == 0)
+	{
+		return;
+	}
+
+	// Wake one parked worker for each job
+	for (unsigned int i = 0; i < m_TotalWokerThreads && _totalJobs > 0; i++)
+	{
+		if (m_JobWorkers[i].Unpark())
+		{
+			_totalJobs--;
+		}
+	}
+}
+
+void __InternalPeon::PeonSystem::SetActiveWorkerCount(unsigned int _totalActiveWorkers)
+{
+	std::lock_guard<std::mutex> lock(m_ActiveWorkersMutex);
+
+	// Worker 0 is always active (it's the thread that initialized the system)
+	_totalActiveWorkers = std::min(std::max(_totalActiveWorkers, 1u), m_TotalWokerThreads);
+	for (unsigned int i = 1; i < m_TotalWokerThreads; i++)
+	{
+		bool active = i < _totalActiveWorkers;
+		if (m_JobWorkers[i].IsActive() != active)
+		{
+			m_JobWorkers[i].SetActive(active);
+		}
+	}
+
+	m_TotalActiveWorkers = _totalActiveWorkers;
+}
+
+unsigned int __InternalPeon::PeonSystem::GetActiveWorkerCount()
+{
+	return m_TotalActiveWorkers.load(std::memory_order_relaxed);
+}
+
+void __InternalPeon::PeonSystem::SetAutoScaleSettings(const PeonAutoScaleSettings& _autoScaleSettings)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_AutoScaleMutex);
+		m_AutoScaleSettings = _autoScaleSettings;
+	}
+
+	UpdateAutoScaler();
+}
+
+__InternalPeon::PeonAutoScaleSettings __InternalPeon::PeonSystem::GetAutoScaleSettings()
+{
+	std::lock_guard<std::mutex> lock(m_AutoScaleMutex);
+	return m_AutoScaleSettings;
+}
+
+void __InternalPeon::PeonSystem::UpdateAutoScaler()
+{
+	bool enabled = false;
+	{
+		std::lock_guard<std::mutex> lock(m_AutoScaleMutex);
+		enabled = m_AutoScaleSettings.enabled && m_JobWorkers != nullptr && !m_IsShutdown;
+		m_AutoScaleStopRequested = !enabled;
+	}
+
+	// Start the thread or wait until it stops
+	if (enabled && !m_AutoScaleThread.joinable())
+	{
+		m_AutoScaleThread = std::thread(&PeonSystem::AutoScaleThread, this);
+	}
+	else if (!enabled && m_AutoScaleThread.joinable())
+	{
+		m_AutoScaleCondition.notify_all();
+		m_AutoScaleThread.join();
+	}
+}
+
+void __InternalPeon::PeonSystem::AutoScaleThread()
+{
+	const uint32_t totalSamples = 10;
+	uint64_t idleSamples = 0;
+	uint32_t sampleIndex = 0;
+
+	std::unique_lock<std::mutex> lock(m_AutoScaleMutex);
+	while (true)
+	{
+		// Wait for the next sample (or until we must stop)
+		uint32_t sampleTime = std::max(m_AutoScaleSettings.intervalMilliseconds / totalSamples, 1u);
+		if (m_AutoScaleCondition.wait_for(lock, std::chrono::milliseconds(sampleTime), [this]() { return m_AutoScaleStopRequested; }))
+		{
+			break;
+		}
+
+		// Sample the idle workers until the interval ends (worker 0 is left out, it's also the thread that initialized the
+		// system, it's not idle while running code outside the system)
+		unsigned int activeWorkers = GetActiveWorkerCount();
+		for (unsigned int i = 1; i < activeWorkers; i++)
+		{
+			idleSamples += m_JobWorkers[i].IsIdle() ? 1 : 0;
+		}
+
+		if (++sampleIndex < totalSamples)
+		{
+			continue;
+		}
+
+		const PeonAutoScaleSettings& settings = m_AutoScaleSettings;
+		unsigned int maximumWorkers = settings.maximumWorkers == 0 ? m_TotalWokerThreads : std::min(settings.maximumWorkers, m_TotalWokerThreads);
+		unsigned int minimumWorkers = std::min(std::max(settings.minimumWorkers, 1u), maximumWorkers);
+		uint64_t growQueueDepth = std::max(settings.growQueueDepth, 1u);
+		uint64_t totalQueuedJobs = GetTotalQueuedJobs();
+		double idleRatio = activeWorkers > 1 ? double(idleSamples) / (double(totalSamples) * (activeWorkers - 1)) : 0.0;
+
+		// Grow straight to the number of workers we need, shrink one worker at a time (so a short pause doesn't throw the
+		// workers away)
+		unsigned int targetWorkers = activeWorkers;
+		if (totalQueuedJobs > growQueueDepth * activeWorkers)
+		{
+			targetWorkers = unsigned(std::max(uint64_t(activeWorkers) + 1, (totalQueuedJobs + growQueueDepth - 1) / growQueueDepth));
+		}
+		else if (totalQueuedJobs == 0 && idleRatio > settings.shrinkIdleRatio)
+		{
+			targetWorkers = activeWorkers - 1;
+		}
+
+		targetWorkers = std::min(std::max(targetWorkers, minimumWorkers), maximumWorkers);
+		if (targetWorkers != activeWorkers)
+		{
+			SetActiveWorkerCount(targetWorkers);
+		}
+
+		idleSamples = 0;
+		sampleIndex = 0;
+	}
+}
+
+uint64_t __InternalPeon::PeonSystem::GetTotalQueuedJobs()
+{
+	uint64_t totalQueuedJobs = 0;
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		for (uint32_t j = 0; j < PeonTotalJobPriorities; j++)
+		{
+			totalQueuedJobs += uint64_t(std::max(m_JobWorkers[i].GetWorkerQueue(PeonJobPriority(j))->GetSize(), 0l));
+		}
+	}
+
+	for (uint32_t i = 0; i < m_TotalInjectors; i++)
+	{
+		totalQueuedJobs += m_Injectors[i].GetSize();
+	}
+
+	return totalQueuedJobs;
+}
+
+bool __InternalPeon::PeonSystem::IsDrained()
+{
+	// A job is always queued or owned by a busy worker, and a worker that finished a job after we started looking changed
+	// its executed count, so if nothing changed while we looked there is no job left
+	uint64_t totalExecutedJobs = 0;
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		totalExecutedJobs += m_JobWorkers[i].GetTotalExecutedJobs();
+	}
+
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		if (!m_JobWorkers[i].IsQueueEmpty())
+		{
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < m_TotalInjectors; i++)
+	{
+		if (!m_Injectors[i].IsEmpty())
+		{
+			return false;
+		}
+	}
+
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		if (m_JobWorkers[i].IsBusy())
+		{
+			return false;
+		}
+	}
+
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		totalExecutedJobs -= m_JobWorkers[i].GetTotalExecutedJobs();
+	}
+
+	return totalExecutedJobs == 0;
+}
+
+void __InternalPeon::PeonSystem::Shutdown()
+{
+	if (m_JobWorkers == nullptr || m_IsShutdown.exchange(true))
+	{
+		return;
+	}
+
+	// We can't be a worker, other than the one from the thread that initialized the system
+	PeonWorker* currentWorker = GetCurrentPeon();
+	assert((currentWorker == nullptr || currentWorker == &m_JobWorkers[0]) && "Peon: Shutdown must not be called from a worker thread!");
+
+	// Stop the auto scaler (it could deactivate workers while we drain)
+	UpdateAutoScaler();
+
+	// Every worker helps with the queued jobs (blocked workers can't run them)
+	SetActiveWorkerCount(m_TotalWokerThreads);
+	BlockThreadsStatus(false);
+
+	// Run every queued job (the thread that initialized the system helps, and continues its waiting fibers)
+	while (!IsDrained())
+	{
+		if (currentWorker == nullptr || (!currentWorker->ResumeReadyFiber() && !currentWorker->ExecuteThread(nullptr)))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	if (currentWorker != nullptr)
+	{
+		currentWorker->SetIdle(false);
+	}
+
+	// Stop and join the workers (worker 0 doesn't have a thread, its thread just stops being a worker)
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		m_JobWorkers[i].Stop();
+	}
+}
+
+bool __InternalPeon::PeonSystem::IsShutdown()
+{
+	return m_IsShutdown.load(std::memory_order_acquire);
+}
+
+bool __InternalPeon::PeonSystem::HasIdleWorkers()
+{
+	return m_TotalIdleWorkers.load(std::memory_order_relaxed) > 0;
+}
+
+bool __InternalPeon::PeonSystem::HasPendingJobs()
+{
+	// Blocked workers can't pick any job (they will be waked when the block is released)
+	if (ThreadsBlocked())
+	{
+		return false;
+	}
+
+	for (unsigned int i = 0; i < m_TotalWokerThreads; i++)
+	{
+		if (!m_JobWorkers[i].IsQueueEmpty())
+		{
+			return true;
+		}
+	}
+
+	for (uint32_t i = 0; i < m_TotalInjectors; i++)
+	{
+		if (!m_Injectors[i].IsEmpty())
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
 unsigned int __InternalPeon::PeonSystem::GetTotalWorkers()
@@ -163,17 +952,56 @@ void __InternalPeon::PeonSystem::ResetWorkerFrame()
 		// Refresh the memory allocator
 		m_JobWorkers[i].RefreshMemoryAllocator();
 	}
+
+	// Trim the memory (if enabled)
+	if (m_MemoryTrimInterval != 0 && ++m_FramesSinceMemoryTrim >= m_MemoryTrimInterval)
+	{
+		TrimMemory();
+	}
+
+	// Reset the job storage from the threads that aren't workers
+	std::lock_guard<std::mutex> lock(m_ExternalStorageMutex);
+	for (auto& externalJobStorage : m_ExternalJobStorages)
+	{
+		externalJobStorage.jobStorage->Reset();
+	}
+}
+
+void __InternalPeon::PeonSystem::TrimMemory()
+{
+	if (m_JobWorkers == nullptr)
+	{
+		return;
+	}
+
+	m_FramesSinceMemoryTrim = 0;
+	m_MemoryDepot.Trim(m_JobWorkers, m_TotalWokerThreads);
+}
+
+void __InternalPeon::PeonSystem::SetMemoryTrimInterval(uint32_t _frames)
+{
+	m_MemoryTrimInterval = _frames;
+	m_FramesSinceMemoryTrim = 0;
 }
 
-bool threadsBlocked = false;
+uint32_t __InternalPeon::PeonSystem::GetMemoryTrimInterval()
+{
+	return m_MemoryTrimInterval;
+}
 
 void __InternalPeon::PeonSystem::BlockThreadsStatus(bool _status)
 {
-	threadsBlocked = _status;
+	m_ThreadsBlocked.store(_status, std::memory_order_seq_cst);
+
+	// Parked workers must re-check for jobs when the block is released
+	if (!_status)
+	{
+		WakeParkedWorkers(m_TotalWokerThreads);
+	}
 }
 
 bool __InternalPeon::PeonSystem::ThreadsBlocked()
 {
-	return threadsBlocked;
+	return m_ThreadsBlocked.load(std::memory_order_seq_cst);
 }
 
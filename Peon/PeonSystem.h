@@ -9,10 +9,20 @@
 #include "PeonConfig.h"
 #include <atomic>
 #include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <cstdlib>
 #include <new>
+#include <initializer_list>
+#include <algorithm>
+#include <type_traits>
 #include "PeonJob.h"
 #include "PeonWorker.h"
+#include "PeonTopology.h"
+#include "PeonInjectorQueue.h"
+#include "PeonTrace.h"
+#include "PeonMemoryDepot.h"
 
 /////////////
 // DEFINES //
@@ -29,6 +39,40 @@
 // __InternalPeon
 PeonNamespaceBegin(__InternalPeon)
 
+// We know the schedule awaiter and the future
+struct PeonScheduleAwaiter;
+template <typename ResultType>
+class PeonFuture;
+
+// The value returned by a job function
+template <typename FunctionType>
+using PeonJobResult = typename std::decay<decltype(std::declval<typename std::decay<FunctionType>::type&>()())>::type;
+
+// The type returned when creating a job, a job for functions that don't return a value and a future for the ones that do
+template <typename FunctionType>
+using PeonJobHandle = typename std::conditional<std::is_void<PeonJobResult<FunctionType>>::value, PeonJob*, PeonFuture<PeonJobResult<FunctionType>>>::type;
+
+// The auto scaler configuration, it changes the number of active workers following the load (can be set at any time)
+struct PeonAutoScaleSettings
+{
+	// If the auto scaler is running
+	bool enabled = false;
+
+	// The minimum and maximum number of active workers (a zero maximum means all workers)
+	uint32_t minimumWorkers = 1;
+	uint32_t maximumWorkers = 0;
+
+	// How often the load is checked (in milliseconds), the idle workers are sampled 10 times in between
+	uint32_t intervalMilliseconds = 20;
+
+	// Grow when there are more queued jobs than this for each active worker (straight to the number of workers that would
+	// bring it under this value)
+	uint32_t growQueueDepth = 4;
+
+	// Shrink by one worker when nothing is queued and the active workers were idle for more than this fraction of the interval
+	float shrinkIdleRatio = 0.5f;
+};
+
 ///////////////
 // ALLOCATOR //
 ///////////////
@@ -42,11 +86,17 @@ struct PeonAllocator
 
 	// The allocate method
 	template <class U> constexpr PeonAllocator(const PeonAllocator<U>&) noexcept {}
-	static [[nodiscard]] T* allocate(std::size_t n)
+	[[nodiscard]] static T* allocate(std::size_t n)
 	{
 		// Get the current worker thread in execution
 		PeonWorker* currentWorker = PeonWorker::GetCurrentLocalThreadWorker();
 
+		// Threads that aren't workers allocate from the heap
+		if (currentWorker == nullptr)
+		{
+			return (T*)(PeonMemoryAllocator::AllocateExternalData(uint32_t(sizeof(T) * n)));
+		}
+
 		// Get the worker allocator
 		auto& allocator = currentWorker->GetMemoryAllocator();
 
@@ -62,6 +112,13 @@ struct PeonAllocator
 		// Get the current worker thread in execution
 		PeonWorker* currentWorker = PeonWorker::GetCurrentLocalThreadWorker();
 
+		// Threads that aren't workers hand the data back to its owner
+		if (currentWorker == nullptr)
+		{
+			PeonMemoryAllocator::DeallocateExternalData((char*)(p));
+			return;
+		}
+
 		// Get the worker allocator
 		auto& allocator = currentWorker->GetMemoryAllocator();
 
@@ -75,6 +132,13 @@ struct PeonAllocator
 		// Get the current worker thread in execution
 		PeonWorker* currentWorker = PeonWorker::GetCurrentLocalThreadWorker();
 
+		// Threads that aren't workers hand the data back to its owner
+		if (currentWorker == nullptr)
+		{
+			PeonMemoryAllocator::DeallocateExternalData((char*)(b));
+			return;
+		}
+
 		// Get the worker allocator
 		auto& allocator = currentWorker->GetMemoryAllocator();
 
@@ -92,6 +156,9 @@ bool operator!=(const PeonAllocator<T>&, const PeonAllocator<U>&) { return false
 ////////////////////////////////////////////////////////////////////////////////
 class PeonSystem
 {
+	// Friend classes
+	friend PeonWorker;
+
 public:
 	PeonSystem();
 	PeonSystem(const PeonSystem&);
@@ -119,6 +186,7 @@ public:
 
 		// Make sure we are working with a buffer size power of 2
 		_jobBufferSize = pow2roundup(_jobBufferSize);
+		m_JobBufferSize = _jobBufferSize;
 
 		// Save the number of worker threads
 		m_TotalWokerThreads = _numberWorkerThreads;
@@ -126,10 +194,17 @@ public:
 		// Alocate space for all threads
 		m_JobWorkers = new PeonWorker[_numberWorkerThreads];
 
-		// Set the queue size for each worker thread (WE CANT DO THIS AND INITIALIZE AT THE SAME TIME!)
+		// Pin the workers to the cpus (if enabled)
+		PlaceWorkers();
+
+		// Create the injector queues (used by threads that aren't workers)
+		InitializeInjectors();
+
+		// Set the queue size for each worker thread (WE CANT DO THIS AND INITIALIZE AT THE SAME TIME!) and share the memory depot
 		for (unsigned int i = 0; i < _numberWorkerThreads; i++)
 		{
-			m_JobWorkers[i].SetQueueSize(_jobBufferSize);
+			m_JobWorkers[i].SetQueueSize(_jobBufferSize, m_InitialDequeSize, m_JobStorageMode);
+			m_JobWorkers[i].GetMemoryAllocator().SetMemoryDepot(&m_MemoryDepot);
 		}
 
 		// Create the thread user data
@@ -146,9 +221,18 @@ public:
 			m_JobWorkers[i].Initialize(this, i, i == 0); // Check for the first thread (the main one)
 		}
 
+		// Wait until all workers are ready (pinned workers allocate their queues from their own thread)
+		WaitForWorkers();
+
+		// All workers start active
+		m_TotalActiveWorkers = _numberWorkerThreads;
+
 		// Unblock all threads
 		BlockThreadsStatus(false);
 
+		// Start the auto scaler (if it was enabled before)
+		UpdateAutoScaler();
+
 		return true;
 	}
 
@@ -163,9 +247,129 @@ public:
 	template <class ThreadUserDatType>
 	ThreadUserDatType* GetUserData()
 	{
-		return GetUserData(__InternalPeon::PeonWorker::GetCurrentLocalThreadIdentifier());
+		return GetUserData<ThreadUserDatType>(__InternalPeon::PeonWorker::GetCurrentLocalThreadIdentifier());
 	}
 
+	// Set the idle settings used by all worker threads (should be called before initializing the system)
+	void SetIdleSettings(const PeonIdleSettings& _idleSettings);
+
+	// Return the idle settings
+	const PeonIdleSettings& GetIdleSettings();
+
+	// Set the initial deque size for each worker (should be called before initializing the system, the deques will grow
+	// if needed, use the deque high-water mark to tune this value)
+	void SetInitialDequeSize(unsigned int _initialDequeSize);
+
+	// Set the job storage mode (should be called before initializing the system, in recycling mode the job buffer size is
+	// the number of jobs each worker allocates when it runs out of free jobs)
+	void SetJobStorageMode(PeonJobStorageMode _storageMode);
+
+	// Set the size of each injector queue (should be called before initializing the system), jobs started by threads that
+	// aren't workers go through them, when a queue is full the thread waits for the workers to catch up
+	void SetInjectorQueueSize(uint32_t _injectorQueueSize);
+
+	// Set the topology settings (should be called before initializing the system)
+	void SetTopologySettings(const PeonTopologySettings& _topologySettings);
+
+	// Return the topology settings
+	const PeonTopologySettings& GetTopologySettings();
+
+	// Return the cpu topology (only detected when the workers are pinned)
+	const PeonTopology& GetTopology();
+
+	// Set the fiber settings (should be called before initializing the system)
+	void SetFiberSettings(const PeonFiberSettings& _fiberSettings);
+
+	// Return the fiber settings
+	const PeonFiberSettings& GetFiberSettings();
+
+	// Return the total number of successful steals and steal attempts on the given tier (all steals are remote when the
+	// workers aren't pinned)
+	uint64_t GetTotalSteals(PeonStealTier _stealTier);
+	uint64_t GetTotalStealAttempts(PeonStealTier _stealTier);
+
+	// Set the steal settings used by all worker threads
+	void SetStealSettings(const PeonStealSettings& _stealSettings);
+
+	// Return the steal settings
+	const PeonStealSettings& GetStealSettings();
+
+	// Set the maximum number of jobs taken by each steal, thieves take up to half of the victim jobs in a single visit and
+	// push the extras into their own queue (use 1 to steal a single job at a time)
+	void SetStealBatchSize(uint32_t _stealBatchSize);
+
+	// Return the steal batch size
+	uint32_t GetStealBatchSize();
+
+	// Set the background aging interval, after this many high/normal jobs are taken while background jobs are waiting in the
+	// same worker, the oldest background job runs (so background jobs can't starve)
+	void SetBackgroundAgingInterval(uint32_t _agingInterval);
+
+	// Return the background aging interval
+	uint32_t GetBackgroundAgingInterval();
+
+	// Enable or disable the lane statistics (the wait time of each job is only recorded while they are enabled)
+	void EnableLaneStatistics(bool _enable);
+
+	// Return if the lane statistics are enabled
+	bool LaneStatisticsEnabled();
+
+	// Return the statistics for a priority lane (the queue depth and wait times summed over all workers), and reset the
+	// wait time counters (can be called from any thread, but the result is only a snapshot)
+	PeonLaneStatistics GetLaneStatistics(PeonJobPriority _priority);
+	void ResetLaneStatistics();
+
+	// Return the runtime statistics for each worker and their totals (can be called from any thread, the counters are only
+	// a snapshot, most of them are compiled out when PeonStatisticsEnabled is 0)
+	PeonStatistics GetStatistics();
+
+	// Start streaming a timeline of the job execution to the given file as chrome trace event json (open it in chrome://tracing
+	// or ui.perfetto.dev), must be called after initializing the system, return false if a trace is running, the file can't
+	// be created or the tracing was compiled out (PeonTraceEnabled is 0)
+	bool StartTrace(const char* _filePath, const PeonTraceSettings& _traceSettings = PeonTraceSettings());
+
+	// Write the recorded events into the trace file now (the writer thread does it periodically)
+	void FlushTrace();
+
+	// Stop the trace, write the remaining events and close the file
+	void StopTrace();
+
+	// Return if a trace is running
+	bool IsTracing();
+
+	// Return the number of trace events dropped because the writer didn't catch up (increase the ring size if needed)
+	uint64_t GetTraceDroppedEvents();
+
+	// Set the number of workers that can run jobs (from 1 to the total workers, the first ones are kept, worker 0 is always
+	// active), the others finish their current job and sleep until they are needed again (can be called from any thread)
+	void SetActiveWorkerCount(unsigned int _totalActiveWorkers);
+
+	// Return the number of active workers
+	unsigned int GetActiveWorkerCount();
+
+	// Set the auto scale settings (can be called at any time, the auto scaler runs on its own thread while enabled)
+	void SetAutoScaleSettings(const PeonAutoScaleSettings& _autoScaleSettings);
+
+	// Return the auto scale settings
+	PeonAutoScaleSettings GetAutoScaleSettings();
+
+	// Run every queued job, then stop and join all worker threads (the system can't be used after this), must be called from
+	// the thread that initialized the system or from a thread that isn't a worker, never from a job, and nobody else should
+	// be starting jobs (the destructor calls it if needed)
+	void Shutdown();
+
+	// Return if the system was shut down
+	bool IsShutdown();
+
+	// Wake up to the given number of parked workers (only does something when there is at least one parked worker)
+	void WakeParkedWorkers(uint32_t _totalJobs = 1);
+
+	// Return if there is any job visible in any worker or injector queue
+	bool HasPendingJobs();
+
+	// Return if there is any idle worker (looking for jobs to steal)
+	bool HasIdleWorkers();
+
 	// Return the total worker threads
 	unsigned int GetTotalWorkers();
 
@@ -175,6 +379,17 @@ public:
 	// Reset the actual worker frame
 	void ResetWorkerFrame();
 
+	// Give the memory the worker allocators don't need back to the system (chunks with every block free are released, the
+	// pages inside big free blocks are discarded), call it like ResetWorkerFrame, when no job is running
+	void TrimMemory();
+
+	// Set how many frames ResetWorkerFrame waits between memory trims (0 never trims, the default), so the reserved memory
+	// follows the working set instead of the peak
+	void SetMemoryTrimInterval(uint32_t _frames);
+
+	// Return the memory trim interval
+	uint32_t GetMemoryTrimInterval();
+
 	// Job container creation helper
 	void JobContainerHelper(void* _data) {}
 
@@ -182,14 +397,105 @@ public:
 	// CONSIDERED STATIC BUT MEMBER //
 	//////////////////////////////////
 
-	// Create a job
-	PeonJob* CreateJob(std::function<void()> _function);
+	// Create a job (the function is moved into the job, no type-erased copies are made, can be called from any thread), if the
+	// function returns a value we get a future for it (the value is kept inside the job)
+	template <typename FunctionType>
+	PeonJobHandle<FunctionType> CreateJob(FunctionType&& _function)
+	{
+		return CreateJob(static_cast<const char*>(nullptr), std::forward<FunctionType>(_function));
+	}
+
+	// Create a job with a label (shown by the traces, must outlive the trace, use string literals)
+	template <typename FunctionType>
+	PeonJobHandle<FunctionType> CreateJob(const char* _label, FunctionType&& _function)
+	{
+		// Get the worker thread for the current thread (nullptr if this thread isn't a worker)
+		PeonWorker* workerThread = PeonSystem::GetCurrentPeon();
+
+		// Get a fresh job
+		PeonJob* freshJob = GetFreshJob(workerThread);
+
+		// Initialize the job
+		freshJob->Initialize(m_JobStorageMode == PeonJobStorageMode::Recycling);
+
+		// Inherit the priority from the job running on this thread (if any)
+		InheritJobPriority(freshJob);
+
+		// Set the job worker thread
+		freshJob->SetWorkerThread(workerThread);
+
+		// Set the job function
+		freshJob->SetJobFunction(nullptr, std::forward<FunctionType>(_function), workerThread);
+
+		// Set the label and trace the creation
+		freshJob->SetLabel(_label);
+		TraceEvent(workerThread, PeonTraceEventType::Create, freshJob);
+
+		// Return the new job (or a future for its value)
+		if constexpr (std::is_void<PeonJobResult<FunctionType>>::value)
+		{
+			return freshJob;
+		}
+		else
+		{
+			return PeonFuture<PeonJobResult<FunctionType>>(this, freshJob);
+		}
+	}
 
 	// Create a job as child for the current job in execution
-	PeonJob* CreateChildJob(std::function<void()> _function);
+	template <typename FunctionType>
+	PeonJobHandle<FunctionType> CreateChildJob(FunctionType&& _function)
+	{
+		return CreateChildJob(PeonWorker::GetCurrentJob(), std::forward<FunctionType>(_function));
+	}
 
 	// Create a job as child for the given parent job
-	PeonJob* CreateChildJob(PeonJob* _parentJob, std::function<void()> _function);
+	template <typename FunctionType>
+	PeonJobHandle<FunctionType> CreateChildJob(PeonJob* _parentJob, FunctionType&& _function)
+	{
+		return CreateChildJob(_parentJob, static_cast<const char*>(nullptr), std::forward<FunctionType>(_function));
+	}
+
+	// Create a job with a label as child for the given parent job (the label is shown by the traces)
+	template <typename FunctionType>
+	PeonJobHandle<FunctionType> CreateChildJob(PeonJob* _parentJob, const char* _label, FunctionType&& _function)
+	{
+		// Atomic increment the number of unfinished jobs of our parent (the parent can't finish while we are adding
+		// this job, only the parent itself or its creator can add children to it)
+		_parentJob->m_UnfinishedJobs++;
+
+		// Get the worker thread for the current thread (nullptr if this thread isn't a worker)
+		PeonWorker* workerThread = PeonSystem::GetCurrentPeon();
+
+		// Get a fresh job
+		PeonJob* freshJob = GetFreshJob(workerThread);
+
+		// Initialize the job
+		freshJob->Initialize(m_JobStorageMode == PeonJobStorageMode::Recycling);
+
+		// Inherit the priority from the job running on this thread (if any)
+		InheritJobPriority(freshJob);
+
+		// Inherit the cancellation token from the parent
+		freshJob->SetCancellationToken(_parentJob->GetCancellationToken());
+
+		// Set the job function and parent
+		freshJob->SetJobFunction(_parentJob, std::forward<FunctionType>(_function), workerThread);
+
+		// Set the label and trace the creation
+		freshJob->SetLabel(_label);
+		TraceEvent(workerThread, PeonTraceEventType::Create, freshJob);
+
+		// Return the new job (or a future for its value)
+		if constexpr (std::is_void<PeonJobResult<FunctionType>>::value)
+		{
+			return freshJob;
+		}
+		else
+		{
+			return PeonFuture<PeonJobResult<FunctionType>>(this, freshJob);
+		}
+	}
 
 	// Create a container
 	Container* CreateContainer();
@@ -200,22 +506,80 @@ public:
 	// Create a child container for the given parent job
 	Container* CreateChildContainer(PeonJob* _parentJob);
 
-	// Run a job
+	// Run a job (using its priority, new jobs inherit the priority of the job running on the thread that created them), jobs
+	// started by threads that aren't workers go through an injector queue
 	void StartJob(PeonJob* _job);
 
-	// Wait for a job to continue
+	// Run a job with the given priority
+	void StartJob(PeonJob* _job, PeonJobPriority _priority);
+
+	// Run many jobs at once, a worker pushes them as a single batch (the array can be reordered)
+	void StartJobs(PeonJob** _jobs, uint32_t _totalJobs);
+
+	// Set a job priority without starting it (use it for jobs started by their dependencies)
+	void SetJobPriority(PeonJob* _job, PeonJobPriority _priority);
+
+	// Set the label shown by the traces for a job (use it for containers, must outlive the trace)
+	void SetJobLabel(PeonJob* _job, const char* _label);
+
+	// Wait for a job to continue (workers run other jobs while waiting, on another fiber if fibers are enabled, threads that
+	// aren't workers just yield)
 	void WaitForJob(PeonJob* _job);
 
-	// Add a job dependency (remember to NOT start this job manually)
+	// Attach a cancellation token to a job before starting it (children created after this inherit it), once the token is
+	// cancelled the queued jobs using it finish without running their functions
+	void SetJobCancellationToken(PeonJob* _job, PeonCancellationToken* _cancellationToken);
+
+	// Return if the job running on this thread was cancelled (poll it inside long jobs to stop early)
+	bool IsCancelled();
+
+	// Return an awaitable that moves the awaiting coroutine onto a worker (it's resumed from a new job with the given priority,
+	// only usable with C++20 coroutines, see PeonTask.h)
+	PeonScheduleAwaiter Schedule(PeonJobPriority _priority = PeonJobPriority::Normal);
+
+	// Add a job dependency (remember to NOT start this job manually), a job can depend on many others and will only start when
+	// all of them finish (add all dependencies before starting any of those jobs)
 	void AddJobDependency(PeonJob* _thisFirst, PeonJob* _thenThis);
+	void AddJobDependency(std::initializer_list<PeonJob*> _thoseFirst, PeonJob* _thenThis);
+
+	// Keep a recyclable job alive after starting it (so we can wait for it) and release it when done (no-op for frame jobs)
+	void RetainJob(PeonJob* _job);
+	void ReleaseJob(PeonJob* _job);
+
+	// Run the function for each index in [begin, end) and wait for all of them, the function can receive a single index or
+	// a [begin, end) chunk. The range is only split (in half) when other workers are idle and our own queue is empty, so
+	// each worker process contiguous chunks of at least _grainSize indexes and only O(log n) jobs are created in the common case
+	template <typename IndexType, typename FunctionType>
+	void ParallelFor(IndexType _begin, IndexType _end, FunctionType&& _function, IndexType _grainSize = 1)
+	{
+		if (_begin >= _end)
+		{
+			return;
+		}
+
+		// The data shared by all range jobs (they only exist until we stop waiting)
+		ParallelForData<IndexType, typename std::remove_reference<FunctionType>::type> parallelForData = { this, CreateContainer(), _function, std::max(_grainSize, IndexType(1)) };
+		RetainJob(parallelForData.container);
+
+		// Process the range on this thread, any split will go to the container
+		ParallelForRange(&parallelForData, _begin, _end);
+
+		// Start the container and help the other workers until all splits finish
+		StartJob(parallelForData.container);
+		WaitForJob(parallelForData.container);
+		ReleaseJob(parallelForData.container);
+	}
 
 	///////////////////////
 	// STATIC BUT MEMBER //
 	///////////////////////
 
-	// Return the current thread executing this code
+	// Return the worker running on the current thread (nullptr if this thread isn't one of our workers)
 	PeonWorker* GetCurrentPeon();
 
+	// Return if the current thread is one of our workers
+	bool IsWorkerThread();
+
 	// Return the default worker thread
 	__InternalPeon::PeonWorker* GetDefaultWorkerThread();
 
@@ -230,17 +594,118 @@ public:
 	// Return the current worker for the actual context
 	PeonWorker* GetCurrentWorker();
 
-	// Return the current worker index for the actual context
+	// Return the current worker index for the actual context (-1 if this thread isn't one of our workers)
 	int GetCurrentWorkerIndex();
 
 protected:
 
+	// The data shared by all jobs from the same parallel for
+	template <typename IndexType, typename FunctionType>
+	struct ParallelForData
+	{
+		PeonSystem* system;
+		Container* container;
+		FunctionType& function;
+		IndexType grainSize;
+	};
+
+	// Process a parallel for range, splitting it when other workers are looking for jobs
+	template <typename IndexType, typename FunctionType>
+	static void ParallelForRange(ParallelForData<IndexType, FunctionType>* _data, IndexType _begin, IndexType _end)
+	{
+		PeonSystem* system = _data->system;
+		PeonWorker* currentWorker = system->GetCurrentPeon();
+
+		while (_begin < _end)
+		{
+			// Give the upper half away if someone could take it (and we don't have anything else for them)
+			if (_end - _begin > _data->grainSize && system->HasIdleWorkers() && (currentWorker == nullptr || currentWorker->IsQueueEmpty()))
+			{
+				IndexType middle = _begin + (_end - _begin) / 2;
+				IndexType end = _end;
+				system->StartJob(system->CreateChildJob(_data->container, [_data, middle, end]() { ParallelForRange(_data, middle, end); }));
+				_end = middle;
+				continue;
+			}
+
+			// Process the next chunk
+			IndexType chunkEnd = _end - _begin > _data->grainSize ? _begin + _data->grainSize : _end;
+			if constexpr (std::is_invocable<FunctionType&, IndexType, IndexType>::value)
+			{
+				_data->function(_begin, chunkEnd);
+			}
+			else
+			{
+				for (IndexType i = _begin; i < chunkEnd; i++)
+				{
+					_data->function(i);
+				}
+			}
+
+			_begin = chunkEnd;
+		}
+	}
+
+	// Detect the topology and set the placement of each worker (only when the workers should be pinned)
+	void PlaceWorkers();
+
+	// Wait until all workers are ready
+	void WaitForWorkers();
+
+	// Create the injector queues (one for each NUMA node when the workers are pinned, a single one otherwise)
+	void InitializeInjectors();
+
+	// Return a fresh job from the given worker, or from the job storage of this thread if it isn't a worker
+	PeonJob* GetFreshJob(PeonWorker* _workerThread);
+
+	// Return the job storage for the current thread (must not be a worker), it's created on the first call
+	PeonStealingQueue* GetExternalJobStorage();
+
+	// Push a job into the injector queue for the node running this thread (waits while the queue is full)
+	void InjectJob(PeonJob* _job);
+
+	// Take a job from the injector queues, starting from the given one
+	PeonJob* PopInjectedJob(uint32_t _firstInjector);
+
+	// Return if every queue is empty and no worker is running a job (only valid while nobody else is starting jobs)
+	bool IsDrained();
+
+	// Return the number of queued jobs in every worker and injector queue (only a snapshot)
+	uint64_t GetTotalQueuedJobs();
+
+	// Start or stop the auto scaler thread following its settings
+	void UpdateAutoScaler();
+
+	// The auto scaler thread
+	void AutoScaleThread();
+
+	// Set the job priority to the one from the job running on this thread
+	void InheritJobPriority(PeonJob* _job);
+
+	// Record a trace event from the given worker (nullptr for threads that aren't workers), only a load while not tracing
+	void TraceEvent(PeonWorker* _workerThread, PeonTraceEventType _type, PeonJob* _job, uint32_t _argument = 0)
+	{
+#if PeonTraceEnabled
+		if (m_Tracer.IsRunning())
+		{
+			m_Tracer.Record(_workerThread != nullptr ? _workerThread->GetThreadId() : -1, _type, _job, _job != nullptr ? _job->GetLabel() : nullptr, _argument);
+		}
+#endif
+	}
+
 	// Should not be used externally, set and check the thread block status
 	void BlockThreadsStatus(bool _status);
 	bool ThreadsBlocked();
 
 private:
 
+	// The job storage used by a thread that isn't a worker
+	struct ExternalJobStorage
+	{
+		std::thread::id threadId;
+		PeonStealingQueue* jobStorage;
+	};
+
 	// The total of worker threads
 	unsigned int m_TotalWokerThreads;
 
@@ -249,8 +714,255 @@ private:
 
 	// The thread user data
 	std::vector<void*> m_ThredUserData;
+
+	// The idle settings
+	PeonIdleSettings m_IdleSettings;
+
+	// The job buffer size and the initial deque size for each worker
+	unsigned int m_JobBufferSize;
+	unsigned int m_InitialDequeSize;
+
+	// The injector queues and their size
+	PeonInjectorQueue* m_Injectors;
+	uint32_t m_TotalInjectors;
+	uint32_t m_InjectorQueueSize;
+
+	// The job storage for each thread that isn't a worker and the unique id of this system (threads cache the storage
+	// from the last system they used)
+	std::mutex m_ExternalStorageMutex;
+	std::vector<ExternalJobStorage> m_ExternalJobStorages;
+	uint64_t m_SystemId;
+
+	// The job storage mode
+	PeonJobStorageMode m_JobStorageMode;
+
+	// The topology settings and the detected topology
+	PeonTopologySettings m_TopologySettings;
+	PeonTopology m_Topology;
+
+	// The fiber settings
+	PeonFiberSettings m_FiberSettings;
+
+	// The steal settings and the steal batch size
+	PeonStealSettings m_StealSettings;
+	uint32_t m_StealBatchSize;
+
+	// The background aging interval
+	uint32_t m_BackgroundAgingInterval;
+
+	// If the lane statistics are enabled
+	std::atomic<bool> m_LaneStatisticsEnabled;
+
+	// The number of jobs created by threads that aren't workers
+	std::atomic<uint64_t> m_ExternalCreatedJobs;
+
+	// The total number of parked workers
+	std::atomic<uint32_t> m_TotalParkedWorkers;
+
+	// The total number of idle workers (looking for jobs, parked workers included)
+	std::atomic<uint32_t> m_TotalIdleWorkers;
+
+	// If the worker threads are blocked
+	std::atomic<bool> m_ThreadsBlocked;
+
+	// The number of active workers (changed under the mutex)
+	std::mutex m_ActiveWorkersMutex;
+	std::atomic<unsigned int> m_TotalActiveWorkers;
+
+	// The auto scale settings, the auto scaler thread and its stop event
+	PeonAutoScaleSettings m_AutoScaleSettings;
+	std::thread m_AutoScaleThread;
+	std::mutex m_AutoScaleMutex;
+	std::condition_variable m_AutoScaleCondition;
+	bool m_AutoScaleStopRequested;
+
+	// If the system was shut down
+	std::atomic<bool> m_IsShutdown;
+
+	// The job timeline tracer
+	PeonTracer m_Tracer;
+
+	// The memory depot shared by the worker allocators (it owns their memory), the trim interval and the frames since the last
+	// trim
+	PeonMemoryDepot m_MemoryDepot;
+	uint32_t m_MemoryTrimInterval;
+	uint32_t m_FramesSinceMemoryTrim;
+};
+
+// The awaitable returned by Schedule(), the coroutine handle type is a template so this header doesn't need C++20
+struct PeonScheduleAwaiter
+{
+	PeonSystem* system;
+	PeonJobPriority priority;
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	// Resume the coroutine from a new job (it could run before this returns, we can't touch the coroutine frame after starting it)
+	template <typename CoroutineHandleType>
+	void await_suspend(CoroutineHandleType _handle)
+	{
+		PeonSystem* scheduleSystem = system;
+		PeonJob* resumeJob = scheduleSystem->CreateJob([address = _handle.address()]()
+		{
+			CoroutineHandleType::from_address(address).resume();
+		});
+
+		scheduleSystem->StartJob(resumeJob, priority);
+	}
+
+	void await_resume() const noexcept
+	{
+	}
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Class name: PeonFuture
+////////////////////////////////////////////////////////////////////////////////
+template <typename ResultType>
+class PeonFuture
+{
+	// The reference a continuation holds on the job it reads the value from (released with the continuation function, even if
+	// the continuation is cancelled and never runs)
+	struct JobReference
+	{
+		JobReference(PeonSystem* _system, PeonJob* _job) : system(_system), job(_job) {}
+		JobReference(JobReference&& _other) noexcept : system(_other.system), job(std::exchange(_other.job, nullptr)) {}
+		~JobReference()
+		{
+			if (job != nullptr)
+			{
+				system->ReleaseJob(job);
+			}
+		}
+
+		PeonSystem* system;
+		PeonJob* job;
+	};
+
+public:
+	PeonFuture() noexcept : m_System(nullptr), m_Job(nullptr) {}
+	PeonFuture(PeonSystem* _system, PeonJob* _job) : m_System(_system), m_Job(_job)
+	{
+		// The value lives inside the job, keep it while this future exists (no-op for frame jobs)
+		m_System->RetainJob(m_Job);
+	}
+	PeonFuture(PeonFuture&& _other) noexcept : m_System(_other.m_System), m_Job(std::exchange(_other.m_Job, nullptr)) {}
+	PeonFuture(const PeonFuture&) = delete;
+	~PeonFuture()
+	{
+		if (m_Job != nullptr)
+		{
+			m_System->ReleaseJob(m_Job);
+		}
+	}
+
+	PeonFuture& operator=(PeonFuture&& _other) noexcept
+	{
+		if (this != &_other)
+		{
+			if (m_Job != nullptr)
+			{
+				m_System->ReleaseJob(m_Job);
+			}
+
+			m_System = _other.m_System;
+			m_Job = std::exchange(_other.m_Job, nullptr);
+		}
+
+		return *this;
+	}
+
+	PeonFuture& operator=(const PeonFuture&) = delete;
+
+	// Return the job that produces the value (start it, wait for it or use it as a dependency like any other job, a future
+	// converts to its job)
+	PeonJob* GetJob() const
+	{
+		return m_Job;
+	}
+
+	operator PeonJob*() const
+	{
+		return m_Job;
+	}
+
+	// Return if the value is ready
+	bool IsReady() const
+	{
+		return m_Job->HasCompleted();
+	}
+
+	// Return if the job was cancelled
+	bool IsCancelled() const
+	{
+		return m_Job->IsCancelled();
+	}
+
+	// Wait for the job and return its value (the job must have been started, or be a continuation), frame jobs keep the value
+	// until the frame is reset, a cancelled job may have no value (check IsCancelled() first)
+	typename std::add_lvalue_reference<ResultType>::type Get()
+	{
+		m_System->WaitForJob(m_Job);
+		if constexpr (!std::is_void<ResultType>::value)
+		{
+			return m_Job->template GetResult<ResultType>();
+		}
+	}
+
+	// Create a job that runs the function with our value (as an lvalue) once our job completes and return a future for its
+	// result, it's a dependency so it must be added before our job starts (and must not be started manually), the new job has
+	// the same parent as ours (so a container waits for the whole chain)
+	template <typename FunctionType>
+	auto Then(FunctionType&& _function)
+	{
+		PeonSystem* system = m_System;
+		PeonJob* job = m_Job;
+
+		// The continuation reads the value straight from our job, keep the job until then
+		system->RetainJob(job);
+
+		auto continuationFunction = [jobReference = JobReference(system, job), function = std::forward<FunctionType>(_function)]() mutable
+		{
+			if constexpr (std::is_void<ResultType>::value)
+			{
+				return function();
+			}
+			else
+			{
+				return function(jobReference.job->template GetResult<ResultType>());
+			}
+		};
+
+		// Our job didn't start yet, so its parent can't finish while we add a child to it
+		PeonJob* parentJob = job->GetParent();
+		auto continuation = parentJob != nullptr ? system->CreateChildJob(parentJob, std::move(continuationFunction)) : system->CreateJob(std::move(continuationFunction));
+
+		// A cancelled job may have no value, so its continuation must be cancelled with it
+		PeonJob* continuationJob = continuation;
+		continuationJob->SetCancellationToken(job->GetCancellationToken());
+
+		system->AddJobDependency(job, continuation);
+
+		// Functions that don't return a value still get a future (so we can wait for them or chain more continuations)
+		if constexpr (std::is_same<decltype(continuation), PeonJob*>::value)
+		{
+			return PeonFuture<void>(system, continuation);
+		}
+		else
+		{
+			return continuation;
+		}
+	}
+
+private:
+
+	// The system and the job that produces the value
+	PeonSystem* m_System;
+	PeonJob* m_Job;
+};
 
 // __InternalPeon
 PeonNamespaceEnd(__InternalPeon)
@@ -0,0 +1,366 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonTask.h
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+//////////////
+// INCLUDES //
+//////////////
+#include "PeonConfig.h"
+#include "PeonSystem.h"
+
+/////////////
+// DEFINES //
+/////////////
+
+// Coroutines need C++20 (the rest of the library only needs C++17, this header is empty without them)
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && __has_include(<coroutine>)
+#define PeonCoroutinesSupported
+#endif
+
+#ifdef PeonCoroutinesSupported
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+///////////////
+// NAMESPACE //
+///////////////
+
+// __InternalPeon
+PeonNamespaceBegin(__InternalPeon)
+
+// We know the task
+template <typename ResultType>
+class PeonTask;
+
+////////////
+// GLOBAL //
+////////////
+
+// Suspend a coroutine until a job completes, the worker that completes the job resumes it (the awaiter is the waiter, it
+// lives in the coroutine frame)
+struct PeonJobAwaiter
+{
+	PeonJob* job;
+	PeonJobWaiter waiter;
+
+	bool await_ready() const noexcept
+	{
+		return job->HasCompleted();
+	}
+
+	// Return false if the job completed meanwhile (the coroutine continues right away)
+	template <typename PromiseType>
+	bool await_suspend(std::coroutine_handle<PromiseType> _handle) noexcept
+	{
+		waiter.resumeFunction = [](void* _address) { std::coroutine_handle<PromiseType>::from_address(_address).resume(); };
+		waiter.address = _handle.address();
+		waiter.next = nullptr;
+
+		return job->AddWaiter(&waiter);
+	}
+
+	void await_resume() const noexcept
+	{
+	}
+};
+
+// The promise data shared by all task types
+class PeonTaskPromiseBase
+{
+	// The awaiter used when the task ends
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		// Continue the awaiting coroutine (if any) or complete the job running this task
+		template <typename PromiseType>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<PromiseType> _handle) noexcept
+		{
+			PeonTaskPromiseBase& promise = _handle.promise();
+			if (promise.m_Continuation)
+			{
+				return promise.m_Continuation;
+			}
+
+			// The task can be destroyed as soon as the job completes, we can't touch the frame after this
+			if (promise.m_CompletionJob != nullptr)
+			{
+				promise.m_System->StartJob(promise.m_CompletionJob);
+			}
+
+			return std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept
+		{
+		}
+	};
+
+public:
+
+	// The coroutine frames come from the allocator of the worker that calls the coroutine function (or the heap if the thread
+	// isn't a worker)
+	static void* operator new(std::size_t _size)
+	{
+		return PeonAllocator<char>::allocate(_size);
+	}
+
+	static void operator delete(void* _data, std::size_t _size)
+	{
+		PeonAllocator<char>::deallocate((char*)_data, _size);
+	}
+
+	// Tasks are lazy, they only start when awaited or when their job runs
+	std::suspend_always initial_suspend() const noexcept
+	{
+		return {};
+	}
+
+	FinalAwaiter final_suspend() const noexcept
+	{
+		return {};
+	}
+
+	void unhandled_exception() noexcept
+	{
+		m_Exception = std::current_exception();
+	}
+
+	// Let the coroutine await jobs directly
+	PeonJobAwaiter await_transform(PeonJob* _job) const noexcept
+	{
+		return PeonJobAwaiter{ _job, {} };
+	}
+
+	// Anything else is awaited as is
+	template <typename AwaitableType>
+	AwaitableType&& await_transform(AwaitableType&& _awaitable) const noexcept
+	{
+		return std::forward<AwaitableType>(_awaitable);
+	}
+
+	// Set the coroutine resumed when this task ends
+	void SetContinuation(std::coroutine_handle<> _continuation)
+	{
+		m_Continuation = _continuation;
+	}
+
+	// Set the job started when this task ends (used when the task runs as a job)
+	void SetCompletionJob(PeonSystem* _system, PeonJob* _completionJob)
+	{
+		m_System = _system;
+		m_CompletionJob = _completionJob;
+	}
+
+protected:
+
+	// Rethrow the exception that escaped the coroutine (if any)
+	void RethrowException()
+	{
+		if (m_Exception)
+		{
+			std::rethrow_exception(m_Exception);
+		}
+	}
+
+///////////////
+// VARIABLES //
+private: //////
+
+	// The awaiting coroutine
+	std::coroutine_handle<> m_Continuation;
+
+	// The system and the job started when this task ends
+	PeonSystem* m_System = nullptr;
+	PeonJob* m_CompletionJob = nullptr;
+
+	// The exception that escaped the coroutine
+	std::exception_ptr m_Exception;
+};
+
+// The promise for tasks that return a value
+template <typename ResultType>
+class PeonTaskPromise : public PeonTaskPromiseBase
+{
+public:
+
+	PeonTask<ResultType> get_return_object() noexcept;
+
+	template <typename ValueType>
+	void return_value(ValueType&& _value)
+	{
+		m_Result.emplace(std::forward<ValueType>(_value));
+	}
+
+	// Return the result (rethrows the exception that escaped the coroutine)
+	ResultType& GetResult()
+	{
+		RethrowException();
+		return *m_Result;
+	}
+
+private:
+
+	// The result
+	std::optional<ResultType> m_Result;
+};
+
+// The promise for tasks that don't return a value
+template <>
+class PeonTaskPromise<void> : public PeonTaskPromiseBase
+{
+public:
+
+	PeonTask<void> get_return_object() noexcept;
+
+	void return_void() noexcept
+	{
+	}
+
+	// Rethrow the exception that escaped the coroutine (if any)
+	void GetResult()
+	{
+		RethrowException();
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: PeonTask
+////////////////////////////////////////////////////////////////////////////////
+template <typename ResultType = void>
+class PeonTask
+{
+public:
+
+	using promise_type = PeonTaskPromise<ResultType>;
+	using HandleType = std::coroutine_handle<promise_type>;
+
+private:
+
+	// The awaiter used when another coroutine awaits this task (it starts the task and continues when it ends)
+	template <bool MoveResult>
+	struct TaskAwaiter
+	{
+		HandleType handle;
+
+		bool await_ready() const noexcept
+		{
+			return !handle || handle.done();
+		}
+
+		// Start the task on this thread (it transfers straight back to us when it ends)
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> _continuation) noexcept
+		{
+			handle.promise().SetContinuation(_continuation);
+			return handle;
+		}
+
+		decltype(auto) await_resume()
+		{
+			if constexpr (MoveResult && !std::is_void<ResultType>::value)
+			{
+				return std::move(handle.promise().GetResult());
+			}
+			else
+			{
+				return handle.promise().GetResult();
+			}
+		}
+	};
+
+public:
+	PeonTask() noexcept = default;
+	explicit PeonTask(HandleType _handle) noexcept : m_Handle(_handle) {}
+	PeonTask(PeonTask&& _other) noexcept : m_Handle(std::exchange(_other.m_Handle, {})) {}
+	PeonTask(const PeonTask&) = delete;
+	~PeonTask()
+	{
+		if (m_Handle)
+		{
+			m_Handle.destroy();
+		}
+	}
+
+	PeonTask& operator=(PeonTask&& _other) noexcept
+	{
+		if (this != &_other)
+		{
+			if (m_Handle)
+			{
+				m_Handle.destroy();
+			}
+
+			m_Handle = std::exchange(_other.m_Handle, {});
+		}
+
+		return *this;
+	}
+
+	PeonTask& operator=(const PeonTask&) = delete;
+
+	// Await this task from another coroutine (the result is moved out when awaiting a temporary)
+	TaskAwaiter<false> operator co_await() & noexcept
+	{
+		return TaskAwaiter<false>{ m_Handle };
+	}
+
+	TaskAwaiter<true> operator co_await() && noexcept
+	{
+		return TaskAwaiter<true>{ m_Handle };
+	}
+
+	// Create a job that runs this task and only completes when the task ends, start and wait for it like any other job (this
+	// task must outlive the job and must not be awaited, don't cancel the job, poll a cancellation token inside the task instead)
+	PeonJob* CreateJob(PeonSystem* _system)
+	{
+		PeonJob* taskJob = _system->CreateJob([address = m_Handle.address()]()
+		{
+			HandleType::from_address(address).resume();
+		});
+
+		// This child keeps the job running until the task ends
+		m_Handle.promise().SetCompletionJob(_system, _system->CreateChildJob(taskJob, []() {}));
+
+		return taskJob;
+	}
+
+	// Return if the task ended
+	bool IsReady() const noexcept
+	{
+		return !m_Handle || m_Handle.done();
+	}
+
+	// Return the result (the task must have ended, rethrows the exception that escaped the coroutine)
+	decltype(auto) GetResult()
+	{
+		return m_Handle.promise().GetResult();
+	}
+
+private:
+
+	// The coroutine
+	HandleType m_Handle;
+};
+
+template <typename ResultType>
+PeonTask<ResultType> PeonTaskPromise<ResultType>::get_return_object() noexcept
+{
+	return PeonTask<ResultType>(std::coroutine_handle<PeonTaskPromise<ResultType>>::from_promise(*this));
+}
+
+inline PeonTask<void> PeonTaskPromise<void>::get_return_object() noexcept
+{
+	return PeonTask<void>(std::coroutine_handle<PeonTaskPromise<void>>::from_promise(*this));
+}
+
+// __InternalPeon
+PeonNamespaceEnd(__InternalPeon)
+
+#endif
@@ -0,0 +1,250 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonTaskGraph.cpp
+////////////////////////////////////////////////////////////////////////////////
+#include "PeonTaskGraph.h"
+#include "PeonSystem.h"
+
+///////////////
+// NAMESPACE //
+///////////////
+
+__InternalPeon::PeonTaskGraph::PeonTaskGraph()
+{
+	// Set the initial data
+	m_Compiled = false;
+	m_System = nullptr;
+	m_Container = nullptr;
+}
+
+__InternalPeon::PeonTaskGraph::~PeonTaskGraph()
+{
+}
+
+bool __InternalPeon::PeonTaskGraph::AddDependency(NodeId _thisFirst, NodeId _thenThis)
+{
+	// Check if both nodes exist
+	if (_thisFirst >= m_Functions.size() || _thenThis >= m_Functions.size() || _thisFirst == _thenThis)
+	{
+		return false;
+	}
+
+	m_Dependencies.push_back({ _thisFirst, _thenThis });
+	m_Compiled = false;
+
+	return true;
+}
+
+bool __InternalPeon::PeonTaskGraph::Compile()
+{
+	uint32_t totalNodes = (uint32_t)m_Functions.size();
+
+	// Count the predecessors and successors of each node
+	std::vector<uint32_t> totalPredecessors(totalNodes, 0);
+	std::vector<uint32_t> successorOffsets(totalNodes + 1, 0);
+	for (auto& dependency : m_Dependencies)
+	{
+		totalPredecessors[dependency.second]++;
+		successorOffsets[dependency.first + 1]++;
+	}
+
+	// Group the successors by node (still using the node ids)
+	for (uint32_t i = 0; i < totalNodes; i++)
+	{
+		successorOffsets[i + 1] += successorOffsets[i];
+	}
+
+	std::vector<uint32_t> successors(m_Dependencies.size());
+	std::vector<uint32_t> successorPositions(successorOffsets.begin(), successorOffsets.end() - 1);
+	for (auto& dependency : m_Dependencies)
+	{
+		successors[successorPositions[dependency.first]++] = dependency.second;
+	}
+
+	// Sort the nodes (Kahn), the root nodes come first
+	std::vector<uint32_t> order;
+	std::vector<uint32_t> remainingPredecessors = totalPredecessors;
+	order.reserve(totalNodes);
+	for (uint32_t i = 0; i < totalNodes; i++)
+	{
+		if (totalPredecessors[i] == 0)
+		{
+			order.push_back(i);
+		}
+	}
+
+	uint32_t totalRootNodes = (uint32_t)order.size();
+	for (uint32_t i = 0; i < order.size(); i++)
+	{
+		for (uint32_t j = successorOffsets[order[i]]; j < successorOffsets[order[i] + 1]; j++)
+		{
+			if (--remainingPredecessors[successors[j]] == 0)
+			{
+				order.push_back(successors[j]);
+			}
+		}
+	}
+
+	// Some nodes were never ready, we have a cycle
+	if (order.size() != totalNodes)
+	{
+		return false;
+	}
+
+	// The compiled index of each node
+	std::vector<uint32_t> compiledIndexes(totalNodes);
+	for (uint32_t i = 0; i < totalNodes; i++)
+	{
+		compiledIndexes[order[i]] = i;
+	}
+
+	// Build the flat node array
+	m_Nodes.clear();
+	m_Successors.clear();
+	m_RootNodes.clear();
+	m_Nodes.reserve(totalNodes);
+	m_Successors.reserve(successors.size());
+	for (uint32_t i = 0; i < totalNodes; i++)
+	{
+		uint32_t nodeId = order[i];
+
+		CompiledNode node;
+		node.function = m_Functions[nodeId];
+		node.firstSuccessor = (uint32_t)m_Successors.size();
+		node.totalSuccessors = successorOffsets[nodeId + 1] - successorOffsets[nodeId];
+		node.totalPredecessors = totalPredecessors[nodeId];
+		m_Nodes.push_back(std::move(node));
+
+		for (uint32_t j = successorOffsets[nodeId]; j < successorOffsets[nodeId + 1]; j++)
+		{
+			m_Successors.push_back(compiledIndexes[successors[j]]);
+		}
+	}
+
+	for (uint32_t i = 0; i < totalRootNodes; i++)
+	{
+		m_RootNodes.push_back(i);
+	}
+
+	// Create the predecessor counters and the root job array
+	m_PendingPredecessors.reset(new std::atomic<uint32_t>[totalNodes]);
+	m_RootJobs.resize(m_RootNodes.size());
+
+	m_Compiled = true;
+
+	return true;
+}
+
+bool __InternalPeon::PeonTaskGraph::Execute(PeonSystem* _system)
+{
+	// Make sure we are compiled
+	if (!m_Compiled && !Compile())
+	{
+		return false;
+	}
+
+	if (m_Nodes.empty())
+	{
+		return true;
+	}
+
+	// Reset the predecessor counters
+	for (uint32_t i = 0; i < m_Nodes.size(); i++)
+	{
+		m_PendingPredecessors[i].store(m_Nodes[i].totalPredecessors, std::memory_order_relaxed);
+	}
+
+	// All node jobs are children of a single container
+	m_System = _system;
+	m_Container = m_System->CreateContainer();
+	m_System->RetainJob(m_Container);
+
+	// Start the root nodes as a single batch
+	for (uint32_t i = 0; i < m_RootNodes.size(); i++)
+	{
+		m_RootJobs[i] = CreateNodeJob(m_RootNodes[i]);
+	}
+
+	m_System->StartJobs(m_RootJobs.data(), uint32_t(m_RootJobs.size()));
+
+	// Start and wait for the container
+	m_System->StartJob(m_Container);
+	m_System->WaitForJob(m_Container);
+	m_System->ReleaseJob(m_Container);
+
+	m_Container = nullptr;
+
+	return true;
+}
+
+void __InternalPeon::PeonTaskGraph::RunNode(uint32_t _nodeIndex)
+{
+	while (true)
+	{
+		CompiledNode& node = m_Nodes[_nodeIndex];
+
+		// Run the node function
+		node.function();
+
+		// Release the successors, the last ready one runs on this job and the others are started in batches before it
+		uint32_t nextNode = UINT32_MAX;
+		PeonJob* readyJobs[PeonJobReleaseBatchSize];
+		uint32_t totalReadyJobs = 0;
+		for (uint32_t i = node.firstSuccessor; i < node.firstSuccessor + node.totalSuccessors; i++)
+		{
+			uint32_t successor = m_Successors[i];
+			if (m_PendingPredecessors[successor].fetch_sub(1, std::memory_order_acq_rel) != 1)
+			{
+				continue;
+			}
+
+			if (nextNode != UINT32_MAX)
+			{
+				readyJobs[totalReadyJobs++] = CreateNodeJob(nextNode);
+				if (totalReadyJobs == PeonJobReleaseBatchSize)
+				{
+					m_System->StartJobs(readyJobs, totalReadyJobs);
+					totalReadyJobs = 0;
+				}
+			}
+
+			nextNode = successor;
+		}
+
+		m_System->StartJobs(readyJobs, totalReadyJobs);
+
+		// Check if there is nothing else to run
+		if (nextNode == UINT32_MAX)
+		{
+			return;
+		}
+
+		_nodeIndex = nextNode;
+	}
+}
+
+__InternalPeon::PeonJob* __InternalPeon::PeonTaskGraph::CreateNodeJob(uint32_t _nodeIndex)
+{
+	return m_System->CreateChildJob(m_Container, [this, _nodeIndex]() { RunNode(_nodeIndex); });
+}
+
+uint32_t __InternalPeon::PeonTaskGraph::GetTotalNodes()
+{
+	return (uint32_t)m_Functions.size();
+}
+
+bool __InternalPeon::PeonTaskGraph::IsCompiled()
+{
+	return m_Compiled;
+}
+
+void __InternalPeon::PeonTaskGraph::Clear()
+{
+	m_Functions.clear();
+	m_Dependencies.clear();
+	m_Nodes.clear();
+	m_Successors.clear();
+	m_RootNodes.clear();
+	m_RootJobs.clear();
+	m_PendingPredecessors.reset();
+	m_Compiled = false;
+}
@@ -0,0 +1,135 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonTaskGraph.h
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+//////////////
+// INCLUDES //
+//////////////
+#include "PeonConfig.h"
+#include "PeonJob.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+///////////////
+// NAMESPACE //
+///////////////
+
+// __InternalPeon
+PeonNamespaceBegin(__InternalPeon)
+
+/////////////
+// DEFINES //
+/////////////
+
+////////////
+// GLOBAL //
+////////////
+
+// We know the job system
+class PeonSystem;
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: PeonTaskGraph
+////////////////////////////////////////////////////////////////////////////////
+class PeonTaskGraph
+{
+public:
+
+	// The node identifier (the index in the order the nodes were added)
+	typedef uint32_t NodeId;
+
+private:
+
+	// A compiled node (the nodes are stored in topological order)
+	struct CompiledNode
+	{
+		// The node function
+		std::function<void()> function;
+
+		// The successors (indexes into the compiled successor array)
+		uint32_t firstSuccessor;
+		uint32_t totalSuccessors;
+
+		// The number of nodes this one waits for
+		uint32_t totalPredecessors;
+	};
+
+public:
+	PeonTaskGraph();
+	PeonTaskGraph(const PeonTaskGraph&) = delete;
+	~PeonTaskGraph();
+
+//////////////////
+// MAIN METHODS //
+public: //////////
+
+	// Add a node (this invalidates the compiled graph)
+	template <typename FunctionType>
+	NodeId AddNode(FunctionType&& _function)
+	{
+		m_Functions.emplace_back(std::forward<FunctionType>(_function));
+		m_Compiled = false;
+		return NodeId(m_Functions.size() - 1);
+	}
+
+	// Run "thenThis" after "thisFirst" (this invalidates the compiled graph), return false for an invalid node or a self dependency
+	bool AddDependency(NodeId _thisFirst, NodeId _thenThis);
+
+	// Validate the graph and build the flat node array (in topological order), return false if the graph has a cycle
+	bool Compile();
+
+	// Run all nodes using the given system and wait for them, only the predecessor counters are reset and the root nodes are
+	// started (the graph is compiled if needed, return false if it can't be compiled). The graph can't run twice at the same time.
+	// Each replay still creates a job for each root node and for each extra successor a node releases (the last one runs on
+	// the releasing job), they are started in batches
+	bool Execute(PeonSystem* _system);
+
+	// Return the total number of nodes
+	uint32_t GetTotalNodes();
+
+	// Return if the graph is compiled
+	bool IsCompiled();
+
+	// Remove all nodes and dependencies
+	void Clear();
+
+private:
+
+	// Run a compiled node and its successors (the last successor that became ready runs on this job, the others are started
+	// first so thieves can take them)
+	void RunNode(uint32_t _nodeIndex);
+
+	// Create a job for a compiled node (started by the caller)
+	PeonJob* CreateNodeJob(uint32_t _nodeIndex);
+
+///////////////
+// VARIABLES //
+private: //////
+
+	// The node functions and dependencies (in the order they were added)
+	std::vector<std::function<void()>> m_Functions;
+	std::vector<std::pair<NodeId, NodeId>> m_Dependencies;
+
+	// The compiled nodes, their successors, the root nodes and their jobs (sized when compiled)
+	std::vector<CompiledNode> m_Nodes;
+	std::vector<uint32_t> m_Successors;
+	std::vector<uint32_t> m_RootNodes;
+	std::vector<PeonJob*> m_RootJobs;
+
+	// The number of predecessors each node is still waiting for (reset each execution)
+	std::unique_ptr<std::atomic<uint32_t>[]> m_PendingPredecessors;
+
+	// If the compiled data matches the nodes and dependencies
+	bool m_Compiled;
+
+	// The system and the container used by the current execution
+	PeonSystem* m_System;
+	Container* m_Container;
+};
+
+// __InternalPeon
+PeonNamespaceEnd(__InternalPeon)
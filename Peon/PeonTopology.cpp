@@ -0,0 +1,318 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonTopology.cpp
+////////////////////////////////////////////////////////////////////////////////
+#include "PeonTopology.h"
+
+#include <algorithm>
+#include <fstream>
+#include <thread>
+#include <tuple>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+///////////////
+// NAMESPACE //
+///////////////
+
+__InternalPeon::PeonTopology::PeonTopology()
+{
+	// Set the initial data
+	m_TotalNodes = 1;
+	m_TotalPackages = 1;
+}
+
+__InternalPeon::PeonTopology::~PeonTopology()
+{
+}
+
+bool __InternalPeon::PeonTopology::Detect()
+{
+	const std::string cpuPath = "/sys/devices/system/cpu/";
+	const std::string nodePath = "/sys/devices/system/node/";
+
+	// Read the online cpus, without them we can't do anything
+	std::vector<uint32_t> onlineCpus;
+	if (!ReadCpuList(cpuPath + "online", onlineCpus) || onlineCpus.empty())
+	{
+		UseFlatLayout(std::max(1u, std::thread::hardware_concurrency()));
+		return false;
+	}
+
+	// Read the core, package and last level cache for each cpu
+	m_Cpus.clear();
+	for (uint32_t cpuId : onlineCpus)
+	{
+		std::string topologyPath = cpuPath + "cpu" + std::to_string(cpuId) + "/";
+
+		PeonCpuInfo cpuInfo;
+		cpuInfo.cpuId = cpuId;
+		cpuInfo.coreId = cpuId;
+		cpuInfo.cacheId = cpuId;
+		ReadValue(topologyPath + "topology/core_id", cpuInfo.coreId);
+		ReadValue(topologyPath + "topology/physical_package_id", cpuInfo.packageId);
+
+		// The last level cache is the one with the highest level, it's identified by the first cpu sharing it
+		uint32_t cacheLevel = 0;
+		for (uint32_t cacheIndex = 0; ; cacheIndex++)
+		{
+			std::string cachePath = topologyPath + "cache/index" + std::to_string(cacheIndex) + "/";
+
+			uint32_t level = 0;
+			std::vector<uint32_t> sharedCpus;
+			if (!ReadValue(cachePath + "level", level))
+			{
+				break;
+			}
+
+			if (level >= cacheLevel && ReadCpuList(cachePath + "shared_cpu_list", sharedCpus) && !sharedCpus.empty())
+			{
+				cacheLevel = level;
+				cpuInfo.cacheId = sharedCpus[0];
+			}
+		}
+
+		m_Cpus.push_back(cpuInfo);
+	}
+
+	// Read the cpus of each NUMA node (machines without NUMA support have a single node)
+	std::vector<uint32_t> onlineNodes;
+	if (ReadCpuList(nodePath + "online", onlineNodes))
+	{
+		for (uint32_t nodeId : onlineNodes)
+		{
+			std::vector<uint32_t> nodeCpus;
+			ReadCpuList(nodePath + "node" + std::to_string(nodeId) + "/cpulist", nodeCpus);
+			for (auto& cpuInfo : m_Cpus)
+			{
+				if (std::find(nodeCpus.begin(), nodeCpus.end(), cpuInfo.cpuId) != nodeCpus.end())
+				{
+					cpuInfo.nodeId = nodeId;
+				}
+			}
+		}
+	}
+
+	// Sort the cpus in placement order
+	std::sort(m_Cpus.begin(), m_Cpus.end(), [](const PeonCpuInfo& _a, const PeonCpuInfo& _b)
+	{
+		return std::tie(_a.nodeId, _a.packageId, _a.cacheId, _a.coreId, _a.cpuId) < std::tie(_b.nodeId, _b.packageId, _b.cacheId, _b.coreId, _b.cpuId);
+	});
+
+	// Count the nodes and packages
+	std::vector<uint32_t> nodes, packages;
+	for (auto& cpuInfo : m_Cpus)
+	{
+		nodes.push_back(cpuInfo.nodeId);
+		packages.push_back(cpuInfo.packageId);
+	}
+
+	std::sort(nodes.begin(), nodes.end());
+	std::sort(packages.begin(), packages.end());
+	nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+	m_NodeIds = nodes;
+	m_TotalNodes = uint32_t(nodes.size());
+	m_TotalPackages = uint32_t(std::unique(packages.begin(), packages.end()) - packages.begin());
+
+	return true;
+}
+
+void __InternalPeon::PeonTopology::UseFlatLayout(uint32_t _totalCpus)
+{
+	m_Cpus.clear();
+	for (uint32_t i = 0; i < _totalCpus; i++)
+	{
+		PeonCpuInfo cpuInfo;
+		cpuInfo.cpuId = i;
+		cpuInfo.coreId = i;
+		m_Cpus.push_back(cpuInfo);
+	}
+
+	m_NodeIds.assign(1, 0);
+	m_TotalNodes = 1;
+	m_TotalPackages = 1;
+}
+
+uint32_t __InternalPeon::PeonTopology::GetTotalCpus() const
+{
+	return uint32_t(m_Cpus.size());
+}
+
+const __InternalPeon::PeonCpuInfo& __InternalPeon::PeonTopology::GetCpu(uint32_t _index) const
+{
+	return m_Cpus[_index];
+}
+
+uint32_t __InternalPeon::PeonTopology::GetTotalNodes() const
+{
+	return m_TotalNodes;
+}
+
+uint32_t __InternalPeon::PeonTopology::GetTotalPackages() const
+{
+	return m_TotalPackages;
+}
+
+uint32_t __InternalPeon::PeonTopology::GetNodeIndex(uint32_t _cpuId) const
+{
+	for (auto& cpuInfo : m_Cpus)
+	{
+		if (cpuInfo.cpuId == _cpuId)
+		{
+			return uint32_t(std::lower_bound(m_NodeIds.begin(), m_NodeIds.end(), cpuInfo.nodeId) - m_NodeIds.begin());
+		}
+	}
+
+	return 0;
+}
+
+int __InternalPeon::PeonTopology::GetCurrentCpuId()
+{
+#if defined(_WIN32)
+
+	return int(GetCurrentProcessorNumber());
+
+#elif defined(__linux__)
+
+	return sched_getcpu();
+
+#else
+
+	return -1;
+
+#endif
+}
+
+__InternalPeon::PeonStealTier __InternalPeon::PeonTopology::GetStealTier(const PeonCpuInfo& _thief, const PeonCpuInfo& _victim)
+{
+	// Another socket or node
+	if (_thief.packageId != _victim.packageId || _thief.nodeId != _victim.nodeId)
+	{
+		return PeonStealTier::Remote;
+	}
+
+	// Same physical core
+	if (_thief.coreId == _victim.coreId)
+	{
+		return PeonStealTier::Sibling;
+	}
+
+	return PeonStealTier::Local;
+}
+
+bool __InternalPeon::PeonTopology::PinCurrentThread(uint32_t _cpuId)
+{
+#if defined(_WIN32)
+
+	// The affinity mask only covers the first 64 cpus (the current processor group)
+	if (_cpuId >= 64)
+	{
+		return false;
+	}
+
+	return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << _cpuId) != 0;
+
+#elif defined(__linux__)
+
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(_cpuId, &cpuSet);
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet) == 0;
+
+#else
+
+	return false;
+
+#endif
+}
+
+bool __InternalPeon::PeonTopology::UnpinCurrentThread() const
+{
+#if defined(_WIN32)
+
+	DWORD_PTR affinityMask = 0;
+	for (auto& cpuInfo : m_Cpus)
+	{
+		affinityMask |= cpuInfo.cpuId < 64 ? DWORD_PTR(1) << cpuInfo.cpuId : 0;
+	}
+
+	return affinityMask != 0 && SetThreadAffinityMask(GetCurrentThread(), affinityMask) != 0;
+
+#elif defined(__linux__)
+
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	for (auto& cpuInfo : m_Cpus)
+	{
+		CPU_SET(cpuInfo.cpuId, &cpuSet);
+	}
+
+	return !m_Cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet) == 0;
+
+#else
+
+	return false;
+
+#endif
+}
+
+bool __InternalPeon::PeonTopology::ReadCpuList(const std::string& _path, std::vector<uint32_t>& _cpuList)
+{
+	std::ifstream file(_path);
+	std::string text;
+	if (!file || !std::getline(file, text))
+	{
+		return false;
+	}
+
+	// Each entry is a single cpu or a range, separated by commas
+	size_t position = 0;
+	while (position < text.size())
+	{
+		size_t entryEnd = text.find(',', position);
+		std::string entry = text.substr(position, entryEnd == std::string::npos ? std::string::npos : entryEnd - position);
+
+		size_t separator = entry.find('-');
+		try
+		{
+			uint32_t first = uint32_t(std::stoul(entry));
+			uint32_t last = separator == std::string::npos ? first : uint32_t(std::stoul(entry.substr(separator + 1)));
+			for (uint32_t i = first; i <= last; i++)
+			{
+				_cpuList.push_back(i);
+			}
+		}
+		catch (...)
+		{
+			return false;
+		}
+
+		if (entryEnd == std::string::npos)
+		{
+			break;
+		}
+
+		position = entryEnd + 1;
+	}
+
+	return true;
+}
+
+bool __InternalPeon::PeonTopology::ReadValue(const std::string& _path, uint32_t& _value)
+{
+	std::ifstream file(_path);
+	long long value = 0;
+	if (!file || !(file >> value) || value < 0)
+	{
+		return false;
+	}
+
+	_value = uint32_t(value);
+
+	return true;
+}
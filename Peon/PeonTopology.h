@@ -0,0 +1,135 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonTopology.h
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+//////////////
+// INCLUDES //
+//////////////
+#include "PeonConfig.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+///////////////
+// NAMESPACE //
+///////////////
+
+// __InternalPeon
+PeonNamespaceBegin(__InternalPeon)
+
+/////////////
+// DEFINES //
+/////////////
+
+// The number of steal tiers
+#define PeonTotalStealTiers		(3)
+
+////////////
+// GLOBAL //
+////////////
+
+// How far a steal victim is from the thief, victims are tried from the nearest tier to the farthest one
+enum class PeonStealTier : uint8_t
+{
+	// The victim runs on the same physical core (SMT sibling)
+	Sibling,
+
+	// The victim shares the last level cache and the NUMA node
+	Local,
+
+	// Anything else (another socket or node, or the workers aren't pinned)
+	Remote
+};
+
+// The topology configuration used by the system (should be set before initializing it)
+struct PeonTopologySettings
+{
+	// Pin each worker to a logical cpu (in topology order) and allocate its queues from its own thread, so the memory is
+	// first touched on the worker node (worker 0 is the thread that initializes the system, it's pinned too)
+	bool pinWorkers = false;
+
+	// Steal from the nearest workers first (SMT sibling, then same L3/node, then remote), only used by pinned workers
+	bool hierarchicalStealing = true;
+};
+
+// The placement of a logical cpu
+struct PeonCpuInfo
+{
+	// The logical cpu id (used for pinning)
+	uint32_t cpuId = 0;
+
+	// The physical core, the package (socket), the last level cache (the first cpu sharing it) and the NUMA node
+	uint32_t coreId = 0;
+	uint32_t packageId = 0;
+	uint32_t cacheId = 0;
+	uint32_t nodeId = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: PeonTopology
+////////////////////////////////////////////////////////////////////////////////
+class PeonTopology
+{
+public:
+	PeonTopology();
+	~PeonTopology();
+
+//////////////////
+// MAIN METHODS //
+public: //////////
+
+	// Read the cpu layout (from sysfs, on linux), if it can't be read a flat layout is used (every cpu is its own core on
+	// the same package and node) and false is returned
+	bool Detect();
+
+	// Return the number of logical cpus, and a cpu in placement order (sorted by node, package, last level cache and core,
+	// so consecutive workers share as much as possible)
+	uint32_t GetTotalCpus() const;
+	const PeonCpuInfo& GetCpu(uint32_t _index) const;
+
+	// Return the number of NUMA nodes and packages
+	uint32_t GetTotalNodes() const;
+	uint32_t GetTotalPackages() const;
+
+	// Return the index (from 0 to the number of nodes - 1) of the NUMA node with the given logical cpu (0 if the cpu is unknown)
+	uint32_t GetNodeIndex(uint32_t _cpuId) const;
+
+	// Return the logical cpu running the calling thread (-1 if it's not supported)
+	static int GetCurrentCpuId();
+
+	// Return the steal tier between two cpus
+	static PeonStealTier GetStealTier(const PeonCpuInfo& _thief, const PeonCpuInfo& _victim);
+
+	// Pin the calling thread to the given logical cpu (return false if it's not supported or it failed)
+	static bool PinCurrentThread(uint32_t _cpuId);
+
+	// Let the calling thread run on any of the detected cpus again (return false if it's not supported or it failed)
+	bool UnpinCurrentThread() const;
+
+private:
+
+	// Read a sysfs cpu list ("0-3,8-11") or a single value (return false if the file can't be read)
+	static bool ReadCpuList(const std::string& _path, std::vector<uint32_t>& _cpuList);
+	static bool ReadValue(const std::string& _path, uint32_t& _value);
+
+	// Use a flat layout with the given number of cpus
+	void UseFlatLayout(uint32_t _totalCpus);
+
+///////////////
+// VARIABLES //
+private: //////
+
+	// The cpus in placement order
+	std::vector<PeonCpuInfo> m_Cpus;
+
+	// The node ids (sorted), their position is the node index
+	std::vector<uint32_t> m_NodeIds;
+
+	// The number of NUMA nodes and packages
+	uint32_t m_TotalNodes;
+	uint32_t m_TotalPackages;
+};
+
+// __InternalPeon
+PeonNamespaceEnd(__InternalPeon)
@@ -0,0 +1,444 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonTrace.cpp
+////////////////////////////////////////////////////////////////////////////////
+#include "PeonTrace.h"
+#include "PeonWorker.h"
+#include <algorithm>
+#include <chrono>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PeonTraceClock() __rdtsc()
+#define PeonTraceClockIsCounter (1)
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define PeonTraceClock() __rdtsc()
+#define PeonTraceClockIsCounter (1)
+#else
+#define PeonTraceClock() __InternalPeon::PeonWorker::GetTimeNanoseconds()
+#define PeonTraceClockIsCounter (0)
+#endif
+
+// How long we measure the time stamp counter rate when a trace starts (in nanoseconds)
+#define PeonTraceCalibrationTime	(2000000)
+
+///////////////
+// NAMESPACE //
+///////////////
+
+__InternalPeon::PeonTracer::PeonTracer()
+{
+	// Set the initial data
+	m_Running = false;
+	m_RingSet = nullptr;
+	m_File = nullptr;
+	m_StartTime = 0;
+	m_NanosecondsPerTick = 1.0;
+	m_WriterStopRequested = false;
+	m_FlushIntervalMilliseconds = 0;
+}
+
+__InternalPeon::PeonTracer::PeonTracer(const __InternalPeon::PeonTracer& other)
+{
+	// Set the initial data
+	m_Running = false;
+	m_RingSet = nullptr;
+	m_File = nullptr;
+	m_StartTime = 0;
+	m_NanosecondsPerTick = 1.0;
+	m_WriterStopRequested = false;
+	m_FlushIntervalMilliseconds = 0;
+}
+
+__InternalPeon::PeonTracer::~PeonTracer()
+{
+	Stop();
+
+	// Release the rings
+	if (m_RingSet.load(std::memory_order_relaxed) != nullptr)
+	{
+		m_RetiredRingSets.push_back(m_RingSet.load(std::memory_order_relaxed));
+	}
+
+	for (RingSet* ringSet : m_RetiredRingSets)
+	{
+		for (uint32_t i = 0; i < ringSet->totalRings; i++)
+		{
+			delete[] ringSet->rings[i].events;
+		}
+
+		delete[] ringSet->rings;
+		delete ringSet;
+	}
+}
+
+bool __InternalPeon::PeonTracer::Start(const char* _filePath, uint32_t _totalWorkers, const PeonTraceSettings& _settings)
+{
+#if PeonTraceEnabled
+
+	std::lock_guard<std::mutex> drainLock(m_DrainMutex);
+	if (m_Running.load(std::memory_order_relaxed))
+	{
+		return false;
+	}
+
+	m_File = fopen(_filePath, "wb");
+	if (m_File == nullptr)
+	{
+		return false;
+	}
+
+	// Make sure the ring size is a power of 2
+	uint32_t ringSize = 2;
+	while (ringSize < _settings.ringSize)
+	{
+		ringSize <<= 1;
+	}
+
+	// Reuse the rings from the last trace when they have the same size (just skip what was left inside them), otherwise keep
+	// them around, an event that saw the last trace running could still be writing into them
+	RingSet* ringSet = m_RingSet.load(std::memory_order_relaxed);
+	if (ringSet == nullptr || ringSet->totalRings != _totalWorkers + 1 || ringSet->ringSize != ringSize)
+	{
+		if (ringSet != nullptr)
+		{
+			m_RetiredRingSets.push_back(ringSet);
+		}
+
+		ringSet = new RingSet();
+		ringSet->totalRings = _totalWorkers + 1;
+		ringSet->ringSize = ringSize;
+		ringSet->rings = new Ring[ringSet->totalRings];
+		for (uint32_t i = 0; i < ringSet->totalRings; i++)
+		{
+			ringSet->rings[i].events = new PeonTraceEvent[ringSize];
+			ringSet->rings[i].mask = ringSize - 1;
+		}
+
+		// Publish the new rings (a late event from the last trace sees either the old set or this one, never a mix)
+		m_RingSet.store(ringSet, std::memory_order_release);
+	}
+
+	for (uint32_t i = 0; i < ringSet->totalRings; i++)
+	{
+		// The cached tail is only behind the real one, the producer reloads it when the ring looks full
+		ringSet->rings[i].tail.store(ringSet->rings[i].head.load(std::memory_order_acquire), std::memory_order_release);
+		ringSet->rings[i].droppedEvents.store(0, std::memory_order_relaxed);
+	}
+
+	m_OpenEvents.assign(ringSet->totalRings, std::vector<OpenEvent>());
+
+	// Events are stamped with the time stamp counter (much cheaper than the steady clock), measure its rate against the steady
+	// clock, the counter runs at a constant rate on every core of the cpus we support
+	m_StartTime = PeonTraceClock();
+	m_NanosecondsPerTick = 1.0;
+	if (PeonTraceClockIsCounter)
+	{
+		uint64_t beginTime = PeonWorker::GetTimeNanoseconds();
+		uint64_t elapsedTime = 0;
+		while ((elapsedTime = PeonWorker::GetTimeNanoseconds() - beginTime) < PeonTraceCalibrationTime)
+		{
+		}
+
+		m_NanosecondsPerTick = double(elapsedTime) / double(std::max<uint64_t>(PeonTraceClock() - m_StartTime, 1));
+	}
+
+	// The header and the thread names (the last ring is shared by every thread that isn't a worker)
+	fprintf(m_File, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(m_File, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Peon\"}}");
+	for (uint32_t i = 0; i < ringSet->totalRings; i++)
+	{
+		if (i < _totalWorkers)
+		{
+			fprintf(m_File, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"Worker %u\"}}", i, i);
+		}
+		else
+		{
+			fprintf(m_File, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"External threads\"}}", i);
+		}
+	}
+
+	// Start recording and streaming
+	m_Running.store(true, std::memory_order_release);
+	m_WriterStopRequested = false;
+	m_FlushIntervalMilliseconds = std::max(_settings.flushIntervalMilliseconds, 1u);
+	m_WriterThread = std::thread(&PeonTracer::WriterLoop, this);
+
+	return true;
+
+#else
+
+	return false;
+
+#endif
+}
+
+void __InternalPeon::PeonTracer::Flush()
+{
+	std::lock_guard<std::mutex> drainLock(m_DrainMutex);
+	if (m_File != nullptr)
+	{
+		Drain();
+		fflush(m_File);
+	}
+}
+
+void __InternalPeon::PeonTracer::Stop()
+{
+	// Stop recording (an event that already saw the trace running can still land in a ring, it will be skipped by the next trace)
+	if (!m_Running.exchange(false, std::memory_order_acq_rel))
+	{
+		return;
+	}
+
+	// Stop the writer
+	{
+		std::lock_guard<std::mutex> writerLock(m_WriterMutex);
+		m_WriterStopRequested = true;
+	}
+
+	m_WriterCondition.notify_one();
+	m_WriterThread.join();
+
+	// Write what is left and close the file (the open slices are unfinished, we don't know their end)
+	std::lock_guard<std::mutex> drainLock(m_DrainMutex);
+	Drain();
+
+	uint64_t droppedEvents = GetDroppedEvents();
+	fprintf(m_File, "\n],\"otherData\":{\"droppedEvents\":\"%llu\"}}\n", (unsigned long long)droppedEvents);
+	fclose(m_File);
+	m_File = nullptr;
+	m_OpenEvents.clear();
+}
+
+uint64_t __InternalPeon::PeonTracer::GetDroppedEvents()
+{
+	uint64_t droppedEvents = 0;
+	RingSet* ringSet = m_RingSet.load(std::memory_order_acquire);
+	for (uint32_t i = 0; ringSet != nullptr && i < ringSet->totalRings; i++)
+	{
+		droppedEvents += ringSet->rings[i].droppedEvents.load(std::memory_order_relaxed);
+	}
+
+	return droppedEvents;
+}
+
+void __InternalPeon::PeonTracer::Record(int _workerIndex, PeonTraceEventType _type, const void* _job, const char* _label, uint32_t _argument)
+{
+	// Load the rings once, a new trace could be replacing them
+	RingSet* ringSet = m_RingSet.load(std::memory_order_acquire);
+
+	// Threads that aren't workers share the last ring
+	if (_workerIndex < 0 || uint32_t(_workerIndex) >= ringSet->totalRings - 1)
+	{
+		std::lock_guard<std::mutex> externalLock(m_ExternalMutex);
+		Ring& ring = ringSet->rings[ringSet->totalRings - 1];
+		uint64_t head = ring.head.load(std::memory_order_relaxed);
+		if (head - ring.cachedTail > ring.mask && head - (ring.cachedTail = ring.tail.load(std::memory_order_acquire)) > ring.mask)
+		{
+			ring.droppedEvents.store(ring.droppedEvents.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return;
+		}
+
+		ring.events[head & ring.mask] = PeonTraceEvent{ PeonTraceClock(), _job, _label, _argument, _type };
+		ring.head.store(head + 1, std::memory_order_release);
+
+		return;
+	}
+
+	// Only the worker writes into its ring
+	Ring& ring = ringSet->rings[_workerIndex];
+	uint64_t head = ring.head.load(std::memory_order_relaxed);
+	if (head - ring.cachedTail > ring.mask && head - (ring.cachedTail = ring.tail.load(std::memory_order_acquire)) > ring.mask)
+	{
+		ring.droppedEvents.store(ring.droppedEvents.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return;
+	}
+
+	ring.events[head & ring.mask] = PeonTraceEvent{ PeonTraceClock(), _job, _label, _argument, _type };
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+void __InternalPeon::PeonTracer::Drain()
+{
+	// Take the events of each ring (copy them out first so the ring is free again as soon as possible)
+	RingSet* ringSet = m_RingSet.load(std::memory_order_relaxed);
+	for (uint32_t i = 0; i < ringSet->totalRings; i++)
+	{
+		Ring& ring = ringSet->rings[i];
+		uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+		uint64_t head = ring.head.load(std::memory_order_acquire);
+		if (head == tail)
+		{
+			continue;
+		}
+
+		m_DrainBuffer.resize(size_t(head - tail));
+		for (uint64_t position = tail; position < head; position++)
+		{
+			m_DrainBuffer[size_t(position - tail)] = ring.events[position & ring.mask];
+		}
+
+		ring.tail.store(head, std::memory_order_release);
+
+		WriteEvents(i, m_DrainBuffer.data(), head - tail);
+	}
+
+	// The jobs started and never executed before the trace stopped are forgotten
+	if (!m_Running.load(std::memory_order_relaxed))
+	{
+		m_StartTimes.clear();
+	}
+}
+
+void __InternalPeon::PeonTracer::WriteEvents(uint32_t _ringIndex, const PeonTraceEvent* _events, uint64_t _totalEvents)
+{
+	std::vector<OpenEvent>& openEvents = m_OpenEvents[_ringIndex];
+
+	for (uint64_t i = 0; i < _totalEvents; i++)
+	{
+		const PeonTraceEvent& event = _events[i];
+		double timestamp = GetMicroseconds(event.time);
+
+		switch (event.type)
+		{
+			// The instant events
+			case PeonTraceEventType::Create:
+			case PeonTraceEventType::Start:
+			case PeonTraceEventType::Steal:
+			{
+				if (event.type == PeonTraceEventType::Start)
+				{
+					m_StartTimes[event.job] = event.time;
+				}
+
+				const char* name = event.type == PeonTraceEventType::Create ? "Create" : event.type == PeonTraceEventType::Start ? "Start" : "Steal";
+				fprintf(m_File, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"job\":\"%p\",\"label\":", name, _ringIndex, timestamp, event.job);
+				WriteLabel(event.label);
+				if (event.type == PeonTraceEventType::Steal)
+				{
+					fprintf(m_File, ",\"victim\":%u", event.argument);
+				}
+
+				fprintf(m_File, "}}");
+				break;
+			}
+
+			// The begin events wait for their ends
+			case PeonTraceEventType::JobBegin:
+			case PeonTraceEventType::WaitBegin:
+			case PeonTraceEventType::Park:
+			{
+				openEvents.push_back(OpenEvent{ event.job, event.type, event.time });
+				break;
+			}
+
+			// The end events close the newest begin for the same job (fibers can interleave the slices of a worker)
+			case PeonTraceEventType::JobEnd:
+			case PeonTraceEventType::WaitEnd:
+			case PeonTraceEventType::Unpark:
+			{
+				PeonTraceEventType beginType = event.type == PeonTraceEventType::JobEnd ? PeonTraceEventType::JobBegin :
+					event.type == PeonTraceEventType::WaitEnd ? PeonTraceEventType::WaitBegin : PeonTraceEventType::Park;
+
+				auto openEvent = std::find_if(openEvents.rbegin(), openEvents.rend(), [&](const OpenEvent& _openEvent)
+				{
+					return _openEvent.type == beginType && _openEvent.job == event.job;
+				});
+
+				// The begin happened before the trace started
+				if (openEvent == openEvents.rend())
+				{
+					break;
+				}
+
+				double beginTimestamp = GetMicroseconds(openEvent->time);
+				double duration = timestamp - beginTimestamp;
+
+				if (event.type == PeonTraceEventType::JobEnd)
+				{
+					fprintf(m_File, ",\n{\"name\":");
+					WriteLabel(event.label != nullptr ? event.label : "Job");
+					fprintf(m_File, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"job\":\"%p\"", _ringIndex, beginTimestamp, duration, event.job);
+
+					// How long the job waited in a queue
+					auto startTime = m_StartTimes.find(event.job);
+					if (startTime != m_StartTimes.end())
+					{
+						fprintf(m_File, ",\"queued_us\":%.3f", beginTimestamp - GetMicroseconds(startTime->second));
+						m_StartTimes.erase(startTime);
+					}
+
+					if (event.argument != 0)
+					{
+						fprintf(m_File, ",\"cancelled\":true");
+					}
+
+					fprintf(m_File, "}}");
+				}
+				else if (event.type == PeonTraceEventType::WaitEnd)
+				{
+					fprintf(m_File, ",\n{\"name\":\"Wait\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"job\":\"%p\",\"label\":", _ringIndex, beginTimestamp, duration, event.job);
+					WriteLabel(event.label);
+					fprintf(m_File, "}}");
+				}
+				else
+				{
+					fprintf(m_File, ",\n{\"name\":\"Parked\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", _ringIndex, beginTimestamp, duration);
+				}
+
+				openEvents.erase(std::next(openEvent).base());
+				break;
+			}
+		}
+	}
+}
+
+void __InternalPeon::PeonTracer::WriteLabel(const char* _label)
+{
+	if (_label == nullptr)
+	{
+		fputs("null", m_File);
+		return;
+	}
+
+	// Escape the characters json doesn't allow inside strings
+	fputc('"', m_File);
+	for (const char* character = _label; *character != '\0'; character++)
+	{
+		if (*character == '"' || *character == '\\')
+		{
+			fputc('\\', m_File);
+			fputc(*character, m_File);
+		}
+		else if ((unsigned char)*character < 0x20)
+		{
+			fprintf(m_File, "\\u%04x", (unsigned)*character);
+		}
+		else
+		{
+			fputc(*character, m_File);
+		}
+	}
+
+	fputc('"', m_File);
+}
+
+double __InternalPeon::PeonTracer::GetMicroseconds(uint64_t _time)
+{
+	return double(int64_t(_time - m_StartTime)) * m_NanosecondsPerTick / 1000.0;
+}
+
+void __InternalPeon::PeonTracer::WriterLoop()
+{
+	std::unique_lock<std::mutex> writerLock(m_WriterMutex);
+	while (!m_WriterStopRequested)
+	{
+		m_WriterCondition.wait_for(writerLock, std::chrono::milliseconds(m_FlushIntervalMilliseconds));
+
+		// Stream the events to the file (without holding the writer lock, the stop request shouldn't wait for the drain)
+		writerLock.unlock();
+		Flush();
+		writerLock.lock();
+	}
+}
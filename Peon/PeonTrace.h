@@ -0,0 +1,191 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: PeonTrace.h
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+//////////////
+// INCLUDES //
+//////////////
+#include "PeonConfig.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/////////////
+// DEFINES //
+/////////////
+
+// The job timeline tracing (each event costs a single load while no trace is running), define it as 0 to compile it out
+#ifndef PeonTraceEnabled
+#define PeonTraceEnabled			(1)
+#endif
+
+///////////////
+// NAMESPACE //
+///////////////
+
+// __InternalPeon
+PeonNamespaceBegin(__InternalPeon)
+
+// The trace event types (the begin/end pairs become a single slice in the timeline)
+enum class PeonTraceEventType : uint16_t
+{
+	Create,
+	Start,
+	Steal,
+	JobBegin,
+	JobEnd,
+	WaitBegin,
+	WaitEnd,
+	Park,
+	Unpark
+};
+
+// A trace event, fixed size so recording it is just a few stores (the label must outlive the trace, use string literals), the
+// time is in trace clock ticks
+struct PeonTraceEvent
+{
+	uint64_t time;
+	const void* job;
+	const char* label;
+	uint32_t argument;
+	PeonTraceEventType type;
+};
+
+// The trace settings
+struct PeonTraceSettings
+{
+	// The number of events each worker ring can hold (rounded up to a power of 2), events recorded while a ring is full are
+	// dropped and counted
+	uint32_t ringSize = 1 << 16;
+
+	// How often the writer thread drains the rings into the file (in milliseconds)
+	uint32_t flushIntervalMilliseconds = 10;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: PeonTracer
+////////////////////////////////////////////////////////////////////////////////
+class PeonTracer
+{
+	// A single producer ring (the producer is the worker thread, or any thread holding the external mutex), the consumer is
+	// whoever holds the drain mutex
+	struct alignas(PeonCacheLineSize) Ring
+	{
+		// The events and the position mask
+		PeonTraceEvent* events = nullptr;
+		uint64_t mask = 0;
+
+		// The next position to write, the last tail seen and the number of dropped events (only written by the producer, the
+		// tail is only read again when the ring looks full)
+		alignas(PeonCacheLineSize) std::atomic<uint64_t> head = { 0 };
+		uint64_t cachedTail = 0;
+		std::atomic<uint64_t> droppedEvents = { 0 };
+
+		// The next position to read (only written by the consumer)
+		alignas(PeonCacheLineSize) std::atomic<uint64_t> tail = { 0 };
+	};
+
+	// The rings of a trace (the last one is used by the threads that aren't workers), published as a whole so a late event
+	// always sees rings and a count that belong together
+	struct RingSet
+	{
+		Ring* rings = nullptr;
+		uint32_t totalRings = 0;
+		uint32_t ringSize = 0;
+	};
+
+	// The open begin events for each ring, used to turn the begin/end pairs into slices
+	struct OpenEvent
+	{
+		const void* job;
+		PeonTraceEventType type;
+		uint64_t time;
+	};
+
+public:
+	PeonTracer();
+	PeonTracer(const PeonTracer&);
+	~PeonTracer();
+
+	// Start a trace streamed to the given file in the chrome trace event format (open it in chrome://tracing or the perfetto
+	// ui), the total rings is the number of workers, one more ring is shared by the other threads
+	bool Start(const char* _filePath, uint32_t _totalWorkers, const PeonTraceSettings& _settings);
+
+	// Write every recorded event into the file now
+	void Flush();
+
+	// Stop the trace, write the remaining events and close the file
+	void Stop();
+
+	// Return if a trace is running (check it before recording events, the rings are visible once it returns true)
+	bool IsRunning()
+	{
+		return m_Running.load(std::memory_order_acquire);
+	}
+
+	// Return the number of events dropped because a ring was full (in the current or last trace)
+	uint64_t GetDroppedEvents();
+
+	// Record an event for the given worker, -1 for threads that aren't workers (only while the trace is running, the event is
+	// dropped if the ring is full, we never wait for the writer)
+	void Record(int _workerIndex, PeonTraceEventType _type, const void* _job, const char* _label, uint32_t _argument);
+
+private:
+
+	// Take the events from every ring and write them (the drain mutex must be held)
+	void Drain();
+
+	// Write the events taken from a ring
+	void WriteEvents(uint32_t _ringIndex, const PeonTraceEvent* _events, uint64_t _totalEvents);
+
+	// Write a job label (escaped)
+	void WriteLabel(const char* _label);
+
+	// Convert a trace clock time into microseconds since the trace started
+	double GetMicroseconds(uint64_t _time);
+
+	// The writer thread loop
+	void WriterLoop();
+
+///////////////
+// VARIABLES //
+private: //////
+
+	// If a trace is running (checked before recording each event)
+	std::atomic<bool> m_Running;
+
+	// The current rings (loaded once by each event) and the rings replaced by other traces (a late event could still be writing
+	// into them, they are released with the tracer)
+	std::atomic<RingSet*> m_RingSet;
+	std::vector<RingSet*> m_RetiredRingSets;
+
+	// The mutex used by the threads that aren't workers to record events
+	std::mutex m_ExternalMutex;
+
+	// The file, the trace start time and the trace clock rate, the open begin events for each ring and the time each job was started (a job can begin
+	// on another worker), only used while holding the drain mutex
+	std::mutex m_DrainMutex;
+	FILE* m_File;
+	uint64_t m_StartTime;
+	double m_NanosecondsPerTick;
+	std::vector<std::vector<OpenEvent>> m_OpenEvents;
+	std::unordered_map<const void*, uint64_t> m_StartTimes;
+	std::vector<PeonTraceEvent> m_DrainBuffer;
+
+	// The writer thread
+	std::thread m_WriterThread;
+	std::mutex m_WriterMutex;
+	std::condition_variable m_WriterCondition;
+	bool m_WriterStopRequested;
+	uint32_t m_FlushIntervalMilliseconds;
+};
+
+// __InternalPeon
+PeonNamespaceEnd(__InternalPeon)
@@ -5,16 +5,89 @@
 #include "PeonSystem.h"
 #include <chrono>
 
-__InternalPeon::PeonWorker::PeonWorker() : m_MemoryAllocator(this)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PeonCpuRelax() _mm_pause()
+#elif defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define PeonCpuRelax() _mm_pause()
+#else
+#define PeonCpuRelax() std::atomic_signal_fence(std::memory_order_seq_cst)
+#endif
+
+__InternalPeon::PeonWorker::PeonWorker() : m_BackgroundSkips(0), m_MemoryAllocator(this), m_IsParked(false), m_WakeRequested(false), m_IsIdle(false)
 {
+	// Set the initial data
+	m_QueuesInitialized = false;
+	m_CpuId = -1;
+	m_HierarchicalStealing = false;
+	m_LastVictim = -1;
+	m_Seed = 0;
+	m_NodeIndex = 0;
+	m_Ready = false;
+	m_StopRequested = false;
+	m_Active = true;
+	m_Busy = false;
+	m_LocalBusy = false;
+	m_TotalExecutedJobs = 0;
+	m_FibersEnabled = false;
+	m_Fibers = nullptr;
+	m_CurrentFiber = &m_ThreadFiber;
+	m_ThreadFiberFree = false;
+	for (uint32_t i = 0; i < PeonTotalStealTiers; i++)
+	{
+		m_TotalSteals[i] = 0;
+		m_TotalStealAttempts[i] = 0;
+	}
+
+	ResetLaneStatistics();
+
+#if PeonStatisticsEnabled
+	for (auto& counter : m_Counters.values)
+	{
+		counter = 0;
+	}
+#endif
 }
 
-__InternalPeon::PeonWorker::PeonWorker(const __InternalPeon::PeonWorker& other) : m_MemoryAllocator(this)
+__InternalPeon::PeonWorker::PeonWorker(const __InternalPeon::PeonWorker& other) : m_BackgroundSkips(0), m_MemoryAllocator(this), m_IsParked(false), m_WakeRequested(false), m_IsIdle(false)
 {
+	// Set the initial data
+	m_QueuesInitialized = false;
+	m_CpuId = -1;
+	m_HierarchicalStealing = false;
+	m_LastVictim = -1;
+	m_Seed = 0;
+	m_NodeIndex = 0;
+	m_Ready = false;
+	m_StopRequested = false;
+	m_Active = true;
+	m_Busy = false;
+	m_LocalBusy = false;
+	m_TotalExecutedJobs = 0;
+	m_FibersEnabled = false;
+	m_Fibers = nullptr;
+	m_CurrentFiber = &m_ThreadFiber;
+	m_ThreadFiberFree = false;
+	for (uint32_t i = 0; i < PeonTotalStealTiers; i++)
+	{
+		m_TotalSteals[i] = 0;
+		m_TotalStealAttempts[i] = 0;
+	}
+
+	ResetLaneStatistics();
+
+#if PeonStatisticsEnabled
+	for (auto& counter : m_Counters.values)
+	{
+		counter = 0;
+	}
+#endif
 }
 
 __InternalPeon::PeonWorker::~PeonWorker()
 {
+	delete[] m_Fibers;
 }
 
 #ifdef JobWorkerDebug
@@ -25,6 +98,7 @@ static unsigned int JobWorkerId = 0;
 thread_local int							CurrentLocalThreadIdentifier;
 thread_local __InternalPeon::PeonJob*		CurrentThreadJob;
 thread_local __InternalPeon::PeonWorker*	CurrentWorker = nullptr;
+thread_local uint64_t						CurrentWorkerSystemId = 0;
 
 int __InternalPeon::PeonWorker::GetCurrentLocalThreadIdentifier()
 {
@@ -36,10 +110,92 @@ __InternalPeon::PeonWorker*__InternalPeon::PeonWorker::GetCurrentLocalThreadWork
 	return CurrentWorker;
 }
 
-void __InternalPeon::PeonWorker::SetQueueSize(unsigned int _jobBufferSize)
+uint64_t __InternalPeon::PeonWorker::GetCurrentLocalThreadSystemId()
+{
+	return CurrentWorkerSystemId;
+}
+
+void __InternalPeon::PeonWorker::SetQueueSize(unsigned int _jobBufferSize, unsigned int _initialDequeSize, PeonJobStorageMode _storageMode)
+{
+	// Save the queue settings
+	m_JobBufferSize = _jobBufferSize;
+	m_InitialDequeSize = _initialDequeSize;
+	m_StorageMode = _storageMode;
+
+	// Pinned workers allocate their queues from their own thread
+	if (m_CpuId < 0)
+	{
+		InitializeQueues();
+	}
+}
+
+void __InternalPeon::PeonWorker::InitializeQueues()
+{
+	// Initialize our concurrent queues (only the normal lane owns job storage, the others just hold jobs from it)
+	for (uint32_t i = 0; i < PeonTotalJobPriorities; i++)
+	{
+		bool ownsStorage = i == uint32_t(PeonJobPriority::Normal);
+		m_WorkQueues[i].Initialize(ownsStorage ? m_JobBufferSize : 0, m_InitialDequeSize, m_StorageMode);
+	}
+
+	m_QueuesInitialized = true;
+}
+
+void __InternalPeon::PeonWorker::SetPlacement(uint32_t _workerIndex, uint32_t _cpuId, const std::vector<PeonStealTier>& _victimTiers, bool _hierarchicalStealing, uint32_t _nodeIndex)
+{
+	m_CpuId = int(_cpuId);
+	m_NodeIndex = _nodeIndex;
+	m_VictimTiers = _victimTiers;
+	m_HierarchicalStealing = _hierarchicalStealing;
+
+	// Group the victims by tier (we never steal from ourselves)
+	for (uint32_t i = 0; i < m_VictimTiers.size(); i++)
+	{
+		if (i != _workerIndex)
+		{
+			m_StealVictims[uint32_t(m_VictimTiers[i])].push_back(i);
+		}
+	}
+}
+
+void __InternalPeon::PeonWorker::PrepareThread()
+{
+	// Pin this thread
+	if (m_CpuId >= 0)
+	{
+		PeonTopology::PinCurrentThread(uint32_t(m_CpuId));
+	}
+
+	// Allocate our queues now that we are running on our own cpu (the memory is first touched on its node)
+	if (!m_QueuesInitialized)
+	{
+		InitializeQueues();
+	}
+
+	// Allocate our fibers (if enabled)
+	InitializeFibers();
+
+	m_Ready.store(true, std::memory_order_release);
+}
+
+int __InternalPeon::PeonWorker::GetCpuId()
+{
+	return m_CpuId;
+}
+
+bool __InternalPeon::PeonWorker::IsReady()
+{
+	return m_Ready.load(std::memory_order_acquire);
+}
+
+uint64_t __InternalPeon::PeonWorker::GetTotalSteals(PeonStealTier _stealTier)
+{
+	return m_TotalSteals[uint32_t(_stealTier)].load(std::memory_order_relaxed);
+}
+
+uint64_t __InternalPeon::PeonWorker::GetTotalStealAttempts(PeonStealTier _stealTier)
 {
-	// Initialize our concurrent queue
-    m_WorkQueue.Initialize(_jobBufferSize);
+	return m_TotalStealAttempts[uint32_t(_stealTier)].load(std::memory_order_relaxed);
 }
 
 bool __InternalPeon::PeonWorker::Initialize(__InternalPeon::PeonSystem* _ownerSystem, int _threadId, bool _mainThread)
@@ -48,6 +204,10 @@ bool __InternalPeon::PeonWorker::Initialize(__InternalPeon::PeonSystem* _ownerSy
 	m_ThreadId = _threadId;
 	m_OwnerSystem = _ownerSystem;
 
+	// Seed the random generator, each worker must start its steal sweeps from a different victim (the worker index is spread
+	// over all bits, the clock makes each run different)
+	m_Seed = uint32_t(std::chrono::steady_clock::now().time_since_epoch().count()) ^ (uint32_t(_threadId + 1) * 2654435761u);
+
 #ifdef JobWorkerDebug
 	std::cout << "Thread with id: " << m_ThreadId << " created" << std::endl;
 #endif
@@ -56,7 +216,7 @@ bool __InternalPeon::PeonWorker::Initialize(__InternalPeon::PeonSystem* _ownerSy
 	if (!_mainThread)
 	{
 		// Create the new thread
-		new std::thread(&PeonWorker::ExecuteThreadAux, this);
+		m_Thread = std::thread(&PeonWorker::ExecuteThreadAux, this);
 	}
 	else
 	{
@@ -65,6 +225,10 @@ bool __InternalPeon::PeonWorker::Initialize(__InternalPeon::PeonSystem* _ownerSy
 
 		// Set the current worker
 		CurrentWorker = this;
+		CurrentWorkerSystemId = m_OwnerSystem->m_SystemId;
+
+		// Pin this thread and allocate our queues (if needed)
+		PrepareThread();
 	}
 
 
@@ -77,14 +241,385 @@ void __InternalPeon::PeonWorker::ExecuteThreadAux()
 	// Set the global per thread id
 	CurrentLocalThreadIdentifier = m_ThreadId;
 	CurrentWorker = this;
+	CurrentWorkerSystemId = m_OwnerSystem->m_SystemId;
+
+	// Pin this thread and allocate our queues (if needed)
+	PrepareThread();
 
 	// Run the execute function
+	RunLoop();
+}
+
+void __InternalPeon::PeonWorker::RunLoop()
+{
+	uint32_t idleRound = 0;
+	while (!m_StopRequested.load(std::memory_order_acquire))
+	{
+		// Continue a fiber whose job completed (or give the loop back to the thread stack)
+		if (m_FibersEnabled && ResumeReadyFiber())
+		{
+			idleRound = 0;
+			continue;
+		}
+
+		// Sleep while we are inactive (we aren't looking for jobs)
+		if (!m_Active.load(std::memory_order_acquire))
+		{
+			// The waiting fibers are still running their jobs, keep checking them until they can continue
+			if (HasWaitingFibers())
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			SetIdle(false);
+			SetBusy(false);
+			WaitUntilActive();
+			idleRound = 0;
+			continue;
+		}
+
+		// Check if we executed a job, if not, wait using the current idle policy (never sleep while a fiber is waiting, its
+		// job could complete on another worker and nobody would wake us)
+		if (ExecuteThread(nullptr))
+		{
+			idleRound = 0;
+		}
+		else if (HasWaitingFibers())
+		{
+			std::this_thread::yield();
+		}
+		else
+		{
+			Idle(idleRound++);
+		}
+	}
+}
+
+void __InternalPeon::PeonWorker::InitializeFibers()
+{
+	const PeonFiberSettings& fiberSettings = m_OwnerSystem->GetFiberSettings();
+	if (!fiberSettings.enabled || m_Fibers != nullptr)
+	{
+		return;
+	}
+
+	// The thread stack is a fiber too (the one running now)
+	if (!m_ThreadFiber.fiber.InitializeFromCurrentThread())
+	{
+		return;
+	}
+
+	// Allocate the pool (the lists never grow after this, switching fibers never allocates)
+	m_Fibers = new WorkerFiber[fiberSettings.fibersPerWorker];
+	m_FreeFibers.reserve(fiberSettings.fibersPerWorker);
+	m_WaitingFibers.reserve(fiberSettings.fibersPerWorker + 1);
+	for (uint32_t i = 0; i < fiberSettings.fibersPerWorker; i++)
+	{
+		if (m_Fibers[i].fiber.Initialize(fiberSettings.stackSize, &PeonWorker::FiberEntry, this))
+		{
+			m_FreeFibers.push_back(&m_Fibers[fiberSettings.fibersPerWorker - 1 - i]);
+		}
+	}
+
+	m_CurrentFiber = &m_ThreadFiber;
+	m_FibersEnabled = !m_FreeFibers.empty();
+}
+
+void __InternalPeon::PeonWorker::FiberEntry(void* _worker)
+{
+	PeonWorker* worker = (PeonWorker*)_worker;
+
+	// A new fiber isn't running any job
+	CurrentThreadJob = nullptr;
+
+	// Run the worker loop, when this worker stops give the thread back to its own stack (a fiber can't return)
 	while (true)
 	{
-		ExecuteThread(nullptr);
+		worker->RunLoop();
+		if (!worker->ResumeReadyFiber())
+		{
+			std::this_thread::yield();
+		}
 	}
 }
 
+bool __InternalPeon::PeonWorker::SuspendUntilComplete(PeonJob* _job)
+{
+	if (!m_FibersEnabled)
+	{
+		return false;
+	}
+
+	// Continue a fiber whose job completed, the thread stack (if it's free) or a free fiber, in this order
+	WorkerFiber* fiber = TakeReadyFiber();
+	if (fiber == nullptr && m_ThreadFiberFree)
+	{
+		fiber = &m_ThreadFiber;
+		m_ThreadFiberFree = false;
+	}
+	else if (fiber == nullptr && !m_FreeFibers.empty())
+	{
+		fiber = m_FreeFibers.back();
+		m_FreeFibers.pop_back();
+	}
+
+	// All fibers are in use
+	if (fiber == nullptr)
+	{
+		return false;
+	}
+
+	// Wait, someone will switch back to us after the job completes
+	m_CurrentFiber->waitJob = _job;
+	SwitchToFiber(fiber);
+
+	return true;
+}
+
+bool __InternalPeon::PeonWorker::HasWaitingFibers()
+{
+	return !m_WaitingFibers.empty();
+}
+
+__InternalPeon::PeonWorker::WorkerFiber* __InternalPeon::PeonWorker::TakeReadyFiber()
+{
+	// The oldest waiting fibers first
+	for (size_t i = 0; i < m_WaitingFibers.size(); i++)
+	{
+		WorkerFiber* fiber = m_WaitingFibers[i];
+		if (HasJobCompleted(fiber->waitJob))
+		{
+			m_WaitingFibers.erase(m_WaitingFibers.begin() + i);
+			return fiber;
+		}
+	}
+
+	return nullptr;
+}
+
+bool __InternalPeon::PeonWorker::ResumeReadyFiber()
+{
+	// A fiber whose job completed continues first
+	WorkerFiber* fiber = TakeReadyFiber();
+
+	// Otherwise a fiber from the pool gives the loop back to the thread stack (so the thread can stop from there)
+	if (fiber == nullptr && m_CurrentFiber != &m_ThreadFiber && m_ThreadFiberFree)
+	{
+		fiber = &m_ThreadFiber;
+		m_ThreadFiberFree = false;
+	}
+
+	if (fiber == nullptr)
+	{
+		return false;
+	}
+
+	SwitchToFiber(fiber);
+
+	return true;
+}
+
+void __InternalPeon::PeonWorker::SwitchToFiber(WorkerFiber* _fiber)
+{
+	// Keep the current fiber as waiting (if it's waiting for a job) or free
+	WorkerFiber* currentFiber = m_CurrentFiber;
+	currentFiber->savedJob = CurrentThreadJob;
+	if (currentFiber->waitJob != nullptr)
+	{
+		m_WaitingFibers.push_back(currentFiber);
+	}
+	else if (currentFiber == &m_ThreadFiber)
+	{
+		m_ThreadFiberFree = true;
+	}
+	else
+	{
+		m_FreeFibers.push_back(currentFiber);
+	}
+
+	// Switch, we return here when someone switches back to us
+	m_CurrentFiber = _fiber;
+	currentFiber->fiber.SwitchTo(&_fiber->fiber);
+
+	// Restore our job
+	currentFiber->waitJob = nullptr;
+	CurrentThreadJob = currentFiber->savedJob;
+}
+
+void __InternalPeon::PeonWorker::Stop()
+{
+	// Ask the thread to stop and wake it up (it could be parked or inactive)
+	{
+		std::lock_guard<std::mutex> lock(m_ParkMutex);
+		m_StopRequested.store(true, std::memory_order_release);
+	}
+
+	m_ParkCondition.notify_all();
+
+	// Wait for it
+	if (m_Thread.joinable())
+	{
+		m_Thread.join();
+	}
+
+	// The calling thread isn't a worker anymore (the main thread worker)
+	if (CurrentWorker == this)
+	{
+		CurrentWorker = nullptr;
+		CurrentWorkerSystemId = 0;
+		CurrentLocalThreadIdentifier = 0;
+	}
+}
+
+void __InternalPeon::PeonWorker::SetActive(bool _active)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_ParkMutex);
+		m_Active.store(_active, std::memory_order_release);
+	}
+
+	// A parked worker must notice it was deactivated (so nobody wastes a wake on it) and an inactive one that it's needed again
+	m_ParkCondition.notify_all();
+}
+
+bool __InternalPeon::PeonWorker::IsActive()
+{
+	return m_Active.load(std::memory_order_acquire);
+}
+
+bool __InternalPeon::PeonWorker::IsBusy()
+{
+	return m_Busy.load(std::memory_order_seq_cst);
+}
+
+uint64_t __InternalPeon::PeonWorker::GetTotalExecutedJobs()
+{
+	// The count is published by the busy flag (it's cleared after the count is updated)
+	return m_TotalExecutedJobs.load(std::memory_order_seq_cst);
+}
+
+void __InternalPeon::PeonWorker::SetBusy(bool _busy)
+{
+	if (m_LocalBusy != _busy)
+	{
+		m_LocalBusy = _busy;
+		m_Busy.store(_busy, std::memory_order_seq_cst);
+	}
+}
+
+void __InternalPeon::PeonWorker::WaitUntilActive()
+{
+	std::unique_lock<std::mutex> lock(m_ParkMutex);
+	m_ParkCondition.wait(lock, [this]() { return m_Active.load(std::memory_order_relaxed) || m_StopRequested.load(std::memory_order_relaxed); });
+}
+
+void __InternalPeon::PeonWorker::Idle(uint32_t _idleRound)
+{
+	const PeonIdleSettings& idleSettings = m_OwnerSystem->GetIdleSettings();
+
+	// Time this round (we have nothing else to do) and select the counter for it
+	uint64_t beginTime = PeonStatisticsEnabled ? GetTimeNanoseconds() : 0;
+	Counter idleCounter = Counter::IdleTime;
+
+	// The original policy, just give our time slice away
+	if (idleSettings.policy == PeonIdlePolicy::Yield)
+	{
+		std::this_thread::yield();
+		idleCounter = Counter::YieldTime;
+	}
+
+	// Spin for an exponentially growing amount of iterations
+	else if (_idleRound < idleSettings.spinRounds)
+	{
+		uint32_t totalSpins = 1u << std::min(_idleRound, 6u);
+		for (uint32_t i = 0; i < totalSpins; i++)
+		{
+			PeonCpuRelax();
+		}
+	}
+
+	// Yield for a while
+	else if (_idleRound < idleSettings.spinRounds + idleSettings.yieldRounds)
+	{
+		std::this_thread::yield();
+		idleCounter = Counter::YieldTime;
+	}
+
+	// Check if we should park
+	else if (idleSettings.policy == PeonIdlePolicy::Park)
+	{
+		Park();
+		idleCounter = Counter::BlockedTime;
+	}
+
+	// Sleep for an exponentially growing amount of time
+	else
+	{
+		uint32_t sleepRound = std::min(_idleRound - idleSettings.spinRounds - idleSettings.yieldRounds, 16u);
+		uint32_t sleepTime = std::min(1u << sleepRound, idleSettings.maximumSleepMicroseconds);
+		std::this_thread::sleep_for(std::chrono::microseconds(sleepTime));
+		idleCounter = Counter::BlockedTime;
+	}
+
+	if (PeonStatisticsEnabled)
+	{
+		AddCounter(idleCounter, GetTimeNanoseconds() - beginTime);
+	}
+}
+
+void __InternalPeon::PeonWorker::Park()
+{
+	// Let the wakers know we are about to sleep (this must be visible before we re-check for pending jobs)
+	m_IsParked.store(true, std::memory_order_seq_cst);
+	m_OwnerSystem->m_TotalParkedWorkers.fetch_add(1, std::memory_order_seq_cst);
+
+	// Any job pushed before the increment above must be visible now, if there is one we won't sleep
+	if (!m_OwnerSystem->HasPendingJobs())
+	{
+		// Wait until someone wake us
+		m_OwnerSystem->TraceEvent(this, PeonTraceEventType::Park, nullptr);
+		std::unique_lock<std::mutex> lock(m_ParkMutex);
+		m_ParkCondition.wait(lock, [this]()
+		{
+			return m_WakeRequested || !m_Active.load(std::memory_order_relaxed) || m_StopRequested.load(std::memory_order_relaxed);
+		});
+
+		m_OwnerSystem->TraceEvent(this, PeonTraceEventType::Unpark, nullptr);
+	}
+
+	// We are awake
+	m_OwnerSystem->m_TotalParkedWorkers.fetch_sub(1, std::memory_order_seq_cst);
+
+	std::lock_guard<std::mutex> lock(m_ParkMutex);
+	m_IsParked.store(false, std::memory_order_relaxed);
+	m_WakeRequested = false;
+}
+
+bool __InternalPeon::PeonWorker::Unpark()
+{
+	// Fast check, no need to lock if this worker isn't parked
+	if (!m_IsParked.load(std::memory_order_seq_cst))
+	{
+		return false;
+	}
+
+	// Request the wake (only once)
+	{
+		std::lock_guard<std::mutex> lock(m_ParkMutex);
+		if (!m_IsParked.load(std::memory_order_relaxed) || m_WakeRequested || !m_Active.load(std::memory_order_relaxed))
+		{
+			return false;
+		}
+
+		m_WakeRequested = true;
+	}
+
+	m_ParkCondition.notify_one();
+
+	return true;
+}
+
 unsigned int __InternalPeon::PeonWorker::FastRandomUnsignedInteger()
 {
 	m_Seed = (214013 * m_Seed + 2531011);
@@ -93,47 +628,250 @@ unsigned int __InternalPeon::PeonWorker::FastRandomUnsignedInteger()
 
 bool __InternalPeon::PeonWorker::GetJob(__InternalPeon::PeonJob** _job)
 {
-	// Primeira coisa, vamos ver se conseguimos pegar algum work do nosso queue interno
-	*_job = m_WorkQueue.Pop();
+	PeonStealingQueue& backgroundQueue = m_WorkQueues[uint32_t(PeonJobPriority::Background)];
+
+	// Background jobs waited too long, take the oldest one (from the top, like a thief would)
+	if (m_BackgroundSkips >= m_OwnerSystem->GetBackgroundAgingInterval())
+	{
+		m_BackgroundSkips = 0;
+		*_job = backgroundQueue.Steal();
+		if (*_job != nullptr)
+		{
+			AddCounter(Counter::LocalPops);
+			return true;
+		}
+	}
+
+	// Primeira coisa, vamos ver se conseguimos pegar algum work do nosso queue interno (high e normal, nesta ordem)
+	for (uint32_t i = 0; i < uint32_t(PeonJobPriority::Background); i++)
+	{
+		*_job = m_WorkQueues[i].Pop();
+		if (*_job != nullptr)
+		{
+			// Conseguimos! Background jobs are waiting for us, age them
+			if (!backgroundQueue.IsEmpty())
+			{
+				m_BackgroundSkips++;
+			}
+
+			AddCounter(Counter::LocalPops);
+			return true;
+		}
+	}
+
+	// Nothing else to do, run a background job
+	*_job = backgroundQueue.Pop();
 	if (*_job != nullptr)
 	{
-		// Conseguimos! Retornamos ele agora
+		m_BackgroundSkips = 0;
+		AddCounter(Counter::LocalPops);
 		return true;
 	}
 
-	// Primeiramente pegamos um index aleatrio de alguma thread e a array de threads
-	unsigned int randomIndex = FastRandomUnsignedInteger() % m_OwnerSystem->GetTotalWorkers();
-	__InternalPeon::PeonWorker* workers = m_OwnerSystem->GetJobWorkers();
+	// Jobs started by threads that aren't workers (from the injector of our node first)
+	*_job = m_OwnerSystem->PopInjectedJob(m_NodeIndex);
+	if (*_job != nullptr)
+	{
+		AddCounter(Counter::InjectedPops);
+		return true;
+	}
 
-	// Pegamos ento o queue desta thread aleatria
-	PeonStealingQueue* stolenQueue = workers[randomIndex].GetWorkerQueue();
+	const PeonStealSettings& stealSettings = m_OwnerSystem->GetStealSettings();
 
-	// Verificamos se no estamos roubando de ns mesmos
-	if (stolenQueue == &m_WorkQueue)
+	// Try the last victim we stole from first, it probably still has jobs
+	if (stealSettings.lastVictimAffinity && m_LastVictim >= 0)
 	{
-		return false;
+		if (StealFrom(uint32_t(m_LastVictim), _job))
+		{
+			return true;
+		}
+
+		m_LastVictim = -1;
 	}
 
-	// Roubamos ento um work desta thread
-	*_job = stolenQueue->Steal();
-	if (*_job == nullptr)
+	// Sweep the victims, backing off between sweeps
+	uint32_t backoffSpins = stealSettings.minimumBackoffSpins;
+	for (uint32_t sweep = 0; sweep < std::max(stealSettings.totalSweeps, 1u); sweep++)
 	{
-		// No foi possvel roubar um work desta thread, melhor parar por aqui!
+		if (sweep > 0)
+		{
+			for (uint32_t i = 0; i < backoffSpins; i++)
+			{
+				PeonCpuRelax();
+			}
+
+			backoffSpins = std::min(backoffSpins * 2, stealSettings.maximumBackoffSpins);
+		}
+
+		if (StealSweep(stealSettings.fullSweep, _job))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool __InternalPeon::PeonWorker::StealSweep(bool _fullSweep, PeonJob** _job)
+{
+	// Hierarchical stealing, go through the tiers (the nearest ones first)
+	if (m_HierarchicalStealing)
+	{
+		for (uint32_t tier = 0; tier < PeonTotalStealTiers; tier++)
+		{
+			std::vector<uint32_t>& stealVictims = m_StealVictims[tier];
+			if (stealVictims.empty())
+			{
+				continue;
+			}
+
+			// Try all victims in this tier (in a random rotation) or just a random one
+			uint32_t totalVictims = uint32_t(stealVictims.size());
+			uint32_t firstVictim = FastRandomUnsignedInteger() % totalVictims;
+			for (uint32_t i = 0; i < (_fullSweep ? totalVictims : 1); i++)
+			{
+				if (StealFrom(stealVictims[(firstVictim + i) % totalVictims], _job))
+				{
+					return true;
+				}
+			}
+		}
+
 		return false;
 	}
 
-	// Conseguimos roubar um work!
+	// Primeiramente pegamos um index aleatrio de alguma thread
+	unsigned int totalWorkers = m_OwnerSystem->GetTotalWorkers();
+	unsigned int randomIndex = FastRandomUnsignedInteger() % totalWorkers;
+
+	// Without a full sweep this is our only try
+	if (!_fullSweep)
+	{
+		// Verificamos se no estamos roubando de ns mesmos
+		return randomIndex != m_ThreadId && StealFrom(randomIndex, _job);
+	}
+
+	// Try all workers, starting from the random one
+	for (unsigned int i = 0; i < totalWorkers; i++)
+	{
+		unsigned int victimIndex = (randomIndex + i) % totalWorkers;
+		if (victimIndex != m_ThreadId && StealFrom(victimIndex, _job))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool __InternalPeon::PeonWorker::StealFrom(uint32_t _victimIndex, PeonJob** _job)
+{
+	PeonWorker& victim = m_OwnerSystem->GetJobWorkers()[_victimIndex];
+	uint32_t stealBatchSize = m_OwnerSystem->GetStealBatchSize();
+
+	// Count the attempt for the victim tier (unpinned workers don't know where their victims are, only written by us)
+	PeonStealTier stealTier = m_VictimTiers.empty() ? PeonStealTier::Remote : m_VictimTiers[_victimIndex];
+	std::atomic<uint64_t>& totalStealAttempts = m_TotalStealAttempts[uint32_t(stealTier)];
+	totalStealAttempts.store(totalStealAttempts.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	// Check the victim lanes in priority order
+	for (uint32_t i = 0; i < PeonTotalJobPriorities; i++)
+	{
+		// Take a batch (the extra jobs go into our lane for the same priority, other workers can steal them from us) or a single job
+		if (stealBatchSize > 1)
+		{
+			uint32_t totalStolen = 0;
+			*_job = victim.GetWorkerQueue(PeonJobPriority(i))->StealBatch(&m_WorkQueues[i], stealBatchSize, &totalStolen);
+			if (totalStolen > 1)
+			{
+				m_OwnerSystem->WakeParkedWorkers(totalStolen - 1);
+			}
+		}
+		else
+		{
+			*_job = victim.GetWorkerQueue(PeonJobPriority(i))->Steal();
+		}
+
+		if (*_job != nullptr)
+		{
+			// Conseguimos roubar um work! Remember this victim and count the steal
+			std::atomic<uint64_t>& totalSteals = m_TotalSteals[uint32_t(stealTier)];
+			totalSteals.store(totalSteals.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			m_LastVictim = int(_victimIndex);
+			m_OwnerSystem->TraceEvent(this, PeonTraceEventType::Steal, *_job, _victimIndex);
+
+			return true;
+		}
+	}
+
+	// No foi possvel roubar um work desta thread
+	return false;
+}
+
+void __InternalPeon::PeonWorker::PushJob(PeonJob* _job)
+{
+	// Record the enqueue time (only when someone wants the lane statistics)
+	_job->SetEnqueueTime(m_OwnerSystem->LaneStatisticsEnabled() ? GetTimeNanoseconds() : 0);
+
+	m_WorkQueues[uint32_t(_job->GetPriority())].Push(_job);
+}
+
+void __InternalPeon::PeonWorker::PushJobs(PeonJob** _jobs, uint32_t _totalJobs)
+{
+	uint64_t enqueueTime = m_OwnerSystem->LaneStatisticsEnabled() ? GetTimeNanoseconds() : 0;
+
+	// Move the normal priority jobs to the front, they can still be pushed as a single batch (the common case)
+	uint32_t totalNormalJobs = 0;
+	for (uint32_t i = 0; i < _totalJobs; i++)
+	{
+		_jobs[i]->SetEnqueueTime(enqueueTime);
+		if (_jobs[i]->GetPriority() == PeonJobPriority::Normal)
+		{
+			std::swap(_jobs[i], _jobs[totalNormalJobs++]);
+		}
+	}
+
+	m_WorkQueues[uint32_t(PeonJobPriority::Normal)].PushBatch(_jobs, totalNormalJobs);
+
+	// Push the other ones into their lanes
+	for (uint32_t i = totalNormalJobs; i < _totalJobs; i++)
+	{
+		m_WorkQueues[uint32_t(_jobs[i]->GetPriority())].Push(_jobs[i]);
+	}
+}
+
+bool __InternalPeon::PeonWorker::IsQueueEmpty()
+{
+	for (uint32_t i = 0; i < PeonTotalJobPriorities; i++)
+	{
+		if (!m_WorkQueues[i].IsEmpty())
+		{
+			return false;
+		}
+	}
+
 	return true;
 }
 
 __InternalPeon::PeonJob* __InternalPeon::PeonWorker::GetFreshJob()
 {
-    return m_WorkQueue.GetFreshJob();
+	AddCounter(Counter::CreatedJobs);
+	if (m_StorageMode == PeonJobStorageMode::FrameRingBuffer)
+	{
+		AddCounter(Counter::FrameJobs);
+	}
+
+    return m_WorkQueues[uint32_t(PeonJobPriority::Normal)].GetFreshJob();
 }
 
 __InternalPeon::PeonStealingQueue* __InternalPeon::PeonWorker::GetWorkerQueue()
 {
-    return &m_WorkQueue;
+    return &m_WorkQueues[uint32_t(PeonJobPriority::Normal)];
+}
+
+__InternalPeon::PeonStealingQueue* __InternalPeon::PeonWorker::GetWorkerQueue(PeonJobPriority _priority)
+{
+	return &m_WorkQueues[uint32_t(_priority)];
 }
 
 int __InternalPeon::PeonWorker::GetThreadId()
@@ -141,14 +879,25 @@ int __InternalPeon::PeonWorker::GetThreadId()
     return m_ThreadId;
 }
 
+__InternalPeon::PeonSystem* __InternalPeon::PeonWorker::GetOwnerSystem()
+{
+    return m_OwnerSystem;
+}
+
 void __InternalPeon::PeonWorker::ResetFreeList()
 {
-	m_WorkQueue.Reset();
+	m_WorkQueues[uint32_t(PeonJobPriority::Normal)].Reset();
+
+	// A new frame starts (nobody creates jobs while the frame is reset)
+#if PeonStatisticsEnabled
+	m_Counters.values[uint32_t(Counter::PeakFrameJobs)].store(std::max(GetCounter(Counter::PeakFrameJobs), GetCounter(Counter::FrameJobs)), std::memory_order_relaxed);
+	m_Counters.values[uint32_t(Counter::FrameJobs)].store(0, std::memory_order_relaxed);
+#endif
 }
 
 void __InternalPeon::PeonWorker::RefreshMemoryAllocator()
 {
-	m_MemoryAllocator.ReleaseDeallocationChain();
+	m_MemoryAllocator.ReclaimRemoteBlocks();
 }
 
 __InternalPeon::PeonMemoryAllocator& __InternalPeon::PeonWorker::GetMemoryAllocator()
@@ -156,19 +905,29 @@ __InternalPeon::PeonMemoryAllocator& __InternalPeon::PeonWorker::GetMemoryAlloca
 	return m_MemoryAllocator;
 }
 
-void __InternalPeon::PeonWorker::ExecuteThread(void* _arg)
+bool __InternalPeon::PeonWorker::ExecuteThread(void* _arg)
 {
 	if (m_OwnerSystem->WorkerExecutionStatus())
 	{
-		std::this_thread::yield();
-		return;
+		// Nothing running on this thread (we could be waiting inside a job, or on a fiber)
+		if (CurrentThreadJob == nullptr && !HasWaitingFibers())
+		{
+			SetBusy(false);
+		}
+
+		return false;
 	}
 
+	// We are busy before taking a job, so a job is always visible in a queue or owned by a busy worker
+	SetBusy(true);
+
 	// Try to get a job
 	__InternalPeon::PeonJob* job = nullptr;
 	bool result = GetJob(&job);
 	if (result)
 	{
+		// We aren't idle anymore
+		SetIdle(false);
 
 // If debug mode is on
 #ifdef JobWorkerDebug
@@ -178,26 +937,233 @@ void __InternalPeon::PeonWorker::ExecuteThread(void* _arg)
 
 #endif
 
-		// Set the current job for this thread
+		// Record how long this job waited
+		RecordWaitTime(job);
+
+		// Set the current job for this thread (we could be waiting inside another job, save it)
+		PeonJob* previousJob = CurrentThreadJob;
 		CurrentThreadJob = job;
 
-		// Run the selected job
-		job->RunJobFunction();
+		// Run the selected job (a cancelled one is only finished, so its parent and dependants still complete)
+		bool cancelled = job->IsCancelled();
+		m_OwnerSystem->TraceEvent(this, PeonTraceEventType::JobBegin, job, cancelled);
+		if (cancelled)
+		{
+			job->DestroyJobFunction(this);
+			AddCounter(Counter::CancelledJobs);
+		}
+		else
+		{
+			job->RunJobFunction(this);
+		}
+
+		// The job can be reused once finished, trace the end before
+		m_OwnerSystem->TraceEvent(this, PeonTraceEventType::JobEnd, job, cancelled);
 
 		// Finish the job
 		job->Finish(this);
+		m_TotalExecutedJobs.store(m_TotalExecutedJobs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		// Restore the previous job
+		CurrentThreadJob = previousJob;
+
+		return true;
 	}
-	else
-    {
-        // Set an empty current job
-        CurrentThreadJob = nullptr;
 
-        // Give our time slice away
-		std::this_thread::yield();
-    }
+	// We are idle (looking for jobs to steal)
+	SetIdle(true);
+
+	// Nothing running on this thread (we could be waiting inside a job, or on a fiber)
+	if (CurrentThreadJob == nullptr && !HasWaitingFibers())
+	{
+		SetBusy(false);
+	}
+
+	return false;
+}
+
+void __InternalPeon::PeonWorker::SetIdle(bool _idle)
+{
+	// Only update the system counter when our state changes
+	if (m_IsIdle.load(std::memory_order_relaxed) != _idle)
+	{
+		m_IsIdle.store(_idle, std::memory_order_relaxed);
+		if (_idle)
+		{
+			m_OwnerSystem->m_TotalIdleWorkers.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			m_OwnerSystem->m_TotalIdleWorkers.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+bool __InternalPeon::PeonWorker::IsIdle()
+{
+	return m_IsIdle.load(std::memory_order_relaxed);
 }
 
 __InternalPeon::PeonJob* __InternalPeon::PeonWorker::GetCurrentJob()
 {
 	return CurrentThreadJob;
+}
+
+uint64_t __InternalPeon::PeonWorker::GetTimeNanoseconds()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void __InternalPeon::PeonWorker::RecordWaitTime(PeonJob* _job)
+{
+	// The enqueue time is only recorded while the statistics are enabled
+	uint64_t enqueueTime = _job->GetEnqueueTime();
+	if (enqueueTime == 0)
+	{
+		return;
+	}
+
+	uint64_t now = GetTimeNanoseconds();
+	uint64_t waitTime = now > enqueueTime ? now - enqueueTime : 0;
+	LaneCounters& laneCounters = m_LaneCounters[uint32_t(_job->GetPriority())];
+
+	// Find the histogram bucket (the number of significant bits)
+	uint32_t bucket = 0;
+	for (uint64_t value = waitTime; value != 0 && bucket < PeonLaneHistogramBuckets - 1; value >>= 1)
+	{
+		bucket++;
+	}
+
+	laneCounters.totalJobs.fetch_add(1, std::memory_order_relaxed);
+	laneCounters.totalWaitTime.fetch_add(waitTime, std::memory_order_relaxed);
+	laneCounters.waitTimeHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+	if (waitTime > laneCounters.maximumWaitTime.load(std::memory_order_relaxed))
+	{
+		laneCounters.maximumWaitTime.store(waitTime, std::memory_order_relaxed);
+	}
+}
+
+void __InternalPeon::PeonWorker::GatherLaneStatistics(PeonJobPriority _priority, PeonLaneStatistics& _statistics)
+{
+	PeonStealingQueue& workQueue = m_WorkQueues[uint32_t(_priority)];
+	LaneCounters& laneCounters = m_LaneCounters[uint32_t(_priority)];
+
+	// The queue depth
+	_statistics.queueDepth += workQueue.GetSize();
+	_statistics.highWaterMark = std::max(_statistics.highWaterMark, (uint64_t)workQueue.GetHighWaterMark());
+
+	// The wait times
+	_statistics.totalJobs += laneCounters.totalJobs.load(std::memory_order_relaxed);
+	_statistics.totalWaitTime += laneCounters.totalWaitTime.load(std::memory_order_relaxed);
+	_statistics.maximumWaitTime = std::max(_statistics.maximumWaitTime, laneCounters.maximumWaitTime.load(std::memory_order_relaxed));
+	for (uint32_t i = 0; i < PeonLaneHistogramBuckets; i++)
+	{
+		_statistics.waitTimeHistogram[i] += laneCounters.waitTimeHistogram[i].load(std::memory_order_relaxed);
+	}
+}
+
+void __InternalPeon::PeonWorker::ResetLaneStatistics()
+{
+	for (auto& laneCounters : m_LaneCounters)
+	{
+		laneCounters.totalJobs.store(0, std::memory_order_relaxed);
+		laneCounters.totalWaitTime.store(0, std::memory_order_relaxed);
+		laneCounters.maximumWaitTime.store(0, std::memory_order_relaxed);
+		for (auto& bucket : laneCounters.waitTimeHistogram)
+		{
+			bucket.store(0, std::memory_order_relaxed);
+		}
+	}
+}
+
+void __InternalPeon::PeonWorker::GatherStatistics(PeonWorkerStatistics& _statistics)
+{
+	// The counters that are always there
+	_statistics.executedJobs = m_TotalExecutedJobs.load(std::memory_order_relaxed);
+	for (uint32_t i = 0; i < PeonTotalStealTiers; i++)
+	{
+		_statistics.stealAttempts += m_TotalStealAttempts[i].load(std::memory_order_relaxed);
+		_statistics.steals += m_TotalSteals[i].load(std::memory_order_relaxed);
+	}
+
+	_statistics.stealFailures = _statistics.stealAttempts - std::min(_statistics.steals, _statistics.stealAttempts);
+
+	// The runtime counters
+	_statistics.createdJobs = GetCounter(Counter::CreatedJobs);
+	_statistics.cancelledJobs = GetCounter(Counter::CancelledJobs);
+	_statistics.localPops = GetCounter(Counter::LocalPops);
+	_statistics.injectedPops = GetCounter(Counter::InjectedPops);
+	_statistics.idleTime = GetCounter(Counter::IdleTime);
+	_statistics.yieldTime = GetCounter(Counter::YieldTime);
+	_statistics.blockedTime = GetCounter(Counter::BlockedTime);
+	_statistics.frameJobs = GetCounter(Counter::FrameJobs);
+	_statistics.peakFrameJobs = std::max(GetCounter(Counter::PeakFrameJobs), _statistics.frameJobs);
+
+	// The queues (only once they exist)
+	if (m_Ready.load(std::memory_order_acquire))
+	{
+		for (auto& workQueue : m_WorkQueues)
+		{
+			_statistics.dequeDepth += std::max(workQueue.GetSize(), 0l);
+			_statistics.peakDequeDepth += workQueue.GetHighWaterMark();
+		}
+
+		_statistics.jobStorageSize = m_WorkQueues[uint32_t(PeonJobPriority::Normal)].GetJobStorageSize();
+	}
+}
+
+void __InternalPeon::PeonWorker::AddCounter(Counter _counter, uint64_t _value)
+{
+#if PeonStatisticsEnabled
+	std::atomic<uint64_t>& counter = m_Counters.values[uint32_t(_counter)];
+	counter.store(counter.load(std::memory_order_relaxed) + _value, std::memory_order_relaxed);
+#endif
+}
+
+uint64_t __InternalPeon::PeonWorker::GetCounter(Counter _counter)
+{
+#if PeonStatisticsEnabled
+	return m_Counters.values[uint32_t(_counter)].load(std::memory_order_relaxed);
+#else
+	return 0;
+#endif
+}
+
+double __InternalPeon::PeonStatistics::GetStealFailureRate() const
+{
+	return total.stealAttempts == 0 ? 0.0 : double(total.stealFailures) / double(total.stealAttempts);
+}
+
+double __InternalPeon::PeonStatistics::GetImbalance() const
+{
+	uint64_t busiestWorker = 0;
+	for (auto& worker : workers)
+	{
+		busiestWorker = std::max(busiestWorker, worker.executedJobs);
+	}
+
+	return total.executedJobs == 0 ? 1.0 : double(busiestWorker) * workers.size() / double(total.executedJobs);
+}
+
+uint64_t __InternalPeon::PeonLaneStatistics::GetWaitTimePercentile(double _percentile) const
+{
+	// The number of jobs that must be inside (or before) the bucket we want
+	uint64_t targetJobs = (uint64_t)(std::min(std::max(_percentile, 0.0), 1.0) * totalJobs + 0.5);
+	if (targetJobs == 0)
+	{
+		return 0;
+	}
+
+	uint64_t totalBucketJobs = 0;
+	for (uint32_t i = 0; i < PeonLaneHistogramBuckets; i++)
+	{
+		totalBucketJobs += waitTimeHistogram[i];
+		if (totalBucketJobs >= targetJobs)
+		{
+			// The last bucket has no upper bound, use the maximum wait time
+			return i == PeonLaneHistogramBuckets - 1 ? maximumWaitTime : std::min((uint64_t(1) << i) - 1, maximumWaitTime);
+		}
+	}
+
+	return maximumWaitTime;
 }
\ No newline at end of file
@@ -11,10 +11,16 @@
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 
 #include "PeonJob.h"
 #include "PeonStealingQueue.h"
 #include "PeonMemoryAllocator.h"
+#include "PeonTopology.h"
+#include "PeonFiber.h"
 
 /////////////
 // DEFINES //
@@ -23,6 +29,16 @@
 // The debug flag
 // #define JobWorkerDebug
 
+// The runtime counters (jobs created, local pops, idle times...), only written by their own worker with relaxed stores and
+// read by GetStatistics(), define it as 0 to compile them out
+#ifndef PeonStatisticsEnabled
+#define PeonStatisticsEnabled		(1)
+#endif
+
+// The number of wait time histogram buckets for each priority lane (bucket i counts the wait times with i significant bits,
+// in nanoseconds, the last bucket also counts everything bigger)
+#define PeonLaneHistogramBuckets	(40)
+
 ////////////
 // GLOBAL //
 ////////////
@@ -37,11 +53,169 @@ PeonNamespaceBegin(__InternalPeon)
 // We know the job system
 class PeonSystem;
 
+// What a worker does when it can't find any job to run
+enum class PeonIdlePolicy
+{
+	// Keep giving the time slice away (the original behavior, lowest latency, highest cpu usage)
+	Yield,
+
+	// Spin, yield and then sleep for an exponentially growing amount of time
+	Backoff,
+
+	// Spin, yield and then park on a per-worker event until new work is pushed
+	Park
+};
+
+// The idle configuration used by all worker threads
+struct PeonIdleSettings
+{
+	// The idle policy
+	PeonIdlePolicy policy = PeonIdlePolicy::Yield;
+
+	// The number of failed job fetches spent spinning (with cpu pause) before we start yielding
+	uint32_t spinRounds = 16;
+
+	// The number of failed job fetches spent yielding before we start sleeping/parking
+	uint32_t yieldRounds = 32;
+
+	// The maximum sleep time for the backoff policy (in microseconds)
+	uint32_t maximumSleepMicroseconds = 1000;
+};
+
+// The steal configuration used by all worker threads
+struct PeonStealSettings
+{
+	// Try every other worker (starting from a random one) before giving up, instead of a single random victim
+	bool fullSweep = true;
+
+	// Try the last worker we stole from before anyone else
+	bool lastVictimAffinity = true;
+
+	// The number of sweeps done before giving up and using the idle policy
+	uint32_t totalSweeps = 2;
+
+	// The number of cpu pauses between the first two sweeps, doubled after each sweep up to the maximum
+	uint32_t minimumBackoffSpins = 16;
+	uint32_t maximumBackoffSpins = 256;
+};
+
+// The statistics for a job priority lane (summed over all workers)
+struct PeonLaneStatistics
+{
+	// The number of jobs queued right now and the biggest number of jobs a single worker lane had queued at the same time
+	uint64_t queueDepth = 0;
+	uint64_t highWaterMark = 0;
+
+	// The number of jobs executed and their total and maximum wait time (from the push until the job starts, in nanoseconds,
+	// only recorded while the lane statistics are enabled)
+	uint64_t totalJobs = 0;
+	uint64_t totalWaitTime = 0;
+	uint64_t maximumWaitTime = 0;
+
+	// The wait time histogram
+	uint64_t waitTimeHistogram[PeonLaneHistogramBuckets] = {};
+
+	// Return the wait time for the given percentile (from 0 to 1, this is the upper bound of the histogram bucket where it
+	// falls, so it's only accurate to a power of 2)
+	uint64_t GetWaitTimePercentile(double _percentile) const;
+};
+
+// The runtime statistics for a worker (only a snapshot, the counters compiled out by PeonStatisticsEnabled are always zero)
+struct PeonWorkerStatistics
+{
+	// The number of jobs executed, created by this worker and cancelled (finished without running)
+	uint64_t executedJobs = 0;
+	uint64_t createdJobs = 0;
+	uint64_t cancelledJobs = 0;
+
+	// Where the jobs came from, our own lanes, the injector queues or other workers (a failure is an attempt on a victim that
+	// had nothing to steal)
+	uint64_t localPops = 0;
+	uint64_t injectedPops = 0;
+	uint64_t stealAttempts = 0;
+	uint64_t steals = 0;
+	uint64_t stealFailures = 0;
+
+	// The time spent without work spinning, yielding and blocked (sleeping or parked), in nanoseconds
+	uint64_t idleTime = 0;
+	uint64_t yieldTime = 0;
+	uint64_t blockedTime = 0;
+
+	// The number of jobs queued right now and the sum of the lane high water marks
+	uint64_t dequeDepth = 0;
+	uint64_t peakDequeDepth = 0;
+
+	// The jobs taken from the ring buffer since the last frame reset, the most a frame took and the job storage size (the
+	// ring buffer size, a frame taking more jobs overwrites jobs that could still be in use, or the number of allocated jobs
+	// in recycling mode)
+	uint64_t frameJobs = 0;
+	uint64_t peakFrameJobs = 0;
+	uint64_t jobStorageSize = 0;
+};
+
+// The runtime statistics for each worker and their totals (the peaks are the maximum over all workers)
+struct PeonStatistics
+{
+	std::vector<PeonWorkerStatistics> workers;
+	PeonWorkerStatistics total;
+
+	// The number of jobs created by threads that aren't workers
+	uint64_t externalCreatedJobs = 0;
+
+	// The bytes reserved by the worker allocators (used or not, TrimMemory gives the unused ones back)
+	uint64_t reservedMemory = 0;
+
+	// Return the fraction of the steal attempts that failed
+	double GetStealFailureRate() const;
+
+	// Return the number of jobs executed by the busiest worker over the average (1 is a perfect balance)
+	double GetImbalance() const;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Class name: PeonWorker
 ////////////////////////////////////////////////////////////////////////////////
 class PeonWorker
 {
+	// The runtime counters
+	enum class Counter : uint32_t
+	{
+		CreatedJobs,
+		CancelledJobs,
+		LocalPops,
+		InjectedPops,
+		IdleTime,
+		YieldTime,
+		BlockedTime,
+		FrameJobs,
+		PeakFrameJobs,
+		Total
+	};
+
+	// The counter values (only written by the worker thread, on their own cache lines so readers never slow down the workers)
+	struct alignas(PeonCacheLineSize) Counters
+	{
+		std::atomic<uint64_t> values[uint32_t(Counter::Total)];
+	};
+
+	// The wait time counters for a priority lane (only written by the worker that executes the jobs)
+	struct LaneCounters
+	{
+		std::atomic<uint64_t> totalJobs;
+		std::atomic<uint64_t> totalWaitTime;
+		std::atomic<uint64_t> maximumWaitTime;
+		std::atomic<uint64_t> waitTimeHistogram[PeonLaneHistogramBuckets];
+	};
+
+	// A fiber owned by this worker, the job it waits for (nullptr if it isn't waiting) and the job it was running when it
+	// switched away (only used by the worker thread)
+	struct WorkerFiber
+	{
+		PeonFiber fiber;
+		PeonJob* waitJob = nullptr;
+		PeonJob* savedJob = nullptr;
+	};
+
 public:
 	PeonWorker();
 	PeonWorker(const PeonWorker&);
@@ -55,33 +229,117 @@ public:
 	// Get the current worker
 	static PeonWorker* GetCurrentLocalThreadWorker();
 
+	// Get the id of the system that owns the current worker (0 if this thread isn't a worker), checked before touching the
+	// worker, its system could be gone
+	static uint64_t GetCurrentLocalThreadSystemId();
+
 public:
 
-	// Set the queue size
-	void SetQueueSize(unsigned int _jobBufferSize);
+	// Set the queue size (the job buffer size and the initial deque size) and the job storage mode, the queues are allocated
+	// now or, for pinned workers, by the worker thread itself (so the memory is first touched on its node)
+	void SetQueueSize(unsigned int _jobBufferSize, unsigned int _initialDequeSize, PeonJobStorageMode _storageMode);
+
+	// Pin this worker (at the given index) to the given logical cpu, the victim tiers has the steal tier for each worker and
+	// the node index selects the injector queue checked first (should be called before setting the queue size)
+	void SetPlacement(uint32_t _workerIndex, uint32_t _cpuId, const std::vector<PeonStealTier>& _victimTiers, bool _hierarchicalStealing, uint32_t _nodeIndex);
+
+	// Return the logical cpu this worker is pinned to (-1 if it isn't pinned)
+	int GetCpuId();
+
+	// Return if this worker thread started and its queues are ready
+	bool IsReady();
+
+	// Return the number of successful steals and steal attempts (one per victim visited) this worker did on the given tier
+	uint64_t GetTotalSteals(PeonStealTier _stealTier);
+	uint64_t GetTotalStealAttempts(PeonStealTier _stealTier);
 
 	// Initialize this worker thread
 	bool Initialize(PeonSystem* _ownerSystem, int _threadId, bool _mainThread = false);
 
-	// Execute this thread
-	void ExecuteThread(void* _arg);
+	// Ask this worker thread to stop (it finishes its current job first) and wait for it (does nothing for the main thread),
+	// if the calling thread runs this worker it stops being a worker
+	void Stop();
+
+	// Set if this worker can run jobs, an inactive worker finishes its current job and sleeps until it's active again (its
+	// queued jobs can still be stolen)
+	void SetActive(bool _active);
+	bool IsActive();
+
+	// Return if this worker is looking for or running a job (it could have a job that isn't visible in any queue), and the
+	// number of jobs it executed (both can be read from any thread)
+	bool IsBusy();
+	uint64_t GetTotalExecutedJobs();
+
+	// Execute this thread (return true if a job was executed)
+	bool ExecuteThread(void* _arg);
+
+	// Suspend the fiber running on this thread until the given job completes, this worker keeps running jobs on another fiber
+	// meanwhile (must be called only by the worker thread, return false if fibers are disabled or all of them are in use)
+	bool SuspendUntilComplete(PeonJob* _job);
+
+	// Return if any fiber of this worker is suspended waiting for a job (must be called only by the worker thread)
+	bool HasWaitingFibers();
 
-	// Try to get a job from the current worker thread, or try to steal one from the others
+	// Continue a waiting fiber whose job completed, or give the loop back to the thread stack, the current fiber becomes free
+	// until a fiber returns to the loop (must be called only by the worker thread while it isn't running any job, return
+	// false if there was nothing to switch to)
+	bool ResumeReadyFiber();
+
+	// Wait for work using the current idle policy (the idle round is the number of consecutive failed job fetches)
+	void Idle(uint32_t _idleRound);
+
+	// Wake this worker if it is parked (return true if it was parked)
+	bool Unpark();
+
+	// Set if this worker is idle (looking for jobs), the system keeps track of the total idle workers
+	void SetIdle(bool _idle);
+
+	// Return if this worker is idle (can be called from any thread)
+	bool IsIdle();
+
+	// Set if this worker is busy, only writes when the value changes (must be called only by the worker thread, and never
+	// cleared while a job is running on it)
+	void SetBusy(bool _busy);
+
+	// Try to get a job from the current worker thread (checking the lanes in priority order, background jobs are aged so they
+	// can't starve), then from the injector queues (jobs started by threads that aren't workers) or try to steal one from the others
 	bool GetJob(PeonJob** _job);
 
-    // Return this PeonWorker work queue
+	// Push a job into the lane for its priority (must be called only by the worker thread)
+	void PushJob(PeonJob* _job);
+
+	// Push many jobs at once, each one into the lane for its priority (must be called only by the worker thread)
+	void PushJobs(PeonJob** _jobs, uint32_t _totalJobs);
+
+	// Return if all lanes look empty (can be called from any thread)
+	bool IsQueueEmpty();
+
+    // Return this PeonWorker work queue (the normal priority lane, the one that owns the job storage)
 	PeonStealingQueue* GetWorkerQueue();
 
+	// Return the work queue for the given priority lane
+	PeonStealingQueue* GetWorkerQueue(PeonJobPriority _priority);
+
+	// Add this worker wait time counters for the given lane into the statistics, or reset all counters
+	void GatherLaneStatistics(PeonJobPriority _priority, PeonLaneStatistics& _statistics);
+	void ResetLaneStatistics();
+
+	// Fill the statistics with this worker counters (can be called from any thread, but the result is only a snapshot)
+	void GatherStatistics(PeonWorkerStatistics& _statistics);
+
 	// Return the thread id
 	int GetThreadId();
 
+	// Return the owner system
+	PeonSystem* GetOwnerSystem();
+
 	// Return a fresh (usable) job
 	PeonJob* GetFreshJob();
 
 	// Reset the free list
 	void ResetFreeList();
 
-	// Refresh the memory allocator
+	// Refresh the memory allocator (take back the blocks other threads freed)
 	void RefreshMemoryAllocator();
 
 	// Return a reference to our memory allocator
@@ -95,11 +353,54 @@ public:
     // Return the job this worker ir working now
 	static PeonJob* GetCurrentJob();
 
+	// Return the current time in nanoseconds (used by the lane statistics)
+	static uint64_t GetTimeNanoseconds();
+
 private:
 
 	// A fast random uint generator
 	unsigned int FastRandomUnsignedInteger();
 
+	// Pin this thread and allocate the queues (if needed), must be called by the thread running this worker
+	void PrepareThread();
+
+	// Allocate the fiber pool (if fibers are enabled), must be called by the thread running this worker
+	void InitializeFibers();
+
+	// The worker loop, run by the worker thread and by the fibers from the pool (returns when this worker must stop)
+	void RunLoop();
+
+	// The function run by each fiber from the pool
+	static void FiberEntry(void* _worker);
+
+	// Remove and return a waiting fiber whose job completed (nullptr if none)
+	WorkerFiber* TakeReadyFiber();
+
+	// Switch to the given fiber, the current one is kept as waiting (if it has a job to wait for) or free
+	void SwitchToFiber(WorkerFiber* _fiber);
+
+	// Allocate the queues using the saved queue settings
+	void InitializeQueues();
+
+	// Go through the victims once (all of them or a single random one for each tier) trying to steal a job
+	bool StealSweep(bool _fullSweep, PeonJob** _job);
+
+	// Try to steal a job from the given worker, checking its lanes in priority order
+	bool StealFrom(uint32_t _victimIndex, PeonJob** _job);
+
+	// Park this worker until someone push new work (can only be called by the worker thread)
+	void Park();
+
+	// Sleep until this worker is active again or it must stop (can only be called by the worker thread)
+	void WaitUntilActive();
+
+	// Record how long the given job waited in its lane (if its enqueue time was recorded)
+	void RecordWaitTime(PeonJob* _job);
+
+	// Add to a runtime counter and return a counter value (no-ops when the counters are compiled out)
+	void AddCounter(Counter _counter, uint64_t _value = 1);
+	uint64_t GetCounter(Counter _counter);
+
 ///////////////
 // VARIABLES //
 private: //////
@@ -107,8 +408,58 @@ private: //////
 	// The owner (job system)
 	PeonSystem* m_OwnerSystem;
 
-	// Array of jobs
-	PeonStealingQueue m_WorkQueue;
+	// Array of jobs for each priority lane (only the normal lane owns job storage)
+	PeonStealingQueue m_WorkQueues[PeonTotalJobPriorities];
+
+	// The number of jobs taken from the other lanes while our background lane had jobs waiting
+	uint32_t m_BackgroundSkips;
+
+	// The wait time counters for each priority lane
+	LaneCounters m_LaneCounters[PeonTotalJobPriorities];
+
+#if PeonStatisticsEnabled
+
+	// The runtime counters
+	Counters m_Counters;
+
+#endif
+
+	// The queue settings and if the queues were allocated
+	unsigned int m_JobBufferSize;
+	unsigned int m_InitialDequeSize;
+	PeonJobStorageMode m_StorageMode;
+	bool m_QueuesInitialized;
+
+	// The logical cpu this worker is pinned to (-1 if not pinned)
+	int m_CpuId;
+
+	// The steal tier of each worker, the victims in each tier and if we should steal from the nearest tiers first
+	std::vector<PeonStealTier> m_VictimTiers;
+	std::vector<uint32_t> m_StealVictims[PeonTotalStealTiers];
+	bool m_HierarchicalStealing;
+
+	// The last worker we stole from (-1 if none)
+	int m_LastVictim;
+
+	// The NUMA node index of our cpu (0 if not pinned), its injector queue is checked first
+	uint32_t m_NodeIndex;
+
+	// The number of successful steals and steal attempts on each tier
+	std::atomic<uint64_t> m_TotalSteals[PeonTotalStealTiers];
+	std::atomic<uint64_t> m_TotalStealAttempts[PeonTotalStealTiers];
+
+	// If this worker thread started and its queues are ready
+	std::atomic<bool> m_Ready;
+
+	// The worker thread (not used by the main thread worker), if it should stop and if it can run jobs
+	std::thread m_Thread;
+	std::atomic<bool> m_StopRequested;
+	std::atomic<bool> m_Active;
+
+	// If this worker is busy (and a copy only used by the worker thread) and the number of jobs it executed
+	std::atomic<bool> m_Busy;
+	bool m_LocalBusy;
+	std::atomic<uint64_t> m_TotalExecutedJobs;
 
 	// The memory allocator for this worker
 	PeonMemoryAllocator m_MemoryAllocator;
@@ -118,6 +469,26 @@ private: //////
 
 	// A seed for our fast random unsigned integer generator
 	unsigned int m_Seed;
+
+	// The park event (mutex, condition and flags)
+	std::mutex m_ParkMutex;
+	std::condition_variable m_ParkCondition;
+	std::atomic<bool> m_IsParked;
+	bool m_WakeRequested;
+
+	// If this worker is idle (only written by the worker thread)
+	std::atomic<bool> m_IsIdle;
+
+	// If fibers are enabled, the fiber pool, the fiber for the thread own stack and the one running now
+	bool m_FibersEnabled;
+	WorkerFiber* m_Fibers;
+	WorkerFiber m_ThreadFiber;
+	WorkerFiber* m_CurrentFiber;
+
+	// The free and waiting fibers, and if the thread stack is free (it gave the loop to a fiber that could continue)
+	std::vector<WorkerFiber*> m_FreeFibers;
+	std::vector<WorkerFiber*> m_WaitingFibers;
+	bool m_ThreadFiberFree;
 };
 
 // __InternalPeon